@@ -69,6 +69,13 @@
  */
 #define MAX_MATCH_LENGTH (64 * 1024 * 1024)
 
+/*
+ * LZX_HUFF_DECOMP_FAST_BITS is the width of the direct lookup table used by
+ * the decompressor. Codes no longer than this are resolved in a single
+ * lookup; longer (and therefore rarer) codes continue down the tree.
+ */
+#define LZX_HUFF_DECOMP_FAST_BITS 10
+
 
 struct bitstream {
 	const uint8_t *bytes;
@@ -77,6 +84,11 @@ struct bitstream {
 	uint32_t bits;
 	int remaining_bits;
 	uint16_t *table;
+	/*
+	 * fast_table entries are (code length << 9) | symbol, or 0 if the
+	 * code is longer than LZX_HUFF_DECOMP_FAST_BITS.
+	 */
+	uint16_t fast_table[1 << LZX_HUFF_DECOMP_FAST_BITS];
 };
 
 
@@ -683,6 +695,42 @@ struct match {
 };
 
 
+/*
+ * match_length() counts the common prefix of here and there, up to max_len.
+ *
+ * We compare eight bytes at a time, and when a word differs, the first
+ * differing byte is found by counting the trailing zero bits of the XOR
+ * (since the words are little-endian, the first byte is the low one).
+ * This is most of the time spent in compression, so it is worth it.
+ */
+static inline size_t match_length(const uint8_t *here,
+				  const uint8_t *there,
+				  size_t max_len)
+{
+	size_t len = 0;
+
+	while (len + 8 <= max_len) {
+		uint64_t diff = PULL_LE_U64(here, len) ^ PULL_LE_U64(there, len);
+		if (diff != 0) {
+#if __has_builtin(__builtin_ctzll)
+			return len + __builtin_ctzll(diff) / 8;
+#else
+			while ((diff & 0xff) == 0) {
+				diff >>= 8;
+				len++;
+			}
+			return len;
+#endif
+		}
+		len += 8;
+	}
+	for (; len < max_len && here[len] == there[len]; len++) {
+		/* counting */
+	}
+	return len;
+}
+
+
 static inline struct match lookup_match(uint16_t *hash_table,
 					uint16_t h,
 					const uint8_t *data,
@@ -720,11 +768,18 @@ static inline struct match lookup_match(uint16_t *hash_table,
 			continue;
 		}
 
-		for (len = 0;
-		     len < max_len && here[len] == there[len];
-		     len++) {
-			/* counting */
+		/*
+		 * Hash collisions usually differ in the first few bytes, and
+		 * a match shorter than 3 is no use to us anyway.
+		 */
+		if (max_len < 3 ||
+		    here[0] != there[0] ||
+		    here[1] != there[1] ||
+		    here[2] != there[2]) {
+			continue;
 		}
+
+		len = match_length(here, there, max_len);
 		if (len > 2) {
 			/*
 			 * As a tiebreaker, we prefer the closer match which
@@ -1592,6 +1647,7 @@ static bool fill_decomp_table(struct bitstream *input)
 		/* prefill the table head */
 		input->table[i] = 0xffff;
 	}
+	memset(input->fast_table, 0, sizeof(input->fast_table));
 	code = -1;
 	prev_len = 0;
 	for (i = 0; i < n_symbols; i++) {
@@ -1609,7 +1665,27 @@ static bool fill_decomp_table(struct bitstream *input)
 		if (code >= 65535) {
 			return false;
 		}
+		if (code > (2 << len) - 2) {
+			/*
+			 * The codes are over-subscribed at this length, which
+			 * the final check below would also catch, but only
+			 * after we had overrun the fast_table.
+			 */
+			return false;
+		}
 		input->table[code] = s;
+		if (len <= LZX_HUFF_DECOMP_FAST_BITS) {
+			/*
+			 * Every fast_table index that starts with this code
+			 * resolves to this symbol.
+			 */
+			size_t shift = LZX_HUFF_DECOMP_FAST_BITS - len;
+			size_t first = (code - ((1 << len) - 1)) << shift;
+			size_t j;
+			for (j = 0; j < ((size_t)1 << shift); j++) {
+				input->fast_table[first + j] = (len << 9) | s;
+			}
+		}
 		for(prefix = (code - 1) >> 1;
 		    prefix > 31;
 		    prefix = (prefix - 1) >> 1) {
@@ -1681,6 +1757,145 @@ static inline ssize_t pull_bits(struct bitstream *input)
 }
 
 
+/*
+ * The fast decoding loop doesn't check for the end of the input on every
+ * read, so it stops when fewer than LZX_HUFF_DECOMP_FAST_MARGIN bytes
+ * remain. That is enough for the worst case symbol: a refill for the code, up
+ * to 7 bytes of match length, and a refill for the distance bits.
+ */
+#define LZX_HUFF_DECOMP_FAST_MARGIN (2 + 7 + 2)
+
+/*
+ * consume_bits() drops n bits from the bitstream. The refill happens exactly
+ * where pull_bits() would have done it when reading one bit at a time, which
+ * matters because the match length bytes are interleaved with the words of
+ * the bitstream.
+ */
+static inline void consume_bits(struct bitstream *input, int n)
+{
+	input->remaining_bits -= n;
+	if (input->remaining_bits < 16) {
+		input->bits <<= 16;
+		input->bits |= PULL_LE_U16(input->bytes, input->byte_pos);
+		input->byte_pos += 2;
+		input->remaining_bits += 16;
+	}
+}
+
+
+static inline int decode_symbol_fast(struct bitstream *input)
+{
+	/* there are always at least 16 bits here, and codes are <= 15 */
+	uint16_t peek = (input->bits >> (input->remaining_bits - 15)) & 0x7fff;
+	uint16_t head = peek >> (15 - LZX_HUFF_DECOMP_FAST_BITS);
+	uint16_t entry = input->fast_table[head];
+	size_t index;
+	int i;
+
+	if (likely(entry != 0)) {
+		consume_bits(input, entry >> 9);
+		return entry & 511;
+	}
+
+	/*
+	 * A long code. We continue down the implicit tree (see
+	 * fill_decomp_table()) from the node at the end of the head bits.
+	 */
+	index = (1 << LZX_HUFF_DECOMP_FAST_BITS) - 1 + head;
+	for (i = LZX_HUFF_DECOMP_FAST_BITS; i < 15; i++) {
+		index <<= 1;
+		index += ((peek >> (14 - i)) & 1) + 1;
+		if (input->table[index] != 0xffff) {
+			consume_bits(input, i + 1);
+			return input->table[index] & 511;
+		}
+	}
+	return -1;
+}
+
+
+/*
+ * lzx_huffman_decompress_fast() decodes whole symbols (and their matches) at
+ * a time, until it gets close to the end of the input or fills the block. It
+ * always stops between symbols, leaving the bit-by-bit loop in
+ * lzx_huffman_decompress_block() to carefully finish the job.
+ */
+static ssize_t lzx_huffman_decompress_fast(struct bitstream *input,
+					   uint8_t *output,
+					   size_t block_size,
+					   size_t output_size,
+					   size_t previous_size)
+{
+	size_t output_pos = 0;
+
+	while (output_pos < block_size &&
+	       input->byte_pos + LZX_HUFF_DECOMP_FAST_MARGIN <= input->byte_size) {
+		int symbol = decode_symbol_fast(input);
+		uint16_t distance_bits;
+		size_t distance;
+		size_t length;
+		size_t end;
+		uint8_t *here = NULL;
+		uint8_t *there = NULL;
+
+		if (symbol < 0) {
+			return LZXPRESS_ERROR;
+		}
+		if (symbol < 256) {
+			output[output_pos] = symbol;
+			output_pos++;
+			continue;
+		}
+
+		distance_bits = (symbol >> 4) & 15;
+		length = symbol & 15;
+		if (length == 15) {
+			length += PULL_LE_U8(input->bytes, input->byte_pos);
+			input->byte_pos++;
+			if (length == 255 + 15) {
+				length = PULL_LE_U16(input->bytes,
+						     input->byte_pos);
+				input->byte_pos += 2;
+				if (length == 0) {
+					length = PULL_LE_U32(input->bytes,
+							     input->byte_pos);
+					input->byte_pos += 4;
+				}
+			}
+		}
+		length += 3;
+
+		distance = 1 << distance_bits;
+		if (distance_bits != 0) {
+			distance |= (input->bits >>
+				     (input->remaining_bits - distance_bits)) &
+				((1 << distance_bits) - 1);
+			consume_bits(input, distance_bits);
+		}
+
+		end = output_pos + length;
+		here = output + output_pos;
+		there = here - distance;
+		if (end > output_size ||
+		    previous_size + output_pos < distance ||
+		    unlikely(end < output_pos || there > here)) {
+			return LZXPRESS_ERROR;
+		}
+		if (distance >= length) {
+			memcpy(here, there, length);
+		} else {
+			/* overlapping, so we copy bytes we just wrote */
+			size_t i;
+			for (i = 0; i < length; i++) {
+				here[i] = there[i];
+			}
+		}
+		output_pos = end;
+	}
+	return output_pos;
+}
+
+
 /*
  * Decompress a block. The actual decompressed size is returned (or -1 on
  * error). The putative block length is 64k (or shorter, if the message ends
@@ -1706,6 +1921,7 @@ static ssize_t lzx_huffman_decompress_block(struct bitstream *input,
 	size_t length = 0;
 	bool ok;
 	uint32_t tmp;
+	ssize_t fast_pos;
 	bool seen_eof_marker = false;
 
 	ok = fill_decomp_table(input);
@@ -1746,6 +1962,16 @@ static ssize_t lzx_huffman_decompress_block(struct bitstream *input,
 	 * there is an EOF in another loop after we stop writing.
 	 */
 
+	fast_pos = lzx_huffman_decompress_fast(input,
+					       output,
+					       block_size,
+					       output_size,
+					       previous_size);
+	if (fast_pos < 0) {
+		return fast_pos;
+	}
+	output_pos = fast_pos;
+
 	index = 0;
 	while (output_pos < block_size) {
 		uint16_t b;
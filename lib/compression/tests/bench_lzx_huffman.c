@@ -0,0 +1,172 @@
+/*
+ * Samba compression library - LGPLv3
+ *
+ * Copyright © Catalyst IT 2022
+ *
+ *  ** NOTE! The following LGPL license applies to this file.
+ *  ** It does NOT imply that all of Samba is released under the LGPL
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * bench_lzx_huffman compresses and decompresses each file named on the
+ * command line, checks the round trip, and reports the compression ratio
+ * and throughput. The files in testdata/compression/decompressed make a
+ * reasonable corpus.
+ *
+ * usage: bench_lzx_huffman [-r repeats] file...
+ */
+
+#include "replace.h"
+#include <talloc.h>
+#include <time.h>
+#include "lzxpress_huffman.h"
+#include "lib/util/samba_util.h"
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double mb_per_sec(size_t len, int repeats, double secs)
+{
+	if (secs <= 0) {
+		return 0;
+	}
+	return (double)len * repeats / (secs * 1024 * 1024);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct lzxhuff_compressor_mem *cmp = NULL;
+	int repeats = 10;
+	int i, r;
+	size_t total_in = 0;
+	size_t total_out = 0;
+	double total_comp_time = 0;
+	double total_decomp_time = 0;
+	int ret = 0;
+
+	i = 1;
+	if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+		repeats = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc || repeats < 1) {
+		fprintf(stderr, "usage: %s [-r repeats] file...\n", argv[0]);
+		TALLOC_FREE(mem_ctx);
+		return 1;
+	}
+
+	cmp = talloc(mem_ctx, struct lzxhuff_compressor_mem);
+	if (cmp == NULL) {
+		TALLOC_FREE(mem_ctx);
+		return 1;
+	}
+
+	printf("%10s %10s %7s %12s %12s  %s\n",
+	       "size", "compressed", "ratio", "comp MB/s", "decomp MB/s",
+	       "name");
+
+	for (; i < argc; i++) {
+		TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
+		size_t len = 0;
+		size_t max_size;
+		uint8_t *data = NULL;
+		uint8_t *compressed = NULL;
+		uint8_t *decompressed = NULL;
+		ssize_t comp_len = -1;
+		ssize_t decomp_len = -1;
+		double start, comp_time, decomp_time;
+
+		data = (uint8_t *)file_load(argv[i], &len, 0, tmp_ctx);
+		if (data == NULL || len == 0) {
+			fprintf(stderr, "could not load %s\n", argv[i]);
+			ret = 1;
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+		max_size = lzxpress_huffman_max_compressed_size(len);
+		compressed = talloc_array(tmp_ctx, uint8_t, max_size);
+		decompressed = talloc_array(tmp_ctx, uint8_t, len);
+		if (compressed == NULL || decompressed == NULL) {
+			TALLOC_FREE(mem_ctx);
+			return 1;
+		}
+
+		start = now();
+		for (r = 0; r < repeats; r++) {
+			comp_len = lzxpress_huffman_compress(cmp,
+							     data,
+							     len,
+							     compressed,
+							     max_size);
+		}
+		comp_time = now() - start;
+		if (comp_len < 0) {
+			fprintf(stderr, "could not compress %s\n", argv[i]);
+			ret = 1;
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+
+		start = now();
+		for (r = 0; r < repeats; r++) {
+			decomp_len = lzxpress_huffman_decompress(compressed,
+								 comp_len,
+								 decompressed,
+								 len);
+		}
+		decomp_time = now() - start;
+		if (decomp_len != (ssize_t)len ||
+		    memcmp(data, decompressed, len) != 0) {
+			fprintf(stderr, "round trip FAILED for %s\n", argv[i]);
+			ret = 1;
+			TALLOC_FREE(tmp_ctx);
+			continue;
+		}
+
+		printf("%10zu %10zd %7.3f %12.2f %12.2f  %s\n",
+		       len,
+		       comp_len,
+		       (double)comp_len / len,
+		       mb_per_sec(len, repeats, comp_time),
+		       mb_per_sec(len, repeats, decomp_time),
+		       argv[i]);
+
+		total_in += len;
+		total_out += comp_len;
+		total_comp_time += comp_time;
+		total_decomp_time += decomp_time;
+		TALLOC_FREE(tmp_ctx);
+	}
+
+	if (total_in != 0) {
+		printf("%10zu %10zu %7.3f %12.2f %12.2f  total\n",
+		       total_in,
+		       total_out,
+		       (double)total_out / total_in,
+		       mb_per_sec(total_in, repeats, total_comp_time),
+		       mb_per_sec(total_in, repeats, total_decomp_time));
+	}
+	TALLOC_FREE(mem_ctx);
+	return ret;
+}
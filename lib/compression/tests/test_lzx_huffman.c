@@ -1226,6 +1226,25 @@ static void test_lzxpress_huffman_decompress_empty_or_null(void **state)
 }
 
 
+static void test_lzxpress_huffman_decompress_oversubscribed(void **state)
+{
+	/*
+	 * A table where every symbol has a 1 bit code is impossible, and
+	 * needs to be rejected before it is used to fill the lookup tables.
+	 */
+	ssize_t ret;
+	uint8_t input[256 + 16];
+	uint8_t output[1000];
+
+	memset(input, 0x11, 256);
+	memset(input + 256, 0, sizeof(input) - 256);
+
+	ret = lzxpress_huffman_decompress(input, sizeof(input),
+					  output, sizeof(output));
+	assert_int_equal(ret, -1LL);
+}
+
+
 int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_lzxpress_huffman_short_boring_strings),
@@ -1246,6 +1265,7 @@ int main(void) {
 		cmocka_unit_test(test_lzxpress_huffman_overlong_matches),
 		cmocka_unit_test(test_lzxpress_huffman_decompress_empty_or_null),
 		cmocka_unit_test(test_lzxpress_huffman_compress_empty_or_null),
+		cmocka_unit_test(test_lzxpress_huffman_decompress_oversubscribed),
 	};
 	if (!isatty(1)) {
 		cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
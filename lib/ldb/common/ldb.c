@@ -1290,6 +1290,18 @@ int ldb_search_default_callback(struct ldb_request *req,
 
 	switch (ares->type) {
 	case LDB_REPLY_ENTRY:
+		/*
+		 * The result outlives the request, so a read only
+		 * view has to be turned into a real copy here
+		 */
+		if (ldb_req_is_read_only_view(req)) {
+			int ret = ldb_msg_elements_take_ownership(ares->message);
+			if (ret != LDB_SUCCESS) {
+				return ldb_request_done(req,
+							LDB_ERR_OPERATIONS_ERROR);
+			}
+		}
+
 		res->msgs = talloc_realloc(res, res->msgs,
 					struct ldb_message *, res->count + 2);
 		if (! res->msgs) {
@@ -2163,6 +2175,23 @@ void ldb_req_mark_trusted(struct ldb_request *req)
 	req->handle->flags &= ~LDB_HANDLE_FLAG_UNTRUSTED;
 }
 
+/**
+  allow the backend to return entries for a search request that point
+  directly into the database rather than into talloc'ed copies.
+ */
+void ldb_req_mark_read_only_view(struct ldb_request *req)
+{
+	req->handle->flags |= LDB_HANDLE_FLAG_READ_ONLY_VIEW;
+}
+
+/**
+ * return true if a request accepts read only views
+ */
+bool ldb_req_is_read_only_view(struct ldb_request *req)
+{
+	return (req->handle->flags & LDB_HANDLE_FLAG_READ_ONLY_VIEW) != 0;
+}
+
 /**
   set custom flags. Those flags are set by applications using ldb,
   they are application dependent and the same bit can have different
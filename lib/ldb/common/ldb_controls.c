@@ -437,6 +437,29 @@ char *ldb_control_to_string(TALLOC_CTX *mem_ctx, const struct ldb_control *contr
 		return res;
 	}
 
+	if (strcmp(control->oid, LDB_CONTROL_EXPLAIN_OID) == 0) {
+		struct ldb_explain_control *rep_control =
+			talloc_get_type(control->data,
+					struct ldb_explain_control);
+
+		if (rep_control == NULL) {
+			/* the request carries no data */
+			res = talloc_asprintf(mem_ctx, "%s:%d",
+						LDB_CONTROL_EXPLAIN_NAME,
+						control->critical);
+			return res;
+		}
+		res = talloc_asprintf(mem_ctx, "%s:%d:%d:%u:%u:%s",
+					LDB_CONTROL_EXPLAIN_NAME,
+					control->critical,
+					rep_control->full_scan,
+					rep_control->candidates,
+					rep_control->examined,
+					rep_control->plan != NULL ?
+					rep_control->plan : "");
+		return res;
+	}
+
 	/*
 	 * From here we don't know the control
 	 */
@@ -1256,6 +1279,28 @@ struct ldb_control *ldb_parse_control_from_string(struct ldb_context *ldb, TALLO
 
 		return ctrl;
 	}
+
+	if (LDB_CONTROL_CMP(control_strings, LDB_CONTROL_EXPLAIN_NAME) == 0) {
+		const char *p;
+		int crit, ret;
+
+		p = &(control_strings[sizeof(LDB_CONTROL_EXPLAIN_NAME)]);
+		ret = sscanf(p, "%d", &crit);
+		if ((ret != 1) || (crit < 0) || (crit > 1)) {
+			ldb_set_errstring(ldb,
+					  "invalid explain control syntax\n"
+					  " syntax: crit(b)\n"
+					  "   note: b = boolean");
+			talloc_free(ctrl);
+			return NULL;
+		}
+
+		ctrl->oid = LDB_CONTROL_EXPLAIN_OID;
+		ctrl->critical = crit;
+		ctrl->data = NULL;
+
+		return ctrl;
+	}
 	if (LDB_CONTROL_CMP(control_strings, LDB_CONTROL_VERIFY_NAME_NAME) == 0) {
 		const char *p;
 		char gc[1024];
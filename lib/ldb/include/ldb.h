@@ -577,6 +577,14 @@ typedef int (*ldb_qsort_cmp_fn_t) (void *v1, void *v2, void *opaque);
 #define LDB_CONTROL_PROVISION_OID "1.3.6.1.4.1.7165.4.3.16"
 #define LDB_CONTROL_PROVISION_NAME	"provision"
 
+/**
+   LDB_CONTROL_EXPLAIN_OID asks the key value backends to report how a
+   search was executed.  The final reply of the search carries a
+   control with the same OID and a struct ldb_explain_control.
+*/
+#define LDB_CONTROL_EXPLAIN_OID "1.3.6.1.4.1.7165.4.3.38"
+#define LDB_CONTROL_EXPLAIN_NAME	"explain"
+
 /* AD controls */
 
 /**
@@ -920,6 +928,13 @@ struct ldb_verify_name_control {
 	char *gc;
 };
 
+struct ldb_explain_control {
+	bool full_scan;		 /* every record was read and matched */
+	unsigned int candidates; /* entries taken from the index */
+	unsigned int examined;	 /* records read to answer the search */
+	char *plan;		 /* human readable description of the plan */
+};
+
 struct ldb_control {
 	const char *oid;
 	int critical;
@@ -388,6 +388,36 @@ void ldb_req_mark_trusted(struct ldb_request *req);
 */
 bool ldb_req_is_untrusted(struct ldb_request *req);
 
+/**
+  mark a search request as accepting read only views.
+
+  A backend that keeps its records at a stable address while the
+  read lock is held (currently the LMDB backend, outside of a
+  transaction) may then return entries whose attribute names and
+  values point directly into the database instead of into talloc'ed
+  copies.
+
+  Such entries are only valid until the LDB_REPLY_DONE of the
+  top-level request has been delivered, as that is when ldb_request()
+  drops the read lock.  The values must not be modified in place,
+  and a callback that keeps an entry for longer has to copy it with
+  ldb_msg_copy() or ldb_msg_elements_take_ownership() first.
+  ldb_search_default_callback() does the latter.
+
+  The mark is inherited by child requests.
+
+  \param req the search request to mark
+*/
+void ldb_req_mark_read_only_view(struct ldb_request *req);
+
+/**
+   return true if a request accepts read only views
+
+  \param req the request check
+  \return whether entries may point into the backend
+*/
+bool ldb_req_is_read_only_view(struct ldb_request *req);
+
 /**
   set custom flags. Those flags are set by applications using ldb,
   they are application dependent and the same bit can have different
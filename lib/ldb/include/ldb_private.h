@@ -52,6 +52,8 @@ struct ldb_backend_ops;
 #define LDB_HANDLE_FLAG_DONE_CALLED 1
 /* call is from an untrusted source - eg. over ldap:// */
 #define LDB_HANDLE_FLAG_UNTRUSTED   2
+/* entries may point into the backend, see ldb_req_mark_read_only_view() */
+#define LDB_HANDLE_FLAG_READ_ONLY_VIEW 4
 
 struct ldb_handle {
 	int status;
@@ -1883,6 +1883,22 @@ static void ldb_kv_request_done(struct ldb_kv_context *ctx, int error)
 	ares->type = LDB_REPLY_DONE;
 	ares->error = error;
 
+	if (ctx->explain != NULL) {
+		int ret;
+
+		ret = ldb_reply_add_control(ares,
+					    LDB_CONTROL_EXPLAIN_OID,
+					    false,
+					    talloc_steal(ares, ctx->explain));
+		ctx->explain = NULL;
+		if (ret != LDB_SUCCESS) {
+			talloc_free(ares);
+			ldb_oom(ldb);
+			req->callback(req, NULL);
+			return;
+		}
+	}
+
 	req->callback(req, ares);
 }
 
@@ -2023,6 +2039,7 @@ static int ldb_kv_handle_request(struct ldb_module *module,
 				 struct ldb_request *req)
 {
 	struct ldb_control *control_permissive;
+	struct ldb_control *control_explain;
 	struct ldb_context *ldb;
 	struct tevent_context *ev;
 	struct ldb_kv_context *ac;
@@ -2034,10 +2051,13 @@ static int ldb_kv_handle_request(struct ldb_module *module,
 
 	control_permissive = ldb_request_get_control(req,
 					LDB_CONTROL_PERMISSIVE_MODIFY_OID);
+	control_explain = ldb_request_get_control(req,
+					LDB_CONTROL_EXPLAIN_OID);
 
 	for (i = 0; req->controls && req->controls[i]; i++) {
 		if (req->controls[i]->critical &&
-		    req->controls[i] != control_permissive) {
+		    req->controls[i] != control_permissive &&
+		    req->controls[i] != control_explain) {
 			ldb_asprintf_errstring(ldb, "Unsupported critical extension %s",
 					       req->controls[i]->oid);
 			return LDB_ERR_UNSUPPORTED_CRITICAL_EXTENSION;
@@ -2099,6 +2119,7 @@ static int ldb_kv_init_rootdse(struct ldb_module *module)
 {
 	/* ignore errors on this - we expect it for non-sam databases */
 	ldb_mod_register_control(module, LDB_CONTROL_PERMISSIVE_MODIFY_OID);
+	ldb_mod_register_control(module, LDB_CONTROL_EXPLAIN_OID);
 
 	/* there can be no module beyond the backend, just return */
 	return LDB_SUCCESS;
@@ -146,6 +146,14 @@ struct ldb_kv_private {
 	 * The size to be used for the index transaction cache
 	 */
 	size_t index_transaction_cache_size;
+
+	/*
+	 * The explain control of the search currently being planned by
+	 * ldb_kv_search_indexed(), NULL otherwise.  It is only set while
+	 * the candidate list is built, which never calls back into other
+	 * modules.
+	 */
+	struct ldb_explain_control *explain;
 };
 
 struct ldb_kv_context {
@@ -172,6 +180,14 @@ struct ldb_kv_context {
 	const char * const *attrs;
 	struct tevent_timer *timeout_event;
 
+	/*
+	 * Query plan for the explain control, NULL unless requested.
+	 * planned_full_scan is set when the index was usable but the
+	 * candidate list was too large to be worth reading by key.
+	 */
+	struct ldb_explain_control *explain;
+	bool planned_full_scan;
+
 	/* error handling */
 	int error;
 };
@@ -253,6 +269,17 @@ int ldb_kv_check_at_attributes_values(const struct ldb_val *value);
 
 struct ldb_parse_tree;
 
+/*
+ * A full scan is preferred once the index candidates are more than
+ * 1/LDB_KV_FULL_SCAN_FRACTION of the records in the database.  With
+ * tdb, reading a record by key costs about ten times more than
+ * reading it during a traverse.  Small candidate lists are always
+ * read by key, as their cost does not matter and the index keeps the
+ * result order stable.
+ */
+#define LDB_KV_FULL_SCAN_FRACTION 8
+#define LDB_KV_FULL_SCAN_MIN_CANDIDATES 1000
+
 int ldb_kv_search_indexed(struct ldb_kv_context *ctx, uint32_t *);
 int ldb_kv_index_add_new(struct ldb_module *module,
 			 struct ldb_kv_private *ldb_kv,
@@ -303,6 +330,11 @@ int ldb_kv_search_key(struct ldb_module *module,
 		      unsigned int unpack_flags);
 int ldb_kv_filter_attrs_in_place(struct ldb_message *msg,
 				 const char *const *attrs);
+int ldb_kv_msg_elements_take_ownership(struct ldb_kv_private *ldb_kv,
+				       struct ldb_request *req,
+				       struct ldb_message *msg);
+void ldb_kv_explain_add(struct ldb_explain_control *explain,
+			const char *fmt, ...) PRINTF_ATTRIBUTE(2, 3);
 int ldb_kv_search(struct ldb_kv_context *ctx);
 
 /*
@@ -262,6 +262,89 @@ static int ldb_val_equal_exact_ordered(const struct ldb_val v1,
 }
 
 
+/*
+  GUID index values are all LDB_KV_GUID_SIZE bytes, so the order of
+  ldb_val_equal_exact_ordered() is that of the bytes alone.  Comparing
+  them as two big-endian 64-bit words avoids a memcmp() call for each
+  step of a search or merge over long index lists.
+*/
+static inline uint64_t ldb_kv_guid_word(const uint8_t *p)
+{
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+	       ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+	       ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+	       ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static inline int ldb_kv_guid_cmp(const struct ldb_val *v1,
+				  const struct ldb_val *v2)
+{
+	uint64_t w1, w2;
+
+	if (v1->length != LDB_KV_GUID_SIZE ||
+	    v2->length != LDB_KV_GUID_SIZE) {
+		return ldb_val_equal_exact_ordered(*v1, v2);
+	}
+
+	w1 = ldb_kv_guid_word(v1->data);
+	w2 = ldb_kv_guid_word(v2->data);
+	if (w1 == w2) {
+		w1 = ldb_kv_guid_word(v1->data + 8);
+		w2 = ldb_kv_guid_word(v2->data + 8);
+	}
+	if (w1 < w2) {
+		return -1;
+	}
+	return w1 > w2;
+}
+
+static int ldb_kv_guid_cmp_ordered(const struct ldb_val v1,
+				   const struct ldb_val *v2)
+{
+	return ldb_kv_guid_cmp(&v1, v2);
+}
+
+/*
+  find the first entry at or after position 'start' of a sorted GUID
+  dn_list that is not less than v, returns list->count if there is
+  none.
+
+  This probes start, start+1, start+3, start+7, ... before doing a
+  binary search over the last gap, so walking a short list against a
+  long one costs O(short * log(long/short)) rather than a full binary
+  search or a full merge for every value.
+ */
+static unsigned int ldb_kv_dn_list_gallop(const struct dn_list *list,
+					  unsigned int start,
+					  const struct ldb_val *v)
+{
+	unsigned int lo = start;
+	unsigned int hi = start;
+	unsigned int step = 1;
+
+	while (hi < list->count && ldb_kv_guid_cmp(&list->dn[hi], v) < 0) {
+		lo = hi + 1;
+		if (list->count - hi <= step) {
+			hi = list->count;
+		} else {
+			hi += step;
+		}
+		step *= 2;
+	}
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (ldb_kv_guid_cmp(&list->dn[mid], v) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
 /*
   find a entry in a dn_list, using a ldb_val. Uses a case sensitive
   binary-safe comparison for the 'dn' returns -1 if not found
@@ -285,7 +368,7 @@ static int ldb_kv_dn_list_find_val(struct ldb_kv_private *ldb_kv,
 	}
 
 	BINARY_ARRAY_SEARCH_GTE(list->dn, list->count,
-				*v, ldb_val_equal_exact_ordered,
+				*v, ldb_kv_guid_cmp_ordered,
 				exact, next);
 	if (exact == NULL) {
 		return -1;
@@ -578,6 +661,122 @@ normal_index:
 	return LDB_SUCCESS;
 }
 
+struct ldb_kv_dn_list_count_ctx {
+	struct ldb_module *module;
+	struct ldb_kv_private *ldb_kv;
+	size_t count;
+};
+
+static int ldb_kv_dn_list_count_parser(_UNUSED_ struct ldb_val key,
+				       struct ldb_val data,
+				       void *private_data)
+{
+	struct ldb_kv_dn_list_count_ctx *ctx = private_data;
+	struct ldb_context *ldb = ldb_module_get_ctx(ctx->module);
+	struct ldb_message *msg = NULL;
+	struct ldb_message_element *el = NULL;
+	int ret;
+
+	msg = ldb_msg_new(ctx->module);
+	if (msg == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	/*
+	 * Nothing is kept beyond this callback, so the values can
+	 * point into the record.
+	 */
+	ret = ldb_unpack_data_flags(ldb, &data, msg,
+				    LDB_UNPACK_DATA_FLAG_NO_DN |
+				    LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
+	if (ret != 0) {
+		talloc_free(msg);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	el = ldb_msg_find_element(msg, LDB_KV_IDX);
+	if (el == NULL) {
+		ctx->count = 0;
+	} else if (ctx->ldb_kv->cache->GUID_index_attribute == NULL) {
+		ctx->count = el->num_values;
+	} else if (el->num_values == 0) {
+		ctx->count = 0;
+	} else {
+		ctx->count = el->values[0].length / LDB_KV_GUID_SIZE;
+	}
+
+	talloc_free(msg);
+	return LDB_SUCCESS;
+}
+
+/*
+  return the number of entries in the @IDX list of an index entry
+  without loading the list.  This is the selectivity of an index
+  value, kept up to date by every write of the index record.
+ */
+static int ldb_kv_dn_list_count(struct ldb_module *module,
+				struct ldb_kv_private *ldb_kv,
+				struct ldb_dn *dn,
+				size_t *count)
+{
+	struct ldb_kv_dn_list_count_ctx ctx = {
+		.module = module,
+		.ldb_kv = ldb_kv,
+	};
+	struct ldb_val key;
+	int ret;
+
+	*count = 0;
+
+	/*
+	 * The in memory index caches of a transaction are more
+	 * recent than the database, look there first.
+	 */
+	if (ldb_kv->idxptr != NULL) {
+		TDB_DATA rec = {0};
+		TDB_DATA tkey = {0};
+		struct dn_list *list = NULL;
+
+		tkey.dptr = discard_const_p(unsigned char,
+					    ldb_dn_get_linearized(dn));
+		tkey.dsize = strlen((char *)tkey.dptr);
+
+		if (ldb_kv->nested_idx_ptr != NULL) {
+			rec = tdb_fetch(ldb_kv->nested_idx_ptr->itdb, tkey);
+		}
+		if (rec.dptr == NULL) {
+			rec = tdb_fetch(ldb_kv->idxptr->itdb, tkey);
+		}
+		if (rec.dptr != NULL) {
+			list = ldb_kv_index_idxptr(module, rec);
+			free(rec.dptr);
+			if (list == NULL) {
+				return LDB_ERR_OPERATIONS_ERROR;
+			}
+			*count = list->count;
+			return LDB_SUCCESS;
+		}
+	}
+
+	key = ldb_kv_key_dn(dn, dn);
+	if (key.data == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	ret = ldb_kv->kv_ops->fetch_and_parse(
+	    ldb_kv, key, ldb_kv_dn_list_count_parser, &ctx);
+	talloc_free(key.data);
+	if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+		return LDB_SUCCESS;
+	}
+	if (ret != LDB_SUCCESS) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	*count = ctx.count;
+	return LDB_SUCCESS;
+}
+
 int ldb_kv_key_dn_from_idx(struct ldb_module *module,
 			   struct ldb_kv_private *ldb_kv,
 			   TALLOC_CTX *mem_ctx,
@@ -1460,12 +1659,33 @@ static bool list_intersect(struct ldb_kv_private *ldb_kv,
 	}
 	list3->count = 0;
 
-	for (i=0;i<short_list->count;i++) {
-		/* For the GUID index case, this is a binary search */
-		if (ldb_kv_dn_list_find_val(
-			ldb_kv, long_list, &short_list->dn[i]) != -1) {
-			list3->dn[list3->count] = short_list->dn[i];
-			list3->count++;
+	if (ldb_kv->cache->GUID_index_attribute != NULL) {
+		unsigned int j = 0;
+
+		/*
+		 * Both lists are sorted, so each value of the short
+		 * list is searched for only in the rest of the long
+		 * list
+		 */
+		for (i=0; i<short_list->count; i++) {
+			j = ldb_kv_dn_list_gallop(long_list, j,
+						  &short_list->dn[i]);
+			if (j == long_list->count) {
+				break;
+			}
+			if (ldb_kv_guid_cmp(&long_list->dn[j],
+					    &short_list->dn[i]) == 0) {
+				list3->dn[list3->count] = short_list->dn[i];
+				list3->count++;
+			}
+		}
+	} else {
+		for (i=0; i<short_list->count; i++) {
+			if (ldb_kv_dn_list_find_val(
+				ldb_kv, long_list, &short_list->dn[i]) != -1) {
+				list3->dn[list3->count] = short_list->dn[i];
+				list3->count++;
+			}
 		}
 	}
 
@@ -1530,8 +1750,7 @@ static bool list_union(struct ldb_context *ldb,
 		} else if (j >= list2->count) {
 			cmp = -1;
 		} else {
-			cmp = ldb_val_equal_exact_ordered(list->dn[i],
-							  &list2->dn[j]);
+			cmp = ldb_kv_guid_cmp(&list->dn[i], &list2->dn[j]);
 		}
 
 		if (cmp < 0) {
@@ -1663,8 +1882,175 @@ static bool ldb_kv_index_unique(struct ldb_context *ldb,
 	return false;
 }
 
+/*
+  estimate how many entries ldb_kv_index_dn() would return for a
+  tree, using the size of the index records but without loading
+  them.
+
+  returns LDB_ERR_OPERATIONS_ERROR if the tree can not be sized, in
+  which case it may or may not be indexed.
+ */
+static int ldb_kv_index_dn_estimate(struct ldb_module *module,
+				    struct ldb_kv_private *ldb_kv,
+				    const struct ldb_parse_tree *tree,
+				    size_t *estimate)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	enum key_truncation truncation = KEY_NOT_TRUNCATED;
+	const char *attr = NULL;
+	struct ldb_dn *dn = NULL;
+	bool sized = false;
+	unsigned int i;
+	int ret;
+
+	*estimate = 0;
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+		/* X && Y can not be larger than the smaller of the two */
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			size_t e;
+
+			ret = ldb_kv_index_dn_estimate(
+			    module, ldb_kv, tree->u.list.elements[i], &e);
+			if (ret != LDB_SUCCESS) {
+				continue;
+			}
+			if (!sized || e < *estimate) {
+				*estimate = e;
+				sized = true;
+			}
+		}
+		return sized ? LDB_SUCCESS : LDB_ERR_OPERATIONS_ERROR;
+
+	case LDB_OP_OR:
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			size_t e;
+
+			ret = ldb_kv_index_dn_estimate(
+			    module, ldb_kv, tree->u.list.elements[i], &e);
+			if (ret != LDB_SUCCESS) {
+				return ret;
+			}
+			*estimate += e;
+		}
+		return LDB_SUCCESS;
+
+	case LDB_OP_EQUALITY:
+		break;
+
+	default:
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	/* This mirrors ldb_kv_index_dn_leaf() */
+	attr = tree->u.equality.attr;
+	if (ldb_kv->disallow_dn_filter && (ldb_attr_cmp(attr, "dn") == 0)) {
+		return LDB_SUCCESS;
+	}
+	if (attr[0] == '@') {
+		return LDB_SUCCESS;
+	}
+	if (ldb_attr_dn(attr) == 0) {
+		*estimate = 1;
+		return LDB_SUCCESS;
+	}
+	if ((ldb_kv->cache->GUID_index_attribute != NULL) &&
+	    (ldb_attr_cmp(attr, ldb_kv->cache->GUID_index_attribute) == 0)) {
+		*estimate = 1;
+		return LDB_SUCCESS;
+	}
+	if (!ldb_kv_is_indexed(module, ldb_kv, attr)) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+	if (ldb_kv_index_unique(ldb, ldb_kv, attr)) {
+		*estimate = 1;
+		return LDB_SUCCESS;
+	}
+
+	dn = ldb_kv_index_key(ldb,
+			      ldb_kv,
+			      ldb_kv,
+			      attr,
+			      &tree->u.equality.value,
+			      NULL,
+			      &truncation);
+	if (dn == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	ret = ldb_kv_dn_list_count(module, ldb_kv, dn, estimate);
+	talloc_free(dn);
+	return ret;
+}
+
+/*
+ * Once the candidate list is this many times smaller than the index
+ * record of a further AND term, intersecting with that term is not
+ * worth loading it: ldb_kv_index_filter() drops the few candidates it
+ * would have removed anyway.
+ */
+#define LDB_KV_INDEX_AND_SKIP_RATIO 1000
+
+struct ldb_kv_and_term {
+	const struct ldb_parse_tree *tree;
+	unsigned int idx;
+	bool sized;
+	size_t estimate;
+};
+
+/*
+  order the terms of an AND by their estimated size, keeping the
+  filter order for those that could not be sized and put them last
+ */
+static int ldb_kv_and_term_cmp(const struct ldb_kv_and_term *t1,
+			       const struct ldb_kv_and_term *t2)
+{
+	if (t1->sized != t2->sized) {
+		return t1->sized ? -1 : 1;
+	}
+	if (t1->sized && t1->estimate != t2->estimate) {
+		return t1->estimate < t2->estimate ? -1 : 1;
+	}
+	if (t1->idx != t2->idx) {
+		return t1->idx < t2->idx ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+  describe an AND term in the plan of the explain control, with the
+  size of its index record and what was done with it
+ */
+static void ldb_kv_explain_term(struct ldb_kv_private *ldb_kv,
+				const struct ldb_parse_tree *tree,
+				size_t count,
+				const char *note)
+{
+	char *expression = NULL;
+
+	if (ldb_kv->explain == NULL) {
+		return;
+	}
+
+	expression = ldb_filter_from_tree(ldb_kv->explain, tree);
+	ldb_kv_explain_add(ldb_kv->explain, " %s",
+			   expression != NULL ? expression : "?");
+	TALLOC_FREE(expression);
+
+	if (note == NULL) {
+		ldb_kv_explain_add(ldb_kv->explain, "=%zu", count);
+	} else {
+		ldb_kv_explain_add(ldb_kv->explain, ":%s", note);
+	}
+}
+
 /*
   process an AND expression (intersection)
+
+  The terms are intersected smallest first, as estimated from the
+  size of their index records, and large terms are not loaded once
+  the candidate list is small.
  */
 static int ldb_kv_index_dn_and(struct ldb_module *module,
 			       struct ldb_kv_private *ldb_kv,
@@ -1672,6 +2058,8 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			       struct dn_list *list)
 {
 	struct ldb_context *ldb;
+	struct ldb_kv_and_term *terms = NULL;
+	unsigned int num_terms = tree->u.list.num_elements;
 	unsigned int i;
 	bool found;
 
@@ -1707,16 +2095,53 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 		}
 	}
 
+	/* size the terms, so the most selective is read first */
+	terms = talloc_array(list, struct ldb_kv_and_term, num_terms);
+	if (terms == NULL) {
+		return ldb_module_oom(module);
+	}
+
+	for (i = 0; i < num_terms; i++) {
+		int ret;
+
+		terms[i] = (struct ldb_kv_and_term) {
+			.tree = tree->u.list.elements[i],
+			.idx = i,
+		};
+		ret = ldb_kv_index_dn_estimate(
+		    module, ldb_kv, terms[i].tree, &terms[i].estimate);
+		if (ret != LDB_SUCCESS) {
+			continue;
+		}
+		if (terms[i].estimate == 0) {
+			/* 0 && X == 0 */
+			ldb_kv_explain_term(ldb_kv, terms[i].tree, 0, NULL);
+			talloc_free(terms);
+			return LDB_ERR_NO_SUCH_OBJECT;
+		}
+		terms[i].sized = true;
+	}
+
+	TYPESAFE_QSORT(terms, num_terms, ldb_kv_and_term_cmp);
+
 	/* now do a full intersection */
 	found = false;
 
-	for (i=0; i<tree->u.list.num_elements; i++) {
-		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
+	for (i = 0; i < num_terms; i++) {
+		const struct ldb_parse_tree *subtree = terms[i].tree;
 		struct dn_list *list2;
 		int ret;
 
+		if (found && terms[i].sized &&
+		    terms[i].estimate / LDB_KV_INDEX_AND_SKIP_RATIO >
+		    list->count) {
+			ldb_kv_explain_term(ldb_kv, subtree, 0, "skipped");
+			continue;
+		}
+
 		list2 = talloc_zero(list, struct dn_list);
 		if (list2 == NULL) {
+			talloc_free(terms);
 			return ldb_module_oom(module);
 		}
 
@@ -1724,18 +2149,23 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 
 		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 			/* X && 0 == 0 */
+			ldb_kv_explain_term(ldb_kv, subtree, 0, NULL);
 			list->dn = NULL;
 			list->count = 0;
 			talloc_free(list2);
+			talloc_free(terms);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 
 		if (ret != LDB_SUCCESS) {
 			/* this didn't adding anything */
+			ldb_kv_explain_term(ldb_kv, subtree, 0, "unindexed");
 			talloc_free(list2);
 			continue;
 		}
 
+		ldb_kv_explain_term(ldb_kv, subtree, list2->count, NULL);
+
 		if (!found) {
 			talloc_reparent(list2, list, list->dn);
 			list->dn = list2->dn;
@@ -1743,20 +2173,25 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			found = true;
 		} else if (!list_intersect(ldb_kv, list, list2)) {
 			talloc_free(list2);
+			talloc_free(terms);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
 
 		if (list->count == 0) {
 			list->dn = NULL;
+			talloc_free(terms);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 
 		if (list->count < 2) {
 			/* it isn't worth loading the next part of the tree */
+			talloc_free(terms);
 			return LDB_SUCCESS;
 		}
 	}
 
+	talloc_free(terms);
+
 	if (!found) {
 		/* none of the attributes were indexed */
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -2421,6 +2856,10 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 			continue;
 		}
 
+		if (ac->explain != NULL) {
+			ac->explain->examined++;
+		}
+
 		if (ret != LDB_SUCCESS && ret != LDB_ERR_NO_SUCH_OBJECT) {
 			/* an internal error */
 			talloc_free(keys);
@@ -2486,7 +2925,7 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 		ldb_msg_shrink_to_fit(msg);
 
 		/* Ensure the message elements are all talloc'd. */
-		ret = ldb_msg_elements_take_ownership(msg);
+		ret = ldb_kv_msg_elements_take_ownership(ldb_kv, ac->req, msg);
 		if (ret != LDB_SUCCESS) {
 			talloc_free(keys);
 			talloc_free(msg);
@@ -2556,6 +2995,8 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 		return ldb_module_oom(ac->module);
 	}
 
+	ldb_kv_explain_add(ac->explain, "index:");
+
 	/*
 	 * For the purposes of selecting the switch arm below, if we
 	 * don't have a one-level index then treat it like a subtree
@@ -2592,6 +3033,8 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 			talloc_free(dn_list);
 			return ret;
 		}
+		ldb_kv_explain_add(ac->explain, " one-level=%u",
+				   dn_list->count);
 
 		/*
 		 * If we have too many children, running ldb_kv_index_filter()
@@ -2626,9 +3069,11 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 			/*
 			 * Try to do an indexed database search
 			 */
+			ldb_kv->explain = ac->explain;
 			ret = ldb_kv_index_dn(
 			    ac->module, ldb_kv, ac->tree,
 			    indexed_search_result);
+			ldb_kv->explain = NULL;
 
 			/*
 			 * We can stop if we're sure the object doesn't exist
@@ -2675,7 +3120,12 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 		 * Here we load the index for the tree.  We have no
 		 * index for the subtree.
 		 */
+		ldb_kv->explain = ac->explain;
 		ret = ldb_kv_index_dn(ac->module, ldb_kv, ac->tree, dn_list);
+		ldb_kv->explain = NULL;
+		if (ret == LDB_ERR_OPERATIONS_ERROR) {
+			ldb_kv_explain_add(ac->explain, " not indexed");
+		}
 		if (ret != LDB_SUCCESS) {
 			talloc_free(dn_list);
 			return ret;
@@ -2683,6 +3133,33 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 		break;
 	}
 
+	if (ac->explain != NULL) {
+		ac->explain->candidates = dn_list->count;
+		ldb_kv_explain_add(ac->explain, " %u candidates",
+				   dn_list->count);
+	}
+
+	/*
+	 * Reading the candidates one by one is much slower per record
+	 * than a full scan, so if the index leaves a large part of the
+	 * database to look at, scan it instead.  The backend size is
+	 * an estimate (and an overestimate for tdb), which errs
+	 * towards using the index.
+	 */
+	if (!ldb_kv->disable_full_db_scan &&
+	    dn_list->count >= LDB_KV_FULL_SCAN_MIN_CANDIDATES) {
+		size_t db_size = ldb_kv->kv_ops->get_size(ldb_kv);
+
+		if (dn_list->count > db_size / LDB_KV_FULL_SCAN_FRACTION) {
+			ldb_kv_explain_add(ac->explain,
+					   " of ~%zu records",
+					   db_size);
+			ac->planned_full_scan = true;
+			talloc_free(dn_list);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+	}
+
 	/*
 	 * It is critical that this function do the re-filter even
 	 * on things found by the index as the index can over-match
@@ -302,10 +302,30 @@ int ldb_kv_filter_attrs_in_place(struct ldb_message *msg,
 	return ldb_filter_attrs_in_place(msg, attrs);
 }
 
+/*
+ * Ensure the message elements of a search result are all talloc'd,
+ * unless the caller accepts read only views (see
+ * ldb_req_mark_read_only_view()) and the backend guarantees the
+ * unpacked values stay put until the read lock is dropped.  The
+ * names and values then keep pointing into the database.
+ */
+int ldb_kv_msg_elements_take_ownership(struct ldb_kv_private *ldb_kv,
+				       struct ldb_request *req,
+				       struct ldb_message *msg)
+{
+	if (ldb_req_is_read_only_view(req) &&
+	    (ldb_kv->kv_ops->options & LDB_KV_OPTION_STABLE_READ_LOCK) &&
+	    !ldb_kv->kv_ops->transaction_active(ldb_kv)) {
+		return LDB_SUCCESS;
+	}
+
+	return ldb_msg_elements_take_ownership(msg);
+}
+
 /*
   search function for a non-indexed search
  */
-static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
+static int search_func(struct ldb_kv_private *ldb_kv,
 		       struct ldb_val key,
 		       struct ldb_val val,
 		       void *state)
@@ -341,6 +361,10 @@ static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 		return 0;
 	}
 
+	if (ac->explain != NULL) {
+		ac->explain->examined++;
+	}
+
 	/*
 	 * Check the time every 64 records, to reduce calls to
 	 * gettimeofday().  This is a compromise, not all calls to
@@ -444,7 +468,7 @@ static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 	ldb_msg_shrink_to_fit(msg);
 
 	/* Ensure the message elements are all talloc'd. */
-	ret = ldb_msg_elements_take_ownership(msg);
+	ret = ldb_kv_msg_elements_take_ownership(ldb_kv, ac->req, msg);
 	if (ret != LDB_SUCCESS) {
 		talloc_free(msg);
 		ac->error = LDB_ERR_OPERATIONS_ERROR;
@@ -511,6 +535,24 @@ static int ldb_kv_search_full(struct ldb_kv_context *ctx)
 	return ctx->error;
 }
 
+/*
+  append to the plan reported by the explain control, if one was
+  requested
+*/
+void ldb_kv_explain_add(struct ldb_explain_control *explain,
+			const char *fmt, ...)
+{
+	va_list ap;
+
+	if (explain == NULL) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	explain->plan = talloc_vasprintf_append_buffer(explain->plan, fmt, ap);
+	va_end(ap);
+}
+
 static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 					 struct ldb_kv_context *ctx)
 {
@@ -549,6 +591,10 @@ static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 		return ret;
 	}
 
+	if (ctx->explain != NULL) {
+		ctx->explain->examined++;
+	}
+
 	if (ldb->redact.callback != NULL) {
 		ret = ldb->redact.callback(ldb->redact.module, ctx->req, msg);
 		if (ret != LDB_SUCCESS) {
@@ -610,7 +656,7 @@ static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 	ldb_msg_shrink_to_fit(msg);
 
 	/* Ensure the message elements are all talloc'd. */
-	ret = ldb_msg_elements_take_ownership(msg);
+	ret = ldb_kv_msg_elements_take_ownership(ldb_kv, ctx->req, msg);
 	if (ret != LDB_SUCCESS) {
 		talloc_free(msg);
 		return LDB_ERR_OPERATIONS_ERROR;
@@ -670,6 +716,19 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 	ctx->base = req->op.search.base;
 	ctx->attrs = req->op.search.attrs;
 
+	if (ldb_request_get_control(req, LDB_CONTROL_EXPLAIN_OID) != NULL) {
+		ctx->explain = talloc_zero(ctx, struct ldb_explain_control);
+		if (ctx->explain == NULL) {
+			ldb_kv->kv_ops->unlock_read(module);
+			return ldb_module_oom(module);
+		}
+		ctx->explain->plan = talloc_strdup(ctx->explain, "");
+		if (ctx->explain->plan == NULL) {
+			ldb_kv->kv_ops->unlock_read(module);
+			return ldb_module_oom(module);
+		}
+	}
+
 	if ((req->op.search.base == NULL) || (ldb_dn_is_null(req->op.search.base) == true)) {
 
 		/* Check what we should do with a NULL dn */
@@ -698,6 +757,7 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 		 * will try to look up an index record for a special
 		 * record (which doesn't exist).
 		 */
+		ldb_kv_explain_add(ctx->explain, "base");
 		ret = ldb_kv_search_and_return_base(ldb_kv, ctx);
 
 		ldb_kv->kv_ops->unlock_read(module);
@@ -746,9 +806,13 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 		 * In that case proceed to a full search unless we got a
 		 * callback error */
 		if (!ctx->request_terminated && ret != LDB_SUCCESS) {
-			/* Not indexed, so we need to do a full scan */
-			if (ldb_kv->warn_unindexed ||
-			    ldb_kv->disable_full_db_scan) {
+			/*
+			 * Not indexed, or the index would give too much
+			 * of the database, so we need to do a full scan
+			 */
+			if (!ctx->planned_full_scan &&
+			    (ldb_kv->warn_unindexed ||
+			     ldb_kv->disable_full_db_scan)) {
 				/* useful for debugging when slow performance
 				 * is caused by unindexed searches */
 				char *expression = ldb_filter_from_tree(ctx, ctx->tree);
@@ -782,6 +846,13 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 				return LDB_ERR_INAPPROPRIATE_MATCHING;
 			}
 
+			if (ctx->explain != NULL) {
+				ctx->explain->full_scan = true;
+				ldb_kv_explain_add(ctx->explain, "%sfull scan",
+						   ctx->explain->plan[0] != '\0' ?
+						   "; " : "");
+			}
+
 			ret = ldb_kv_search_full(ctx);
 			if (ret != LDB_SUCCESS) {
 				ldb_set_errstring(ldb, "Indexed and full searches both failed!\n");
@@ -351,6 +351,166 @@ static void test_init_store_set_index_cache_size_range(void **state)
 	TALLOC_FREE(ldb);
 }
 
+/*
+ * Build a sorted GUID index list of the multiples of step below max.
+ *
+ * Each value v is stored as v / 4 and v % 4 in the two big-endian
+ * halves of the GUID, so neighbouring values often only differ in the
+ * second half.
+ */
+static struct dn_list *guid_list(TALLOC_CTX *mem_ctx,
+				 unsigned int step,
+				 unsigned int max)
+{
+	struct dn_list *list = NULL;
+	unsigned int v;
+
+	list = talloc_zero(mem_ctx, struct dn_list);
+	assert_non_null(list);
+	list->dn = talloc_zero_array(list, struct ldb_val, max / step + 1);
+	assert_non_null(list->dn);
+	list->strict = true;
+
+	for (v = 0; v < max; v += step) {
+		uint8_t *guid = talloc_zero_array(list->dn,
+						  uint8_t,
+						  LDB_KV_GUID_SIZE);
+		uint64_t hi = v / 4;
+		uint64_t lo = v % 4;
+		int i;
+
+		assert_non_null(guid);
+		for (i = 0; i < 8; i++) {
+			guid[7 - i] = (hi >> (i * 8)) & 0xff;
+			guid[15 - i] = (lo >> (i * 8)) & 0xff;
+		}
+		list->dn[list->count].data = guid;
+		list->dn[list->count].length = LDB_KV_GUID_SIZE;
+		list->count++;
+	}
+
+	return list;
+}
+
+static unsigned int guid_value(const struct ldb_val *val)
+{
+	uint64_t hi = 0;
+	uint64_t lo = 0;
+	int i;
+
+	assert_int_equal(val->length, LDB_KV_GUID_SIZE);
+	for (i = 0; i < 8; i++) {
+		hi = (hi << 8) | val->data[i];
+		lo = (lo << 8) | val->data[i + 8];
+	}
+	return hi * 4 + lo;
+}
+
+static struct ldb_kv_private *guid_ldb_kv(TALLOC_CTX *mem_ctx)
+{
+	struct ldb_kv_private *ldb_kv = NULL;
+
+	ldb_kv = talloc_zero(mem_ctx, struct ldb_kv_private);
+	assert_non_null(ldb_kv);
+	ldb_kv->cache = talloc_zero(ldb_kv, struct ldb_kv_cache);
+	assert_non_null(ldb_kv->cache);
+	ldb_kv->cache->GUID_index_attribute = "objectUUID";
+
+	return ldb_kv;
+}
+
+/*
+ * Check list_intersect() on sorted GUID lists, for lists of similar
+ * length as well as a short list against a much longer one.
+ */
+static void test_guid_list_intersect(void **state)
+{
+	struct test_ctx *test_ctx = talloc_get_type_abort(
+		*state,
+		struct test_ctx);
+	struct ldb_kv_private *ldb_kv = guid_ldb_kv(test_ctx);
+	const struct {
+		unsigned int step1, max1, step2, max2;
+	} cases[] = {
+		{ 3, 3000, 5, 3000 },
+		{ 5, 3000, 3, 3000 },
+		{ 1, 100000, 997, 100000 },
+		{ 997, 100000, 1, 100000 },
+		{ 7, 100000, 2, 700 },
+		{ 2, 50, 3, 100000 },
+		{ 4, 4000, 4, 4000 },
+		{ 6, 12000, 9, 1000 },
+	};
+	size_t c;
+
+	for (c = 0; c < ARRAY_SIZE(cases); c++) {
+		struct dn_list *list1 = guid_list(test_ctx,
+						  cases[c].step1,
+						  cases[c].max1);
+		struct dn_list *list2 = guid_list(test_ctx,
+						  cases[c].step2,
+						  cases[c].max2);
+		unsigned int max = MIN(cases[c].max1, cases[c].max2);
+		unsigned int expected = 0;
+		unsigned int v;
+		unsigned int i;
+		bool ok;
+
+		ok = list_intersect(ldb_kv, list1, list2);
+		assert_true(ok);
+
+		i = 0;
+		for (v = 0; v < max; v++) {
+			if (v % cases[c].step1 != 0 ||
+			    v % cases[c].step2 != 0) {
+				continue;
+			}
+			assert_true(i < list1->count);
+			assert_int_equal(guid_value(&list1->dn[i]), v);
+			i++;
+			expected++;
+		}
+		assert_int_equal(list1->count, expected);
+
+		TALLOC_FREE(list1);
+		TALLOC_FREE(list2);
+	}
+
+	TALLOC_FREE(ldb_kv);
+}
+
+/*
+ * Check list_union() merges sorted GUID lists without duplicates.
+ */
+static void test_guid_list_union(void **state)
+{
+	struct test_ctx *test_ctx = talloc_get_type_abort(
+		*state,
+		struct test_ctx);
+	struct ldb_kv_private *ldb_kv = guid_ldb_kv(test_ctx);
+	struct dn_list *list1 = guid_list(test_ctx, 3, 3000);
+	struct dn_list *list2 = guid_list(test_ctx, 5, 4000);
+	unsigned int v;
+	unsigned int i = 0;
+	bool ok;
+
+	ok = list_union(NULL, ldb_kv, list1, list2);
+	assert_true(ok);
+
+	for (v = 0; v < 4000; v++) {
+		if ((v < 3000 && v % 3 == 0) || v % 5 == 0) {
+			assert_true(i < list1->count);
+			assert_int_equal(guid_value(&list1->dn[i]), v);
+			i++;
+		}
+	}
+	assert_int_equal(list1->count, i);
+
+	TALLOC_FREE(list1);
+	TALLOC_FREE(list2);
+	TALLOC_FREE(ldb_kv);
+}
+
 int main(int argc, const char **argv)
 {
 	const struct CMUnitTest tests[] = {
@@ -382,6 +542,14 @@ int main(int argc, const char **argv)
 			test_init_store_set_index_cache_size_range,
 			setup,
 			teardown),
+		cmocka_unit_test_setup_teardown(
+			test_guid_list_intersect,
+			setup,
+			teardown),
+		cmocka_unit_test_setup_teardown(
+			test_guid_list_union,
+			setup,
+			teardown),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
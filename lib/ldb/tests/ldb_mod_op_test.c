@@ -1394,6 +1394,288 @@ static void test_search_match_both(void **state)
 	assert_expected(search_test_ctx, result->msgs[1]);
 }
 
+struct read_only_view_ctx {
+	unsigned count;
+};
+
+static int read_only_view_callback(struct ldb_request *req,
+				   struct ldb_reply *ares)
+{
+	struct read_only_view_ctx *ctx =
+		talloc_get_type_abort(req->context,
+				      struct read_only_view_ctx);
+	const char *cn_vals[] = { "test_search_cn",
+				  "test_search_cn2" };
+
+	assert_non_null(ares);
+	assert_int_equal(ares->error, LDB_SUCCESS);
+
+	switch (ares->type) {
+	case LDB_REPLY_ENTRY:
+		/* the entry has to be usable until the request is done */
+		assert_attr_has_vals(ares->message, "cn", cn_vals, 2);
+		ctx->count++;
+		break;
+	case LDB_REPLY_REFERRAL:
+		break;
+	case LDB_REPLY_DONE:
+		return ldb_request_done(req, LDB_SUCCESS);
+	}
+
+	talloc_free(ares);
+	return LDB_SUCCESS;
+}
+
+static void test_search_read_only_view(void **state)
+{
+	struct search_test_ctx *search_test_ctx = talloc_get_type_abort(*state,
+			struct search_test_ctx);
+	struct ldb_context *ldb = search_test_ctx->ldb_test_ctx->ldb;
+	struct read_only_view_ctx *ctx = NULL;
+	struct ldb_result *result = NULL;
+	struct ldb_request *req = NULL;
+	struct ldb_message *msg = NULL;
+	struct ldb_dn *basedn = NULL;
+	const char *cn_vals[] = { "test_search_cn",
+				  "test_search_cn2" };
+	int ret;
+
+	basedn = ldb_dn_new_fmt(search_test_ctx, ldb, "%s",
+				search_test_ctx->base_dn);
+	assert_non_null(basedn);
+
+	ctx = talloc_zero(search_test_ctx, struct read_only_view_ctx);
+	assert_non_null(ctx);
+
+	ret = ldb_build_search_req(&req, ldb, ctx,
+				   basedn,
+				   LDB_SCOPE_SUBTREE,
+				   "cn=test_search_cn",
+				   NULL,
+				   NULL,
+				   ctx,
+				   read_only_view_callback,
+				   NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ldb_req_mark_read_only_view(req);
+	assert_true(ldb_req_is_read_only_view(req));
+
+	ret = ldb_request(ldb, req);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_wait(req->handle, LDB_WAIT_ALL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(ctx->count, 1);
+	TALLOC_FREE(req);
+
+	/*
+	 * ldb_search_default_callback() keeps the entries beyond the
+	 * request, so they have to survive the entry being changed
+	 * afterwards.
+	 */
+	result = talloc_zero(search_test_ctx, struct ldb_result);
+	assert_non_null(result);
+
+	ret = ldb_build_search_req(&req, ldb, result,
+				   basedn,
+				   LDB_SCOPE_SUBTREE,
+				   "cn=test_search_cn",
+				   NULL,
+				   NULL,
+				   result,
+				   ldb_search_default_callback,
+				   NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ldb_req_mark_read_only_view(req);
+
+	ret = ldb_request(ldb, req);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_wait(req->handle, LDB_WAIT_ALL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(result->count, 1);
+
+	msg = ldb_msg_new(search_test_ctx);
+	assert_non_null(msg);
+	msg->dn = ldb_dn_copy(msg, result->msgs[0]->dn);
+	assert_non_null(msg->dn);
+	ret = ldb_msg_add_empty(msg, "cn", LDB_FLAG_MOD_REPLACE, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_msg_add_string(msg, "cn", "test_search_cn3");
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_modify(ldb, msg);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	assert_attr_has_vals(result->msgs[0], "cn", cn_vals, 2);
+}
+
+/*
+ * Enough entries that an objectClass term is skipped once the
+ * department has narrowed the search to two candidates, and that
+ * reading every entry through the index is planned as a full scan.
+ */
+#define EXPLAIN_TEST_ENTRIES 3000
+
+static int ldb_explain_test_setup(void **state)
+{
+	struct ldbtest_ctx *ldb_test_ctx = NULL;
+	struct ldb_ldif *ldif = NULL;
+	const char *index_ldif =
+		"dn: @INDEXLIST\n"
+		"@IDXATTR: objectClass\n"
+		"@IDXATTR: department\n"
+#ifdef GUID_IDX
+		"@IDXGUID: objectUUID\n"
+		"@IDX_DN_GUID: GUID\n"
+#endif
+		"\n";
+	unsigned int i;
+	int ret;
+
+	ldbtest_noconn_setup((void **) &ldb_test_ctx);
+
+	ret = ldb_connect(ldb_test_ctx->ldb, ldb_test_ctx->dbpath, 0, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	while ((ldif = ldb_ldif_read_string(ldb_test_ctx->ldb, &index_ldif))) {
+		ret = ldb_add(ldb_test_ctx->ldb, ldif->msg);
+		assert_int_equal(ret, LDB_SUCCESS);
+	}
+
+	ret = ldb_transaction_start(ldb_test_ctx->ldb);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	for (i = 0; i < EXPLAIN_TEST_ENTRIES; i++) {
+		struct ldb_message *msg = ldb_msg_new(ldb_test_ctx);
+		assert_non_null(msg);
+
+		msg->dn = ldb_dn_new_fmt(msg, ldb_test_ctx->ldb,
+					 "cn=explain%u,dc=explain_test", i);
+		assert_non_null(msg->dn);
+
+		ret = ldb_msg_add_fmt(msg, "cn", "explain%u", i);
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_string(msg, "objectClass", "explain");
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_fmt(msg, "department", "dep%u",
+				      i % (EXPLAIN_TEST_ENTRIES / 2));
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_fmt(msg, "objectUUID", "explain%09u", i);
+		assert_int_equal(ret, LDB_SUCCESS);
+
+		ret = ldb_add(ldb_test_ctx->ldb, msg);
+		assert_int_equal(ret, LDB_SUCCESS);
+		TALLOC_FREE(msg);
+	}
+
+	ret = ldb_transaction_commit(ldb_test_ctx->ldb);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	*state = ldb_test_ctx;
+	return 0;
+}
+
+static struct ldb_explain_control *explain_search(
+	struct ldbtest_ctx *test_ctx,
+	const char *expression,
+	unsigned int *count)
+{
+	struct ldb_result *result = NULL;
+	struct ldb_request *req = NULL;
+	struct ldb_control *control = NULL;
+	struct ldb_explain_control *explain = NULL;
+	int ret;
+
+	result = talloc_zero(test_ctx, struct ldb_result);
+	assert_non_null(result);
+
+	ret = ldb_build_search_req(&req, test_ctx->ldb, result,
+				   NULL,
+				   LDB_SCOPE_SUBTREE,
+				   expression,
+				   NULL,
+				   NULL,
+				   result,
+				   ldb_search_default_callback,
+				   NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	ret = ldb_request_add_control(req, LDB_CONTROL_EXPLAIN_OID,
+				      true, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	ret = ldb_request(test_ctx->ldb, req);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_wait(req->handle, LDB_WAIT_ALL);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	assert_non_null(result->controls);
+	control = result->controls[0];
+	assert_non_null(control);
+	assert_string_equal(control->oid, LDB_CONTROL_EXPLAIN_OID);
+	explain = talloc_get_type(control->data, struct ldb_explain_control);
+	assert_non_null(explain);
+
+	*count = result->count;
+	return explain;
+}
+
+static void test_search_explain_and(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+			struct ldbtest_ctx);
+	struct ldb_explain_control *explain = NULL;
+	unsigned int count = 0;
+
+	/*
+	 * The terms are read smallest first, objectClass is not
+	 * worth intersecting with two candidates and cn has no index.
+	 */
+	explain = explain_search(test_ctx,
+				 "(&(cn=explain7)"
+				 "(objectClass=explain)"
+				 "(department=dep7))",
+				 &count);
+	assert_int_equal(count, 1);
+	assert_false(explain->full_scan);
+	assert_int_equal(explain->candidates, 2);
+	assert_int_equal(explain->examined, 2);
+	assert_string_equal(explain->plan,
+			    "index: (department=dep7)=2 "
+			    "(objectClass=explain):skipped "
+			    "(cn=explain7):unindexed "
+			    "2 candidates");
+
+	/* a term without index entries ends the search */
+	explain = explain_search(test_ctx,
+				 "(&(objectClass=explain)(department=none))",
+				 &count);
+	assert_int_equal(count, 0);
+	assert_int_equal(explain->examined, 0);
+	assert_string_equal(explain->plan, "index: (department=none)=0");
+}
+
+static void test_search_explain_full_scan(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+			struct ldbtest_ctx);
+	struct ldb_explain_control *explain = NULL;
+	unsigned int count = 0;
+
+	/* every entry is a candidate, so a scan is cheaper */
+	explain = explain_search(test_ctx, "(objectClass=explain)", &count);
+	assert_int_equal(count, EXPLAIN_TEST_ENTRIES);
+	assert_true(explain->full_scan);
+	assert_int_equal(explain->candidates, EXPLAIN_TEST_ENTRIES);
+	assert_int_equal(explain->examined, EXPLAIN_TEST_ENTRIES);
+	assert_non_null(strstr(explain->plan, "full scan"));
+
+	explain = explain_search(test_ctx, "(cn=explain7)", &count);
+	assert_int_equal(count, 1);
+	assert_true(explain->full_scan);
+	assert_int_equal(explain->candidates, 0);
+	assert_int_equal(explain->examined, EXPLAIN_TEST_ENTRIES);
+	assert_string_equal(explain->plan, "index: not indexed; full scan");
+}
+
 static void test_search_match_basedn(void **state)
 {
 	struct search_test_ctx *search_test_ctx = talloc_get_type_abort(*state,
@@ -4595,6 +4877,15 @@ int main(int argc, const char **argv)
 		cmocka_unit_test_setup_teardown(test_search_match_basedn,
 						ldb_search_test_setup,
 						ldb_search_test_teardown),
+		cmocka_unit_test_setup_teardown(test_search_read_only_view,
+						ldb_search_test_setup,
+						ldb_search_test_teardown),
+		cmocka_unit_test_setup_teardown(test_search_explain_and,
+						ldb_explain_test_setup,
+						ldbtest_teardown),
+		cmocka_unit_test_setup_teardown(test_search_explain_full_scan,
+						ldb_explain_test_setup,
+						ldbtest_teardown),
 		cmocka_unit_test_setup_teardown(test_ldb_search_against_transaction,
 						ldb_search_test_setup,
 						ldb_search_test_teardown),
@@ -610,6 +610,27 @@ int handle_controls_reply(struct ldb_control **reply, struct ldb_control **reque
 			continue;
 		}
 
+		if (strcmp(LDB_CONTROL_EXPLAIN_OID, reply[i]->oid) == 0) {
+			struct ldb_explain_control *rep_control;
+
+			rep_control = talloc_get_type(reply[i]->data, struct ldb_explain_control);
+			if (rep_control == NULL) {
+				fprintf(stderr,
+					"Warning EXPLAIN reply OID received "
+					"with no data\n");
+				continue;
+			}
+
+			fprintf(stderr, "Explain: %s, %u index candidates, "
+				"%u records examined: %s\n",
+				rep_control->full_scan ? "full scan" : "indexed",
+				rep_control->candidates,
+				rep_control->examined,
+				rep_control->plan != NULL ? rep_control->plan : "");
+
+			continue;
+		}
+
 		if (strcmp(LDB_CONTROL_PAGED_RESULTS_OID, reply[i]->oid) == 0) {
 			struct ldb_paged_control *rep_control, *req_control;
 
@@ -34,8 +34,83 @@
 #include "lib/util/tevent_unix.h"
 #include "lib/util/smb_strtox.h"
 
+#if defined(HAVE_EVENTFD) && defined(HAVE_MEMFD_CREATE) && \
+	defined(HAVE___ATOMIC_ADD_FETCH) && defined(HAVE___ATOMIC_ADD_LOAD)
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef SYS_pidfd_open
+#define MESSAGING_DGM_RINGS 1
+#endif
+#endif
+
 #define MESSAGING_DGM_FRAGMENT_LENGTH 1024
 
+/*
+ * messaging_dgm_send_multi() hands this many datagrams to one
+ * sendmmsg() call
+ */
+#define MESSAGING_DGM_MCAST_BATCH 64
+
+/*
+ * Datagrams are charged to the sending socket until the receiver
+ * read them. Fan-out to many sleeping receivers needs more than
+ * the default.
+ */
+#define MESSAGING_DGM_MCAST_SNDBUF (4*1024*1024)
+
+/*
+ * Datagrams with this cookie set up shared memory rings, see
+ * messaging_dgm_enable_rings(). Fragmented messages never use it.
+ */
+#define MESSAGING_DGM_RING_COOKIE UINT64_MAX
+
+#define MESSAGING_DGM_RING_REQUEST 1
+#define MESSAGING_DGM_RING_OFFER 2
+
+struct messaging_dgm_ring_ctrl {
+	uint32_t type;
+	uint32_t pid;
+};
+
+#define MESSAGING_DGM_RING_MAGIC 0x52494e47 /* "RING" */
+#define MESSAGING_DGM_RING_SIZE (64*1024)
+
+/*
+ * Larger messages and messages with fds go through the socket
+ */
+#define MESSAGING_DGM_RING_MAX_MSG (MESSAGING_DGM_RING_SIZE/4)
+
+/*
+ * Ask for a ring after this many messages to the same process
+ */
+#define MESSAGING_DGM_RING_THRESHOLD 16
+
+/*
+ * A single-producer single-consumer ring in a memfd shared by a
+ * sender and a receiver. The receiver creates it on request and
+ * passes it to the sender together with its eventfd. Entries are a
+ * uint64_t length followed by the message, padded to 8 bytes. head
+ * is only written by the sender, tail only by the receiver.
+ */
+struct messaging_dgm_ring {
+	uint32_t magic;
+	uint32_t size;
+
+	uint32_t rx_closed;	/* receiver is gone, don't send */
+	uint32_t tx_closed;	/* sender is gone, free when empty */
+	uint32_t rx_wakeup;	/* receiver sleeps, kick its eventfd */
+	uint32_t tx_wakeup;	/* sender waits for space, kick it */
+
+	uint8_t pad1[40];
+	uint64_t head;
+	uint8_t pad2[56];
+	uint64_t tail;
+	uint8_t pad3[56];
+
+	uint8_t data[];
+};
+
 struct sun_path_buf {
 	/*
 	 * This will carry enough for a socket path
@@ -60,8 +135,11 @@ struct messaging_dgm_fde_ev {
 
 	struct tevent_context *ev;
 	struct tevent_fd *fde;
+	struct tevent_fd *ring_fde;
 };
 
+struct messaging_dgm_out_pending;
+
 struct messaging_dgm_out {
 	struct messaging_dgm_out *prev, *next;
 	struct messaging_dgm_context *ctx;
@@ -73,6 +151,37 @@ struct messaging_dgm_out {
 
 	struct tevent_queue *queue;
 	struct tevent_timer *idle_timer;
+
+	unsigned num_sent;
+	bool ring_requested;
+	struct messaging_dgm_ring *ring;
+	uint32_t ring_size;
+	int ring_efd;
+	int ring_pidfd;
+	struct tevent_fd *ring_pid_fde;
+
+	/*
+	 * Messages waiting for space in the ring
+	 */
+	struct messaging_dgm_out_pending *pending;
+	struct tevent_timer *pending_timer;
+};
+
+struct messaging_dgm_in_ring {
+	struct messaging_dgm_in_ring *prev, *next;
+	struct messaging_dgm_context *ctx;
+
+	pid_t pid;
+	struct messaging_dgm_ring *ring;
+	uint32_t size;
+	int tx_efd;
+	int pidfd;
+	struct tevent_fd *pid_fde;
+
+	bool sender_gone;
+	bool busy;
+	bool gone;
+	bool *freed;
 };
 
 struct messaging_dgm_in_msg {
@@ -96,6 +205,12 @@ struct messaging_dgm_context {
 	int sock;
 	struct messaging_dgm_in_msg *in_msgs;
 
+	/*
+	 * Unconnected socket for messaging_dgm_send_multi(), -1
+	 * until first used
+	 */
+	int mcast_sock;
+
 	struct messaging_dgm_fde_ev *fde_evs;
 	void (*recv_cb)(struct tevent_context *ev,
 			const uint8_t *msg,
@@ -109,6 +224,15 @@ struct messaging_dgm_context {
 
 	struct pthreadpool_tevent *pool;
 	struct messaging_dgm_out *outsocks;
+
+	/*
+	 * -1 unless messaging_dgm_enable_rings() was called.
+	 * Kicked by senders writing to our in_rings and by
+	 * receivers making space in the rings we send to.
+	 */
+	int ring_efd;
+	struct messaging_dgm_in_ring *in_rings;
+	uint64_t in_rings_gen;
 };
 
 /* Set socket close on exec. */
@@ -143,6 +267,83 @@ static void close_fd_array(int *fds, size_t num_fds)
 	}
 }
 
+#ifdef MESSAGING_DGM_RINGS
+
+static void messaging_dgm_ring_kick(int efd)
+{
+	uint64_t val = 1;
+	ssize_t nwritten;
+
+	do {
+		nwritten = write(efd, &val, sizeof(val));
+	} while ((nwritten == -1) && (errno == EINTR));
+
+	/*
+	 * EAGAIN means the counter is about to overflow, the
+	 * reader is woken up anyway.
+	 */
+}
+
+static void messaging_dgm_ring_copy_in(struct messaging_dgm_ring *ring,
+				       uint32_t size, uint64_t ofs,
+				       const void *src, size_t len)
+{
+	size_t pos = ofs & (size - 1);
+	size_t first = MIN(len, size - pos);
+
+	memcpy(ring->data + pos, src, first);
+	memcpy(ring->data, (const uint8_t *)src + first, len - first);
+}
+
+static void messaging_dgm_ring_copy_out(struct messaging_dgm_ring *ring,
+					uint32_t size, uint64_t ofs,
+					void *dst, size_t len)
+{
+	size_t pos = ofs & (size - 1);
+	size_t first = MIN(len, size - pos);
+
+	memcpy(dst, ring->data + pos, first);
+	memcpy((uint8_t *)dst + first, ring->data, len - first);
+}
+
+static size_t messaging_dgm_ring_entry_len(uint64_t msglen)
+{
+	return sizeof(uint64_t) + ((msglen + 7) & ~(uint64_t)7);
+}
+
+/*
+ * Has the receiver consumed everything we sent through the ring?
+ */
+static bool messaging_dgm_out_ring_empty(struct messaging_dgm_out *out)
+{
+	uint64_t tail = __atomic_load_n(&out->ring->tail, __ATOMIC_ACQUIRE);
+	return (tail == out->ring->head);
+}
+
+#endif /* MESSAGING_DGM_RINGS */
+
+/*
+ * An out with queued fragments, messages waiting for the ring or
+ * unread messages in the ring must stay.
+ */
+static bool messaging_dgm_out_busy(struct messaging_dgm_out *out)
+{
+	if (tevent_queue_length(out->queue) != 0) {
+		return true;
+	}
+	if (out->pending != NULL) {
+		return true;
+	}
+#ifdef MESSAGING_DGM_RINGS
+	if ((out->ring != NULL) && !messaging_dgm_out_ring_empty(out)) {
+		return true;
+	}
+#endif
+	return false;
+}
+
+static void messaging_dgm_out_rearm_idle_timer(struct messaging_dgm_out *out);
+
 /*
  * The idle handler can free the struct messaging_dgm_out *,
  * if it's unused (qlen of zero) which closes the socket.
@@ -155,39 +356,45 @@ static void messaging_dgm_out_idle_handler(struct tevent_context *ev,
 {
 	struct messaging_dgm_out *out = talloc_get_type_abort(
 		private_data, struct messaging_dgm_out);
-	size_t qlen;
 
 	out->idle_timer = NULL;
 
-	qlen = tevent_queue_length(out->queue);
-	if (qlen == 0) {
+	if (!messaging_dgm_out_busy(out)) {
 		TALLOC_FREE(out);
+		return;
 	}
+
+	/*
+	 * Only unread messages in the ring don't re-arm the timer
+	 */
+	messaging_dgm_out_rearm_idle_timer(out);
 }
 
 /*
  * Setup the idle handler to fire after 1 second if the
- * queue is zero.
+ * queue is zero. A ring is more expensive to set up, keep
+ * it for 10 seconds.
  */
 
 static void messaging_dgm_out_rearm_idle_timer(struct messaging_dgm_out *out)
 {
 	size_t qlen;
+	uint32_t secs = (out->ring != NULL) ? 10 : 1;
 
 	qlen = tevent_queue_length(out->queue);
-	if (qlen != 0) {
+	if ((qlen != 0) || (out->pending != NULL)) {
 		TALLOC_FREE(out->idle_timer);
 		return;
 	}
 
 	if (out->idle_timer != NULL) {
 		tevent_update_timer(out->idle_timer,
-				    tevent_timeval_current_ofs(1, 0));
+				    tevent_timeval_current_ofs(secs, 0));
 		return;
 	}
 
 	out->idle_timer = tevent_add_timer(
-		out->ctx->ev, out, tevent_timeval_current_ofs(1, 0),
+		out->ctx->ev, out, tevent_timeval_current_ofs(secs, 0),
 		messaging_dgm_out_idle_handler, out);
 	/*
 	 * No NULL check, we'll come back here. Worst case we're
@@ -224,7 +431,9 @@ static int messaging_dgm_out_create(TALLOC_CTX *mem_ctx,
 	*out = (struct messaging_dgm_out) {
 		.pid = pid,
 		.ctx = ctx,
-		.cookie = 1
+		.cookie = 1,
+		.ring_efd = -1,
+		.ring_pidfd = -1,
 	};
 
 	out_pathlen = snprintf(addr_buf, sizeof(addr_buf),
@@ -278,10 +487,18 @@ fail:
 	return ret;
 }
 
+#ifdef MESSAGING_DGM_RINGS
+static void messaging_dgm_out_ring_detach(struct messaging_dgm_out *out);
+#endif
+
 static int messaging_dgm_out_destructor(struct messaging_dgm_out *out)
 {
 	DLIST_REMOVE(out->ctx->outsocks, out);
 
+#ifdef MESSAGING_DGM_RINGS
+	messaging_dgm_out_ring_detach(out);
+#endif
+
 	if ((tevent_queue_length(out->queue) != 0) &&
 	    (tevent_cached_getpid() == out->ctx->pid)) {
 		/*
@@ -619,6 +836,9 @@ static int messaging_dgm_out_queue_recv(struct tevent_req *req)
 }
 
 static void messaging_dgm_out_sent_fragment(struct tevent_req *req);
+#ifdef MESSAGING_DGM_RINGS
+static void messaging_dgm_out_flush(struct messaging_dgm_out *out);
+#endif
 
 /*
  * Core function to send a message fragment given a
@@ -705,6 +925,14 @@ static void messaging_dgm_out_sent_fragment(struct tevent_req *req)
 			    strerror(ret));
 	}
 
+#ifdef MESSAGING_DGM_RINGS
+	if ((out->pending != NULL) &&
+	    (tevent_queue_length(out->queue) == 0)) {
+		messaging_dgm_out_flush(out);
+		return;
+	}
+#endif
+
 	messaging_dgm_out_rearm_idle_timer(out);
 }
 
@@ -852,586 +1080,1528 @@ static int messaging_dgm_out_send_fragmented(struct tevent_context *ev,
 	}
 
 	out->cookie += 1;
-	if (out->cookie == 0) {
-		out->cookie += 1;
+	if ((out->cookie == 0) ||
+	    (out->cookie == MESSAGING_DGM_RING_COOKIE)) {
+		out->cookie = 1;
 	}
 
 	return ret;
 }
 
-static struct messaging_dgm_context *global_dgm_context;
+#ifdef MESSAGING_DGM_RINGS
 
-static int messaging_dgm_context_destructor(struct messaging_dgm_context *c);
+/*
+ * A message waiting for space in the ring. Everything sent to the
+ * destination after it queues up behind it to keep the ordering.
+ */
+struct messaging_dgm_out_pending {
+	struct messaging_dgm_out_pending *prev, *next;
+	int *fds;
+	size_t num_fds;
+	size_t buflen;
+	uint8_t buf[];
+};
 
-static int messaging_dgm_lockfile_create(struct messaging_dgm_context *ctx,
-					 pid_t pid, int *plockfile_fd,
-					 uint64_t *punique)
+static int messaging_dgm_out_pending_destructor(
+	struct messaging_dgm_out_pending *p)
 {
-	char buf[64];
-	int lockfile_fd;
-	struct sun_path_buf lockfile_name;
-	struct flock lck;
-	uint64_t unique;
-	int unique_len, ret;
-	ssize_t written;
+	close_fd_array(p->fds, p->num_fds);
+	return 0;
+}
 
-	ret = snprintf(lockfile_name.buf, sizeof(lockfile_name.buf),
-		       "%s/%u", ctx->lockfile_dir.buf, (unsigned)pid);
-	if (ret < 0) {
-		return errno;
+static void messaging_dgm_out_ring_detach(struct messaging_dgm_out *out)
+{
+	TALLOC_FREE(out->ring_pid_fde);
+	if (out->ring_pidfd != -1) {
+		close(out->ring_pidfd);
+		out->ring_pidfd = -1;
 	}
-	if ((unsigned)ret >= sizeof(lockfile_name.buf)) {
-		return ENAMETOOLONG;
+
+	if (out->ring == NULL) {
+		return;
 	}
 
-	/* no O_EXCL, existence check is via the fcntl lock */
+	if (tevent_cached_getpid() == out->ctx->pid) {
+		/*
+		 * Let the receiver free the ring once it has read
+		 * what we left in there
+		 */
+		__atomic_store_n(&out->ring->tx_closed, 1, __ATOMIC_RELEASE);
+		messaging_dgm_ring_kick(out->ring_efd);
+	}
 
-	lockfile_fd = open(lockfile_name.buf, O_NONBLOCK|O_CREAT|O_RDWR,
-			   0644);
+	munmap(out->ring, sizeof(struct messaging_dgm_ring) + out->ring_size);
+	out->ring = NULL;
+	out->ring_size = 0;
+	close(out->ring_efd);
+	out->ring_efd = -1;
 
-        if ((lockfile_fd == -1) &&
-	    ((errno == ENXIO) /* Linux */ ||
-	     (errno == ENODEV) /* Linux kernel bug */ ||
-	     (errno == EOPNOTSUPP) /* FreeBSD */)) {
-		/*
-                 * Huh -- a socket? This might be a stale socket from
-                 * an upgrade of Samba. Just unlink and retry, nobody
-                 * else is supposed to be here at this time.
-                 *
-                 * Yes, this is racy, but I don't see a way to deal
-                 * with this properly.
-                 */
-		unlink(lockfile_name.buf);
+	/*
+	 * A re-started receiver might offer a new ring
+	 */
+	out->ring_requested = false;
+	out->num_sent = 0;
+}
 
-		lockfile_fd = open(lockfile_name.buf,
-				   O_NONBLOCK|O_CREAT|O_WRONLY,
-				   0644);
+static bool messaging_dgm_out_ring_write(struct messaging_dgm_out *out,
+					 const struct iovec *iov, int iovlen,
+					 uint64_t msglen)
+{
+	struct messaging_dgm_ring *ring = out->ring;
+	uint32_t size = out->ring_size;
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	size_t entry_len = messaging_dgm_ring_entry_len(msglen);
+	uint64_t ofs;
+	int i;
+
+	if ((head - tail) > size) {
+		/*
+		 * Corrupt ring, wait for the timeout
+		 */
+		return false;
 	}
-
-	if (lockfile_fd == -1) {
-		ret = errno;
-		DEBUG(1, ("%s: open failed: %s\n", __func__, strerror(errno)));
-		return ret;
+	if ((size - (head - tail)) < entry_len) {
+		return false;
 	}
 
-	lck = (struct flock) {
-		.l_type = F_WRLCK,
-		.l_whence = SEEK_SET
-	};
+	messaging_dgm_ring_copy_in(ring, size, head, &msglen, sizeof(msglen));
+	ofs = head + sizeof(msglen);
 
-	ret = fcntl(lockfile_fd, F_SETLK, &lck);
-	if (ret == -1) {
-		ret = errno;
-		DEBUG(1, ("%s: fcntl failed: %s\n", __func__, strerror(ret)));
-		goto fail_close;
+	for (i=0; i<iovlen; i++) {
+		messaging_dgm_ring_copy_in(ring, size, ofs,
+					   iov[i].iov_base, iov[i].iov_len);
+		ofs += iov[i].iov_len;
 	}
 
+	__atomic_store_n(&ring->head, head + entry_len, __ATOMIC_RELEASE);
+
 	/*
-	 * Directly using the binary value for
-	 * SERVERID_UNIQUE_ID_NOT_TO_VERIFY is a layering
-	 * violation. But including all of ndr here just for this
-	 * seems to be a bit overkill to me. Also, messages_dgm might
-	 * be replaced sooner or later by something streams-based,
-	 * where unique_id generation will be handled differently.
+	 * Pairs with the fence in messaging_dgm_in_ring_drain(): Either
+	 * the receiver sees the new head or we see rx_wakeup.
 	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	do {
-		generate_random_buffer((uint8_t *)&unique, sizeof(unique));
-	} while (unique == UINT64_C(0xFFFFFFFFFFFFFFFF));
-
-	unique_len = snprintf(buf, sizeof(buf), "%"PRIu64"\n", unique);
-
-	/* shorten a potentially preexisting file */
-
-	ret = ftruncate(lockfile_fd, unique_len);
-	if (ret == -1) {
-		ret = errno;
-		DEBUG(1, ("%s: ftruncate failed: %s\n", __func__,
-			  strerror(ret)));
-		goto fail_unlink;
-	}
-
-	written = write(lockfile_fd, buf, unique_len);
-	if (written != unique_len) {
-		ret = errno;
-		DEBUG(1, ("%s: write failed: %s\n", __func__, strerror(ret)));
-		goto fail_unlink;
+	if (__atomic_exchange_n(&ring->rx_wakeup, 0, __ATOMIC_SEQ_CST) != 0) {
+		messaging_dgm_ring_kick(out->ring_efd);
 	}
 
-	*plockfile_fd = lockfile_fd;
-	*punique = unique;
-	return 0;
-
-fail_unlink:
-	unlink(lockfile_name.buf);
-fail_close:
-	close(lockfile_fd);
-	return ret;
+	return true;
 }
 
-static void messaging_dgm_read_handler(struct tevent_context *ev,
-				       struct tevent_fd *fde,
-				       uint16_t flags,
-				       void *private_data);
-
 /*
- * Create the rendezvous point in the file system
- * that other processes can use to send messages to
- * this pid.
+ * Send through the ring if possible. Messages with fds and large
+ * messages go through the socket, but only once the receiver has
+ * emptied the ring. Ring messages wait for queued fragments to be
+ * sent. EAGAIN means we have to wait.
  */
 
-int messaging_dgm_init(struct tevent_context *ev,
-		       uint64_t *punique,
-		       const char *socket_dir,
-		       const char *lockfile_dir,
-		       void (*recv_cb)(struct tevent_context *ev,
-				       const uint8_t *msg,
-				       size_t msg_len,
-				       int *fds,
-				       size_t num_fds,
-				       void *private_data),
-		       void *recv_cb_private_data)
+static int messaging_dgm_out_ring_send(struct messaging_dgm_out *out,
+				       const struct iovec *iov, int iovlen,
+				       const int *fds, size_t num_fds)
 {
-	struct messaging_dgm_context *ctx;
-	int ret;
-	struct sockaddr_un socket_address;
-	size_t len;
-	static bool have_dgm_context = false;
-
-	if (have_dgm_context) {
-		return EEXIST;
-	}
+	struct messaging_dgm_ring *ring = out->ring;
+	ssize_t msglen;
+	bool use_ring;
+	unsigned i;
 
-	if ((socket_dir == NULL) || (lockfile_dir == NULL)) {
+	if (iovlen < 0) {
 		return EINVAL;
 	}
+	msglen = iov_buflen(iov, iovlen);
+	if (msglen == -1) {
+		return EMSGSIZE;
+	}
 
-	ctx = talloc_zero(NULL, struct messaging_dgm_context);
-	if (ctx == NULL) {
-		goto fail_nomem;
+	if (__atomic_load_n(&ring->rx_closed, __ATOMIC_ACQUIRE) != 0) {
+		messaging_dgm_out_ring_detach(out);
+		return messaging_dgm_out_send_fragmented(
+			out->ctx->ev, out, iov, iovlen, fds, num_fds);
 	}
-	ctx->ev = ev;
-	ctx->pid = tevent_cached_getpid();
-	ctx->recv_cb = recv_cb;
-	ctx->recv_cb_private_data = recv_cb_private_data;
 
-	len = strlcpy(ctx->lockfile_dir.buf, lockfile_dir,
-		      sizeof(ctx->lockfile_dir.buf));
-	if (len >= sizeof(ctx->lockfile_dir.buf)) {
-		TALLOC_FREE(ctx);
-		return ENAMETOOLONG;
+	use_ring = ((num_fds == 0) &&
+		    ((size_t)msglen <= MESSAGING_DGM_RING_MAX_MSG));
+
+	if (use_ring && (tevent_queue_length(out->queue) != 0)) {
+		/*
+		 * messaging_dgm_out_sent_fragment() flushes us
+		 */
+		return EAGAIN;
 	}
 
-	len = strlcpy(ctx->socket_dir.buf, socket_dir,
-		      sizeof(ctx->socket_dir.buf));
-	if (len >= sizeof(ctx->socket_dir.buf)) {
-		TALLOC_FREE(ctx);
-		return ENAMETOOLONG;
+	for (i=0; i<2; i++) {
+		if (use_ring) {
+			bool ok = messaging_dgm_out_ring_write(
+				out, iov, iovlen, msglen);
+			if (ok) {
+				return 0;
+			}
+		} else if (messaging_dgm_out_ring_empty(out)) {
+			return messaging_dgm_out_send_fragmented(
+				out->ctx->ev, out, iov, iovlen, fds, num_fds);
+		}
+
+		if (i == 0) {
+			/*
+			 * Ask the receiver for a kick when it makes
+			 * progress and check again to not miss it.
+			 */
+			__atomic_store_n(&ring->tx_wakeup, 1,
+					 __ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		}
 	}
 
-	socket_address = (struct sockaddr_un) { .sun_family = AF_UNIX };
-	len = snprintf(socket_address.sun_path,
-		       sizeof(socket_address.sun_path),
-		       "%s/%u", socket_dir, (unsigned)ctx->pid);
-	if (len >= sizeof(socket_address.sun_path)) {
-		TALLOC_FREE(ctx);
-		return ENAMETOOLONG;
+	return EAGAIN;
+}
+
+static void messaging_dgm_out_pending_timeout(struct tevent_context *ev,
+					      struct tevent_timer *te,
+					      struct timeval current_time,
+					      void *private_data)
+{
+	struct messaging_dgm_out *out = talloc_get_type_abort(
+		private_data, struct messaging_dgm_out);
+
+	out->pending_timer = NULL;
+
+	DBG_WARNING("Dropping messages to %u, ring stuck\n",
+		    (unsigned)out->pid);
+
+	while (out->pending != NULL) {
+		struct messaging_dgm_out_pending *p = out->pending;
+		DLIST_REMOVE(out->pending, p);
+		TALLOC_FREE(p);
 	}
 
-	ret = messaging_dgm_lockfile_create(ctx, ctx->pid, &ctx->lockfile_fd,
-					    punique);
+	messaging_dgm_out_ring_detach(out);
+	messaging_dgm_out_rearm_idle_timer(out);
+}
+
+static int messaging_dgm_out_pend(struct messaging_dgm_out *out,
+				  const struct iovec *iov, int iovlen,
+				  const int *fds, size_t num_fds)
+{
+	struct messaging_dgm_out_pending *p;
+	ssize_t buflen;
+	size_t i;
+
+	buflen = iov_buflen(iov, iovlen);
+	if (buflen == -1) {
+		return EMSGSIZE;
+	}
+
+	p = talloc_size(
+		out, offsetof(struct messaging_dgm_out_pending, buf) + buflen);
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	talloc_set_name_const(p, "struct messaging_dgm_out_pending");
+	*p = (struct messaging_dgm_out_pending) { .buflen = buflen };
+	iov_buf(iov, iovlen, p->buf, buflen);
+
+	p->fds = talloc_array(p, int, num_fds);
+	if (p->fds == NULL) {
+		TALLOC_FREE(p);
+		return ENOMEM;
+	}
+	for (i=0; i<num_fds; i++) {
+		p->fds[i] = dup(fds[i]);
+		if (p->fds[i] == -1) {
+			int ret = errno;
+			close_fd_array(p->fds, i);
+			TALLOC_FREE(p);
+			return ret;
+		}
+	}
+	p->num_fds = num_fds;
+	talloc_set_destructor(p, messaging_dgm_out_pending_destructor);
+
+	if ((out->pending == NULL) && (out->pending_timer == NULL)) {
+		out->pending_timer = tevent_add_timer(
+			out->ctx->ev, out, tevent_timeval_current_ofs(60, 0),
+			messaging_dgm_out_pending_timeout, out);
+		if (out->pending_timer == NULL) {
+			TALLOC_FREE(p);
+			return ENOMEM;
+		}
+	}
+
+	DLIST_ADD_END(out->pending, p);
+	TALLOC_FREE(out->idle_timer);
+
+	return 0;
+}
+
+/*
+ * The receiver made space in the ring, send what's waiting
+ */
+
+static void messaging_dgm_out_flush(struct messaging_dgm_out *out)
+{
+	while (out->pending != NULL) {
+		struct messaging_dgm_out_pending *p = out->pending;
+		struct iovec iov = {
+			.iov_base = p->buf, .iov_len = p->buflen
+		};
+		int ret;
+
+		if (out->ring != NULL) {
+			ret = messaging_dgm_out_ring_send(
+				out, &iov, 1, p->fds, p->num_fds);
+		} else {
+			ret = messaging_dgm_out_send_fragmented(
+				out->ctx->ev, out, &iov, 1,
+				p->fds, p->num_fds);
+		}
+		if (ret == EAGAIN) {
+			return;
+		}
+		if (ret != 0) {
+			DBG_WARNING("Sending to %u failed: %s\n",
+				    (unsigned)out->pid, strerror(ret));
+		}
+
+		DLIST_REMOVE(out->pending, p);
+		TALLOC_FREE(p);
+	}
+
+	TALLOC_FREE(out->pending_timer);
+	messaging_dgm_out_rearm_idle_timer(out);
+}
+
+/*
+ * Ask the receiver for a ring: We pass it our eventfd, it answers
+ * with a MESSAGING_DGM_RING_OFFER, see messaging_dgm_ring_offer().
+ */
+
+static void messaging_dgm_out_ring_request(struct messaging_dgm_out *out)
+{
+	struct messaging_dgm_context *ctx = out->ctx;
+	uint64_t cookie = MESSAGING_DGM_RING_COOKIE;
+	struct messaging_dgm_ring_ctrl ctrl = {
+		.type = MESSAGING_DGM_RING_REQUEST, .pid = ctx->pid
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &cookie, .iov_len = sizeof(cookie) },
+		{ .iov_base = &ctrl, .iov_len = sizeof(ctrl) },
+	};
+	int ret;
+
+	out->ring_requested = true;
+
+	ret = messaging_dgm_out_send_fragment(ctx->ev, out, iov, 2,
+					      &ctx->ring_efd, 1);
 	if (ret != 0) {
-		DEBUG(1, ("%s: messaging_dgm_create_lockfile failed: %s\n",
-			  __func__, strerror(ret)));
-		TALLOC_FREE(ctx);
+		DBG_DEBUG("Requesting a ring from %u failed: %s\n",
+			  (unsigned)out->pid, strerror(ret));
+	}
+}
+
+#endif /* MESSAGING_DGM_RINGS */
+
+static int messaging_dgm_out_send(struct messaging_dgm_out *out,
+				  const struct iovec *iov, int iovlen,
+				  const int *fds, size_t num_fds)
+{
+#ifdef MESSAGING_DGM_RINGS
+	int ret;
+
+	if (out->pending != NULL) {
+		return messaging_dgm_out_pend(out, iov, iovlen, fds, num_fds);
+	}
+
+	if (out->ring != NULL) {
+		ret = messaging_dgm_out_ring_send(out, iov, iovlen,
+						  fds, num_fds);
+		if (ret == EAGAIN) {
+			ret = messaging_dgm_out_pend(out, iov, iovlen,
+						     fds, num_fds);
+		}
 		return ret;
 	}
 
-	unlink(socket_address.sun_path);
+	if (!out->ring_requested && (out->ctx->ring_efd != -1)) {
+		out->num_sent += 1;
+		if (out->num_sent >= MESSAGING_DGM_RING_THRESHOLD) {
+			messaging_dgm_out_ring_request(out);
+		}
+	}
+#endif
 
-	ctx->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
-	if (ctx->sock == -1) {
+	return messaging_dgm_out_send_fragmented(out->ctx->ev, out, iov, iovlen,
+						 fds, num_fds);
+}
+
+static struct messaging_dgm_context *global_dgm_context;
+
+static int messaging_dgm_context_destructor(struct messaging_dgm_context *c);
+
+static int messaging_dgm_lockfile_create(struct messaging_dgm_context *ctx,
+					 pid_t pid, int *plockfile_fd,
+					 uint64_t *punique)
+{
+	char buf[64];
+	int lockfile_fd;
+	struct sun_path_buf lockfile_name;
+	struct flock lck;
+	uint64_t unique;
+	int unique_len, ret;
+	ssize_t written;
+
+	ret = snprintf(lockfile_name.buf, sizeof(lockfile_name.buf),
+		       "%s/%u", ctx->lockfile_dir.buf, (unsigned)pid);
+	if (ret < 0) {
+		return errno;
+	}
+	if ((unsigned)ret >= sizeof(lockfile_name.buf)) {
+		return ENAMETOOLONG;
+	}
+
+	/* no O_EXCL, existence check is via the fcntl lock */
+
+	lockfile_fd = open(lockfile_name.buf, O_NONBLOCK|O_CREAT|O_RDWR,
+			   0644);
+
+        if ((lockfile_fd == -1) &&
+	    ((errno == ENXIO) /* Linux */ ||
+	     (errno == ENODEV) /* Linux kernel bug */ ||
+	     (errno == EOPNOTSUPP) /* FreeBSD */)) {
+		/*
+                 * Huh -- a socket? This might be a stale socket from
+                 * an upgrade of Samba. Just unlink and retry, nobody
+                 * else is supposed to be here at this time.
+                 *
+                 * Yes, this is racy, but I don't see a way to deal
+                 * with this properly.
+                 */
+		unlink(lockfile_name.buf);
+
+		lockfile_fd = open(lockfile_name.buf,
+				   O_NONBLOCK|O_CREAT|O_WRONLY,
+				   0644);
+	}
+
+	if (lockfile_fd == -1) {
 		ret = errno;
-		DBG_WARNING("socket failed: %s\n", strerror(ret));
-		TALLOC_FREE(ctx);
+		DEBUG(1, ("%s: open failed: %s\n", __func__, strerror(errno)));
 		return ret;
 	}
 
-	ret = prepare_socket_cloexec(ctx->sock);
+	lck = (struct flock) {
+		.l_type = F_WRLCK,
+		.l_whence = SEEK_SET
+	};
+
+	ret = fcntl(lockfile_fd, F_SETLK, &lck);
 	if (ret == -1) {
 		ret = errno;
-		DBG_WARNING("prepare_socket_cloexec failed: %s\n",
-			    strerror(ret));
-		TALLOC_FREE(ctx);
-		return ret;
+		DEBUG(1, ("%s: fcntl failed: %s\n", __func__, strerror(ret)));
+		goto fail_close;
 	}
 
-	ret = bind(ctx->sock, (struct sockaddr *)(void *)&socket_address,
-		   sizeof(socket_address));
+	/*
+	 * Directly using the binary value for
+	 * SERVERID_UNIQUE_ID_NOT_TO_VERIFY is a layering
+	 * violation. But including all of ndr here just for this
+	 * seems to be a bit overkill to me. Also, messages_dgm might
+	 * be replaced sooner or later by something streams-based,
+	 * where unique_id generation will be handled differently.
+	 */
+
+	do {
+		generate_random_buffer((uint8_t *)&unique, sizeof(unique));
+	} while (unique == UINT64_C(0xFFFFFFFFFFFFFFFF));
+
+	unique_len = snprintf(buf, sizeof(buf), "%"PRIu64"\n", unique);
+
+	/* shorten a potentially preexisting file */
+
+	ret = ftruncate(lockfile_fd, unique_len);
 	if (ret == -1) {
 		ret = errno;
-		DBG_WARNING("bind failed: %s\n", strerror(ret));
-		TALLOC_FREE(ctx);
-		return ret;
+		DEBUG(1, ("%s: ftruncate failed: %s\n", __func__,
+			  strerror(ret)));
+		goto fail_unlink;
+	}
+
+	written = write(lockfile_fd, buf, unique_len);
+	if (written != unique_len) {
+		ret = errno;
+		DEBUG(1, ("%s: write failed: %s\n", __func__, strerror(ret)));
+		goto fail_unlink;
+	}
+
+	*plockfile_fd = lockfile_fd;
+	*punique = unique;
+	return 0;
+
+fail_unlink:
+	unlink(lockfile_name.buf);
+fail_close:
+	close(lockfile_fd);
+	return ret;
+}
+
+static void messaging_dgm_read_handler(struct tevent_context *ev,
+				       struct tevent_fd *fde,
+				       uint16_t flags,
+				       void *private_data);
+
+/*
+ * Create the rendezvous point in the file system
+ * that other processes can use to send messages to
+ * this pid.
+ */
+
+int messaging_dgm_init(struct tevent_context *ev,
+		       uint64_t *punique,
+		       const char *socket_dir,
+		       const char *lockfile_dir,
+		       void (*recv_cb)(struct tevent_context *ev,
+				       const uint8_t *msg,
+				       size_t msg_len,
+				       int *fds,
+				       size_t num_fds,
+				       void *private_data),
+		       void *recv_cb_private_data)
+{
+	struct messaging_dgm_context *ctx;
+	int ret;
+	struct sockaddr_un socket_address;
+	size_t len;
+	static bool have_dgm_context = false;
+
+	if (have_dgm_context) {
+		return EEXIST;
 	}
 
-	talloc_set_destructor(ctx, messaging_dgm_context_destructor);
+	if ((socket_dir == NULL) || (lockfile_dir == NULL)) {
+		return EINVAL;
+	}
+
+	ctx = talloc_zero(NULL, struct messaging_dgm_context);
+	if (ctx == NULL) {
+		goto fail_nomem;
+	}
+	ctx->ev = ev;
+	ctx->pid = tevent_cached_getpid();
+	ctx->ring_efd = -1;
+	ctx->mcast_sock = -1;
+	ctx->recv_cb = recv_cb;
+	ctx->recv_cb_private_data = recv_cb_private_data;
+
+	len = strlcpy(ctx->lockfile_dir.buf, lockfile_dir,
+		      sizeof(ctx->lockfile_dir.buf));
+	if (len >= sizeof(ctx->lockfile_dir.buf)) {
+		TALLOC_FREE(ctx);
+		return ENAMETOOLONG;
+	}
+
+	len = strlcpy(ctx->socket_dir.buf, socket_dir,
+		      sizeof(ctx->socket_dir.buf));
+	if (len >= sizeof(ctx->socket_dir.buf)) {
+		TALLOC_FREE(ctx);
+		return ENAMETOOLONG;
+	}
+
+	socket_address = (struct sockaddr_un) { .sun_family = AF_UNIX };
+	len = snprintf(socket_address.sun_path,
+		       sizeof(socket_address.sun_path),
+		       "%s/%u", socket_dir, (unsigned)ctx->pid);
+	if (len >= sizeof(socket_address.sun_path)) {
+		TALLOC_FREE(ctx);
+		return ENAMETOOLONG;
+	}
+
+	ret = messaging_dgm_lockfile_create(ctx, ctx->pid, &ctx->lockfile_fd,
+					    punique);
+	if (ret != 0) {
+		DEBUG(1, ("%s: messaging_dgm_create_lockfile failed: %s\n",
+			  __func__, strerror(ret)));
+		TALLOC_FREE(ctx);
+		return ret;
+	}
+
+	unlink(socket_address.sun_path);
+
+	ctx->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (ctx->sock == -1) {
+		ret = errno;
+		DBG_WARNING("socket failed: %s\n", strerror(ret));
+		TALLOC_FREE(ctx);
+		return ret;
+	}
+
+	ret = prepare_socket_cloexec(ctx->sock);
+	if (ret == -1) {
+		ret = errno;
+		DBG_WARNING("prepare_socket_cloexec failed: %s\n",
+			    strerror(ret));
+		TALLOC_FREE(ctx);
+		return ret;
+	}
+
+	ret = bind(ctx->sock, (struct sockaddr *)(void *)&socket_address,
+		   sizeof(socket_address));
+	if (ret == -1) {
+		ret = errno;
+		DBG_WARNING("bind failed: %s\n", strerror(ret));
+		TALLOC_FREE(ctx);
+		return ret;
+	}
+
+	talloc_set_destructor(ctx, messaging_dgm_context_destructor);
+
+	ctx->have_dgm_context = &have_dgm_context;
+
+	ret = pthreadpool_tevent_init(ctx, UINT_MAX, &ctx->pool);
+	if (ret != 0) {
+		DBG_WARNING("pthreadpool_tevent_init failed: %s\n",
+			    strerror(ret));
+		TALLOC_FREE(ctx);
+		return ret;
+	}
+
+	global_dgm_context = ctx;
+	return 0;
+
+fail_nomem:
+	TALLOC_FREE(ctx);
+	return ENOMEM;
+}
+
+/*
+ * Remove the rendezvous point in the filesystem
+ * if we're the owner.
+ */
+
+static int messaging_dgm_context_destructor(struct messaging_dgm_context *c)
+{
+	while (c->outsocks != NULL) {
+		TALLOC_FREE(c->outsocks);
+	}
+	while (c->in_msgs != NULL) {
+		TALLOC_FREE(c->in_msgs);
+	}
+	while (c->in_rings != NULL) {
+		TALLOC_FREE(c->in_rings);
+	}
+	while (c->fde_evs != NULL) {
+		tevent_fd_set_flags(c->fde_evs->fde, 0);
+		if (c->fde_evs->ring_fde != NULL) {
+			tevent_fd_set_flags(c->fde_evs->ring_fde, 0);
+		}
+		c->fde_evs->ctx = NULL;
+		DLIST_REMOVE(c->fde_evs, c->fde_evs);
+	}
+
+	close(c->sock);
+	if (c->mcast_sock != -1) {
+		close(c->mcast_sock);
+	}
+	if (c->ring_efd != -1) {
+		close(c->ring_efd);
+	}
+
+	if (tevent_cached_getpid() == c->pid) {
+		struct sun_path_buf name;
+		int ret;
+
+		ret = snprintf(name.buf, sizeof(name.buf), "%s/%u",
+			       c->socket_dir.buf, (unsigned)c->pid);
+		if ((ret < 0) || ((size_t)ret >= sizeof(name.buf))) {
+			/*
+			 * We've checked the length when creating, so this
+			 * should never happen
+			 */
+			abort();
+		}
+		unlink(name.buf);
+
+		ret = snprintf(name.buf, sizeof(name.buf), "%s/%u",
+			       c->lockfile_dir.buf, (unsigned)c->pid);
+		if ((ret < 0) || ((size_t)ret >= sizeof(name.buf))) {
+			/*
+			 * We've checked the length when creating, so this
+			 * should never happen
+			 */
+			abort();
+		}
+		unlink(name.buf);
+	}
+	close(c->lockfile_fd);
+
+	if (c->have_dgm_context != NULL) {
+		*c->have_dgm_context = false;
+	}
+
+	return 0;
+}
+
+static void messaging_dgm_validate(struct messaging_dgm_context *ctx)
+{
+#ifdef DEVELOPER
+	pid_t pid = tevent_cached_getpid();
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	struct sockaddr_un *un_addr;
+	struct sun_path_buf pathbuf;
+	struct stat st1, st2;
+	int ret;
+
+	/*
+	 * Protect against using the wrong messaging context after a
+	 * fork without reinit_after_fork.
+	 */
+
+	ret = getsockname(ctx->sock, (struct sockaddr *)&addr, &addrlen);
+	if (ret == -1) {
+		DBG_ERR("getsockname failed: %s\n", strerror(errno));
+		goto fail;
+	}
+	if (addr.ss_family != AF_UNIX) {
+		DBG_ERR("getsockname returned family %d\n",
+			(int)addr.ss_family);
+		goto fail;
+	}
+	un_addr = (struct sockaddr_un *)&addr;
+
+	ret = snprintf(pathbuf.buf, sizeof(pathbuf.buf),
+		       "%s/%u", ctx->socket_dir.buf, (unsigned)pid);
+	if (ret < 0) {
+		DBG_ERR("snprintf failed: %s\n", strerror(errno));
+		goto fail;
+	}
+	if ((size_t)ret >= sizeof(pathbuf.buf)) {
+		DBG_ERR("snprintf returned %d chars\n", (int)ret);
+		goto fail;
+	}
+
+	if (strcmp(pathbuf.buf, un_addr->sun_path) != 0) {
+		DBG_ERR("sockname wrong: Expected %s, got %s\n",
+			pathbuf.buf, un_addr->sun_path);
+		goto fail;
+	}
+
+	ret = snprintf(pathbuf.buf, sizeof(pathbuf.buf),
+		       "%s/%u", ctx->lockfile_dir.buf, (unsigned)pid);
+	if (ret < 0) {
+		DBG_ERR("snprintf failed: %s\n", strerror(errno));
+		goto fail;
+	}
+	if ((size_t)ret >= sizeof(pathbuf.buf)) {
+		DBG_ERR("snprintf returned %d chars\n", (int)ret);
+		goto fail;
+	}
+
+	ret = stat(pathbuf.buf, &st1);
+	if (ret == -1) {
+		DBG_ERR("stat failed: %s\n", strerror(errno));
+		goto fail;
+	}
+	ret = fstat(ctx->lockfile_fd, &st2);
+	if (ret == -1) {
+		DBG_ERR("fstat failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	if ((st1.st_dev != st2.st_dev) || (st1.st_ino != st2.st_ino)) {
+		DBG_ERR("lockfile differs, expected (%d/%d), got (%d/%d)\n",
+			(int)st2.st_dev, (int)st2.st_ino,
+			(int)st1.st_dev, (int)st1.st_ino);
+		goto fail;
+	}
+
+	return;
+fail:
+	abort();
+#else
+	return;
+#endif
+}
+
+static void messaging_dgm_recv(struct messaging_dgm_context *ctx,
+			       struct tevent_context *ev,
+			       uint8_t *msg, size_t msg_len,
+			       int *fds, size_t num_fds);
+static void messaging_dgm_ring_ctrl_recv(struct messaging_dgm_context *ctx,
+					 const uint8_t *buf, size_t buflen,
+					 int *fds, size_t num_fds);
+
+/*
+ * Read one datagram and pass it to messaging_dgm_recv() for
+ * fragment reassembly processing. Returns the recvmsg errno.
+ */
+
+static int messaging_dgm_read_one(struct messaging_dgm_context *ctx,
+				  struct tevent_context *ev,
+				  int recv_flags)
+{
+	ssize_t received;
+	struct msghdr msg;
+	struct iovec iov;
+	size_t msgbufsize = msghdr_prep_recv_fds(NULL, NULL, 0, INT8_MAX);
+	uint8_t msgbuf[msgbufsize];
+	uint8_t buf[MESSAGING_DGM_FRAGMENT_LENGTH];
+	size_t num_fds;
+
+	iov = (struct iovec) { .iov_base = buf, .iov_len = sizeof(buf) };
+	msg = (struct msghdr) { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	msghdr_prep_recv_fds(&msg, msgbuf, msgbufsize, INT8_MAX);
+
+#ifdef MSG_CMSG_CLOEXEC
+	msg.msg_flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	received = recvmsg(ctx->sock, &msg, recv_flags);
+	if (received == -1) {
+		return errno;
+	}
+
+	if ((size_t)received > sizeof(buf)) {
+		/* More than we expected, not for us */
+		return 0;
+	}
+
+	num_fds = msghdr_extract_fds(&msg, NULL, 0);
+	if (num_fds == 0) {
+		int fds[1];
+
+		messaging_dgm_recv(ctx, ev, buf, received, fds, 0);
+	} else {
+		size_t i;
+		int fds[num_fds];
+
+		msghdr_extract_fds(&msg, fds, num_fds);
+
+		for (i = 0; i < num_fds; i++) {
+			int err;
+
+			err = prepare_socket_cloexec(fds[i]);
+			if (err != 0) {
+				close_fd_array(fds, num_fds);
+				num_fds = 0;
+			}
+		}
+
+		messaging_dgm_recv(ctx, ev, buf, received, fds, num_fds);
+	}
+
+	return 0;
+}
+
+/*
+ * Raw read callback handler
+ */
+
+static void messaging_dgm_read_handler(struct tevent_context *ev,
+				       struct tevent_fd *fde,
+				       uint16_t flags,
+				       void *private_data)
+{
+	struct messaging_dgm_context *ctx = talloc_get_type_abort(
+		private_data, struct messaging_dgm_context);
+	int ret;
+
+	messaging_dgm_validate(ctx);
+
+	if ((flags & TEVENT_FD_READ) == 0) {
+		return;
+	}
+
+	ret = messaging_dgm_read_one(ctx, ev, 0);
+	if ((ret == 0) ||
+	    (ret == EAGAIN) ||
+	    (ret == EWOULDBLOCK) ||
+	    (ret == EINTR) ||
+	    (ret == ENOMEM)) {
+		/* Not really an error - just try again. */
+		return;
+	}
+
+	/* Problem with the socket. Set it unreadable. */
+	tevent_fd_set_flags(fde, 0);
+}
+
+static int messaging_dgm_in_msg_destructor(struct messaging_dgm_in_msg *m)
+{
+	DLIST_REMOVE(m->ctx->in_msgs, m);
+	return 0;
+}
+
+static void messaging_dgm_close_unconsumed(int *fds, size_t num_fds)
+{
+	size_t i;
+
+	for (i=0; i<num_fds; i++) {
+		if (fds[i] != -1) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+
+/*
+ * Deal with identification of fragmented messages and
+ * re-assembly into full messages sent, then calls the
+ * callback.
+ */
+
+static void messaging_dgm_recv(struct messaging_dgm_context *ctx,
+			       struct tevent_context *ev,
+			       uint8_t *buf, size_t buflen,
+			       int *fds, size_t num_fds)
+{
+	struct messaging_dgm_fragment_hdr hdr;
+	struct messaging_dgm_in_msg *msg;
+	size_t space;
+	uint64_t cookie;
+
+	if (buflen < sizeof(cookie)) {
+		goto close_fds;
+	}
+	memcpy(&cookie, buf, sizeof(cookie));
+	buf += sizeof(cookie);
+	buflen -= sizeof(cookie);
+
+	if (cookie == MESSAGING_DGM_RING_COOKIE) {
+		messaging_dgm_ring_ctrl_recv(ctx, buf, buflen, fds, num_fds);
+		return;
+	}
+
+	if (cookie == 0) {
+		ctx->recv_cb(ev, buf, buflen, fds, num_fds,
+			     ctx->recv_cb_private_data);
+		messaging_dgm_close_unconsumed(fds, num_fds);
+		return;
+	}
+
+	if (buflen < sizeof(hdr)) {
+		goto close_fds;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	buf += sizeof(hdr);
+	buflen -= sizeof(hdr);
+
+	for (msg = ctx->in_msgs; msg != NULL; msg = msg->next) {
+		if ((msg->sender_pid == hdr.pid) &&
+		    (msg->sender_sock == hdr.sock)) {
+			break;
+		}
+	}
+
+	if ((msg != NULL) && (msg->cookie != cookie)) {
+		TALLOC_FREE(msg);
+	}
+
+	if (msg == NULL) {
+		size_t msglen;
+		msglen = offsetof(struct messaging_dgm_in_msg, buf) +
+			hdr.msglen;
+
+		msg = talloc_size(ctx, msglen);
+		if (msg == NULL) {
+			goto close_fds;
+		}
+		talloc_set_name_const(msg, "struct messaging_dgm_in_msg");
+
+		*msg = (struct messaging_dgm_in_msg) {
+			.ctx = ctx, .msglen = hdr.msglen,
+			.sender_pid = hdr.pid, .sender_sock = hdr.sock,
+			.cookie = cookie
+		};
+		DLIST_ADD(ctx->in_msgs, msg);
+		talloc_set_destructor(msg, messaging_dgm_in_msg_destructor);
+	}
+
+	space = msg->msglen - msg->received;
+	if (buflen > space) {
+		goto close_fds;
+	}
+
+	memcpy(msg->buf + msg->received, buf, buflen);
+	msg->received += buflen;
+
+	if (msg->received < msg->msglen) {
+		/*
+		 * Any valid sender will send the fds in the last
+		 * block. Invalid senders might have sent fd's that we
+		 * need to close here.
+		 */
+		goto close_fds;
+	}
+
+	DLIST_REMOVE(ctx->in_msgs, msg);
+	talloc_set_destructor(msg, NULL);
+
+	ctx->recv_cb(ev, msg->buf, msg->msglen, fds, num_fds,
+		     ctx->recv_cb_private_data);
+	messaging_dgm_close_unconsumed(fds, num_fds);
+
+	TALLOC_FREE(msg);
+	return;
+
+close_fds:
+	close_fd_array(fds, num_fds);
+}
+
+#ifdef MESSAGING_DGM_RINGS
+
+static int messaging_dgm_in_ring_destructor(struct messaging_dgm_in_ring *r)
+{
+	struct messaging_dgm_context *ctx = r->ctx;
+
+	DLIST_REMOVE(ctx->in_rings, r);
+	ctx->in_rings_gen += 1;
+
+	if (r->freed != NULL) {
+		*r->freed = true;
+	}
+
+	TALLOC_FREE(r->pid_fde);
+	if (r->pidfd != -1) {
+		close(r->pidfd);
+	}
+
+	if (tevent_cached_getpid() == ctx->pid) {
+		__atomic_store_n(&r->ring->rx_closed, 1, __ATOMIC_RELEASE);
+		messaging_dgm_ring_kick(r->tx_efd);
+	}
+
+	munmap(r->ring, sizeof(struct messaging_dgm_ring) + r->size);
+	close(r->tx_efd);
+
+	return 0;
+}
+
+/*
+ * Pass all messages in the ring to recv_cb. Returns false if the
+ * callback destroyed the messaging context, "r" is gone then.
+ */
+
+static bool messaging_dgm_in_ring_drain(struct messaging_dgm_in_ring *r,
+					struct tevent_context *ev)
+{
+	struct messaging_dgm_context *ctx = r->ctx;
+	struct messaging_dgm_ring *ring = r->ring;
+	uint32_t size = r->size;
+	uint64_t tail = ring->tail;
+	uint64_t head = tail;
+	bool caught_up = true;
+	bool freed = false;
+
+	r->busy = true;
+	r->freed = &freed;
+
+	while (true) {
+		uint8_t buf[MESSAGING_DGM_RING_MAX_MSG];
+		uint64_t msglen;
+		size_t entry_len;
+		int fds[1];
+
+		if (head == tail) {
+			head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		}
+		if (head == tail) {
+			if ((__atomic_load_n(&ring->tx_closed,
+					     __ATOMIC_ACQUIRE) != 0) ||
+			    r->sender_gone) {
+				r->gone = true;
+				break;
+			}
+
+			/*
+			 * Ask for a kick and check again, pairs with
+			 * the fence in messaging_dgm_out_ring_write()
+			 */
+			__atomic_store_n(&ring->rx_wakeup, 1,
+					 __ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+			head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			if (head == tail) {
+				break;
+			}
+			__atomic_store_n(&ring->rx_wakeup, 0,
+					 __ATOMIC_RELAXED);
+		}
+		if (caught_up) {
+			/*
+			 * We had emptied the ring, so the sender might
+			 * have used the socket before writing the new
+			 * entries. Those messages are already in the
+			 * socket, read them first.
+			 */
+			while (messaging_dgm_read_one(ctx, ev,
+						      MSG_DONTWAIT) == 0) {
+				if (freed) {
+					return false;
+				}
+			}
+			if (r->gone) {
+				break;
+			}
+			caught_up = false;
+		}
+
+		if (((head - tail) > size) ||
+		    ((head - tail) < sizeof(msglen))) {
+			DBG_WARNING("Invalid ring from %u\n",
+				    (unsigned)r->pid);
+			r->gone = true;
+			break;
+		}
+
+		messaging_dgm_ring_copy_out(ring, size, tail,
+					    &msglen, sizeof(msglen));
+		if (msglen > sizeof(buf)) {
+			DBG_WARNING("Invalid message length %"PRIu64" "
+				    "from %u\n", msglen, (unsigned)r->pid);
+			r->gone = true;
+			break;
+		}
+		entry_len = messaging_dgm_ring_entry_len(msglen);
+		if (entry_len > (head - tail)) {
+			DBG_WARNING("Truncated message from %u\n",
+				    (unsigned)r->pid);
+			r->gone = true;
+			break;
+		}
+
+		messaging_dgm_ring_copy_out(ring, size, tail + sizeof(msglen),
+					    buf, msglen);
+
+		tail += entry_len;
+		caught_up = (tail == head);
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	ctx->have_dgm_context = &have_dgm_context;
+		if (__atomic_exchange_n(&ring->tx_wakeup, 0,
+					__ATOMIC_SEQ_CST) != 0) {
+			messaging_dgm_ring_kick(r->tx_efd);
+		}
 
-	ret = pthreadpool_tevent_init(ctx, UINT_MAX, &ctx->pool);
-	if (ret != 0) {
-		DBG_WARNING("pthreadpool_tevent_init failed: %s\n",
-			    strerror(ret));
-		TALLOC_FREE(ctx);
-		return ret;
-	}
+		ctx->recv_cb(ev, buf, msglen, fds, 0,
+			     ctx->recv_cb_private_data);
 
-	global_dgm_context = ctx;
-	return 0;
+		if (freed) {
+			return false;
+		}
+		if (r->gone) {
+			break;
+		}
+	}
 
-fail_nomem:
-	TALLOC_FREE(ctx);
-	return ENOMEM;
+	r->freed = NULL;
+	r->busy = false;
+	return true;
 }
 
 /*
- * Remove the rendezvous point in the filesystem
- * if we're the owner.
+ * Drain all rings, freeing the ones the sender is done with. Returns
+ * false if the messaging context was destroyed.
  */
 
-static int messaging_dgm_context_destructor(struct messaging_dgm_context *c)
+static bool messaging_dgm_rings_drain(struct messaging_dgm_context *ctx,
+				      struct tevent_context *ev)
 {
-	while (c->outsocks != NULL) {
-		TALLOC_FREE(c->outsocks);
-	}
-	while (c->in_msgs != NULL) {
-		TALLOC_FREE(c->in_msgs);
-	}
-	while (c->fde_evs != NULL) {
-		tevent_fd_set_flags(c->fde_evs->fde, 0);
-		c->fde_evs->ctx = NULL;
-		DLIST_REMOVE(c->fde_evs, c->fde_evs);
-	}
+	struct messaging_dgm_in_ring *r, *next;
+	uint64_t gen;
 
-	close(c->sock);
+again:
+	gen = ctx->in_rings_gen;
 
-	if (tevent_cached_getpid() == c->pid) {
-		struct sun_path_buf name;
-		int ret;
+	for (r = ctx->in_rings; r != NULL; r = next) {
+		next = r->next;
 
-		ret = snprintf(name.buf, sizeof(name.buf), "%s/%u",
-			       c->socket_dir.buf, (unsigned)c->pid);
-		if ((ret < 0) || ((size_t)ret >= sizeof(name.buf))) {
+		if (r->busy) {
 			/*
-			 * We've checked the length when creating, so this
-			 * should never happen
+			 * Nested event loop in recv_cb, the outer
+			 * drain will continue with this ring
 			 */
-			abort();
+			continue;
 		}
-		unlink(name.buf);
 
-		ret = snprintf(name.buf, sizeof(name.buf), "%s/%u",
-			       c->lockfile_dir.buf, (unsigned)c->pid);
-		if ((ret < 0) || ((size_t)ret >= sizeof(name.buf))) {
-			/*
-			 * We've checked the length when creating, so this
-			 * should never happen
-			 */
-			abort();
+		if (!r->gone) {
+			bool ok = messaging_dgm_in_ring_drain(r, ev);
+			if (!ok) {
+				return false;
+			}
+		}
+		if (r->gone) {
+			TALLOC_FREE(r);
 		}
-		unlink(name.buf);
-	}
-	close(c->lockfile_fd);
 
-	if (c->have_dgm_context != NULL) {
-		*c->have_dgm_context = false;
+		if (ctx->in_rings_gen != gen) {
+			goto again;
+		}
 	}
 
-	return 0;
+	return true;
 }
 
-static void messaging_dgm_validate(struct messaging_dgm_context *ctx)
+static void messaging_dgm_in_ring_pid_handler(struct tevent_context *ev,
+					      struct tevent_fd *fde,
+					      uint16_t flags,
+					      void *private_data)
 {
-#ifdef DEVELOPER
-	pid_t pid = tevent_cached_getpid();
-	struct sockaddr_storage addr;
-	socklen_t addrlen = sizeof(addr);
-	struct sockaddr_un *un_addr;
-	struct sun_path_buf pathbuf;
-	struct stat st1, st2;
-	int ret;
+	struct messaging_dgm_in_ring *r = talloc_get_type_abort(
+		private_data, struct messaging_dgm_in_ring);
 
 	/*
-	 * Protect against using the wrong messaging context after a
-	 * fork without reinit_after_fork.
+	 * The sender exited. Deliver what it left in the ring from
+	 * the ring handler, that frees it afterwards.
 	 */
+	TALLOC_FREE(r->pid_fde);
+	r->sender_gone = true;
+	messaging_dgm_ring_kick(r->ctx->ring_efd);
+}
 
-	ret = getsockname(ctx->sock, (struct sockaddr *)&addr, &addrlen);
-	if (ret == -1) {
-		DBG_ERR("getsockname failed: %s\n", strerror(errno));
-		goto fail;
+static int messaging_dgm_pidfd_open(pid_t pid)
+{
+	int fd = syscall(SYS_pidfd_open, pid, 0);
+	if (fd == -1) {
+		return -1;
 	}
-	if (addr.ss_family != AF_UNIX) {
-		DBG_ERR("getsockname returned family %d\n",
-			(int)addr.ss_family);
-		goto fail;
+	if (prepare_socket_cloexec(fd) == -1) {
+		close(fd);
+		return -1;
 	}
-	un_addr = (struct sockaddr_un *)&addr;
+	return fd;
+}
 
-	ret = snprintf(pathbuf.buf, sizeof(pathbuf.buf),
-		       "%s/%u", ctx->socket_dir.buf, (unsigned)pid);
-	if (ret < 0) {
-		DBG_ERR("snprintf failed: %s\n", strerror(errno));
-		goto fail;
+/*
+ * "pid" asked for a ring: Create one and offer it together with our
+ * eventfd.
+ */
+
+static void messaging_dgm_ring_request(struct messaging_dgm_context *ctx,
+				       pid_t pid, int tx_efd)
+{
+	size_t len = sizeof(struct messaging_dgm_ring) +
+		MESSAGING_DGM_RING_SIZE;
+	uint64_t cookie = MESSAGING_DGM_RING_COOKIE;
+	struct messaging_dgm_ring_ctrl ctrl = {
+		.type = MESSAGING_DGM_RING_OFFER, .pid = ctx->pid
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &cookie, .iov_len = sizeof(cookie) },
+		{ .iov_base = &ctrl, .iov_len = sizeof(ctrl) },
+	};
+	struct messaging_dgm_in_ring *r;
+	struct messaging_dgm_ring *ring;
+	struct messaging_dgm_out *out;
+	int fds[2];
+	int memfd, pidfd, ret;
+
+	memfd = memfd_create("messaging_dgm_ring", MFD_CLOEXEC);
+	if (memfd == -1) {
+		DBG_DEBUG("memfd_create failed: %s\n", strerror(errno));
+		close(tx_efd);
+		return;
 	}
-	if ((size_t)ret >= sizeof(pathbuf.buf)) {
-		DBG_ERR("snprintf returned %d chars\n", (int)ret);
-		goto fail;
+	ret = ftruncate(memfd, len);
+	if (ret == -1) {
+		DBG_DEBUG("ftruncate failed: %s\n", strerror(errno));
+		close(memfd);
+		close(tx_efd);
+		return;
 	}
-
-	if (strcmp(pathbuf.buf, un_addr->sun_path) != 0) {
-		DBG_ERR("sockname wrong: Expected %s, got %s\n",
-			pathbuf.buf, un_addr->sun_path);
-		goto fail;
+	ring = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (ring == MAP_FAILED) {
+		DBG_DEBUG("mmap failed: %s\n", strerror(errno));
+		close(memfd);
+		close(tx_efd);
+		return;
+	}
+	ring->magic = MESSAGING_DGM_RING_MAGIC;
+	ring->size = MESSAGING_DGM_RING_SIZE;
+	ring->rx_wakeup = 1;
+
+	pidfd = messaging_dgm_pidfd_open(pid);
+	if (pidfd == -1) {
+		DBG_DEBUG("pidfd_open(%u) failed: %s\n",
+			  (unsigned)pid, strerror(errno));
+		munmap(ring, len);
+		close(memfd);
+		close(tx_efd);
+		return;
 	}
 
-	ret = snprintf(pathbuf.buf, sizeof(pathbuf.buf),
-		       "%s/%u", ctx->lockfile_dir.buf, (unsigned)pid);
-	if (ret < 0) {
-		DBG_ERR("snprintf failed: %s\n", strerror(errno));
-		goto fail;
+	r = talloc(ctx, struct messaging_dgm_in_ring);
+	if (r == NULL) {
+		close(pidfd);
+		munmap(ring, len);
+		close(memfd);
+		close(tx_efd);
+		return;
 	}
-	if ((size_t)ret >= sizeof(pathbuf.buf)) {
-		DBG_ERR("snprintf returned %d chars\n", (int)ret);
-		goto fail;
+	*r = (struct messaging_dgm_in_ring) {
+		.ctx = ctx, .pid = pid, .ring = ring,
+		.size = MESSAGING_DGM_RING_SIZE, .tx_efd = tx_efd,
+		.pidfd = pidfd,
+	};
+	DLIST_ADD(ctx->in_rings, r);
+	ctx->in_rings_gen += 1;
+	talloc_set_destructor(r, messaging_dgm_in_ring_destructor);
+
+	r->pid_fde = tevent_add_fd(ctx->ev, r, pidfd, TEVENT_FD_READ,
+				   messaging_dgm_in_ring_pid_handler, r);
+	if (r->pid_fde == NULL) {
+		TALLOC_FREE(r);
+		close(memfd);
+		return;
 	}
 
-	ret = stat(pathbuf.buf, &st1);
-	if (ret == -1) {
-		DBG_ERR("stat failed: %s\n", strerror(errno));
-		goto fail;
+	ret = messaging_dgm_out_get(ctx, pid, &out);
+	if (ret == 0) {
+		fds[0] = memfd;
+		fds[1] = ctx->ring_efd;
+		ret = messaging_dgm_out_send_fragment(ctx->ev, out, iov, 2,
+						      fds, 2);
 	}
-	ret = fstat(ctx->lockfile_fd, &st2);
-	if (ret == -1) {
-		DBG_ERR("fstat failed: %s\n", strerror(errno));
-		goto fail;
+	close(memfd);
+
+	if (ret != 0) {
+		DBG_DEBUG("Offering a ring to %u failed: %s\n",
+			  (unsigned)pid, strerror(ret));
+		TALLOC_FREE(r);
 	}
+}
 
-	if ((st1.st_dev != st2.st_dev) || (st1.st_ino != st2.st_ino)) {
-		DBG_ERR("lockfile differs, expected (%d/%d), got (%d/%d)\n",
-			(int)st2.st_dev, (int)st2.st_ino,
-			(int)st1.st_dev, (int)st1.st_ino);
-		goto fail;
+static void messaging_dgm_out_ring_pid_handler(struct tevent_context *ev,
+					       struct tevent_fd *fde,
+					       uint16_t flags,
+					       void *private_data)
+{
+	struct messaging_dgm_out *out = talloc_get_type_abort(
+		private_data, struct messaging_dgm_out);
+
+	/*
+	 * The receiver exited, a new process with its pid must not
+	 * get a stale ring
+	 */
+	while (out->pending != NULL) {
+		struct messaging_dgm_out_pending *p = out->pending;
+		DLIST_REMOVE(out->pending, p);
+		TALLOC_FREE(p);
 	}
+	TALLOC_FREE(out->pending_timer);
 
-	return;
-fail:
-	abort();
-#else
-	return;
-#endif
+	messaging_dgm_out_ring_detach(out);
+	messaging_dgm_out_rearm_idle_timer(out);
 }
 
-static void messaging_dgm_recv(struct messaging_dgm_context *ctx,
-			       struct tevent_context *ev,
-			       uint8_t *msg, size_t msg_len,
-			       int *fds, size_t num_fds);
-
 /*
- * Raw read callback handler - passes to messaging_dgm_recv()
- * for fragment reassembly processing.
+ * "pid" answered our request with a ring in memfd, use it
  */
 
-static void messaging_dgm_read_handler(struct tevent_context *ev,
-				       struct tevent_fd *fde,
-				       uint16_t flags,
-				       void *private_data)
+static void messaging_dgm_ring_offer(struct messaging_dgm_context *ctx,
+				     pid_t pid, int memfd, int rx_efd)
 {
-	struct messaging_dgm_context *ctx = talloc_get_type_abort(
-		private_data, struct messaging_dgm_context);
-	ssize_t received;
-	struct msghdr msg;
-	struct iovec iov;
-	size_t msgbufsize = msghdr_prep_recv_fds(NULL, NULL, 0, INT8_MAX);
-	uint8_t msgbuf[msgbufsize];
-	uint8_t buf[MESSAGING_DGM_FRAGMENT_LENGTH];
-	size_t num_fds;
-
-	messaging_dgm_validate(ctx);
+	struct messaging_dgm_out *out;
+	struct messaging_dgm_ring *ring;
+	struct stat st;
+	size_t len, size;
+	int pidfd;
+	int ret;
 
-	if ((flags & TEVENT_FD_READ) == 0) {
-		return;
+	ret = fstat(memfd, &st);
+	if (ret == -1) {
+		goto fail;
+	}
+	if ((st.st_size <= (off_t)sizeof(struct messaging_dgm_ring)) ||
+	    (st.st_size > (off_t)(sizeof(struct messaging_dgm_ring) +
+				  MESSAGING_DGM_RING_SIZE * 256))) {
+		goto fail;
+	}
+	len = st.st_size;
+	size = len - sizeof(struct messaging_dgm_ring);
+	if ((size & (size - 1)) != 0) {
+		goto fail;
+	}
+	if (size < (MESSAGING_DGM_RING_MAX_MSG + sizeof(uint64_t))) {
+		goto fail;
 	}
 
-	iov = (struct iovec) { .iov_base = buf, .iov_len = sizeof(buf) };
-	msg = (struct msghdr) { .msg_iov = &iov, .msg_iovlen = 1 };
-
-	msghdr_prep_recv_fds(&msg, msgbuf, msgbufsize, INT8_MAX);
+	ring = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (ring == MAP_FAILED) {
+		goto fail;
+	}
+	close(memfd);
+	memfd = -1;
 
-#ifdef MSG_CMSG_CLOEXEC
-	msg.msg_flags |= MSG_CMSG_CLOEXEC;
-#endif
+	if ((ring->magic != MESSAGING_DGM_RING_MAGIC) ||
+	    (ring->size != size)) {
+		munmap(ring, len);
+		goto fail;
+	}
 
-	received = recvmsg(ctx->sock, &msg, 0);
-	if (received == -1) {
-		if ((errno == EAGAIN) ||
-		    (errno == EWOULDBLOCK) ||
-		    (errno == EINTR) ||
-		    (errno == ENOMEM)) {
-			/* Not really an error - just try again. */
-			return;
+	for (out = ctx->outsocks; out != NULL; out = out->next) {
+		if (out->pid == pid) {
+			break;
 		}
-		/* Problem with the socket. Set it unreadable. */
-		tevent_fd_set_flags(fde, 0);
-		return;
 	}
 
-	if ((size_t)received > sizeof(buf)) {
-		/* More than we expected, not for us */
-		return;
+	if ((out == NULL) || !out->ring_requested || (out->ring != NULL)) {
+		/*
+		 * Our out went away in between, tell the receiver
+		 * to free it again.
+		 */
+		__atomic_store_n(&ring->tx_closed, 1, __ATOMIC_RELEASE);
+		messaging_dgm_ring_kick(rx_efd);
+		munmap(ring, len);
+		goto fail;
 	}
 
-	num_fds = msghdr_extract_fds(&msg, NULL, 0);
-	if (num_fds == 0) {
-		int fds[1];
-
-		messaging_dgm_recv(ctx, ev, buf, received, fds, 0);
-	} else {
-		size_t i;
-		int fds[num_fds];
+	pidfd = messaging_dgm_pidfd_open(pid);
+	if (pidfd == -1) {
+		__atomic_store_n(&ring->tx_closed, 1, __ATOMIC_RELEASE);
+		messaging_dgm_ring_kick(rx_efd);
+		munmap(ring, len);
+		goto fail;
+	}
 
-		msghdr_extract_fds(&msg, fds, num_fds);
+	out->ring = ring;
+	out->ring_size = size;
+	out->ring_efd = rx_efd;
+	out->ring_pidfd = pidfd;
 
-		for (i = 0; i < num_fds; i++) {
-			int err;
+	out->ring_pid_fde = tevent_add_fd(
+		ctx->ev, out, pidfd, TEVENT_FD_READ,
+		messaging_dgm_out_ring_pid_handler, out);
+	if (out->ring_pid_fde == NULL) {
+		messaging_dgm_out_ring_detach(out);
+		return;
+	}
 
-			err = prepare_socket_cloexec(fds[i]);
-			if (err != 0) {
-				close_fd_array(fds, num_fds);
-				num_fds = 0;
-			}
-		}
+	messaging_dgm_out_rearm_idle_timer(out);
+	return;
 
-		messaging_dgm_recv(ctx, ev, buf, received, fds, num_fds);
+fail:
+	DBG_DEBUG("Invalid ring offer from %u\n", (unsigned)pid);
+	if (memfd != -1) {
+		close(memfd);
 	}
+	close(rx_efd);
 }
 
-static int messaging_dgm_in_msg_destructor(struct messaging_dgm_in_msg *m)
-{
-	DLIST_REMOVE(m->ctx->in_msgs, m);
-	return 0;
-}
+#endif /* MESSAGING_DGM_RINGS */
 
-static void messaging_dgm_close_unconsumed(int *fds, size_t num_fds)
+static void messaging_dgm_ring_ctrl_recv(struct messaging_dgm_context *ctx,
+					 const uint8_t *buf, size_t buflen,
+					 int *fds, size_t num_fds)
 {
-	size_t i;
+#ifdef MESSAGING_DGM_RINGS
+	struct messaging_dgm_ring_ctrl ctrl;
 
-	for (i=0; i<num_fds; i++) {
-		if (fds[i] != -1) {
-			close(fds[i]);
-			fds[i] = -1;
-		}
+	if ((ctx->ring_efd == -1) || (buflen != sizeof(ctrl))) {
+		goto close_fds;
+	}
+	memcpy(&ctrl, buf, sizeof(ctrl));
+
+	if ((ctrl.type == MESSAGING_DGM_RING_REQUEST) && (num_fds == 1)) {
+		messaging_dgm_ring_request(ctx, ctrl.pid, fds[0]);
+		return;
+	}
+	if ((ctrl.type == MESSAGING_DGM_RING_OFFER) && (num_fds == 2)) {
+		messaging_dgm_ring_offer(ctx, ctrl.pid, fds[0], fds[1]);
+		return;
 	}
+
+close_fds:
+#endif
+	close_fd_array(fds, num_fds);
 }
 
+#ifdef MESSAGING_DGM_RINGS
+
 /*
- * Deal with identification of fragmented messages and
- * re-assembly into full messages sent, then calls the
- * callback.
+ * Our eventfd was kicked: A sender wrote to one of our rings or a
+ * receiver made space in one of the rings we send to.
  */
 
-static void messaging_dgm_recv(struct messaging_dgm_context *ctx,
-			       struct tevent_context *ev,
-			       uint8_t *buf, size_t buflen,
-			       int *fds, size_t num_fds)
+static void messaging_dgm_ring_handler(struct tevent_context *ev,
+				       struct tevent_fd *fde,
+				       uint16_t flags,
+				       void *private_data)
 {
-	struct messaging_dgm_fragment_hdr hdr;
-	struct messaging_dgm_in_msg *msg;
-	size_t space;
-	uint64_t cookie;
+	struct messaging_dgm_context *ctx = talloc_get_type_abort(
+		private_data, struct messaging_dgm_context);
+	struct messaging_dgm_out *out, *next;
+	uint64_t val;
+	ssize_t nread;
+	bool ok;
 
-	if (buflen < sizeof(cookie)) {
-		goto close_fds;
+	messaging_dgm_validate(ctx);
+
+	if ((flags & TEVENT_FD_READ) == 0) {
+		return;
 	}
-	memcpy(&cookie, buf, sizeof(cookie));
-	buf += sizeof(cookie);
-	buflen -= sizeof(cookie);
 
-	if (cookie == 0) {
-		ctx->recv_cb(ev, buf, buflen, fds, num_fds,
-			     ctx->recv_cb_private_data);
-		messaging_dgm_close_unconsumed(fds, num_fds);
+	nread = read(ctx->ring_efd, &val, sizeof(val));
+	if ((nread == -1) && (errno != EAGAIN) && (errno != EINTR)) {
+		tevent_fd_set_flags(fde, 0);
 		return;
 	}
 
-	if (buflen < sizeof(hdr)) {
-		goto close_fds;
+	ok = messaging_dgm_rings_drain(ctx, ev);
+	if (!ok) {
+		return;
 	}
-	memcpy(&hdr, buf, sizeof(hdr));
-	buf += sizeof(hdr);
-	buflen -= sizeof(hdr);
 
-	for (msg = ctx->in_msgs; msg != NULL; msg = msg->next) {
-		if ((msg->sender_pid == hdr.pid) &&
-		    (msg->sender_sock == hdr.sock)) {
-			break;
+	for (out = ctx->outsocks; out != NULL; out = next) {
+		next = out->next;
+		if (out->pending != NULL) {
+			messaging_dgm_out_flush(out);
 		}
 	}
+}
 
-	if ((msg != NULL) && (msg->cookie != cookie)) {
-		TALLOC_FREE(msg);
-	}
+#endif /* MESSAGING_DGM_RINGS */
 
-	if (msg == NULL) {
-		size_t msglen;
-		msglen = offsetof(struct messaging_dgm_in_msg, buf) +
-			hdr.msglen;
+/*
+ * Pass high-volume messages through shared memory rings instead of
+ * the socket. A sender asks for a ring after a few messages to the
+ * same destination, if the destination also enabled rings.
+ */
 
-		msg = talloc_size(ctx, msglen);
-		if (msg == NULL) {
-			goto close_fds;
-		}
-		talloc_set_name_const(msg, "struct messaging_dgm_in_msg");
+int messaging_dgm_enable_rings(void)
+{
+#ifdef MESSAGING_DGM_RINGS
+	struct messaging_dgm_context *ctx = global_dgm_context;
+	struct messaging_dgm_fde_ev *fde_ev;
 
-		*msg = (struct messaging_dgm_in_msg) {
-			.ctx = ctx, .msglen = hdr.msglen,
-			.sender_pid = hdr.pid, .sender_sock = hdr.sock,
-			.cookie = cookie
-		};
-		DLIST_ADD(ctx->in_msgs, msg);
-		talloc_set_destructor(msg, messaging_dgm_in_msg_destructor);
+	if (ctx == NULL) {
+		return ENOTCONN;
 	}
-
-	space = msg->msglen - msg->received;
-	if (buflen > space) {
-		goto close_fds;
+	if (ctx->ring_efd != -1) {
+		return 0;
 	}
 
-	memcpy(msg->buf + msg->received, buf, buflen);
-	msg->received += buflen;
-
-	if (msg->received < msg->msglen) {
-		/*
-		 * Any valid sender will send the fds in the last
-		 * block. Invalid senders might have sent fd's that we
-		 * need to close here.
-		 */
-		goto close_fds;
+	ctx->ring_efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (ctx->ring_efd == -1) {
+		return errno;
 	}
 
-	DLIST_REMOVE(ctx->in_msgs, msg);
-	talloc_set_destructor(msg, NULL);
-
-	ctx->recv_cb(ev, msg->buf, msg->msglen, fds, num_fds,
-		     ctx->recv_cb_private_data);
-	messaging_dgm_close_unconsumed(fds, num_fds);
-
-	TALLOC_FREE(msg);
-	return;
+	for (fde_ev = ctx->fde_evs; fde_ev != NULL; fde_ev = fde_ev->next) {
+		if (tevent_fd_get_flags(fde_ev->fde) == 0) {
+			continue;
+		}
+		fde_ev->ring_fde = tevent_add_fd(
+			fde_ev->ev, fde_ev, ctx->ring_efd, TEVENT_FD_READ,
+			messaging_dgm_ring_handler, ctx);
+		if (fde_ev->ring_fde == NULL) {
+			return ENOMEM;
+		}
+	}
 
-close_fds:
-	close_fd_array(fds, num_fds);
+	return 0;
+#else
+	return ENOSYS;
+#endif
 }
 
 void messaging_dgm_destroy(void)
@@ -1462,8 +2632,7 @@ again:
 
 	DEBUG(10, ("%s: Sending message to %u\n", __func__, (unsigned)pid));
 
-	ret = messaging_dgm_out_send_fragmented(ctx->ev, out, iov, iovlen,
-						fds, num_fds);
+	ret = messaging_dgm_out_send(out, iov, iovlen, fds, num_fds);
 	if (ret == ECONNREFUSED) {
 		/*
 		 * We cache outgoing sockets. If the receiver has
@@ -1481,6 +2650,294 @@ again:
 	return ret;
 }
 
+static const struct iovec *messaging_dgm_dst_iov(const struct iovec *dst_iov,
+						 int dst_iovlen, size_t i)
+{
+	if (dst_iovlen == 0) {
+		return NULL;
+	}
+	return &dst_iov[i * dst_iovlen];
+}
+
+static int messaging_dgm_send_one(pid_t pid,
+				  const struct iovec *dst_iov, int dst_iovlen,
+				  const struct iovec *iov, int iovlen)
+{
+	struct iovec iov_cat[MAX(1, dst_iovlen + iovlen)];
+
+	if (dst_iovlen > 0) {
+		memcpy(iov_cat, dst_iov, sizeof(struct iovec) * dst_iovlen);
+	}
+	if (iovlen > 0) {
+		memcpy(&iov_cat[dst_iovlen], iov, sizeof(struct iovec) * iovlen);
+	}
+
+	return messaging_dgm_send(pid, iov_cat, dst_iovlen + iovlen,
+				  NULL, 0);
+}
+
+#ifdef HAVE_SENDMMSG
+
+static int messaging_dgm_mcast_sock(struct messaging_dgm_context *ctx,
+				    int *psock)
+{
+	int sock, ret;
+	int sndbuf = MESSAGING_DGM_MCAST_SNDBUF;
+
+	if (ctx->mcast_sock != -1) {
+		*psock = ctx->mcast_sock;
+		return 0;
+	}
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock == -1) {
+		return errno;
+	}
+
+	ret = prepare_socket_cloexec(sock);
+	if (ret == -1) {
+		ret = errno;
+		close(sock);
+		return ret;
+	}
+
+	ret = set_blocking(sock, false);
+	if (ret == -1) {
+		ret = errno;
+		close(sock);
+		return ret;
+	}
+
+	ret = setsockopt(sock, SOL_SOCKET, SO_SNDBUF,
+			 &sndbuf, sizeof(sndbuf));
+	if (ret == -1) {
+		DBG_DEBUG("setsockopt(SO_SNDBUF) failed: %s\n",
+			  strerror(errno));
+	}
+
+	ctx->mcast_sock = sock;
+	*psock = sock;
+	return 0;
+}
+
+/*
+ * A destination with queued fragments or a ring has to get the
+ * message through its struct messaging_dgm_out to keep the order.
+ */
+static bool messaging_dgm_mcast_ok(struct messaging_dgm_context *ctx,
+				   pid_t pid)
+{
+	struct messaging_dgm_out *out;
+
+	for (out = ctx->outsocks; out != NULL; out = out->next) {
+		if (out->pid == pid) {
+			break;
+		}
+	}
+	if (out == NULL) {
+		return true;
+	}
+	if (messaging_dgm_out_busy(out)) {
+		return false;
+	}
+#ifdef MESSAGING_DGM_RINGS
+	if (out->ring != NULL) {
+		return false;
+	}
+#endif
+	return true;
+}
+
+/*
+ * Send up to MESSAGING_DGM_MCAST_BATCH messages starting at
+ * pids[*pidx] with one sendmmsg() call. We stop at the first
+ * message the kernel did not take and continue behind it with the
+ * next call, so a destination that falls back to its struct
+ * messaging_dgm_out never sees a later message overtake it.
+ */
+static void messaging_dgm_send_mcast(struct messaging_dgm_context *ctx,
+				     int sock,
+				     const pid_t *pids, size_t num_pids,
+				     size_t *pidx,
+				     const struct iovec *dst_iov,
+				     int dst_iovlen,
+				     const struct iovec *iov, int iovlen,
+				     size_t msglen, int *errors)
+{
+	static const uint64_t cookie = 0;
+	struct mmsghdr msgs[MESSAGING_DGM_MCAST_BATCH];
+	struct sockaddr_un addrs[MESSAGING_DGM_MCAST_BATCH];
+	size_t idx[MESSAGING_DGM_MCAST_BATCH];
+	struct iovec iovs[MESSAGING_DGM_MCAST_BATCH][1 + dst_iovlen + iovlen];
+	size_t i = *pidx;
+	unsigned num = 0;
+	int nsent, err;
+
+	for (; (i < num_pids) && (num < MESSAGING_DGM_MCAST_BATCH); i++) {
+		const struct iovec *d = messaging_dgm_dst_iov(
+			dst_iov, dst_iovlen, i);
+		ssize_t dst_len = iov_buflen(d, dst_iovlen);
+		int len;
+
+		if ((dst_len == -1) ||
+		    ((size_t)dst_len + msglen >
+		     MESSAGING_DGM_FRAGMENT_LENGTH - sizeof(cookie)) ||
+		    !messaging_dgm_mcast_ok(ctx, pids[i])) {
+			errors[i] = messaging_dgm_send_one(
+				pids[i], d, dst_iovlen, iov, iovlen);
+			continue;
+		}
+
+		addrs[num] = (struct sockaddr_un) { .sun_family = AF_UNIX };
+		len = snprintf(addrs[num].sun_path,
+			       sizeof(addrs[num].sun_path), "%s/%u",
+			       ctx->socket_dir.buf, (unsigned)pids[i]);
+		if ((len < 0) || ((size_t)len >= sizeof(addrs[num].sun_path))) {
+			errors[i] = ENAMETOOLONG;
+			continue;
+		}
+
+		iovs[num][0] = (struct iovec) {
+			.iov_base = discard_const_p(uint64_t, &cookie),
+			.iov_len = sizeof(cookie)
+		};
+		if (dst_iovlen > 0) {
+			memcpy(&iovs[num][1], d,
+			       sizeof(struct iovec) * dst_iovlen);
+		}
+		if (iovlen > 0) {
+			memcpy(&iovs[num][1 + dst_iovlen], iov,
+			       sizeof(struct iovec) * iovlen);
+		}
+
+		msgs[num] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name = &addrs[num],
+				.msg_namelen = sizeof(addrs[num]),
+				.msg_iov = iovs[num],
+				.msg_iovlen = 1 + dst_iovlen + iovlen,
+			},
+		};
+		idx[num] = i;
+		num += 1;
+	}
+
+	*pidx = i;
+
+	if (num == 0) {
+		return;
+	}
+
+	do {
+		nsent = sendmmsg(sock, msgs, num, 0);
+	} while ((nsent == -1) && (errno == EINTR));
+
+	if (nsent == -1) {
+		nsent = 0;
+		err = errno;
+	} else {
+		err = 0;
+	}
+
+	for (i=0; i<(size_t)nsent; i++) {
+		errors[idx[i]] = 0;
+	}
+
+	if (nsent == num) {
+		return;
+	}
+
+	i = idx[nsent];
+	*pidx = i + 1;
+
+	if (err == 0) {
+		/*
+		 * sendmmsg() stopped early, the next call tells us why
+		 */
+		*pidx = i;
+		return;
+	}
+
+	if ((err == EWOULDBLOCK) || (err == EAGAIN) || (err == ENOBUFS)) {
+		/*
+		 * The receiver or our socket is full. Queue it.
+		 */
+		errors[i] = messaging_dgm_send_one(
+			pids[i], messaging_dgm_dst_iov(dst_iov, dst_iovlen, i),
+			dst_iovlen, iov, iovlen);
+		return;
+	}
+
+	errors[i] = err;
+}
+
+#endif /* HAVE_SENDMMSG */
+
+/*
+ * Send the same message to many processes. The dst_iovlen
+ * iovecs at dst_iov[i*dst_iovlen] are put in front of iov for
+ * pids[i], errors[i] receives the result for pids[i]. File
+ * descriptors can't be passed.
+ *
+ * Small messages to destinations without queued messages are
+ * handed to the kernel in sendmmsg() batches from one socket,
+ * everything else goes through messaging_dgm_send().
+ */
+
+int messaging_dgm_send_multi(const pid_t *pids, size_t num_pids,
+			     const struct iovec *dst_iov, int dst_iovlen,
+			     const struct iovec *iov, int iovlen,
+			     int *errors)
+{
+	struct messaging_dgm_context *ctx = global_dgm_context;
+	ssize_t msglen;
+	size_t i;
+
+	if (ctx == NULL) {
+		return ENOTCONN;
+	}
+	if ((dst_iovlen < 0) || (iovlen < 0)) {
+		return EINVAL;
+	}
+	msglen = iov_buflen(iov, iovlen);
+	if (msglen == -1) {
+		return EMSGSIZE;
+	}
+
+	messaging_dgm_validate(ctx);
+
+#ifdef HAVE_SENDMMSG
+	{
+		int sock = -1;
+		int ret;
+
+		ret = messaging_dgm_mcast_sock(ctx, &sock);
+		if (ret != 0) {
+			DBG_DEBUG("messaging_dgm_mcast_sock failed: %s\n",
+				  strerror(ret));
+		}
+
+		i = 0;
+		while ((sock != -1) && (i < num_pids)) {
+			messaging_dgm_send_mcast(ctx, sock, pids, num_pids, &i,
+						 dst_iov, dst_iovlen,
+						 iov, iovlen, msglen, errors);
+		}
+		if (sock != -1) {
+			return 0;
+		}
+	}
+#endif
+
+	for (i=0; i<num_pids; i++) {
+		errors[i] = messaging_dgm_send_one(
+			pids[i], messaging_dgm_dst_iov(dst_iov, dst_iovlen, i),
+			dst_iovlen, iov, iovlen);
+	}
+
+	return 0;
+}
+
 static int messaging_dgm_read_unique(int fd, uint64_t *punique)
 {
 	char buf[25];
@@ -1756,6 +3213,18 @@ struct messaging_dgm_fde *messaging_dgm_register_tevent_context(
 			TALLOC_FREE(fde);
 			return NULL;
 		}
+		fde_ev->ring_fde = NULL;
+#ifdef MESSAGING_DGM_RINGS
+		if (ctx->ring_efd != -1) {
+			fde_ev->ring_fde = tevent_add_fd(
+				ev, fde_ev, ctx->ring_efd, TEVENT_FD_READ,
+				messaging_dgm_ring_handler, ctx);
+			if (fde_ev->ring_fde == NULL) {
+				TALLOC_FREE(fde);
+				return NULL;
+			}
+		}
+#endif
 		fde_ev->ev = ev;
 		fde_ev->ctx = ctx;
 		DLIST_ADD(ctx->fde_evs, fde_ev);
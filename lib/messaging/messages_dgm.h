@@ -40,10 +40,15 @@ int messaging_dgm_get_unique(pid_t pid, uint64_t *unique);
 int messaging_dgm_send(pid_t pid,
 		       const struct iovec *iov, int iovlen,
 		       const int *fds, size_t num_fds);
+int messaging_dgm_send_multi(const pid_t *pids, size_t num_pids,
+			     const struct iovec *dst_iov, int dst_iovlen,
+			     const struct iovec *iov, int iovlen,
+			     int *errors);
 int messaging_dgm_cleanup(pid_t pid);
 int messaging_dgm_wipe(void);
 int messaging_dgm_forall(int (*fn)(pid_t pid, void *private_data),
 			 void *private_data);
+int messaging_dgm_enable_rings(void);
 
 struct messaging_dgm_fde;
 struct messaging_dgm_fde *messaging_dgm_register_tevent_context(
@@ -31,6 +31,7 @@
 */
 
 #include "replace.h"
+#include "system/time.h"
 #include "talloc.h"
 
 #ifdef HAVE_SYS_AUXV_H
@@ -60,12 +61,13 @@
 #define TALLOC_FLAG_LOOP 0x02
 #define TALLOC_FLAG_POOL 0x04		/* This is a talloc pool */
 #define TALLOC_FLAG_POOLMEM 0x08	/* This is allocated in a pool */
+#define TALLOC_FLAG_SLAB 0x10		/* This fits into its slab class */
 
 /*
  * Bits above this are random, used to make it harder to fake talloc
  * headers during an attack.  Try not to change this without good reason.
  */
-#define TALLOC_FLAG_MASK 0x0F
+#define TALLOC_FLAG_MASK 0x1F
 
 #define TALLOC_MAGIC_REFERENCE ((const char *)1)
 
@@ -310,6 +312,13 @@ struct talloc_chunk {
 	 * from.
 	 */
 	struct talloc_pool_hdr *pool;
+
+	/*
+	 * If the allocation profile picked this chunk, the monotonic
+	 * time of the allocation in microseconds, see
+	 * talloc_enable_profile().
+	 */
+	uint64_t sampled;
 };
 
 union talloc_chunk_cast_u {
@@ -733,6 +742,234 @@ static inline struct talloc_chunk *tc_alloc_pool(struct talloc_chunk *parent,
 	return result;
 }
 
+/*
+  The slab cache keeps small chunks freed by a thread in per size
+  class lists of that thread, so that the next allocation of that
+  size can take them without calling malloc(3). It's enabled per
+  thread with talloc_enable_slab().
+
+  Only a thread with the cache enabled rounds its small allocations
+  up to a TC_ALIGN16() size, and marks those chunks with
+  TALLOC_FLAG_SLAB. Only marked chunks go into a cache when they are
+  freed, their class follows from tc->size. tc->size may shrink in
+  _talloc_realloc() without the chunk being reallocated, which just
+  means that the chunk is larger than its class needs. The cached
+  chunks are linked through tc->next, the rest of the header stays as
+  _talloc_chunk_set_free() left it.
+*/
+
+#define TALLOC_SLAB_MAX_SIZE 512
+#define TALLOC_SLAB_CLASSES (TALLOC_SLAB_MAX_SIZE / 16)
+#define TALLOC_SLAB_DEPTH 64
+
+struct talloc_slab {
+	bool enabled;
+	struct {
+		struct talloc_chunk *first;
+		unsigned int num;
+	} classes[TALLOC_SLAB_CLASSES];
+	size_t hits;
+	size_t misses;
+};
+
+#ifdef HAVE___THREAD
+static __thread struct talloc_slab talloc_slab;
+#else
+/* never enabled */
+static struct talloc_slab talloc_slab;
+#endif
+
+/*
+  Allocates at least size bytes, *slab tells if the result is
+  large enough for the class of size
+*/
+static inline void *tc_slab_alloc(size_t size, bool *slab)
+{
+	struct talloc_chunk *tc = NULL;
+	size_t chunk_size = TC_ALIGN16(size);
+	size_t idx;
+
+	if (likely(!talloc_slab.enabled) ||
+	    chunk_size > TALLOC_SLAB_MAX_SIZE) {
+		*slab = false;
+		return malloc(size);
+	}
+
+	*slab = true;
+	idx = chunk_size / 16 - 1;
+	tc = talloc_slab.classes[idx].first;
+
+	if (tc == NULL) {
+		talloc_slab.misses += 1;
+		return malloc(chunk_size);
+	}
+
+	talloc_slab.classes[idx].first = tc->next;
+	talloc_slab.classes[idx].num -= 1;
+	talloc_slab.hits += 1;
+
+#if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_UNDEFINED)
+	VALGRIND_MAKE_MEM_UNDEFINED(tc, chunk_size);
+#endif
+
+	return tc;
+}
+
+/*
+  Returns true if tc was put into the slab cache, false if the
+  caller has to free(3) it. chunk_size is 0 for chunks without
+  TALLOC_FLAG_SLAB.
+*/
+static inline bool tc_slab_free(struct talloc_chunk *tc, size_t chunk_size)
+{
+	size_t idx;
+
+	if (likely(!talloc_slab.enabled) ||
+	    chunk_size == 0 ||
+	    chunk_size > TALLOC_SLAB_MAX_SIZE) {
+		return false;
+	}
+
+	idx = chunk_size / 16 - 1;
+
+	if (talloc_slab.classes[idx].num >= TALLOC_SLAB_DEPTH) {
+		return false;
+	}
+
+#if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_UNDEFINED)
+	VALGRIND_MAKE_MEM_UNDEFINED(&tc->next, sizeof(tc->next));
+#endif
+
+	tc->next = talloc_slab.classes[idx].first;
+	talloc_slab.classes[idx].first = tc;
+	talloc_slab.classes[idx].num += 1;
+
+	return true;
+}
+
+/*
+  The allocation profile marks every sample_interval'th chunk a
+  thread allocates with its allocation time. When a marked chunk is
+  freed, its name, size and lifetime are added to the statistics of
+  the freeing thread, per name. Names that point into the chunk
+  itself, like those of talloc_strdup(), count as "(string)".
+*/
+
+#define TALLOC_PROFILE_HASH_SIZE 256
+#define TALLOC_PROFILE_LIFETIMES 8
+
+struct talloc_profile_site {
+	struct talloc_profile_site *next;
+	size_t count;
+	size_t pooled;
+	size_t bytes;
+	size_t lifetimes[TALLOC_PROFILE_LIFETIMES];
+	char name[];
+};
+
+struct talloc_profile {
+	bool enabled;
+	unsigned int interval;
+	unsigned int countdown;
+	size_t num_samples;
+	struct talloc_profile_site **sites;
+};
+
+#ifdef HAVE___THREAD
+static __thread struct talloc_profile talloc_profile;
+#else
+/* never enabled */
+static struct talloc_profile talloc_profile;
+#endif
+
+static uint64_t talloc_profile_now(void)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	/* 0 means not sampled */
+	return (now == 0) ? 1 : now;
+}
+
+static inline void tc_profile_alloc(struct talloc_chunk *tc)
+{
+	if (likely(!talloc_profile.enabled)) {
+		return;
+	}
+	if (--talloc_profile.countdown != 0) {
+		return;
+	}
+	talloc_profile.countdown = talloc_profile.interval;
+	tc->sampled = talloc_profile_now();
+}
+
+static void tc_profile_free(struct talloc_chunk *tc)
+{
+	const char *name = tc->name;
+	const char *data = TC_PTR_FROM_CHUNK(tc);
+	struct talloc_profile_site *site = NULL;
+	uint64_t lifetime;
+	uint32_t hash = 5381;
+	size_t i, len;
+
+	if (!talloc_profile.enabled) {
+		return;
+	}
+
+	if (name == NULL) {
+		name = "UNNAMED";
+	} else if (name == TALLOC_MAGIC_REFERENCE) {
+		name = ".reference";
+	} else if ((name >= data) && (name < data + tc->size)) {
+		name = "(string)";
+	}
+
+	len = strlen(name);
+	for (i=0; i<len; i++) {
+		hash = hash * 33 + (unsigned char)name[i];
+	}
+	hash %= TALLOC_PROFILE_HASH_SIZE;
+
+	for (site = talloc_profile.sites[hash];
+	     site != NULL;
+	     site = site->next) {
+		if (strcmp(site->name, name) == 0) {
+			break;
+		}
+	}
+
+	if (site == NULL) {
+		site = calloc(1, sizeof(*site) + len + 1);
+		if (site == NULL) {
+			return;
+		}
+		memcpy(site->name, name, len + 1);
+		site->next = talloc_profile.sites[hash];
+		talloc_profile.sites[hash] = site;
+	}
+
+	site->count += 1;
+	site->bytes += tc->size;
+	if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		site->pooled += 1;
+	}
+
+	/* 10us, 100us, ... 10s and longer */
+	lifetime = (talloc_profile_now() - tc->sampled) / 10;
+	for (i=0; i<TALLOC_PROFILE_LIFETIMES-1; i++) {
+		if (lifetime == 0) {
+			break;
+		}
+		lifetime /= 10;
+	}
+	site->lifetimes[i] += 1;
+
+	talloc_profile.num_samples += 1;
+}
+
 /*
    Allocate a bit of memory as a child of an existing pointer
 */
@@ -771,6 +1008,7 @@ static inline void *__talloc_with_prefix(const void *context,
 	if (tc == NULL) {
 		uint8_t *ptr = NULL;
 		union talloc_chunk_cast_u tcc;
+		bool slab;
 
 		/*
 		 * Only do the memlimit check/update on actual allocation.
@@ -780,13 +1018,16 @@ static inline void *__talloc_with_prefix(const void *context,
 			return NULL;
 		}
 
-		ptr = malloc(total_len);
+		ptr = tc_slab_alloc(total_len, &slab);
 		if (unlikely(ptr == NULL)) {
 			return NULL;
 		}
 		tcc = (union talloc_chunk_cast_u) { .ptr = ptr + prefix_len };
 		tc = tcc.chunk;
 		tc->flags = talloc_magic;
+		if (slab && prefix_len == 0) {
+			tc->flags |= TALLOC_FLAG_SLAB;
+		}
 		tc->pool  = NULL;
 
 		talloc_memlimit_grow(limit, total_len);
@@ -798,6 +1039,9 @@ static inline void *__talloc_with_prefix(const void *context,
 	tc->child = NULL;
 	tc->name = NULL;
 	tc->refs = NULL;
+	tc->sampled = 0;
+
+	tc_profile_alloc(tc);
 
 	if (likely(context != NULL)) {
 		if (parent->child) {
@@ -1112,6 +1356,7 @@ static inline int _tc_free_internal(struct talloc_chunk *tc,
 {
 	void *ptr_to_free;
 	void *ptr = TC_PTR_FROM_CHUNK(tc);
+	size_t chunk_size;
 
 	if (unlikely(tc->refs)) {
 		int is_child;
@@ -1181,6 +1426,11 @@ static inline int _tc_free_internal(struct talloc_chunk *tc,
 
 	tc->flags |= TALLOC_FLAG_LOOP;
 
+	if (unlikely(tc->sampled != 0)) {
+		/* before a name allocated by talloc_set_name() is gone */
+		tc_profile_free(tc);
+	}
+
 	_tc_free_children_internal(tc, ptr, location);
 
 	_talloc_chunk_set_free(tc, location);
@@ -1218,7 +1468,17 @@ static inline int _tc_free_internal(struct talloc_chunk *tc,
 
 	tc_memlimit_update_on_free(tc);
 
+	chunk_size = 0;
+	if (tc->flags & TALLOC_FLAG_SLAB) {
+		chunk_size = TC_ALIGN16(TC_HDR_SIZE + tc->size);
+	}
+
 	TC_INVALIDATE_FULL_CHUNK(tc);
+
+	if ((ptr_to_free == tc) && tc_slab_free(tc, chunk_size)) {
+		return 0;
+	}
+
 	free(ptr_to_free);
 	return 0;
 }
@@ -1803,6 +2063,7 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 	struct talloc_chunk *tc;
 	void *new_ptr;
 	bool malloced = false;
+	bool slab = false;
 	struct talloc_pool_hdr *pool_hdr = NULL;
 	size_t old_size = 0;
 	size_t new_size = 0;
@@ -2005,7 +2266,7 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 					return NULL;
 				}
 			}
-			new_ptr = malloc(TC_HDR_SIZE+size);
+			new_ptr = tc_slab_alloc(TC_HDR_SIZE+size, &slab);
 			malloced = true;
 			new_size = size;
 		}
@@ -2032,7 +2293,12 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 				return NULL;
 			}
 		}
-		new_ptr = realloc(tc, size + TC_HDR_SIZE);
+		/* keep TALLOC_FLAG_SLAB true for the new size */
+		if (tc->flags & TALLOC_FLAG_SLAB) {
+			new_ptr = realloc(tc, TC_ALIGN16(size + TC_HDR_SIZE));
+		} else {
+			new_ptr = realloc(tc, size + TC_HDR_SIZE);
+		}
 	}
 got_new_ptr:
 
@@ -2057,6 +2323,9 @@ got_new_ptr:
 	_talloc_chunk_set_not_free(tc);
 	if (malloced) {
 		tc->flags &= ~TALLOC_FLAG_POOLMEM;
+		if (slab) {
+			tc->flags |= TALLOC_FLAG_SLAB;
+		}
 	}
 	if (tc->parent) {
 		tc->parent->child = tc;
@@ -2328,12 +2597,44 @@ _PUBLIC_ void talloc_report_depth_file(const void *ptr, int depth, int max_depth
 	}
 }
 
+/*
+  report the slab cache of this thread
+*/
+static void talloc_report_slab(FILE *f)
+{
+	size_t num = 0, bytes = 0;
+	size_t i;
+
+	for (i=0; i<TALLOC_SLAB_CLASSES; i++) {
+		num += talloc_slab.classes[i].num;
+		bytes += talloc_slab.classes[i].num * (i + 1) * 16;
+	}
+
+	fprintf(f, "talloc slab cache: %zu bytes in %zu chunks "
+		"(%zu hits, %zu misses)\n",
+		bytes, num, talloc_slab.hits, talloc_slab.misses);
+
+	for (i=0; i<TALLOC_SLAB_CLASSES; i++) {
+		if (talloc_slab.classes[i].num == 0) {
+			continue;
+		}
+		fprintf(f, "    %4zu byte chunks: %3u of %u\n",
+			(i + 1) * 16, talloc_slab.classes[i].num,
+			TALLOC_SLAB_DEPTH);
+	}
+	fflush(f);
+}
+
 /*
   report on memory usage by all children of a pointer, giving a full tree view
 */
 _PUBLIC_ void talloc_report_full(const void *ptr, FILE *f)
 {
 	talloc_report_depth_file(ptr, 0, -1, f);
+
+	if (unlikely(talloc_slab.enabled)) {
+		talloc_report_slab(f);
+	}
 }
 
 /*
@@ -2413,6 +2714,185 @@ _PUBLIC_ void talloc_enable_leak_report_full(void)
 	talloc_setup_atexit();
 }
 
+/*
+  enable the slab cache of this thread
+*/
+_PUBLIC_ int talloc_enable_slab(void)
+{
+#ifdef HAVE___THREAD
+	talloc_slab.enabled = true;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+  disable the slab cache of this thread, freeing all cached chunks
+*/
+_PUBLIC_ void talloc_disable_slab(void)
+{
+	size_t i;
+
+	talloc_slab.enabled = false;
+
+	for (i=0; i<TALLOC_SLAB_CLASSES; i++) {
+		struct talloc_chunk *tc = talloc_slab.classes[i].first;
+
+		while (tc != NULL) {
+			struct talloc_chunk *next = tc->next;
+			free(tc);
+			tc = next;
+		}
+		talloc_slab.classes[i].first = NULL;
+		talloc_slab.classes[i].num = 0;
+	}
+
+	talloc_slab.hits = 0;
+	talloc_slab.misses = 0;
+}
+
+/*
+  enable the allocation profile of this thread
+*/
+_PUBLIC_ int talloc_enable_profile(unsigned int sample_interval)
+{
+#ifdef HAVE___THREAD
+	if (sample_interval == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (talloc_profile.sites == NULL) {
+		talloc_profile.sites = calloc(TALLOC_PROFILE_HASH_SIZE,
+					      sizeof(talloc_profile.sites[0]));
+		if (talloc_profile.sites == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	talloc_profile.interval = sample_interval;
+	talloc_profile.countdown = sample_interval;
+	talloc_profile.enabled = true;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+  disable the allocation profile of this thread, dropping the statistics
+*/
+_PUBLIC_ void talloc_disable_profile(void)
+{
+	size_t i;
+
+	talloc_profile.enabled = false;
+
+	if (talloc_profile.sites == NULL) {
+		return;
+	}
+
+	for (i=0; i<TALLOC_PROFILE_HASH_SIZE; i++) {
+		struct talloc_profile_site *site = talloc_profile.sites[i];
+
+		while (site != NULL) {
+			struct talloc_profile_site *next = site->next;
+			free(site);
+			site = next;
+		}
+	}
+	free(talloc_profile.sites);
+	talloc_profile.sites = NULL;
+	talloc_profile.num_samples = 0;
+}
+
+static int talloc_profile_site_cmp(const void *p1, const void *p2)
+{
+	const struct talloc_profile_site *s1 =
+		*(const struct talloc_profile_site * const *)p1;
+	const struct talloc_profile_site *s2 =
+		*(const struct talloc_profile_site * const *)p2;
+
+	if (s1->count != s2->count) {
+		return (s1->count > s2->count) ? -1 : 1;
+	}
+	return strcmp(s1->name, s2->name);
+}
+
+/*
+  report the allocation profile of this thread, most frequent names first
+*/
+_PUBLIC_ void talloc_report_profile(FILE *f)
+{
+	static const char *lifetimes[TALLOC_PROFILE_LIFETIMES] = {
+		"<10us", "<100us", "<1ms", "<10ms",
+		"<100ms", "<1s", "<10s", ">=10s"
+	};
+	struct talloc_profile_site **sorted = NULL;
+	size_t i, j, num = 0;
+
+	if (!talloc_profile.enabled) {
+		return;
+	}
+
+	for (i=0; i<TALLOC_PROFILE_HASH_SIZE; i++) {
+		struct talloc_profile_site *site;
+		for (site = talloc_profile.sites[i];
+		     site != NULL;
+		     site = site->next) {
+			num += 1;
+		}
+	}
+
+	fprintf(f, "talloc profile: %zu samples of %zu names, "
+		"1 in %u allocations\n",
+		talloc_profile.num_samples, num, talloc_profile.interval);
+
+	if (num == 0) {
+		fflush(f);
+		return;
+	}
+
+	sorted = malloc(num * sizeof(sorted[0]));
+	if (sorted == NULL) {
+		fflush(f);
+		return;
+	}
+
+	num = 0;
+	for (i=0; i<TALLOC_PROFILE_HASH_SIZE; i++) {
+		struct talloc_profile_site *site;
+		for (site = talloc_profile.sites[i];
+		     site != NULL;
+		     site = site->next) {
+			sorted[num++] = site;
+		}
+	}
+	qsort(sorted, num, sizeof(sorted[0]), talloc_profile_site_cmp);
+
+	for (i=0; i<num; i++) {
+		struct talloc_profile_site *site = sorted[i];
+
+		fprintf(f, "    %-30s count %8zu bytes %10zu pooled %8zu\n",
+			site->name, site->count, site->bytes, site->pooled);
+		fprintf(f, "        lifetime");
+		for (j=0; j<TALLOC_PROFILE_LIFETIMES; j++) {
+			if (site->lifetimes[j] == 0) {
+				continue;
+			}
+			fprintf(f, " %s:%zu", lifetimes[j], site->lifetimes[j]);
+		}
+		fprintf(f, "\n");
+	}
+
+	free(sorted);
+	fflush(f);
+}
+
 /*
    talloc and zero memory.
 */
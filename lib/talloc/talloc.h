@@ -925,6 +925,89 @@ _PUBLIC_ void *_talloc_pooled_object(const void *ctx,
 			    size_t total_subobjects_size);
 #endif
 
+/**
+ * @brief Cache small chunks freed by the calling thread.
+ *
+ * With the slab cache enabled, a thread keeps the small chunks it frees in
+ * lists by size, and takes the next allocation of that size from there
+ * instead of calling malloc(3). This helps code that allocates and frees
+ * lots of small objects per request, where setting up a talloc_pool() for
+ * each request is not practical.
+ *
+ * The cache only changes where the memory comes from, the hierarchy and
+ * destructors work as before. A chunk can be freed by any thread, it goes
+ * into the cache of the thread that frees it. Chunks allocated while the
+ * cache was disabled are always given back to free(3). talloc_report_full()
+ * shows the cache of the calling thread. A thread that enabled the cache
+ * must call talloc_disable_slab() before it exits, or the cached memory
+ * leaks.
+ *
+ * @return              0 on success, -1 with errno set to ENOSYS if the
+ *                      platform has no thread local storage.
+ *
+ * @see talloc_disable_slab()
+ */
+_PUBLIC_ int talloc_enable_slab(void);
+
+/**
+ * @brief Disable the slab cache of the calling thread.
+ *
+ * This gives all chunks in the cache back with free(3).
+ *
+ * @see talloc_enable_slab()
+ */
+_PUBLIC_ void talloc_disable_slab(void);
+
+/**
+ * @brief Sample the allocations of the calling thread per name.
+ *
+ * With the profile enabled, every sample_interval'th allocation of the
+ * calling thread is marked with its allocation time. When a marked chunk
+ * is freed, the thread freeing it counts the chunk, its size and its
+ * lifetime under the chunk's name, which for most chunks is the
+ * "file:line" location of the allocation. This shows which code paths
+ * allocate and free lots of short lived memory and might benefit from a
+ * talloc_pool() or the stack, without the overhead of looking at every
+ * allocation.
+ *
+ * Chunks still alive are not part of the profile, use
+ * talloc_report_full() for those. Calling this again changes the
+ * interval and keeps the statistics collected so far.
+ *
+ * @param[in]  sample_interval  Sample one in sample_interval allocations,
+ *                              1 samples all of them.
+ *
+ * @return              0 on success, -1 with errno set on error. errno is
+ *                      ENOSYS if the platform has no thread local storage.
+ *
+ * @see talloc_report_profile()
+ * @see talloc_disable_profile()
+ */
+_PUBLIC_ int talloc_enable_profile(unsigned int sample_interval);
+
+/**
+ * @brief Disable the allocation profile of the calling thread.
+ *
+ * This drops the statistics collected so far.
+ *
+ * @see talloc_enable_profile()
+ */
+_PUBLIC_ void talloc_disable_profile(void);
+
+/**
+ * @brief Print the allocation profile of the calling thread.
+ *
+ * For every name this prints the number of sampled chunks freed, their
+ * bytes, how many came from a pool and a histogram of their lifetimes,
+ * the most frequent names first. Nothing is printed if the profile is
+ * not enabled.
+ *
+ * @param[in]  f        The file handle to print to.
+ *
+ * @see talloc_enable_profile()
+ */
+_PUBLIC_ void talloc_report_profile(FILE *f);
+
 /**
  * @brief Free a talloc chunk and NULL out the pointer.
  *
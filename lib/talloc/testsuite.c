@@ -904,6 +904,30 @@ static bool test_speed(void)
 
 	fprintf(stderr, "talloc_pool: %.0f ops/sec\n", count/private_timeval_elapsed(&tv));
 
+	if (talloc_enable_slab() == 0) {
+		ctx = talloc_new(NULL);
+
+		tv = private_timeval_current();
+		count = 0;
+		do {
+			void *p1, *p2, *p3;
+			for (i=0;i<loop;i++) {
+				p1 = talloc_size(ctx, loop % 100);
+				p2 = talloc_strdup(p1, "foo bar");
+				p3 = talloc_size(p1, 300);
+				(void)p2;
+				(void)p3;
+				talloc_free(p1);
+			}
+			count += 3 * loop;
+		} while (private_timeval_elapsed(&tv) < 5.0);
+
+		talloc_free(ctx);
+		talloc_disable_slab();
+
+		fprintf(stderr, "talloc_slab: %.0f ops/sec\n", count/private_timeval_elapsed(&tv));
+	}
+
 	tv = private_timeval_current();
 	count = 0;
 	do {
@@ -1591,6 +1615,199 @@ static bool test_free_children(void)
 	return true;
 }
 
+static int slab_destructor_count;
+
+static int slab_destructor(char *ptr)
+{
+	slab_destructor_count += 1;
+	return 0;
+}
+
+static bool slab_report(void *root, char *report, size_t report_size)
+{
+	FILE *f;
+	size_t report_len;
+
+	f = tmpfile();
+	if (f == NULL) {
+		return false;
+	}
+	talloc_report_full(root, f);
+	rewind(f);
+	report_len = fread(report, 1, report_size - 1, f);
+	report[report_len] = '\0';
+	fclose(f);
+	printf("%s", report);
+	return true;
+}
+
+static bool test_slab(void)
+{
+	void *root;
+	char *p1, *p2, *p3;
+	void *old_p1;
+	char report[4096];
+	int i;
+
+	printf("test: slab\n# SLAB CACHE\n");
+
+	root = talloc_new(NULL);
+
+	/* chunks allocated before the cache was enabled are not cached */
+	p1 = talloc_size(root, 1);
+
+	if (talloc_enable_slab() != 0) {
+		talloc_free(root);
+		printf("success: slab (no thread local storage)\n");
+		return true;
+	}
+
+	talloc_free(p1);
+	torture_assert("slab", slab_report(root, report, sizeof(report)),
+		       "tmpfile failed\n");
+	torture_assert("slab",
+		       strstr(report, "talloc slab cache: 0 bytes in 0 chunks")
+		       != NULL,
+		       "unrounded chunk cached\n");
+
+	/* a freed chunk is given out again for the same size */
+	p1 = talloc_size(root, 100);
+	old_p1 = p1;
+	talloc_free(p1);
+	p1 = talloc_size(root, 100);
+	torture_assert("slab", p1 == old_p1, "chunk not reused\n");
+
+	/* hierarchy and destructors work as usual */
+	p2 = talloc_strdup(p1, "child");
+	p3 = talloc_strdup(p2, "grandchild");
+	talloc_set_destructor(p2, slab_destructor);
+	talloc_set_destructor(p3, slab_destructor);
+	CHECK_BLOCKS("slab", root, 4);
+	slab_destructor_count = 0;
+	talloc_free(p1);
+	torture_assert("slab", slab_destructor_count == 2,
+		       "destructors not called\n");
+	CHECK_BLOCKS("slab", root, 1);
+
+	/* so does realloc of a cached chunk */
+	p1 = talloc_strdup(root, "slab");
+	p1 = talloc_realloc(root, p1, char, 2000);
+	torture_assert("slab", p1 != NULL, "realloc failed\n");
+	torture_assert_str_equal("slab", p1, "slab", "wrong contents");
+	p1 = talloc_realloc(root, p1, char, 10);
+	torture_assert_str_equal("slab", p1, "slab", "wrong contents");
+	talloc_free(p1);
+
+	/* the cache is bounded */
+	for (i=0; i<1000; i++) {
+		talloc_size(root, 50);
+	}
+	talloc_free_children(root);
+
+	torture_assert("slab", slab_report(root, report, sizeof(report)),
+		       "tmpfile failed\n");
+	torture_assert("slab", strstr(report, "talloc slab cache: ") != NULL,
+		       "no slab report\n");
+	torture_assert("slab", strstr(report, " of 64\n") != NULL,
+		       "full class not reported\n");
+
+	talloc_free(root);
+	talloc_disable_slab();
+
+	printf("success: slab\n");
+	return true;
+}
+
+static bool test_profile(void)
+{
+	void *root;
+	char *p1;
+	void *pool;
+	FILE *f;
+	char report[4096];
+	size_t report_len;
+	const char *line;
+	int i;
+
+	printf("test: profile\n# ALLOCATION PROFILE\n");
+
+	if (talloc_enable_profile(1) != 0) {
+		printf("success: profile (no thread local storage)\n");
+		return true;
+	}
+
+	root = talloc_new(NULL);
+
+	for (i=0; i<10; i++) {
+		p1 = talloc_named_const(root, 100, "profile_site");
+		talloc_strdup(p1, "string");
+		talloc_free(p1);
+	}
+
+	pool = talloc_pool(root, 1024);
+	p1 = talloc_named_const(pool, 10, "profile_pooled");
+	talloc_free(p1);
+	talloc_free(pool);
+
+	/* still alive, so not counted */
+	talloc_named_const(root, 10, "profile_alive");
+
+	/* sampling every other allocation */
+	torture_assert("profile", talloc_enable_profile(2) == 0,
+		       "changing the interval failed\n");
+	for (i=0; i<10; i++) {
+		p1 = talloc_named_const(root, 1, "profile_sampled");
+		talloc_free(p1);
+	}
+
+	f = tmpfile();
+	torture_assert("profile", f != NULL, "tmpfile failed\n");
+	talloc_report_profile(f);
+	rewind(f);
+	report_len = fread(report, 1, sizeof(report) - 1, f);
+	report[report_len] = '\0';
+	fclose(f);
+	printf("%s", report);
+
+	torture_assert("profile",
+		       strstr(report, "1 in 2 allocations\n") != NULL,
+		       "no profile header\n");
+	line = strstr(report, "profile_site ");
+	torture_assert("profile", line != NULL, "site not reported\n");
+	torture_assert("profile",
+		       strstr(line, "count       10 bytes       1000 ") != NULL,
+		       "wrong site counts\n");
+	line = strstr(report, "(string) ");
+	torture_assert("profile", line != NULL, "strings not reported\n");
+	torture_assert("profile", strstr(line, "count       10 ") != NULL,
+		       "wrong string count\n");
+	line = strstr(report, "profile_pooled ");
+	torture_assert("profile", line != NULL, "pooled not reported\n");
+	torture_assert("profile", strstr(line, "pooled        1\n") != NULL,
+		       "pool member not counted\n");
+	line = strstr(report, "profile_sampled ");
+	torture_assert("profile", line != NULL, "sampled not reported\n");
+	torture_assert("profile", strstr(line, "count        5 ") != NULL,
+		       "wrong sample count\n");
+	torture_assert("profile", strstr(report, "profile_alive") == NULL,
+		       "live chunk reported\n");
+
+	talloc_disable_profile();
+
+	f = tmpfile();
+	torture_assert("profile", f != NULL, "tmpfile failed\n");
+	talloc_report_profile(f);
+	torture_assert("profile", ftell(f) == 0,
+		       "disabled profile reported\n");
+	fclose(f);
+
+	/* freeing a chunk sampled before is fine */
+	talloc_free(root);
+
+	printf("success: profile\n");
+	return true;
+}
+
 static bool test_memlimit(void)
 {
 	void *root;
@@ -2265,6 +2482,10 @@ bool torture_local_talloc(struct torture_context *tctx)
 	ret &= test_free_children();
 	test_reset();
 	ret &= test_memlimit();
+	test_reset();
+	ret &= test_slab();
+	test_reset();
+	ret &= test_profile();
 #ifdef HAVE_PTHREAD
 	test_reset();
 	ret &= test_pthread_talloc_passing();
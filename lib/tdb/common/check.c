@@ -324,6 +324,53 @@ static bool tdb_check_free_record(struct tdb_context *tdb,
 	return true;
 }
 
+/* Check the sub-chain heads of a split hash chain. */
+static bool tdb_check_subhash_record(struct tdb_context *tdb,
+				     tdb_off_t off,
+				     const struct tdb_record *rec,
+				     unsigned char **hashes)
+{
+	tdb_off_t table, head;
+	uint32_t i, num;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SUBHASH)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Sub-hash record at offset %u without feature flag\n",
+			 off));
+		return false;
+	}
+	if (!tdb_check_record(tdb, off, rec))
+		return false;
+
+	if (rec->full_hash >= tdb->hash_size) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Sub-hash record offset %u has bad chain %u\n",
+			 off, rec->full_hash));
+		return false;
+	}
+
+	/* This validates the record if the chain uses it */
+	if (tdb_hash_chains(tdb, rec->full_hash, &table, &num) == -1)
+		return false;
+	if (table != off + sizeof(*rec)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Sub-hash record offset %u not used by chain %u\n",
+			 off, rec->full_hash));
+		return false;
+	}
+
+	/* The hash top points here, and we point to the sub-chains. */
+	record_offset(hashes[rec->full_hash+1], off);
+	for (i = 0; i < num; i++) {
+		if (tdb_ofs_read(tdb, table + i * sizeof(tdb_off_t),
+				 &head) == -1)
+			return false;
+		if (head)
+			record_offset(hashes[rec->full_hash+1], head);
+	}
+	return true;
+}
+
 /* Slow, but should be very rare. */
 size_t tdb_dead_space(struct tdb_context *tdb, tdb_off_t off)
 {
@@ -398,6 +445,14 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			record_offset(hashes[h], off);
 	}
 
+	/* The other free lists share the bitmap of the first one. */
+	for (h = 1; h < tdb_freelist_classes(tdb); h++) {
+		if (tdb_ofs_read(tdb, TDB_FREELIST_TOP(h), &off) == -1)
+			goto free;
+		if (off)
+			record_offset(hashes[0], off);
+	}
+
 	/* For each record, read it in and check it's ok. */
 	for (off = TDB_DATA_START(tdb->hash_size);
 	     off < tdb->map_size;
@@ -416,6 +471,10 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			if (!tdb_check_free_record(tdb, off, &rec, hashes))
 				goto free;
 			break;
+		case TDB_SUBHASH_MAGIC:
+			if (!tdb_check_subhash_record(tdb, off, &rec, hashes))
+				goto free;
+			break;
 		/* If we crash after ftruncate, we can get zeroes or fill. */
 		case TDB_RECOVERY_INVALID_MAGIC:
 		case 0x42424242:
@@ -62,9 +62,11 @@ static int tdb_dump_chain(struct tdb_context *tdb, int i)
 {
 	struct tdb_chainwalk_ctx chainwalk;
 	tdb_off_t rec_ptr, top;
+	uint32_t sub, num = 1;
 
 	if (i == -1) {
 		top = FREELIST_TOP;
+		num = tdb_freelist_classes(tdb);
 	} else {
 		top = TDB_HASH_TOP(i);
 	}
@@ -72,21 +74,38 @@ static int tdb_dump_chain(struct tdb_context *tdb, int i)
 	if (tdb_lock(tdb, i, F_WRLCK) != 0)
 		return -1;
 
-	if (tdb_ofs_read(tdb, top, &rec_ptr) == -1)
+	if ((i != -1) && (tdb_hash_chains(tdb, i, &top, &num) == -1))
 		return tdb_unlock(tdb, i, F_WRLCK);
 
-	tdb_chainwalk_init(&chainwalk, rec_ptr);
+	if (num > 1)
+		printf("hash=%d split into %u sub-chains\n", i, num);
 
-	if (rec_ptr)
-		printf("hash=%d\n", i);
+	for (sub = 0; sub < num; sub++) {
+		tdb_off_t head = top + sub * sizeof(tdb_off_t);
 
-	while (rec_ptr) {
-		bool ok;
-		rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
-		ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
-		if (!ok) {
-			printf("circular hash chain %d\n", i);
+		if (i == -1)
+			head = TDB_FREELIST_TOP(sub);
+
+		if (tdb_ofs_read(tdb, head, &rec_ptr) == -1)
 			break;
+
+		tdb_chainwalk_init(&chainwalk, rec_ptr);
+
+		if (rec_ptr && (i == -1) && (num > 1))
+			printf("freelist class=%u\n", sub);
+		else if (rec_ptr && (num > 1))
+			printf("hash=%d sub=%u\n", i, sub);
+		else if (rec_ptr)
+			printf("hash=%d\n", i);
+
+		while (rec_ptr) {
+			bool ok;
+			rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
+			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
+			if (!ok) {
+				printf("circular hash chain %d\n", i);
+				break;
+			}
 		}
 	}
 
@@ -109,38 +128,42 @@ _PUBLIC_ int tdb_printfreelist(struct tdb_context *tdb)
 	long total_free = 0;
 	tdb_off_t offset, rec_ptr;
 	struct tdb_record rec;
+	unsigned list;
 
 	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
-
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
+	for (list = 0; list < tdb_freelist_classes(tdb); list++) {
+		offset = TDB_FREELIST_TOP(list);
 
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
-					   sizeof(rec), DOCONV()) == -1) {
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
 			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		printf("freelist top=[0x%08x]\n", rec_ptr );
+		while (rec_ptr) {
+			if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
+						   sizeof(rec), DOCONV()) == -1) {
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
+
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n",
+				       rec.magic);
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
+
+			printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
+			       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
 		}
-
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
-		       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
-		total_free += rec.rec_len;
-
-		/* move to the next record */
-		rec_ptr = rec.next;
 	}
 	printf("total rec_len = [0x%08lx (%lu)]\n", total_free, total_free);
 
@@ -27,6 +27,49 @@
 
 #include "tdb_private.h"
 
+/*
+ * How many records tdb_allocate looks at in the list for the
+ * requested size before taking a larger one
+ */
+#define TDB_FREELIST_PROBE 16
+
+/*
+ * Number of free lists, see TDB_FEATURE_FLAG_FREELISTS
+ */
+unsigned tdb_freelist_classes(struct tdb_context *tdb)
+{
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREELISTS) {
+		return TDB_FREELIST_CLASSES;
+	}
+	return 1;
+}
+
+/*
+ * The free list a record of rec_len bytes goes into: class 0 takes
+ * everything below 64 bytes, class c records from 2^(c+5) to
+ * 2^(c+6)-1 bytes, the last class everything from 1MB.
+ *
+ * A free record on a list only grows, when the record to its right is
+ * freed and merged into it, so all records in class c are at least
+ * 2^(c+5) bytes long. Larger ones are moved to their class before we
+ * expand the file.
+ */
+unsigned tdb_freelist_class(struct tdb_context *tdb, tdb_len_t rec_len)
+{
+	unsigned c = 0;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_FREELISTS)) {
+		return 0;
+	}
+
+	rec_len >>= 6;
+	while ((rec_len != 0) && (c < TDB_FREELIST_CLASSES - 1)) {
+		rec_len >>= 1;
+		c += 1;
+	}
+	return c;
+}
+
 /* read a freelist record and check for simple errors */
 int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off, struct tdb_record *rec)
 {
@@ -263,6 +306,22 @@ static int check_merge_ptr_with_left_record(struct tdb_context *tdb,
 	return 1;
 }
 
+/*
+ * Prepend a free record to the list for its size
+ */
+static int tdb_freelist_push(struct tdb_context *tdb, tdb_off_t offset,
+			     struct tdb_record *rec)
+{
+	tdb_off_t top = TDB_FREELIST_TOP(tdb_freelist_class(tdb, rec->rec_len));
+
+	if (tdb_ofs_read(tdb, top, &rec->next) == -1 ||
+	    tdb_rec_write(tdb, offset, rec) == -1 ||
+	    tdb_ofs_write(tdb, top, &offset) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
 /**
  * Add an element into the freelist.
  *
@@ -301,9 +360,7 @@ int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 
 	rec->magic = TDB_FREE_MAGIC;
 
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec->next) == -1 ||
-	    tdb_rec_write(tdb, offset, rec) == -1 ||
-	    tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
+	if (tdb_freelist_push(tdb, offset, rec) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free record write failed at offset=%u\n", offset));
 		goto fail;
 	}
@@ -330,7 +387,8 @@ done:
  */
 static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 				  tdb_len_t length, tdb_off_t rec_ptr,
-				  struct tdb_record *rec, tdb_off_t last_ptr)
+				  struct tdb_record *rec, tdb_off_t last_ptr,
+				  unsigned list)
 {
 #define MIN_REC_SIZE (sizeof(struct tdb_record) + sizeof(tdb_off_t) + 8)
 
@@ -352,7 +410,16 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 
 	/* we're going to just shorten the existing record */
 	rec->rec_len -= (length + sizeof(*rec));
-	if (tdb_rec_write(tdb, rec_ptr, rec) == -1) {
+
+	if (tdb_freelist_class(tdb, rec->rec_len) < list) {
+		/* too small for its list now, move it */
+		if (tdb_ofs_write(tdb, last_ptr, &rec->next) == -1) {
+			return 0;
+		}
+		if (tdb_freelist_push(tdb, rec_ptr, rec) == -1) {
+			return 0;
+		}
+	} else if (tdb_rec_write(tdb, rec_ptr, rec) == -1) {
 		return 0;
 	}
 	if (update_tailer(tdb, rec_ptr, rec) == -1) {
@@ -377,14 +444,63 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 	return rec_ptr;
 }
 
-/* allocate some space from the free list. The offset returned points
-   to a unconnected tdb_record within the database with room for at
-   least length bytes of total data
+/*
+ * Move records that grew out of free list "list" to the list for
+ * their size. Returns the number of records moved, -1 on error.
+ */
+static int tdb_freelist_sort(struct tdb_context *tdb, unsigned list)
+{
+	tdb_off_t rec_ptr, last_ptr;
+	struct tdb_record rec;
+	tdb_len_t seen = 0;
+	int moved = 0;
 
-   0 is returned if the space could not be allocated
+	last_ptr = TDB_FREELIST_TOP(list);
+
+	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1) {
+		return -1;
+	}
+
+	while (rec_ptr != 0) {
+		tdb_off_t next;
+
+		if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+			return -1;
+		}
+		next = rec.next;
+
+		if (tdb_freelist_class(tdb, rec.rec_len) != list) {
+			if (tdb_ofs_write(tdb, last_ptr, &next) == -1) {
+				return -1;
+			}
+			if (tdb_freelist_push(tdb, rec_ptr, &rec) == -1) {
+				return -1;
+			}
+			moved += 1;
+		} else {
+			last_ptr = rec_ptr;
+		}
+
+		rec_ptr = next;
+
+		if (++seen > tdb->map_size / sizeof(rec)) {
+			/* can't be, there's a loop */
+			tdb->ecode = TDB_ERR_CORRUPT;
+			return -1;
+		}
+	}
+
+	return moved;
+}
+
+/*
+ * Best fit search in free list "list", looking at no more than
+ * max_recs records if max_recs != 0. Returns 0 with *pbestfit == 0
+ * if nothing fits.
  */
-static tdb_off_t tdb_allocate_from_freelist(
-	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+static int tdb_freelist_bestfit(struct tdb_context *tdb, tdb_len_t length,
+				unsigned list, unsigned max_recs,
+				struct tdb_record *rec, tdb_off_t *pbestfit)
 {
 	tdb_off_t rec_ptr, last_ptr, newrec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
@@ -395,21 +511,17 @@ static tdb_off_t tdb_allocate_from_freelist(
 	} bestfit;
 	float multiplier = 1.0;
 	bool merge_created_candidate;
+	unsigned num_recs = 0;
 
-	/* over-allocate to reduce fragmentation */
-	length *= 1.25;
-
-	/* Extra bytes required for tailer */
-	length += sizeof(tdb_off_t);
-	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+	*pbestfit = 0;
 
  again:
 	merge_created_candidate = false;
-	last_ptr = FREELIST_TOP;
+	last_ptr = TDB_FREELIST_TOP(list);
 
 	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		return 0;
+	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
+		return -1;
 
 	modified = false;
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
@@ -429,20 +541,20 @@ static tdb_off_t tdb_allocate_from_freelist(
 		struct tdb_record left_rec;
 
 		if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
-			return 0;
+			return -1;
 		}
 
 		ret = check_merge_with_left_record(tdb, rec_ptr, rec,
 						   &left_ptr, &left_rec);
 		if (ret == -1) {
-			return 0;
+			return -1;
 		}
 		if (ret == 1) {
 			/* merged */
 			rec_ptr = rec->next;
 			ret = tdb_ofs_write(tdb, last_ptr, &rec->next);
 			if (ret == -1) {
-				return 0;
+				return -1;
 			}
 
 			/*
@@ -496,7 +608,7 @@ static tdb_off_t tdb_allocate_from_freelist(
 			bool ok;
 			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
 			if (!ok) {
-				return 0;
+				return -1;
 			}
 		}
 
@@ -514,22 +626,144 @@ static tdb_off_t tdb_allocate_from_freelist(
 		   accept records up to 11 times larger than what we
 		   want */
 		multiplier *= 1.05;
+
+		if (++num_recs == max_recs) {
+			break;
+		}
 	}
 
 	if (bestfit.rec_ptr != 0) {
 		if (tdb_rec_free_read(tdb, bestfit.rec_ptr, rec) == -1) {
-			return 0;
+			return -1;
 		}
 
 		newrec_ptr = tdb_allocate_ofs(tdb, length, bestfit.rec_ptr,
-					      rec, bestfit.last_ptr);
-		return newrec_ptr;
+					      rec, bestfit.last_ptr, list);
+		if (newrec_ptr == 0) {
+			return -1;
+		}
+		*pbestfit = newrec_ptr;
+		return 0;
 	}
 
 	if (merge_created_candidate) {
 		goto again;
 	}
 
+	return 0;
+}
+
+/* allocate some space from the free list. The offset returned points
+   to a unconnected tdb_record within the database with room for at
+   least length bytes of total data
+
+   0 is returned if the space could not be allocated
+ */
+static tdb_off_t tdb_allocate_from_freelist(
+	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+{
+	unsigned num_lists = tdb_freelist_classes(tdb);
+	unsigned first, list;
+	tdb_off_t rec_ptr;
+	int ret;
+
+	/* over-allocate to reduce fragmentation */
+	length *= 1.25;
+
+	/* Extra bytes required for tailer */
+	length += sizeof(tdb_off_t);
+	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+	first = tdb_freelist_class(tdb, length);
+
+ again:
+	if (num_lists == 1) {
+		ret = tdb_freelist_bestfit(tdb, length, 0, 0, rec, &rec_ptr);
+		if (ret == -1) {
+			return 0;
+		}
+		if (rec_ptr != 0) {
+			return rec_ptr;
+		}
+		goto expand;
+	}
+
+	/*
+	 * Only some records in our own list are large enough, have
+	 * a short look there before going to the larger sizes.
+	 */
+	ret = tdb_freelist_bestfit(tdb, length, first, TDB_FREELIST_PROBE,
+				   rec, &rec_ptr);
+	if (ret == -1) {
+		return 0;
+	}
+	if (rec_ptr != 0) {
+		return rec_ptr;
+	}
+
+	for (list = first + 1; list < num_lists - 1; list++) {
+		/*
+		 * Everything in the lists between is large enough,
+		 * just take the first one.
+		 */
+		if (tdb_ofs_read(tdb, TDB_FREELIST_TOP(list), &rec_ptr) == -1) {
+			return 0;
+		}
+		if (rec_ptr == 0) {
+			continue;
+		}
+		if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
+			return 0;
+		}
+		if (rec->rec_len < length) {
+			tdb->ecode = TDB_ERR_CORRUPT;
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_allocate: free "
+				 "record at %u too small for list %u\n",
+				 rec_ptr, list));
+			return 0;
+		}
+		return tdb_allocate_ofs(tdb, length, rec_ptr, rec,
+					TDB_FREELIST_TOP(list), list);
+	}
+
+	/* The last list has all the huge records */
+	if (first < num_lists - 1) {
+		ret = tdb_freelist_bestfit(tdb, length, num_lists - 1, 0,
+					   rec, &rec_ptr);
+		if (ret == -1) {
+			return 0;
+		}
+		if (rec_ptr != 0) {
+			return rec_ptr;
+		}
+	}
+
+	/* and our own might still have a fit further down */
+	ret = tdb_freelist_bestfit(tdb, length, first, 0, rec, &rec_ptr);
+	if (ret == -1) {
+		return 0;
+	}
+	if (rec_ptr != 0) {
+		return rec_ptr;
+	}
+
+	/*
+	 * Before growing the file, see whether records in the lists
+	 * for smaller sizes grew large enough by merging.
+	 */
+	ret = 0;
+	for (list = 0; list < first; list++) {
+		int moved = tdb_freelist_sort(tdb, list);
+		if (moved == -1) {
+			return 0;
+		}
+		ret += moved;
+	}
+	if (ret > 0) {
+		goto again;
+	}
+
+expand:
 	/* we didn't find enough space. See if we can expand the
 	   database and if we can then try again */
 	if (tdb_expand(tdb, length + sizeof(*rec)) == 0)
@@ -648,6 +882,7 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 				       int *count_records, int *count_merged)
 {
 	tdb_off_t cur, next;
+	unsigned list;
 	int count = 0;
 	int merged = 0;
 	int ret;
@@ -657,32 +892,38 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 		return -1;
 	}
 
-	cur = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
-		tdb_off_t next2;
+	for (list = 0; list < tdb_freelist_classes(tdb); list++) {
+		cur = TDB_FREELIST_TOP(list);
+		while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
+			tdb_off_t next2;
 
-		count++;
+			count++;
 
-		ret = check_merge_ptr_with_left_record(tdb, next, &next2);
-		if (ret == -1) {
-			goto done;
-		}
-		if (ret == 1) {
-			/*
-			 * merged:
-			 * now let cur->next point to next2 instead of next
-			 */
-
-			ret = tdb_ofs_write(tdb, cur, &next2);
-			if (ret != 0) {
+			ret = check_merge_ptr_with_left_record(tdb, next, &next2);
+			if (ret == -1) {
 				goto done;
 			}
+			if (ret == 1) {
+				/*
+				 * merged:
+				 * now let cur->next point to next2 instead of next
+				 */
+
+				ret = tdb_ofs_write(tdb, cur, &next2);
+				if (ret != 0) {
+					goto done;
+				}
+
+				/*
+				 * look at next2 from cur again, it
+				 * might be 0 at the end of the list
+				 */
+				merged++;
+				continue;
+			}
 
-			next = next2;
-			merged++;
+			cur = next;
 		}
-
-		cur = next;
 	}
 
 	if (count_records != NULL) {
@@ -706,15 +947,18 @@ done:
 static int tdb_freelist_size_no_merge(struct tdb_context *tdb)
 {
 	tdb_off_t ptr;
+	unsigned list;
 	int count=0;
 
 	if (tdb_lock(tdb, -1, F_RDLCK) == -1) {
 		return -1;
 	}
 
-	ptr = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
-		count++;
+	for (list = 0; list < tdb_freelist_classes(tdb); list++) {
+		ptr = TDB_FREELIST_TOP(list);
+		while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
+			count++;
+		}
 	}
 
 	tdb_unlock(tdb, -1, F_RDLCK);
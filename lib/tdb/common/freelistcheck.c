@@ -47,6 +47,7 @@ _PUBLIC_ int tdb_validate_freelist(struct tdb_context *tdb, int *pnum_entries)
 	struct tdb_context *mem_tdb = NULL;
 	struct tdb_record rec;
 	tdb_off_t rec_ptr, last_ptr;
+	unsigned list;
 	int ret = -1;
 
 	*pnum_entries = 0;
@@ -62,39 +63,41 @@ _PUBLIC_ int tdb_validate_freelist(struct tdb_context *tdb, int *pnum_entries)
 		return 0;
 	}
 
-	last_ptr = FREELIST_TOP;
+	for (list = 0; list < tdb_freelist_classes(tdb); list++) {
+		last_ptr = TDB_FREELIST_TOP(list);
 
-	/* Store the FREELIST_TOP record. */
-	if (seen_insert(mem_tdb, last_ptr) == -1) {
-		tdb->ecode = TDB_ERR_CORRUPT;
-		ret = -1;
-		goto fail;
-	}
-
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1) {
-		goto fail;
-	}
-
-	while (rec_ptr) {
-
-		/* If we can't store this record (we've seen it
-		   before) then the free list has a loop and must
-		   be corrupt. */
-
-		if (seen_insert(mem_tdb, rec_ptr)) {
+		/* Store the FREELIST_TOP record. */
+		if (seen_insert(mem_tdb, last_ptr) == -1) {
 			tdb->ecode = TDB_ERR_CORRUPT;
 			ret = -1;
 			goto fail;
 		}
 
-		if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1) {
 			goto fail;
 		}
 
-		/* move to the next record */
-		rec_ptr = rec.next;
-		*pnum_entries += 1;
+		while (rec_ptr) {
+
+			/* If we can't store this record (we've seen it
+			   before) then the free list has a loop and must
+			   be corrupt. */
+
+			if (seen_insert(mem_tdb, rec_ptr)) {
+				tdb->ecode = TDB_ERR_CORRUPT;
+				ret = -1;
+				goto fail;
+			}
+
+			if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+				goto fail;
+			}
+
+			/* move to the next record */
+			rec_ptr = rec.next;
+			*pnum_entries += 1;
+		}
 	}
 
 	ret = 0;
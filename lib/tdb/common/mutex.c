@@ -73,6 +73,19 @@ struct tdb_mutexes {
 	 * one mutex per hashchain.
 	 */
 	pthread_mutex_t hashchains[1];
+
+	/*
+	 * With TDB_FEATURE_FLAG_SEQLOCK the hashchains are followed by
+	 * hash_size+1 uint32_t sequence counters. Index 0 belongs to
+	 * the allrecord lock, the others use the hashchains index.
+	 *
+	 * A counter is odd while a writer might change what it
+	 * protects: From acquiring a chain mutex until releasing it,
+	 * and while the allrecord lock is held exclusively. Readers
+	 * walking a chain without a lock check that both the
+	 * allrecord and the chain counter were even and unchanged
+	 * before and after, see tdb_seqlock_read_begin().
+	 */
 };
 
 bool tdb_have_mutexes(struct tdb_context *tdb)
@@ -80,6 +93,63 @@ bool tdb_have_mutexes(struct tdb_context *tdb)
 	return ((tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) != 0);
 }
 
+static uint32_t *tdb_mutex_seqlocks(struct tdb_context *tdb)
+{
+	struct tdb_mutexes *m = tdb->mutexes;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK)) {
+		return NULL;
+	}
+	return (uint32_t *)(void *)&m->hashchains[tdb->hash_size+1];
+}
+
+#ifdef USE_TDB_SEQLOCK
+
+/*
+ * The counters are only written with the corresponding mutex held,
+ * so no read-modify-write atomics are needed. The parity is forced
+ * rather than just incrementing, a writer might have died with an odd
+ * counter.
+ */
+
+static void tdb_seqlock_write_begin(uint32_t *seqlocks, unsigned idx)
+{
+	uint32_t seq;
+
+	if (seqlocks == NULL) {
+		return;
+	}
+	seq = __atomic_load_n(&seqlocks[idx], __ATOMIC_RELAXED);
+	__atomic_store_n(&seqlocks[idx], (seq + 1) | 1, __ATOMIC_RELAXED);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void tdb_seqlock_write_end(uint32_t *seqlocks, unsigned idx)
+{
+	uint32_t seq;
+
+	if (seqlocks == NULL) {
+		return;
+	}
+	seq = __atomic_load_n(&seqlocks[idx], __ATOMIC_RELAXED);
+	atomic_thread_fence(memory_order_seq_cst);
+	__atomic_store_n(&seqlocks[idx], (seq | 1) + 1, __ATOMIC_RELAXED);
+}
+
+#else
+
+static void tdb_seqlock_write_begin(uint32_t *seqlocks, unsigned idx)
+{
+	return;
+}
+
+static void tdb_seqlock_write_end(uint32_t *seqlocks, unsigned idx)
+{
+	return;
+}
+
+#endif
+
 size_t tdb_mutex_size(struct tdb_context *tdb)
 {
 	size_t mutex_size;
@@ -91,6 +161,10 @@ size_t tdb_mutex_size(struct tdb_context *tdb)
 	mutex_size = sizeof(struct tdb_mutexes);
 	mutex_size += tdb->hash_size * sizeof(pthread_mutex_t);
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		mutex_size += (tdb->hash_size + 1) * sizeof(uint32_t);
+	}
+
 	return TDB_ALIGN(mutex_size, tdb->page_size);
 }
 
@@ -193,8 +267,9 @@ static int chain_mutex_lock(pthread_mutex_t *m, bool waitflag)
 	return pthread_mutex_consistent(m);
 }
 
-static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
+static int allrecord_mutex_lock(struct tdb_context *tdb, bool waitflag)
 {
+	struct tdb_mutexes *m = tdb->mutexes;
 	int ret;
 
 	if (waitflag) {
@@ -211,6 +286,9 @@ static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
 	 * to F_UNLCK. This should also be the indication for
 	 * tdb_needs_recovery.
 	 */
+	if (m->allrecord_lock == F_WRLCK) {
+		tdb_seqlock_write_end(tdb_mutex_seqlocks(tdb), 0);
+	}
 	m->allrecord_lock = F_UNLCK;
 
 	return pthread_mutex_consistent(&m->allrecord_mutex);
@@ -268,6 +346,7 @@ again:
 		 * chain lock.
 		 */
 
+		tdb_seqlock_write_begin(tdb_mutex_seqlocks(tdb), idx);
 		*pret = 0;
 		return true;
 	}
@@ -293,6 +372,11 @@ again:
 	}
 
 	if (allrecord_ok) {
+		/*
+		 * Also for read locks: They might be upgraded
+		 * by a nested write lock without touching the mutex.
+		 */
+		tdb_seqlock_write_begin(tdb_mutex_seqlocks(tdb), idx);
 		*pret = 0;
 		return true;
 	}
@@ -304,7 +388,7 @@ again:
 		errno = ret;
 		goto fail;
 	}
-	ret = allrecord_mutex_lock(m, waitflag);
+	ret = allrecord_mutex_lock(tdb, waitflag);
 	if (ret == EBUSY) {
 		ret = EAGAIN;
 	}
@@ -344,6 +428,10 @@ bool tdb_mutex_unlock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 	}
 	chain = &m->hashchains[idx];
 
+	if (idx != 0) {
+		tdb_seqlock_write_end(tdb_mutex_seqlocks(tdb), idx);
+	}
+
 	ret = pthread_mutex_unlock(chain);
 	if (ret == 0) {
 		*pret = 0;
@@ -371,7 +459,7 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 		return 0;
 	}
 
-	ret = allrecord_mutex_lock(m, waitflag);
+	ret = allrecord_mutex_lock(tdb, waitflag);
 	if (!waitflag && (ret == EBUSY)) {
 		errno = EAGAIN;
 		tdb->ecode = TDB_ERR_LOCK;
@@ -394,6 +482,14 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 	}
 	m->allrecord_lock = (ltype == F_RDLCK) ? F_RDLCK : F_WRLCK;
 
+	if (m->allrecord_lock == F_WRLCK) {
+		/*
+		 * Writers under the allrecord lock don't take the
+		 * chain mutexes.
+		 */
+		tdb_seqlock_write_begin(tdb_mutex_seqlocks(tdb), 0);
+	}
+
 	for (i=0; i<tdb->hash_size; i++) {
 
 		/* ignore hashchains[0], the freelist */
@@ -428,6 +524,9 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 	return 0;
 
 fail_unroll_allrecord_lock:
+	if (m->allrecord_lock == F_WRLCK) {
+		tdb_seqlock_write_end(tdb_mutex_seqlocks(tdb), 0);
+	}
 	m->allrecord_lock = F_UNLCK;
 
 fail_unlock_allrecord_mutex:
@@ -467,6 +566,7 @@ int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb)
 	}
 
 	m->allrecord_lock = F_WRLCK;
+	tdb_seqlock_write_begin(tdb_mutex_seqlocks(tdb), 0);
 
 	for (i=0; i<tdb->hash_size; i++) {
 
@@ -491,6 +591,7 @@ int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb)
 	return 0;
 
 fail_unroll_allrecord_lock:
+	tdb_seqlock_write_end(tdb_mutex_seqlocks(tdb), 0);
 	m->allrecord_lock = F_RDLCK;
 	tdb->ecode = TDB_ERR_LOCK;
 	return -1;
@@ -513,6 +614,7 @@ void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb)
 		return;
 	}
 
+	tdb_seqlock_write_end(tdb_mutex_seqlocks(tdb), 0);
 	m->allrecord_lock = F_RDLCK;
 	return;
 }
@@ -543,10 +645,16 @@ int tdb_mutex_allrecord_unlock(struct tdb_context *tdb)
 	}
 
 	old = m->allrecord_lock;
+	if (old == F_WRLCK) {
+		tdb_seqlock_write_end(tdb_mutex_seqlocks(tdb), 0);
+	}
 	m->allrecord_lock = F_UNLCK;
 
 	ret = pthread_mutex_unlock(&m->allrecord_mutex);
 	if (ret != 0) {
+		if (old == F_WRLCK) {
+			tdb_seqlock_write_begin(tdb_mutex_seqlocks(tdb), 0);
+		}
 		m->allrecord_lock = old;
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "pthread_mutex_unlock"
 			 "(allrecord_mutex) failed: %s\n", strerror(ret)));
@@ -596,6 +704,11 @@ int tdb_mutex_init(struct tdb_context *tdb)
 
 	m->allrecord_lock = F_UNLCK;
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		uint32_t *seqlocks = tdb_mutex_seqlocks(tdb);
+		memset(seqlocks, 0, (tdb->hash_size + 1) * sizeof(uint32_t));
+	}
+
 	ret = pthread_mutex_init(&m->allrecord_mutex, &ma);
 	if (ret != 0) {
 		goto fail;
@@ -1017,6 +1130,67 @@ cleanup:
 	return tdb_mutex_locking_cached;
 }
 
+#ifdef USE_TDB_SEQLOCK
+
+bool tdb_seqlock_supported(void)
+{
+	return true;
+}
+
+bool tdb_have_seqlock(struct tdb_context *tdb)
+{
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK)) {
+		return false;
+	}
+	if (tdb->mutexes == NULL) {
+		return false;
+	}
+	if (tdb->flags & TDB_NOLOCK) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Start a lock-free read of the chain for "hash". Returns false if a
+ * writer is active, the caller should take the chain lock then. The
+ * reads of the chain have to be followed by tdb_seqlock_read_valid()
+ * before anything found there may be used.
+ */
+bool tdb_seqlock_read_begin(struct tdb_context *tdb, uint32_t hash,
+			    struct tdb_seqlock_read *s)
+{
+	uint32_t *seqlocks = tdb_mutex_seqlocks(tdb);
+
+	s->idx = BUCKET(hash) + 1;
+
+	/*
+	 * The allrecord counter first: An allrecord locker bumps it
+	 * before it waits for the chain mutexes to be released.
+	 */
+	s->allrecord_seq = __atomic_load_n(&seqlocks[0], __ATOMIC_ACQUIRE);
+	s->chain_seq = __atomic_load_n(&seqlocks[s->idx], __ATOMIC_ACQUIRE);
+
+	return (((s->allrecord_seq | s->chain_seq) & 1) == 0);
+}
+
+bool tdb_seqlock_read_valid(struct tdb_context *tdb,
+			    const struct tdb_seqlock_read *s)
+{
+	uint32_t *seqlocks = tdb_mutex_seqlocks(tdb);
+	uint32_t chain_seq, allrecord_seq;
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	chain_seq = __atomic_load_n(&seqlocks[s->idx], __ATOMIC_RELAXED);
+	allrecord_seq = __atomic_load_n(&seqlocks[0], __ATOMIC_RELAXED);
+
+	return ((chain_seq == s->chain_seq) &&
+		(allrecord_seq == s->allrecord_seq));
+}
+
+#endif /* USE_TDB_SEQLOCK */
+
 #else
 
 size_t tdb_mutex_size(struct tdb_context *tdb)
@@ -1076,3 +1250,29 @@ _PUBLIC_ bool tdb_runtime_check_for_robust_mutexes(void)
 }
 
 #endif
+
+#ifndef USE_TDB_SEQLOCK
+
+bool tdb_seqlock_supported(void)
+{
+	return false;
+}
+
+bool tdb_have_seqlock(struct tdb_context *tdb)
+{
+	return false;
+}
+
+bool tdb_seqlock_read_begin(struct tdb_context *tdb, uint32_t hash,
+			    struct tdb_seqlock_read *s)
+{
+	return false;
+}
+
+bool tdb_seqlock_read_valid(struct tdb_context *tdb,
+			    const struct tdb_seqlock_read *s)
+{
+	return false;
+}
+
+#endif
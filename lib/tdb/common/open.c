@@ -85,6 +85,25 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
 	}
 
+	/*
+	 * Without the atomics the sequence counters need we just
+	 * create a tdb without TDB_FEATURE_FLAG_SEQLOCK, it's only
+	 * an optimization for the readers.
+	 */
+	if ((tdb->flags & TDB_MUTEX_LOCKING) &&
+	    (tdb->flags & TDB_SEQLOCK_READ) &&
+	    tdb_seqlock_supported()) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_SEQLOCK;
+	}
+
+	if (tdb->flags & TDB_RESIZABLE_HASH) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_SUBHASH;
+	}
+
+	if (tdb->flags & TDB_SIZE_CLASSES) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_FREELISTS;
+	}
+
 	/*
 	 * If we have any features we add the FEATURE_FLAG_MAGIC, overwriting the
 	 * TDB_HASH_RWLOCK_MAGIC above.
@@ -246,6 +265,19 @@ static bool tdb_mutex_open_ok(struct tdb_context *tdb,
 		return false;
 	}
 
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) &&
+	    !tdb_seqlock_supported()) {
+		/*
+		 * We would not maintain the sequence counters
+		 * for the lock-free readers.
+		 */
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mutex_open_ok[%s]: "
+			 "Can't write to SEQLOCK_READ databases "
+			 "without atomics support\n",
+			 tdb->name));
+		return false;
+	}
+
 	if (tdb_mutex_size(tdb) != header->mutex_size) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mutex_open_ok[%s]: "
 			 "Mutex size changed from %"PRIu32" to %zu\n.",
@@ -367,7 +399,8 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		tdb->read_only = 1;
 		/* read only databases don't do locking or clear if first */
 		tdb->flags |= TDB_NOLOCK;
-		tdb->flags &= ~(TDB_CLEAR_IF_FIRST|TDB_MUTEX_LOCKING);
+		tdb->flags &= ~(TDB_CLEAR_IF_FIRST|TDB_MUTEX_LOCKING|
+				TDB_SEQLOCK_READ);
 	}
 
 	if ((tdb->flags & TDB_ALLOW_NESTING) &&
@@ -429,6 +462,19 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		}
 	}
 
+	if ((tdb->flags & TDB_SEQLOCK_READ) &&
+	    !(tdb->flags & TDB_MUTEX_LOCKING)) {
+		/*
+		 * The sequence counters live in the mutex area,
+		 * it's the only part of the file that's not remapped.
+		 */
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+			"invalid flags for %s - TDB_SEQLOCK_READ "
+			"requires TDB_MUTEX_LOCKING\n", name));
+		errno = EINVAL;
+		goto fail;
+	}
+
 	if (getenv("TDB_NO_FSYNC")) {
 		tdb->flags |= TDB_NOSYNC;
 	}
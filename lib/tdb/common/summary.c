@@ -24,6 +24,7 @@
 	"Incompatible hash: %s\n" \
 	"Active/supported feature flags: 0x%08x/0x%08x\n" \
 	"Robust mutexes locking: %s\n" \
+	"Lock-free reads: %s\n" \
 	"Smallest/average/largest keys: %zu/%zu/%zu\n" \
 	"Smallest/average/largest data: %zu/%zu/%zu\n" \
 	"Smallest/average/largest padding: %zu/%zu/%zu\n" \
@@ -33,6 +34,7 @@
 	"Smallest/average/largest free records: %zu/%zu/%zu\n" \
 	"Number of hash chains: %zu\n" \
 	"Smallest/average/largest hash chains: %zu/%zu/%zu\n" \
+	"Number of split hash chains/sub-chains: %zu/%zu\n" \
 	"Number of uncoalesced records: %zu\n" \
 	"Smallest/average/largest uncoalesced runs: %zu/%zu/%zu\n" \
 	"Percentage keys/data/padding/free/dead/rechdrs&tailers/hashes: %.0f/%.0f/%.0f/%.0f/%.0f/%.0f/%.0f\n"
@@ -69,13 +71,13 @@ static size_t tally_mean(const struct tally *tally)
 	return tally->total / tally->num;
 }
 
-static size_t get_hash_length(struct tdb_context *tdb, unsigned int i)
+static size_t get_hash_length(struct tdb_context *tdb, tdb_off_t head)
 {
 	tdb_off_t rec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
 	size_t count = 0;
 
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(i), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, head, &rec_ptr) == -1)
 		return 0;
 
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
@@ -100,11 +102,12 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 {
 	off_t file_size;
 	tdb_off_t off, rec_off;
-	struct tally freet, keys, data, dead, extra, hashval, uncoal;
+	struct tally freet, keys, data, dead, extra, hashval, uncoal, subhash;
 	struct tdb_record rec;
 	char *ret = NULL;
 	bool locked;
 	size_t unc = 0;
+	size_t num_split = 0;
 	int len;
 	struct tdb_record recovery;
 
@@ -129,6 +132,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	tally_init(&extra);
 	tally_init(&hashval);
 	tally_init(&uncoal);
+	tally_init(&subhash);
 
 	for (off = TDB_DATA_START(tdb->hash_size);
 	     off < tdb->map_size - 1;
@@ -150,6 +154,12 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 			tally_add(&freet, rec.rec_len);
 			unc++;
 			break;
+		case TDB_SUBHASH_MAGIC:
+			tally_add(&subhash, rec.data_len);
+			if (unc > 1)
+				tally_add(&uncoal, unc - 1);
+			unc = 0;
+			break;
 		/* If we crash after ftruncate, we can get zeroes or fill. */
 		case TDB_RECOVERY_INVALID_MAGIC:
 		case 0x42424242:
@@ -174,8 +184,19 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	if (unc > 1)
 		tally_add(&uncoal, unc - 1);
 
-	for (off = 0; off < tdb->hash_size; off++)
-		tally_add(&hashval, get_hash_length(tdb, off));
+	for (off = 0; off < tdb->hash_size; off++) {
+		tdb_off_t table;
+		uint32_t i, num;
+
+		if (tdb_hash_chains(tdb, off, &table, &num) == -1)
+			goto unlock;
+		if (num > 1)
+			num_split++;
+		for (i = 0; i < num; i++) {
+			tally_add(&hashval, get_hash_length(
+					  tdb, table + i * sizeof(tdb_off_t)));
+		}
+	}
 
 	file_size = tdb->hdr_ofs + tdb->map_size;
 
@@ -186,6 +207,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 (tdb->hash_fn == tdb_jenkins_hash)?"yes":"no",
 		 (unsigned)tdb->feature_flags, TDB_SUPPORTED_FEATURE_FLAGS,
 		 (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX)?"yes":"no",
+		 (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK)?"yes":"no",
 		 keys.min, tally_mean(&keys), keys.max,
 		 data.min, tally_mean(&data), data.max,
 		 extra.min, tally_mean(&extra), extra.max,
@@ -195,6 +217,8 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 freet.min, tally_mean(&freet), freet.max,
 		 hashval.num,
 		 hashval.min, tally_mean(&hashval), hashval.max,
+		 num_split,
+		 num_split ? hashval.num - (tdb->hash_size - num_split) : 0,
 		 uncoal.total,
 		 uncoal.min, tally_mean(&uncoal), uncoal.max,
 		 keys.total * 100.0 / file_size,
@@ -202,10 +226,10 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 extra.total * 100.0 / file_size,
 		 freet.total * 100.0 / file_size,
 		 dead.total * 100.0 / file_size,
-		 (keys.num + freet.num + dead.num)
+		 (keys.num + freet.num + dead.num + subhash.num)
 		 * (sizeof(struct tdb_record) + sizeof(uint32_t))
 		 * 100.0 / file_size,
-		 tdb->hash_size * sizeof(tdb_off_t)
+		 (tdb->hash_size * sizeof(tdb_off_t) + subhash.total)
 		 * 100.0 / file_size);
 	if (len == -1) {
 		goto unlock;
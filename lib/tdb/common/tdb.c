@@ -117,16 +117,93 @@ bool tdb_chainwalk_check(struct tdb_context *tdb,
 	return true;
 }
 
+/*
+ * Find the chain heads of the hash bucket "list". Usually this is
+ * just the hash top. With TDB_FEATURE_FLAG_SUBHASH the hash top of a
+ * bucket that has been split points at a TDB_SUBHASH_MAGIC record,
+ * its data is an array of *pnum sub-chain heads.
+ */
+int tdb_hash_chains(struct tdb_context *tdb, uint32_t list,
+		    tdb_off_t *ptable, uint32_t *pnum)
+{
+	struct tdb_record rec;
+	tdb_off_t top;
+	uint32_t num;
+
+	*ptable = TDB_HASH_TOP(list);
+	*pnum = 1;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SUBHASH)) {
+		return 0;
+	}
+
+	if (tdb_ofs_read(tdb, TDB_HASH_TOP(list), &top) == -1) {
+		return -1;
+	}
+	if (top == 0) {
+		return 0;
+	}
+	if (tdb->methods->tdb_read(tdb, top, &rec, sizeof(rec),
+				   DOCONV()) == -1) {
+		return -1;
+	}
+	if (rec.magic != TDB_SUBHASH_MAGIC) {
+		return 0;
+	}
+
+	num = rec.data_len / sizeof(tdb_off_t);
+
+	if ((rec.key_len != 0) || (rec.full_hash != BUCKET(list)) ||
+	    (rec.data_len % sizeof(tdb_off_t) != 0) ||
+	    (num < 2) || (num > TDB_SUBHASH_MAX) || ((num & (num-1)) != 0) ||
+	    (rec.rec_len < rec.data_len + sizeof(tdb_off_t))) {
+		tdb->ecode = TDB_ERR_CORRUPT;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_hash_chains: bad "
+			 "sub-hash record at offset %u for chain %u\n",
+			 top, BUCKET(list)));
+		return -1;
+	}
+	if (tdb_oob(tdb, top + sizeof(rec), rec.data_len, 0) != 0) {
+		return -1;
+	}
+
+	*ptable = top + sizeof(rec);
+	*pnum = num;
+	return 0;
+}
+
+/*
+ * Return the offset of the pointer to the first record of the
+ * (sub-)chain "hash" belongs into.
+ */
+int tdb_hash_head(struct tdb_context *tdb, uint32_t hash, tdb_off_t *phead)
+{
+	tdb_off_t table;
+	uint32_t num;
+	int ret;
+
+	ret = tdb_hash_chains(tdb, hash, &table, &num);
+	if (ret == -1) {
+		return -1;
+	}
+	*phead = table + tdb_subhash_index(hash, num) * sizeof(tdb_off_t);
+	return 0;
+}
+
 /* Returns 0 on fail.  On success, return offset of record, and fills
    in rec */
 static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 			struct tdb_record *r)
 {
-	tdb_off_t rec_ptr;
+	tdb_off_t rec_ptr, head;
 	struct tdb_chainwalk_ctx chainwalk;
 
+	tdb->last_chain_len = 0;
+
 	/* read in the hash top */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
+	if (tdb_hash_head(tdb, hash, &head) == -1)
+		return 0;
+	if (tdb_ofs_read(tdb, head, &rec_ptr) == -1)
 		return 0;
 
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
@@ -138,6 +215,8 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 		if (tdb_rec_read(tdb, rec_ptr, r) == -1)
 			return 0;
 
+		tdb->last_chain_len += 1;
+
 		if (!TDB_DEAD(r) && hash==r->full_hash
 		    && key.dsize==r->key_len
 		    && tdb_parse_data(tdb, key, rec_ptr + sizeof(*r),
@@ -169,6 +248,166 @@ tdb_off_t tdb_find_lock_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t has
 	return rec_ptr;
 }
 
+/*
+ * How often a lock-free reader retries after having raced with a
+ * writer before it takes the chain lock.
+ */
+#define TDB_SEQLOCK_READ_RETRIES 3
+
+/*
+ * Look up a record without locking its hash chain, for databases with
+ * TDB_FEATURE_FLAG_SEQLOCK.
+ *
+ * The chain is walked directly in our mmap while other processes
+ * might change it, so nothing read there can be trusted before
+ * tdb_seqlock_read_valid() said there was no writer: All offsets are
+ * checked against our map_size (we can't remap here), the walk is
+ * bounded and the data is copied out before the check. If data is
+ * not NULL, it gets the copy: In buf if it fits, malloc'ed otherwise.
+ *
+ * Returns 0 if the record was found, -1 if it does not exist and -2 if
+ * the caller has to find it with the chain locked.
+ */
+static int tdb_find_seqlock(struct tdb_context *tdb, TDB_DATA key,
+			    uint32_t hash, uint8_t *buf, size_t buflen,
+			    TDB_DATA *data)
+{
+	int i;
+
+	if (!tdb_have_seqlock(tdb)) {
+		return -2;
+	}
+	if ((tdb->transaction != NULL) || (tdb->map_ptr == NULL) ||
+	    (tdb->flags & TDB_CONVERT)) {
+		return -2;
+	}
+
+	for (i=0; i<TDB_SEQLOCK_READ_RETRIES; i++) {
+		struct tdb_seqlock_read seq;
+		const uint8_t *map = (const uint8_t *)tdb->map_ptr;
+		tdb_len_t map_size = tdb->map_size;
+		tdb_len_t max_records = map_size / sizeof(struct tdb_record);
+		tdb_len_t num_records = 0;
+		tdb_off_t rec_ptr;
+		uint8_t *dptr = NULL;
+		bool found = false;
+		bool bad = false;
+
+		if (!tdb_seqlock_read_begin(tdb, hash, &seq)) {
+			/*
+			 * A writer is in the chain, better wait for
+			 * it in the chain lock than spin.
+			 */
+			return -2;
+		}
+
+		memcpy(&rec_ptr, map + TDB_HASH_TOP(hash), sizeof(rec_ptr));
+
+		if ((rec_ptr != 0) &&
+		    (tdb->feature_flags & TDB_FEATURE_FLAG_SUBHASH) &&
+		    (rec_ptr <= map_size) &&
+		    (map_size - rec_ptr >= sizeof(struct tdb_record))) {
+			struct tdb_record rec;
+			uint32_t num;
+
+			memcpy(&rec, map + rec_ptr, sizeof(rec));
+
+			num = rec.data_len / sizeof(tdb_off_t);
+
+			if (rec.magic == TDB_SUBHASH_MAGIC) {
+				tdb_off_t head;
+
+				if ((num == 0) || ((num & (num-1)) != 0) ||
+				    (map_size - rec_ptr - sizeof(rec) <
+				     rec.data_len)) {
+					bad = true;
+					rec_ptr = 0;
+				} else {
+					head = rec_ptr + sizeof(rec) +
+						tdb_subhash_index(hash, num) *
+						sizeof(tdb_off_t);
+					memcpy(&rec_ptr, map + head,
+					       sizeof(rec_ptr));
+				}
+			}
+		}
+
+		while (rec_ptr != 0) {
+			struct tdb_record rec;
+			uint64_t rec_end;
+
+			if ((rec_ptr > map_size) ||
+			    (map_size - rec_ptr < sizeof(rec)) ||
+			    (num_records++ > max_records)) {
+				bad = true;
+				break;
+			}
+			memcpy(&rec, map + rec_ptr, sizeof(rec));
+
+			if (TDB_BAD_MAGIC(&rec)) {
+				bad = true;
+				break;
+			}
+
+			rec_end = (uint64_t)rec_ptr + sizeof(rec) +
+				rec.key_len + rec.data_len;
+			if (rec_end > map_size) {
+				bad = true;
+				break;
+			}
+
+			if (!TDB_DEAD(&rec) && (hash == rec.full_hash) &&
+			    (key.dsize == rec.key_len) &&
+			    (memcmp(map + rec_ptr + sizeof(rec), key.dptr,
+				    key.dsize) == 0)) {
+				found = true;
+			}
+
+			if (found && (data != NULL)) {
+				const uint8_t *src = map + rec_ptr +
+					sizeof(rec) + rec.key_len;
+
+				if ((buf != NULL) && (rec.data_len <= buflen)) {
+					dptr = buf;
+				} else {
+					dptr = malloc(rec.data_len ?
+						      rec.data_len : 1);
+					if (dptr == NULL) {
+						return -2;
+					}
+				}
+				memcpy(dptr, src, rec.data_len);
+				*data = (TDB_DATA) {
+					.dptr = dptr, .dsize = rec.data_len
+				};
+			}
+			if (found) {
+				break;
+			}
+
+			rec_ptr = rec.next;
+		}
+
+		if (tdb_seqlock_read_valid(tdb, &seq)) {
+			if (bad) {
+				/*
+				 * Beyond our mmap or corrupt, the
+				 * locked path deals with it.
+				 */
+				return -2;
+			}
+			tdb->last_chain_len = num_records;
+			return found ? 0 : -1;
+		}
+
+		if (dptr != buf) {
+			free(dptr);
+		}
+	}
+
+	return -2;
+}
+
 static TDB_DATA _tdb_fetch(struct tdb_context *tdb, TDB_DATA key);
 
 struct tdb_update_hash_state {
@@ -277,6 +516,15 @@ static TDB_DATA _tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
+
+	switch (tdb_find_seqlock(tdb, key, hash, NULL, 0, &ret)) {
+	case 0:
+		return ret;
+	case -1:
+		tdb->ecode = TDB_ERR_NOEXIST;
+		return tdb_null;
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec)))
 		return tdb_null;
 
@@ -310,6 +558,10 @@ _PUBLIC_ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
  * This is interesting for all readers of potentially large data structures in
  * the tdb records, ldb indexes being one example.
  *
+ * With TDB_SEQLOCK_READ the parser is mostly called without any lock, on
+ * a private copy of the data that was verified not to have been changed
+ * while it was copied.
+ *
  * Return -1 if the record was not found.
  */
 
@@ -320,12 +572,29 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 {
 	tdb_off_t rec_ptr;
 	struct tdb_record rec;
+	uint8_t buf[1024];
+	TDB_DATA data;
 	int ret;
 	uint32_t hash;
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
 
+	ret = tdb_find_seqlock(tdb, key, hash, buf, sizeof(buf), &data);
+	if (ret == 0) {
+		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, 0);
+		ret = parser(key, data, private_data);
+		if (data.dptr != buf) {
+			free(data.dptr);
+		}
+		return ret;
+	}
+	if (ret == -1) {
+		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, -1);
+		tdb->ecode = TDB_ERR_NOEXIST;
+		return -1;
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec))) {
 		/* record not found */
 		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, -1);
@@ -352,6 +621,14 @@ static int tdb_exists_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t hash)
 {
 	struct tdb_record rec;
 
+	switch (tdb_find_seqlock(tdb, key, hash, NULL, 0, NULL)) {
+	case 0:
+		return 1;
+	case -1:
+		tdb->ecode = TDB_ERR_NOEXIST;
+		return 0;
+	}
+
 	if (tdb_find_lock_hash(tdb, key, hash, F_RDLCK, &rec) == 0)
 		return 0;
 	tdb_unlock(tdb, BUCKET(rec.full_hash), F_RDLCK);
@@ -413,7 +690,10 @@ int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash)
 	int num_dead = 0;
 	int ret;
 
-	last_ptr = TDB_HASH_TOP(hash);
+	ret = tdb_hash_head(tdb, hash, &last_ptr);
+	if (ret == -1) {
+		return -1;
+	}
 
 	/*
 	 * Init chainwalk with the pointer to the hash top. It might
@@ -563,7 +843,8 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 
 	length += sizeof(tdb_off_t); /* tailer */
 
-	last_ptr = TDB_HASH_TOP(hash);
+	if (tdb_hash_head(tdb, hash, &last_ptr) == -1)
+		return 0;
 
 	/* read in the hash top */
 	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
@@ -602,13 +883,258 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 	return best_rec_ptr;
 }
 
+/*
+ * Walk all (sub-)chains of the bucket "hash" belongs into, calling
+ * fn for every record. Stops when fn returns nonzero.
+ */
+static int tdb_hash_walk(struct tdb_context *tdb, uint32_t hash,
+			 int (*fn)(struct tdb_context *tdb, tdb_off_t rec_ptr,
+				   const struct tdb_record *rec,
+				   void *private_data),
+			 void *private_data)
+{
+	tdb_off_t table;
+	uint32_t i, num;
+
+	if (tdb_hash_chains(tdb, hash, &table, &num) == -1) {
+		return -1;
+	}
+
+	for (i=0; i<num; i++) {
+		struct tdb_chainwalk_ctx chainwalk;
+		struct tdb_record rec;
+		tdb_off_t rec_ptr;
+		int ret;
+
+		if (tdb_ofs_read(tdb, table + i * sizeof(tdb_off_t),
+				 &rec_ptr) == -1) {
+			return -1;
+		}
+
+		tdb_chainwalk_init(&chainwalk, rec_ptr);
+
+		while (rec_ptr != 0) {
+			if (tdb_rec_read(tdb, rec_ptr, &rec) == -1) {
+				return -1;
+			}
+			ret = fn(tdb, rec_ptr, &rec, private_data);
+			if (ret != 0) {
+				return ret;
+			}
+			rec_ptr = rec.next;
+			if (!tdb_chainwalk_check(tdb, &chainwalk, rec_ptr)) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+struct tdb_hash_split_state {
+	uint32_t new_num;
+	uint32_t sub;
+	uint32_t num_records;
+	uint32_t num_same_sub;
+	tdb_off_t *heads;
+};
+
+static int tdb_hash_split_check(struct tdb_context *tdb, tdb_off_t rec_ptr,
+				const struct tdb_record *rec,
+				void *private_data)
+{
+	struct tdb_hash_split_state *state = private_data;
+
+	/*
+	 * A traverse sitting on a record in this chain relies on
+	 * rec->next to continue, leave the chain alone then.
+	 */
+	if (tdb_write_lock_record(tdb, rec_ptr) == -1) {
+		return 1;
+	}
+	tdb_write_unlock_record(tdb, rec_ptr);
+
+	state->num_records += 1;
+	if (tdb_subhash_index(rec->full_hash, state->new_num) == state->sub) {
+		state->num_same_sub += 1;
+	}
+	return 0;
+}
+
+/*
+ * Called with the chain "hash" write-locked after its (sub-)chain
+ * got chain_len records long. Redistribute the records of the bucket
+ * over twice as many sub-chains.
+ *
+ * The bucket stays the unit of locking, so only the lookups get
+ * cheaper, there's no change in the lock layout that would have to
+ * be coordinated with other openers.
+ */
+static int tdb_hash_split(struct tdb_context *tdb, uint32_t hash,
+			  uint32_t chain_len)
+{
+	struct tdb_hash_split_state state = { .num_records = 0 };
+	struct tdb_record rec;
+	tdb_off_t table, new_top, rec_ptr;
+	tdb_len_t heads_len;
+	uint32_t i, num, new_num;
+	uint32_t num_records = 0;
+	int ret;
+
+	ret = tdb_hash_chains(tdb, hash, &table, &num);
+	if (ret == -1) {
+		return -1;
+	}
+	if (num >= TDB_SUBHASH_MAX) {
+		return 0;
+	}
+	new_num = (num == 1) ? TDB_SUBHASH_FIRST : num * 2;
+
+	state.new_num = new_num;
+	state.sub = tdb_subhash_index(hash, new_num);
+
+	ret = tdb_hash_walk(tdb, hash, tdb_hash_split_check, &state);
+	if (ret == -1) {
+		return -1;
+	}
+	if (ret != 0) {
+		/* Try again with the next insert */
+		return 0;
+	}
+	if (state.num_same_sub > chain_len / 2) {
+		/*
+		 * Mostly colliding hashes, splitting would hardly
+		 * shorten the chain.
+		 */
+		return 0;
+	}
+
+	heads_len = new_num * sizeof(tdb_off_t);
+
+	state.heads = calloc(new_num, sizeof(tdb_off_t));
+	if (state.heads == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+
+	/*
+	 * This might take dead records out of our chains, so do it
+	 * before relinking.
+	 */
+	new_top = tdb_allocate(tdb, hash, heads_len, &rec);
+	if (new_top == 0) {
+		goto fail;
+	}
+
+	ret = tdb_hash_chains(tdb, hash, &table, &num);
+	if (ret == -1) {
+		goto fail_free;
+	}
+
+	/*
+	 * No chainwalk check from here on, it would follow the next
+	 * pointers we rewrite. tdb_hash_walk() above found the chains
+	 * to be fine, and they can only have become shorter.
+	 */
+	for (i=0; i<num; i++) {
+		ret = tdb_ofs_read(tdb, table + i * sizeof(tdb_off_t),
+				   &rec_ptr);
+		if (ret == -1) {
+			goto fail_free;
+		}
+
+		while (rec_ptr != 0) {
+			struct tdb_record r;
+			uint32_t sub;
+
+			if (num_records++ >= state.num_records) {
+				tdb->ecode = TDB_ERR_CORRUPT;
+				goto fail_free;
+			}
+
+			ret = tdb_rec_read(tdb, rec_ptr, &r);
+			if (ret == -1) {
+				goto fail_free;
+			}
+
+			sub = tdb_subhash_index(r.full_hash, new_num);
+
+			/* next is the first field of struct tdb_record */
+			ret = tdb_ofs_write(tdb, rec_ptr, &state.heads[sub]);
+			if (ret == -1) {
+				goto fail;
+			}
+			state.heads[sub] = rec_ptr;
+
+			rec_ptr = r.next;
+		}
+	}
+
+	rec.next = 0;
+	rec.key_len = 0;
+	rec.data_len = heads_len;
+	rec.full_hash = BUCKET(hash);
+	rec.magic = TDB_SUBHASH_MAGIC;
+
+	ret = tdb_rec_write(tdb, new_top, &rec);
+	if (ret == -1) {
+		goto fail;
+	}
+	if (DOCONV()) {
+		tdb_convert(state.heads, heads_len);
+	}
+	ret = tdb->methods->tdb_write(tdb, new_top + sizeof(rec),
+				      state.heads, heads_len);
+	if (ret == -1) {
+		goto fail;
+	}
+	ret = tdb_ofs_write(tdb, TDB_HASH_TOP(hash), &new_top);
+	if (ret == -1) {
+		goto fail;
+	}
+
+	SAFE_FREE(state.heads);
+
+	if (num > 1) {
+		tdb_off_t old_top = table - sizeof(rec);
+
+		ret = tdb->methods->tdb_read(tdb, old_top, &rec, sizeof(rec),
+					     DOCONV());
+		if (ret == -1) {
+			return -1;
+		}
+		ret = tdb_free(tdb, old_top, &rec);
+		if (ret == -1) {
+			return -1;
+		}
+	}
+
+	TDB_LOG((tdb, TDB_DEBUG_TRACE, "tdb_hash_split: split chain %u "
+		 "into %u sub-chains\n", BUCKET(hash), new_num));
+	return 0;
+
+fail_free:
+	/*
+	 * Nothing relinked yet, we can give back the space.
+	 */
+	if (num_records == 0) {
+		tdb_free(tdb, new_top, &rec);
+	}
+fail:
+	SAFE_FREE(state.heads);
+	TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_hash_split: failed to split "
+		 "chain %u\n", BUCKET(hash)));
+	return -1;
+}
+
 static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 		       const TDB_DATA *dbufs, int num_dbufs,
 		       int flag, uint32_t hash)
 {
 	struct tdb_record rec;
-	tdb_off_t rec_ptr, ofs;
+	tdb_off_t rec_ptr, ofs, head;
 	tdb_len_t rec_len, dbufs_len;
+	uint32_t chain_len;
 	int i;
 	int ret = -1;
 
@@ -663,6 +1189,9 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 	if (flag != TDB_INSERT)
 		tdb_delete_hash(tdb, key, hash);
 
+	/* the lookups above walked the chain we are about to extend */
+	chain_len = tdb->last_chain_len;
+
 	/* we have to allocate some space */
 	rec_ptr = tdb_allocate(tdb, hash, rec_len, &rec);
 
@@ -671,7 +1200,9 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 	}
 
 	/* Read hash top into next ptr */
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec.next) == -1)
+	if (tdb_hash_head(tdb, hash, &head) == -1)
+		goto fail;
+	if (tdb_ofs_read(tdb, head, &rec.next) == -1)
 		goto fail;
 
 	rec.key_len = key.dsize;
@@ -707,12 +1238,28 @@ static int _tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 		ofs += dbufs[i].dsize;
 	}
 
-	ret = tdb_ofs_write(tdb, TDB_HASH_TOP(hash), &rec_ptr);
+	ret = tdb_ofs_write(tdb, head, &rec_ptr);
 	if (ret == -1) {
 		/* Need to tdb_unallocate() here */
 		goto fail;
 	}
 
+	/*
+	 * Only try at power of two chain lengths, so a chain of
+	 * colliding hashes that splitting does not help doesn't get
+	 * walked over and over.
+	 */
+	chain_len += 1;
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_SUBHASH) &&
+	    (chain_len >= TDB_SUBHASH_SPLIT_LEN) &&
+	    ((chain_len & (chain_len - 1)) == 0)) {
+		/*
+		 * Best effort, the new record is stored
+		 * fine whatever happens here.
+		 */
+		tdb_hash_split(tdb, hash, chain_len);
+	}
+
  done:
 	ret = 0;
  fail:
@@ -1011,10 +1558,12 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 		}
 	}
 
-	/* wipe the freelist */
-	if (tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
-		goto failed;
+	/* wipe the freelists */
+	for (i=0;i<tdb_freelist_classes(tdb);i++) {
+		if (tdb_ofs_write(tdb, TDB_FREELIST_TOP(i), &offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
+			goto failed;
+		}
 	}
 
 	/* add all the rest of the file to the freelist, possibly leaving a gap
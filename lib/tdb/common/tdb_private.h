@@ -54,6 +54,7 @@ typedef uint32_t tdb_off_t;
 #define TDB_RECOVERY_INVALID_MAGIC (0x0)
 #define TDB_HASH_RWLOCK_MAGIC (0xbad1a51U)
 #define TDB_FEATURE_FLAG_MAGIC (0xbad1a52U)
+#define TDB_SUBHASH_MAGIC (0x5b4a54e1U)
 #define TDB_ALIGNMENT 4
 #define DEFAULT_HASH_SIZE 131
 #define FREELIST_TOP (sizeof(struct tdb_header))
@@ -70,11 +71,63 @@ typedef uint32_t tdb_off_t;
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_SEQLOCK 0x00000002
+#define TDB_FEATURE_FLAG_SUBHASH 0x00000004
+#define TDB_FEATURE_FLAG_FREELISTS 0x00000008
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_SEQLOCK | \
+	TDB_FEATURE_FLAG_SUBHASH | \
+	TDB_FEATURE_FLAG_FREELISTS | \
 	0)
 
+/*
+ * With TDB_FEATURE_FLAG_FREELISTS the free records are kept in
+ * TDB_FREELIST_CLASSES lists by size, see tdb_freelist_class().
+ * Class 0 uses FREELIST_TOP, the others start in the header.
+ */
+#define TDB_FREELIST_CLASSES 16
+#define TDB_FREELIST_TOP(c) ((c) == 0 ? FREELIST_TOP : \
+	offsetof(struct tdb_header, freelist_tops) + \
+	((c) - 1) * sizeof(tdb_off_t))
+
+/*
+ * With TDB_FEATURE_FLAG_SUBHASH a hash chain that got longer than
+ * TDB_SUBHASH_SPLIT_LEN records is split into TDB_SUBHASH_FIRST
+ * sub-chains, and the number of sub-chains doubles whenever one of
+ * them gets that long again, see tdb_hash_split().
+ */
+#define TDB_SUBHASH_SPLIT_LEN 16
+#define TDB_SUBHASH_FIRST 16
+#define TDB_SUBHASH_MAX 65536
+
+/*
+ * The sub-chain of a record in a bucket split into num sub-chains.
+ * The hashes in a bucket all have the same remainder modulo
+ * hash_size, and tdb_old_hash() hands out very regular values, so
+ * scramble them (the murmur3 finalizer) before taking the top bits.
+ */
+static inline uint32_t tdb_subhash_index(uint32_t hash, uint32_t num)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+	return ((uint64_t)hash * num) >> 32;
+}
+
+/*
+ * The writers of a TDB_FEATURE_FLAG_SEQLOCK database bump the
+ * sequence counters in the mutex area, see mutex.c.
+ */
+#if defined(USE_TDB_MUTEX_LOCKING) && \
+	defined(HAVE___ATOMIC_ADD_LOAD) && \
+	defined(HAVE_ATOMIC_THREAD_FENCE_SUPPORT)
+#define USE_TDB_SEQLOCK 1
+#endif
+
 /* NB assumes there is a local variable called "tdb" that is the
  * current context, also takes doubly-parenthesized print-style
  * argument. */
@@ -182,7 +235,9 @@ struct tdb_header {
 	uint32_t magic2_hash; /* hash of TDB_MAGIC. */
 	uint32_t feature_flags;
 	tdb_len_t mutex_size; /* set if TDB_FEATURE_FLAG_MUTEX is set */
-	tdb_off_t reserved[25];
+	/* set if TDB_FEATURE_FLAG_FREELISTS is set */
+	tdb_off_t freelist_tops[TDB_FREELIST_CLASSES - 1];
+	tdb_off_t reserved[26 - TDB_FREELIST_CLASSES];
 };
 
 struct tdb_lock_type {
@@ -196,6 +251,16 @@ struct tdb_chainwalk_ctx {
 	bool slow_chase;
 };
 
+/*
+ * Snapshot of the sequence counters a lock-free reader has to
+ * check again after having looked at a hash chain.
+ */
+struct tdb_seqlock_read {
+	uint32_t idx;
+	uint32_t allrecord_seq;
+	uint32_t chain_seq;
+};
+
 struct tdb_traverse_lock {
 	struct tdb_traverse_lock *next;
 	uint32_t off;
@@ -259,6 +324,7 @@ struct tdb_context {
 	struct tdb_transaction *transaction;
 	int page_size;
 	int max_dead_records;
+	uint32_t last_chain_len; /* records looked at by the last tdb_find() */
 #ifdef TDB_TRACE
 	int tracefd;
 #endif
@@ -302,6 +368,8 @@ int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 void *tdb_convert(void *buf, uint32_t size);
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+unsigned tdb_freelist_classes(struct tdb_context *tdb);
+unsigned tdb_freelist_class(struct tdb_context *tdb, tdb_len_t rec_len);
 tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 		       struct tdb_record *rec);
 
@@ -336,6 +404,9 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 			struct tdb_record *r, tdb_len_t length,
 			tdb_off_t *p_last_ptr);
 int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash);
+int tdb_hash_chains(struct tdb_context *tdb, uint32_t list,
+		    tdb_off_t *ptable, uint32_t *pnum);
+int tdb_hash_head(struct tdb_context *tdb, uint32_t hash, tdb_off_t *phead);
 void tdb_io_init(struct tdb_context *tdb);
 int tdb_expand(struct tdb_context *tdb, tdb_off_t size);
 tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size);
@@ -366,5 +437,11 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 int tdb_mutex_allrecord_unlock(struct tdb_context *tdb);
 int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb);
 void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb);
+bool tdb_seqlock_supported(void);
+bool tdb_have_seqlock(struct tdb_context *tdb);
+bool tdb_seqlock_read_begin(struct tdb_context *tdb, uint32_t hash,
+			    struct tdb_seqlock_read *s);
+bool tdb_seqlock_read_valid(struct tdb_context *tdb,
+			    const struct tdb_seqlock_read *s);
 
 #endif /* TDB_PRIVATE_H */
@@ -38,6 +38,9 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 
 	/* Lock each chain from the start one. */
 	for (; tlock->list < tdb->hash_size; tlock->list++) {
+		tdb_off_t table;
+		uint32_t sub = 0, num;
+
 		if (!tlock->off && tlock->list != 0) {
 			/* this is an optimisation for the common case where
 			   the hash chain is empty, which is particularly
@@ -76,10 +79,16 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 		if (tdb_lock(tdb, tlock->list, tlock->lock_rw) == -1)
 			return TDB_NEXT_LOCK_ERR;
 
+		/*
+		 * A split bucket has several sub-chains. They can't
+		 * be rearranged while we hold a record lock in there.
+		 */
+		if (tdb_hash_chains(tdb, tlock->list, &table, &num) == -1)
+			goto fail;
+
 		/* No previous record?  Start at top of chain. */
 		if (!tlock->off) {
-			if (tdb_ofs_read(tdb, TDB_HASH_TOP(tlock->list),
-				     &tlock->off) == -1)
+			if (tdb_ofs_read(tdb, table, &tlock->off) == -1)
 				goto fail;
 		} else {
 			/* Otherwise unlock the previous record. */
@@ -92,8 +101,10 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 			if (tdb_rec_read(tdb, tlock->off, rec) == -1)
 				goto fail;
 			tlock->off = rec->next;
+			sub = tdb_subhash_index(rec->full_hash, num);
 		}
 
+	next_sub:
 		/* Iterate through chain */
 		while( tlock->off) {
 			if (tdb_rec_read(tdb, tlock->off, rec) == -1)
@@ -115,6 +126,12 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 
 			tlock->off = rec->next;
 		}
+		if (++sub < num) {
+			if (tdb_ofs_read(tdb, table + sub * sizeof(tdb_off_t),
+					 &tlock->off) == -1)
+				goto fail;
+			goto next_sub;
+		}
 		tdb_unlock(tdb, tlock->list, tlock->lock_rw);
 		want_next = 0;
 	}
@@ -404,7 +421,8 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 				tdb_traverse_func fn,
 				void *private_data)
 {
-	tdb_off_t rec_ptr;
+	tdb_off_t table, rec_ptr;
+	uint32_t sub = 0, num;
 	struct tdb_chainwalk_ctx chainwalk;
 	int count = 0;
 	int ret;
@@ -426,7 +444,13 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 
 	tdb->traverse_read += 1;
 
-	ret = tdb_ofs_read(tdb, TDB_HASH_TOP(chain), &rec_ptr);
+	ret = tdb_hash_chains(tdb, chain, &table, &num);
+	if (ret == -1) {
+		goto fail;
+	}
+
+next_sub:
+	ret = tdb_ofs_read(tdb, table + sub * sizeof(tdb_off_t), &rec_ptr);
 	if (ret == -1) {
 		goto fail;
 	}
@@ -473,7 +497,7 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 			count += 1;
 
 			if (ret != 0) {
-				break;
+				goto done;
 			}
 		}
 
@@ -484,6 +508,12 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 			goto fail;
 		}
 	}
+
+	sub += 1;
+	if (sub < num) {
+		goto next_sub;
+	}
+done:
 	tdb->traverse_read -= 1;
 	tdb_unlock(tdb, chain, F_RDLCK);
 	return count;
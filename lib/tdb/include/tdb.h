@@ -97,6 +97,10 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_SEQLOCK_READ 8192 /** lock-free tdb_fetch/tdb_parse_record/tdb_exists, only valid in
+                                  combination with TDB_MUTEX_LOCKING, can't be opened by tdb < 1.4.10 */
+#define TDB_RESIZABLE_HASH 16384 /** split long hash chains on the fly, can't be opened by tdb < 1.4.10 */
+#define TDB_SIZE_CLASSES 32768 /** keep free records in lists by size, can't be opened by tdb < 1.4.10 */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
@@ -165,6 +169,20 @@ struct tdb_logging_context {
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_SEQLOCK_READ - Readers validate a per hash chain sequence counter
+ *                                            instead of taking the chain lock,
+ *                                            can't be opened by tdb < 1.4.10.
+ *                                            Only valid in combination with TDB_MUTEX_LOCKING,
+ *                                            only used when the database is created.\n
+ *                         TDB_RESIZABLE_HASH - Split hash chains that got too long into
+ *                                              sub-chains while the database is in use,
+ *                                              can't be opened by tdb < 1.4.10.
+ *                                              Only used when the database is created.\n
+ *                         TDB_SIZE_CLASSES - Keep the free space in separate lists by
+ *                                            size, so allocations don't have to search
+ *                                            a long free list. Can't be opened by
+ *                                            tdb < 1.4.10, only used when the database
+ *                                            is created.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -206,6 +224,20 @@ _PUBLIC_ struct tdb_context *tdb_open(const char *name, int hash_size, int tdb_f
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_SEQLOCK_READ - Readers validate a per hash chain sequence counter
+ *                                            instead of taking the chain lock,
+ *                                            can't be opened by tdb < 1.4.10.
+ *                                            Only valid in combination with TDB_MUTEX_LOCKING,
+ *                                            only used when the database is created.\n
+ *                         TDB_RESIZABLE_HASH - Split hash chains that got too long into
+ *                                              sub-chains while the database is in use,
+ *                                              can't be opened by tdb < 1.4.10.
+ *                                              Only used when the database is created.\n
+ *                         TDB_SIZE_CLASSES - Keep the free space in separate lists by
+ *                                            size, so allocations don't have to search
+ *                                            a long free list. Can't be opened by
+ *                                            tdb < 1.4.10, only used when the database
+ *                                            is created.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
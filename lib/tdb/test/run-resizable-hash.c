@@ -0,0 +1,191 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/summary.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 3000
+
+static unsigned char seen[NUM_RECORDS * 2];
+
+static int count_seen(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		      void *private_data)
+{
+	unsigned int *num_bad = private_data;
+	uint32_t k;
+
+	if (key.dsize != sizeof(k)) {
+		*num_bad += 1;
+		return 0;
+	}
+	memcpy(&k, key.dptr, sizeof(k));
+	if ((k >= NUM_RECORDS * 2) || (data.dsize != sizeof(k)) ||
+	    (memcmp(data.dptr, &k, sizeof(k)) != 0)) {
+		*num_bad += 1;
+		return 0;
+	}
+	seen[k] += 1;
+	return 0;
+}
+
+/* Store more records while we traverse, splitting chains under us */
+static int store_more(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		      void *private_data)
+{
+	uint32_t k;
+
+	memcpy(&k, key.dptr, sizeof(k));
+	if (k < NUM_RECORDS) {
+		uint32_t n = k + NUM_RECORDS;
+		TDB_DATA nkey = { .dptr = (uint8_t *)&n, .dsize = sizeof(n) };
+
+		if (tdb_store(tdb, nkey, nkey, TDB_INSERT) != 0) {
+			return -1;
+		}
+	}
+	return count_seen(tdb, key, data, private_data);
+}
+
+static bool check_records(struct tdb_context *tdb, uint32_t first,
+			  uint32_t last, uint32_t step)
+{
+	uint32_t k;
+
+	for (k = first; k < last; k += step) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		TDB_DATA data = tdb_fetch(tdb, key);
+		bool ok;
+
+		ok = (data.dsize == sizeof(k)) &&
+			(memcmp(data.dptr, &k, sizeof(k)) == 0);
+		free(data.dptr);
+		if (!ok) {
+			diag("record %u missing", (unsigned)k);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, j;
+	struct tdb_context *tdb;
+	int flags[] = { TDB_DEFAULT, TDB_NOMMAP, TDB_CONVERT,
+			TDB_NOMMAP|TDB_CONVERT,
+			TDB_MUTEX_LOCKING|TDB_SEQLOCK_READ };
+	uint32_t k;
+	TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+	char *summary;
+	tdb_off_t table;
+	uint32_t num;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 17);
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		unsigned int num_bad = 0;
+		unsigned int num_wrong = 0;
+		int count;
+
+		if ((flags[i] & TDB_MUTEX_LOCKING) &&
+		    !tdb_runtime_check_for_robust_mutexes()) {
+			skip(17, "No robust mutex support");
+			continue;
+		}
+
+		tdb = tdb_open_ex("run-resizable-hash.tdb", 3,
+				  flags[i]|TDB_RESIZABLE_HASH|
+				  TDB_INCOMPATIBLE_HASH,
+				  O_RDWR|O_CREAT|O_TRUNC, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		if (!tdb) {
+			skip(16, "tdb_open_ex failed");
+			continue;
+		}
+		ok1(tdb->feature_flags & TDB_FEATURE_FLAG_SUBHASH);
+
+		for (k = 0; k < NUM_RECORDS; k++) {
+			if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+				fail("Storing in tdb");
+			}
+		}
+
+		ok1(tdb_hash_chains(tdb, 0, &table, &num) == 0);
+		ok1(num >= TDB_SUBHASH_FIRST);
+		ok1(check_records(tdb, 0, NUM_RECORDS, 1));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		summary = tdb_summary(tdb);
+		diag("%s", summary);
+		ok1(strstr(summary, "Number of records: 3000\n"));
+		ok1(strstr(summary, "Number of split hash chains/sub-chains: 3/"));
+		free(summary);
+
+		/* Deletes and traverses see the sub-chains */
+		for (k = 0; k < NUM_RECORDS; k += 2) {
+			if (tdb_delete(tdb, key) != 0) {
+				fail("Deleting from tdb");
+			}
+		}
+		ok1(check_records(tdb, 1, NUM_RECORDS, 2));
+		ok1(tdb_traverse(tdb, NULL, NULL) == NUM_RECORDS / 2);
+
+		for (k = 0; k < NUM_RECORDS; k += 2) {
+			if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+				fail("Storing in tdb");
+			}
+		}
+
+		/*
+		 * Grow the database while traversing it: every record
+		 * there before must be seen exactly once.
+		 */
+		memset(seen, 0, sizeof(seen));
+		count = tdb_traverse(tdb, store_more, &num_bad);
+		ok1(count >= NUM_RECORDS);
+		for (k = 0; k < NUM_RECORDS; k++) {
+			if (seen[k] != 1) {
+				num_wrong += 1;
+			}
+		}
+		ok1(num_bad == 0 && num_wrong == 0);
+		ok1(check_records(tdb, 0, NUM_RECORDS * 2, 1));
+
+		/* tdb_firstkey/tdb_nextkey walk the sub-chains as well */
+		j = 0;
+		key = tdb_firstkey(tdb);
+		while (key.dptr != NULL) {
+			TDB_DATA next = tdb_nextkey(tdb, key);
+			free(key.dptr);
+			key = next;
+			j++;
+		}
+		ok1(j == NUM_RECORDS * 2);
+		key = (TDB_DATA) { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+
+		/* Splits inside a transaction */
+		ok1(tdb_transaction_start(tdb) == 0);
+		for (k = NUM_RECORDS * 2; k < NUM_RECORDS * 4; k++) {
+			if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+				fail("Storing in tdb");
+			}
+		}
+		ok1(tdb_transaction_commit(tdb) == 0);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
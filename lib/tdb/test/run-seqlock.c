@@ -0,0 +1,224 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdarg.h>
+
+#define NUM_WRITES 20000
+
+static void log_fn(struct tdb_context *tdb, enum tdb_debug_level level,
+		   const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static int tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_MUTEX_LOCKING|
+	TDB_SEQLOCK_READ|TDB_CLEAR_IF_FIRST;
+
+static TDB_DATA hot;
+
+/*
+ * The child keeps rewriting "hot" with a random length, every byte of
+ * the value is the length modulo 256.
+ */
+static int do_child(int to, int from)
+{
+	struct tdb_context *tdb;
+	unsigned int log_count;
+	struct tdb_logging_context log_ctx = { log_fn, &log_count };
+	uint8_t buf[3000];
+	char c = 0;
+	int i, ret;
+
+	read(from, &c, sizeof(c));
+
+	tdb = tdb_open_ex("seqlock.tdb", 3, tdb_flags,
+			  O_RDWR|O_CREAT, 0755, &log_ctx, NULL);
+	if (tdb == NULL) {
+		return 1;
+	}
+
+	write(to, &c, sizeof(c));
+
+	for (i=0; i<NUM_WRITES; i++) {
+		TDB_DATA data = { .dptr = buf, .dsize = 1 + random() % 3000 };
+
+		memset(buf, data.dsize % 256, data.dsize);
+
+		if ((i % 100) == 0) {
+			ret = tdb_delete(tdb, hot);
+		} else {
+			ret = tdb_store(tdb, hot, data, TDB_REPLACE);
+		}
+		if (ret != 0) {
+			return 1;
+		}
+	}
+
+	read(from, &c, sizeof(c));
+	tdb_close(tdb);
+	return 0;
+}
+
+static int check_hot(TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	size_t i;
+
+	for (i=0; i<data.dsize; i++) {
+		if (data.dptr[i] != data.dsize % 256) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	unsigned int log_count;
+	struct tdb_logging_context log_ctx = { log_fn, &log_count };
+	TDB_DATA key, missing, data, big;
+	uint8_t bigbuf[4096];
+	int fromchild[2];
+	int tochild[2];
+	int ret, status, i;
+	int bad = 0;
+	pid_t child, wait_ret;
+	char c;
+
+	if (!tdb_runtime_check_for_robust_mutexes()) {
+		skip(1, "No robust mutex support");
+		return exit_status();
+	}
+
+	hot.dptr = discard_const_p(uint8_t, "hot");
+	hot.dsize = 3;
+	key.dptr = discard_const_p(uint8_t, "hi");
+	key.dsize = 2;
+	missing.dptr = discard_const_p(uint8_t, "nothere");
+	missing.dsize = 7;
+
+	pipe(fromchild);
+	pipe(tochild);
+
+	child = fork();
+	if (child == 0) {
+		close(fromchild[0]);
+		close(tochild[1]);
+		exit(do_child(fromchild[1], tochild[0]));
+	}
+	close(fromchild[1]);
+	close(tochild[0]);
+
+	tdb = tdb_open_ex("seqlock.tdb", 3, TDB_SEQLOCK_READ,
+			  O_RDWR|O_CREAT, 0755, &log_ctx, NULL);
+	ok(tdb == NULL && errno == EINVAL,
+	   "TDB_SEQLOCK_READ without TDB_MUTEX_LOCKING should fail");
+
+	tdb = tdb_open_ex("seqlock.tdb", 3, tdb_flags,
+			  O_RDWR|O_CREAT, 0755, &log_ctx, NULL);
+	ok(tdb, "tdb_open_ex should succeed");
+
+	if (!tdb_seqlock_supported()) {
+		ok(!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK),
+		   "no seqlock feature without atomics");
+		tdb_close(tdb);
+		kill(child, SIGKILL);
+		skip(1, "No atomics for the sequence counters");
+		return exit_status();
+	}
+	ok(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK,
+	   "seqlock feature should be set");
+
+	data.dptr = discard_const_p(uint8_t, "world");
+	data.dsize = 5;
+	ret = tdb_store(tdb, key, data, TDB_INSERT);
+	ok(ret == 0, "tdb_store should succeed");
+
+	memset(bigbuf, sizeof(bigbuf) % 256, sizeof(bigbuf));
+	big.dptr = bigbuf;
+	big.dsize = sizeof(bigbuf);
+	ret = tdb_store(tdb, hot, big, TDB_INSERT);
+	ok(ret == 0, "tdb_store should succeed");
+
+	ret = tdb_find_seqlock(tdb, key, tdb->hash_fn(&key), NULL, 0, &data);
+	ok(ret == 0, "lock-free lookup should find the record");
+	ok(data.dsize == 5 && memcmp(data.dptr, "world", 5) == 0,
+	   "lock-free lookup should return the data");
+	free(data.dptr);
+
+	ret = tdb_find_seqlock(tdb, missing, tdb->hash_fn(&missing),
+			       NULL, 0, NULL);
+	ok(ret == -1, "lock-free lookup should not find missing records");
+	ok(tdb_exists(tdb, missing) == 0, "tdb_exists should return 0");
+
+	ret = tdb_chainlock(tdb, key);
+	ok(ret == 0, "tdb_chainlock should succeed");
+	ret = tdb_find_seqlock(tdb, key, tdb->hash_fn(&key), NULL, 0, NULL);
+	ok(ret == -2, "lock-free lookup should give up in a locked chain");
+	data = tdb_fetch(tdb, key);
+	ok(data.dsize == 5, "tdb_fetch should fall back to the chain lock");
+	free(data.dptr);
+	tdb_chainunlock(tdb, key);
+
+	ret = tdb_lockall(tdb);
+	ok(ret == 0, "tdb_lockall should succeed");
+	ret = tdb_find_seqlock(tdb, key, tdb->hash_fn(&key), NULL, 0, NULL);
+	ok(ret == -2, "lock-free lookup should give up under tdb_lockall");
+	tdb_unlockall(tdb);
+
+	ret = tdb_lockall_read(tdb);
+	ok(ret == 0, "tdb_lockall_read should succeed");
+	ret = tdb_find_seqlock(tdb, key, tdb->hash_fn(&key), NULL, 0, NULL);
+	ok(ret == 0, "lock-free lookup should work under tdb_lockall_read");
+	tdb_unlockall_read(tdb);
+
+	ret = tdb_parse_record(tdb, hot, check_hot, NULL);
+	ok(ret == 0, "tdb_parse_record should see the large record");
+
+	write(tochild[1], &c, sizeof(c));
+	read(fromchild[0], &c, sizeof(c));
+
+	for (i=0; i<NUM_WRITES; i++) {
+		ret = tdb_parse_record(tdb, hot, check_hot, NULL);
+		if ((ret != 0) && (tdb_error(tdb) != TDB_ERR_NOEXIST)) {
+			bad++;
+		}
+		data = tdb_fetch(tdb, hot);
+		if ((data.dptr != NULL) &&
+		    (check_hot(hot, data, NULL) != 0)) {
+			bad++;
+		}
+		free(data.dptr);
+	}
+	ok(bad == 0, "readers should never see inconsistent records");
+
+	write(tochild[1], &c, sizeof(c));
+
+	wait_ret = wait(&status);
+	ok(wait_ret == child, "child should have exited correctly");
+	ok(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+	   "child should have succeeded");
+
+	ret = tdb_check(tdb, NULL, NULL);
+	ok(ret == 0, "tdb_check should succeed");
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -0,0 +1,186 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/freelistcheck.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_RECORDS 2000
+
+static uint8_t buf[70000];
+
+static size_t rec_size(uint32_t k)
+{
+	/* A few small records, less large ones */
+	return (k * 7919) % ((k % 16 == 0) ? sizeof(buf) : 600);
+}
+
+static bool store_records(struct tdb_context *tdb, uint32_t first,
+			  uint32_t last, uint32_t step)
+{
+	uint32_t k;
+
+	for (k = first; k < last; k += step) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		TDB_DATA data = { .dptr = buf, .dsize = rec_size(k) };
+
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			diag("storing record %u failed", (unsigned)k);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool delete_records(struct tdb_context *tdb, uint32_t first,
+			   uint32_t last, uint32_t step)
+{
+	uint32_t k;
+
+	for (k = first; k < last; k += step) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+
+		if (tdb_delete(tdb, key) != 0) {
+			diag("deleting record %u failed", (unsigned)k);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_records(struct tdb_context *tdb, uint32_t first,
+			  uint32_t last, uint32_t step)
+{
+	uint32_t k;
+
+	for (k = first; k < last; k += step) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		TDB_DATA data = tdb_fetch(tdb, key);
+		bool ok;
+
+		ok = (data.dptr != NULL) && (data.dsize == rec_size(k)) &&
+			(memcmp(data.dptr, buf, data.dsize) == 0);
+		free(data.dptr);
+		if (!ok) {
+			diag("record %u missing", (unsigned)k);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Every free record must sit in the list for its size or, after
+ * growing by a merge, in one for smaller sizes.
+ */
+static bool check_lists(struct tdb_context *tdb, unsigned *pnum_lists)
+{
+	unsigned list;
+
+	*pnum_lists = 0;
+
+	for (list = 0; list < tdb_freelist_classes(tdb); list++) {
+		struct tdb_record rec;
+		tdb_off_t ptr;
+
+		if (tdb_ofs_read(tdb, TDB_FREELIST_TOP(list), &ptr) == -1) {
+			return false;
+		}
+		if (ptr != 0) {
+			*pnum_lists += 1;
+		}
+		while (ptr != 0) {
+			if (tdb_rec_free_read(tdb, ptr, &rec) == -1) {
+				return false;
+			}
+			if (tdb_freelist_class(tdb, rec.rec_len) < list) {
+				diag("record of %u bytes in list %u",
+				     (unsigned)rec.rec_len, list);
+				return false;
+			}
+			ptr = rec.next;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	struct tdb_context *tdb;
+	int flags[] = { TDB_DEFAULT, TDB_NOMMAP, TDB_CONVERT,
+			TDB_NOMMAP|TDB_CONVERT,
+			TDB_MUTEX_LOCKING|TDB_RESIZABLE_HASH };
+	unsigned num_lists;
+	int num_free;
+
+	memset(buf, 0x42, sizeof(buf));
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 18 + 2);
+
+	tdb = tdb_open_ex("run-size-classes.tdb", 131, TDB_DEFAULT,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb_freelist_classes(tdb) == 1);
+	tdb_close(tdb);
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		tdb_len_t map_size;
+
+		if ((flags[i] & TDB_MUTEX_LOCKING) &&
+		    !tdb_runtime_check_for_robust_mutexes()) {
+			skip(18, "No robust mutex support");
+			continue;
+		}
+
+		tdb = tdb_open_ex("run-size-classes.tdb", 131,
+				  flags[i]|TDB_SIZE_CLASSES,
+				  O_RDWR|O_CREAT|O_TRUNC, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		if (!tdb) {
+			skip(17, "tdb_open_ex failed");
+			continue;
+		}
+		ok1(tdb->feature_flags & TDB_FEATURE_FLAG_FREELISTS);
+		ok1(tdb_freelist_classes(tdb) == TDB_FREELIST_CLASSES);
+
+		ok1(store_records(tdb, 0, NUM_RECORDS, 1));
+
+		/* Free records of all sizes */
+		ok1(delete_records(tdb, 0, NUM_RECORDS, 3));
+		ok1(check_lists(tdb, &num_lists));
+		ok1(num_lists > 4);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(tdb_validate_freelist(tdb, &num_free) == 0);
+		ok1(num_free > 0 && num_free == tdb_freelist_size(tdb));
+
+		/* Reusing the space doesn't grow the file much */
+		map_size = tdb->map_size;
+		ok1(store_records(tdb, 0, NUM_RECORDS, 3));
+		ok1(check_records(tdb, 0, NUM_RECORDS, 1));
+		ok1(tdb->map_size < map_size + map_size / 4);
+		ok1(check_lists(tdb, &num_lists));
+
+		/* Repacking moves everything into the new lists */
+		ok1(tdb_repack(tdb) == 0);
+		ok1(check_records(tdb, 0, NUM_RECORDS, 1));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		ok1(tdb_wipe_all(tdb) == 0 && tdb_check(tdb, NULL, NULL) == 0);
+
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
@@ -23,6 +23,7 @@
 #define TRAVERSE_PROB 20
 #define TRAVERSE_READ_PROB 20
 #define CULL_PROB 100
+#define READ_HEAVY_PROB 50
 #define KEYLEN 3
 #define DATALEN 100
 
@@ -34,6 +35,10 @@ static int hash_size = 2;
 static unsigned loopnum;
 static int count_pipe;
 static bool mutex = false;
+static bool seqlock = false;
+static bool resizable = false;
+static bool size_classes = false;
+static int read_heavy = 0;
 static struct tdb_logging_context log_ctx;
 
 #ifdef PRINTF_ATTRIBUTE
@@ -124,6 +129,12 @@ static void addrec_db(void)
 	data.dptr = (unsigned char *)d;
 	data.dsize = dlen+1;
 
+	if (read_heavy && random() % READ_HEAVY_PROB != 0) {
+		data = tdb_fetch(db, key);
+		if (data.dptr) free(data.dptr);
+		goto next;
+	}
+
 #if REOPEN_PROB
 	if (in_transaction == 0 && random() % REOPEN_PROB == 0) {
 		tdb_reopen_all(0);
@@ -228,7 +239,7 @@ static int traverse_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA dbuf,
 
 static void usage(void)
 {
-	printf("Usage: tdbtorture [-t] [-k] [-m] [-n NUM_PROCS] [-l NUM_LOOPS] [-s SEED] [-H HASH_SIZE]\n");
+	printf("Usage: tdbtorture [-t] [-k] [-m] [-S] [-R] [-G] [-F] [-n NUM_PROCS] [-l NUM_LOOPS] [-s SEED] [-H HASH_SIZE]\n");
 	exit(0);
 }
 
@@ -251,6 +262,15 @@ static int run_child(const char *filename, int i, int seed, unsigned num_loops,
 	if (mutex) {
 		tdb_flags |= TDB_MUTEX_LOCKING;
 	}
+	if (seqlock) {
+		tdb_flags |= TDB_SEQLOCK_READ;
+	}
+	if (resizable) {
+		tdb_flags |= TDB_RESIZABLE_HASH;
+	}
+	if (size_classes) {
+		tdb_flags |= TDB_SIZE_CLASSES;
+	}
 
 	db = tdb_open_ex(filename, hash_size, tdb_flags,
 			 O_RDWR | O_CREAT, 0600, &log_ctx, NULL);
@@ -321,10 +341,11 @@ int main(int argc, char * const *argv)
 	int kill_random = 0;
 	int *done;
 	char *test_tdb;
+	struct timeval start, end;
 
 	log_ctx.log_fn = tdb_log;
 
-	while ((c = getopt(argc, argv, "n:l:s:H:thkm")) != -1) {
+	while ((c = getopt(argc, argv, "n:l:s:H:thkmSRGF")) != -1) {
 		switch (c) {
 		case 'n':
 			num_procs = strtol(optarg, NULL, 0);
@@ -351,6 +372,23 @@ int main(int argc, char * const *argv)
 				exit(1);
 			}
 			break;
+		case 'S':
+			mutex = tdb_runtime_check_for_robust_mutexes();
+			if (!mutex) {
+				printf("tdb_runtime_check_for_robust_mutexes() returned false\n");
+				exit(1);
+			}
+			seqlock = true;
+			break;
+		case 'R':
+			read_heavy = 1;
+			break;
+		case 'G':
+			resizable = true;
+			break;
+		case 'F':
+			size_classes = true;
+			break;
 		default:
 			usage();
 		}
@@ -364,9 +402,15 @@ int main(int argc, char * const *argv)
 		seed = (getpid() + time(NULL)) & 0x7FFFFFFF;
 	}
 
-	printf("Testing with %d processes, %d loops, %d hash_size, seed=%d%s\n",
+	printf("Testing with %d processes, %d loops, %d hash_size, seed=%d%s%s%s%s%s\n",
 	       num_procs, num_loops, hash_size, seed,
-	       (always_transaction ? " (all within transactions)" : ""));
+	       (always_transaction ? " (all within transactions)" : ""),
+	       (seqlock ? " (lock-free reads)" : ""),
+	       (resizable ? " (resizable hash)" : ""),
+	       (size_classes ? " (free lists by size)" : ""),
+	       (read_heavy ? " (read heavy)" : ""));
+
+	gettimeofday(&start, NULL);
 
 	if (num_procs == 1 && !kill_random) {
 		/* Don't fork for this case, makes debugging easier. */
@@ -474,6 +518,13 @@ int main(int argc, char * const *argv)
 	free(pids);
 
 done:
+	if (read_heavy) {
+		gettimeofday(&end, NULL);
+		printf("Took %.3f seconds\n",
+		       (end.tv_sec - start.tv_sec) +
+		       (end.tv_usec - start.tv_usec) * 1.0e-6);
+	}
+
 	if (error_count == 0) {
 		int tdb_flags = TDB_DEFAULT;
 
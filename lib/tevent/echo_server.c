@@ -606,8 +606,8 @@ int main(int argc, const char **argv)
 	struct tevent_req *req;
 	bool result;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+	if ((argc != 2) && (argc != 3)) {
+		fprintf(stderr, "Usage: %s <port> [backend]\n", argv[0]);
 		exit(1);
 	}
 
@@ -639,7 +639,7 @@ int main(int argc, const char **argv)
 		exit(1);
 	}
 
-	ev = tevent_context_init(NULL);
+	ev = tevent_context_init_byname(NULL, (argc == 3) ? argv[2] : NULL);
 	if (ev == NULL) {
 		fprintf(stderr, "tevent_context_init failed\n");
 		exit(1);
@@ -827,6 +827,106 @@ static bool test_event_fd2(struct torture_context *tctx,
 	return true;
 }
 
+#define FREE_OTHER_NUM 8
+
+struct test_free_other_state {
+	int sock[FREE_OTHER_NUM][2];
+	struct tevent_fd *fde[FREE_OTHER_NUM];
+	int num_called;
+};
+
+static void test_free_other_handler(struct tevent_context *ev,
+				    struct tevent_fd *fde,
+				    uint16_t flags,
+				    void *private_data)
+{
+	struct test_free_other_state *state =
+		(struct test_free_other_state *)private_data;
+	size_t i;
+
+	state->num_called += 1;
+
+	/*
+	 * All the other fds are readable as well, free them
+	 * before their events get dispatched.
+	 */
+	for (i = 0; i < FREE_OTHER_NUM; i++) {
+		if (state->fde[i] != fde) {
+			TALLOC_FREE(state->fde[i]);
+		}
+	}
+}
+
+static bool test_event_fd_free_other(struct torture_context *tctx,
+				     const void *test_data)
+{
+	const char *backend = (const char *)test_data;
+	struct test_free_other_state state;
+	struct tevent_context *ev = NULL;
+	int finished = 0;
+	size_t i;
+	int ret;
+
+	ev = test_tevent_context_init_byname(tctx, backend);
+	if (ev == NULL) {
+		torture_skip(tctx, talloc_asprintf(tctx,
+			     "event backend '%s' not supported\n",
+			     backend));
+		return true;
+	}
+
+	torture_comment(tctx, "backend '%s' - %s\n",
+			backend, __FUNCTION__);
+
+	ZERO_STRUCT(state);
+
+	for (i = 0; i < FREE_OTHER_NUM; i++) {
+		char c = 0;
+
+		ret = socketpair(AF_UNIX, SOCK_STREAM, 0, state.sock[i]);
+		torture_assert(tctx, ret == 0, "socketpair() failed");
+
+		do_write(state.sock[i][1], &c, 1);
+
+		state.fde[i] = tevent_add_fd(ev, ev, state.sock[i][0],
+					     TEVENT_FD_READ,
+					     test_free_other_handler,
+					     &state);
+		torture_assert(tctx, state.fde[i] != NULL,
+			       "tevent_add_fd failed");
+		tevent_fd_set_auto_close(state.fde[i]);
+	}
+
+	ret = tevent_loop_once(ev);
+	torture_assert_int_equal(tctx, ret, 0, "tevent_loop_once failed");
+	torture_assert_int_equal(tctx, state.num_called, 1, "handler calls");
+
+	/* only the fde of the first handler is left */
+	for (i = 0; i < FREE_OTHER_NUM; i++) {
+		if (state.fde[i] != NULL) {
+			tevent_fd_set_flags(state.fde[i], 0);
+		}
+	}
+
+	tevent_add_timer(ev, ev, timeval_current_ofs(0, 10000),
+			 finished_handler, &finished);
+	while (finished == 0) {
+		ret = tevent_loop_once(ev);
+		torture_assert_int_equal(tctx, ret, 0,
+					 "tevent_loop_once failed");
+	}
+	torture_assert_int_equal(tctx, state.num_called, 1,
+				 "handler of a freed fde called");
+
+	TALLOC_FREE(ev);
+
+	for (i = 0; i < FREE_OTHER_NUM; i++) {
+		close(state.sock[i][1]);
+	}
+
+	return true;
+}
+
 struct test_wrapper_state {
 	struct torture_context *tctx;
 	int num_events;
@@ -1956,6 +2056,139 @@ static bool test_cached_pid(struct torture_context *test,
 	return true;
 }
 
+#define TIMER_SPEED_NUM 20000
+
+struct test_timer_speed_state {
+	struct torture_context *tctx;
+	struct timeval last_event;
+	uint64_t last_order;
+	size_t num_fired;
+	bool ok;
+};
+
+struct test_timer_speed_timer {
+	struct test_timer_speed_state *state;
+	struct tevent_timer *te;
+	struct timeval next_event;
+	uint64_t order;
+};
+
+static void test_timer_speed_handler(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	struct test_timer_speed_timer *t =
+		(struct test_timer_speed_timer *)private_data;
+	struct test_timer_speed_state *state = t->state;
+	int cmp;
+
+	t->te = NULL;
+
+	cmp = timeval_compare(&t->next_event, &state->last_event);
+	if ((cmp < 0) || ((cmp == 0) && (t->order < state->last_order))) {
+		torture_comment(state->tctx,
+				"timer %"PRIu64" fired out of order\n",
+				t->order);
+		state->ok = false;
+	}
+
+	state->last_event = t->next_event;
+	state->last_order = t->order;
+	state->num_fired += 1;
+}
+
+/*
+ * Add lots of timers, many of them at the same time, cancel and
+ * move some of them and check that they fire in order. Timers for
+ * the same time have to fire in the order they were added.
+ */
+static bool test_timer_speed(struct torture_context *tctx,
+			     const void *test_data)
+{
+	struct tevent_context *ev = NULL;
+	struct test_timer_speed_state state = {
+		.tctx = tctx,
+		.ok = true,
+	};
+	struct test_timer_speed_timer *timers = NULL;
+	struct timeval base;
+	struct timeval t;
+	uint64_t order = 0;
+	size_t num_expected = 0;
+	double elapsed;
+	size_t i;
+
+	ev = tevent_context_init(tctx);
+	torture_assert(tctx, ev != NULL, "tevent_context_init failed");
+
+	timers = talloc_zero_array(tctx, struct test_timer_speed_timer,
+				   TIMER_SPEED_NUM);
+	torture_assert(tctx, timers != NULL, "talloc failed");
+
+	/* all in the past, so the loop doesn't have to wait */
+	base = timeval_current();
+	base.tv_sec -= 3600;
+
+	t = timeval_current();
+	for (i = 0; i < TIMER_SPEED_NUM; i++) {
+		struct test_timer_speed_timer *tt = &timers[i];
+
+		tt->state = &state;
+		tt->next_event = timeval_add(&base, 0,
+					     (random() % 1000) * 1000);
+		tt->order = order++;
+		tt->te = tevent_add_timer(ev, ev, tt->next_event,
+					  test_timer_speed_handler, tt);
+		torture_assert(tctx, tt->te != NULL, "tevent_add_timer failed");
+	}
+	elapsed = timeval_elapsed(&t);
+	torture_comment(tctx, "Added %d timers, %.0f timers/sec\n",
+			TIMER_SPEED_NUM, TIMER_SPEED_NUM / elapsed);
+
+	t = timeval_current();
+	for (i = 0; i < TIMER_SPEED_NUM; i += 3) {
+		TALLOC_FREE(timers[i].te);
+	}
+	elapsed = timeval_elapsed(&t);
+	torture_comment(tctx, "Cancelled %d timers, %.0f timers/sec\n",
+			(TIMER_SPEED_NUM + 2) / 3,
+			((TIMER_SPEED_NUM + 2) / 3) / elapsed);
+
+	for (i = 1; i < TIMER_SPEED_NUM; i += 5) {
+		struct test_timer_speed_timer *tt = &timers[i];
+
+		if (tt->te == NULL) {
+			continue;
+		}
+		tt->next_event = timeval_add(&base, 0,
+					     (random() % 1000) * 1000);
+		tt->order = order++;
+		tevent_update_timer(tt->te, tt->next_event);
+	}
+
+	for (i = 0; i < TIMER_SPEED_NUM; i++) {
+		if (timers[i].te != NULL) {
+			num_expected += 1;
+		}
+	}
+
+	t = timeval_current();
+	while (state.num_fired < num_expected) {
+		int ret = tevent_loop_once(ev);
+		torture_assert_int_equal(tctx, ret, 0, "tevent_loop_once failed");
+	}
+	elapsed = timeval_elapsed(&t);
+	torture_comment(tctx, "Ran %zu timers, %.0f timers/sec\n",
+			num_expected, num_expected / elapsed);
+
+	torture_assert(tctx, state.ok, "timers fired out of order");
+
+	TALLOC_FREE(ev);
+	TALLOC_FREE(timers);
+	return true;
+}
+
 struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "event");
@@ -1987,6 +2220,10 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					       "fd2",
 					       test_event_fd2,
 					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "fd_free_other",
+					       test_event_fd_free_other,
+					       (const void *)list[i]);
 		torture_suite_add_simple_tcase_const(backend_suite,
 					       "wrapper",
 					       test_wrapper,
@@ -2022,5 +2259,9 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					     test_cached_pid,
 					     NULL);
 
+	torture_suite_add_simple_tcase_const(suite, "timer_speed",
+					     test_timer_speed,
+					     NULL);
+
 	return suite;
 }
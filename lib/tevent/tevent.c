@@ -131,6 +131,9 @@ static void tevent_backend_init(void)
 #if defined(HAVE_EPOLL)
 	tevent_epoll_init();
 #endif
+#if defined(HAVE_TEVENT_IO_URING)
+	tevent_io_uring_init();
+#endif
 
 	tevent_standard_init();
 }
@@ -416,13 +419,13 @@ int tevent_common_context_destructor(struct tevent_context *ev)
 		DLIST_REMOVE(ev->fd_events, fd);
 	}
 
-	ev->last_zero_timer = NULL;
 	for (te = ev->timer_events; te; te = tn) {
 		tn = te->next;
 		tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
 		te->wrapper = NULL;
 		te->event_ctx = NULL;
-		DLIST_REMOVE(ev->timer_events, te);
+		tevent_common_timer_unlink(ev, te);
+		ev->timers.count -= 1;
 	}
 
 	for (ie = ev->immediate_events; ie; ie = in) {
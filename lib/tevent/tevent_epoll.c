@@ -41,6 +41,19 @@ struct epoll_event_context {
 
 	pid_t pid;
 
+	/*
+	 * The "epoll_batch" backend harvests up to
+	 * EPOLL_BATCH_MAXEVENTS ready events per epoll_wait()
+	 * and dispatches them one per loop iteration before
+	 * waiting again. The plain "epoll" backend asks for
+	 * a single event.
+	 */
+	bool batch;
+#define EPOLL_BATCH_MAXEVENTS 64
+	struct epoll_event events[EPOLL_BATCH_MAXEVENTS];
+	int num_ready;
+	int next_ready;
+
 	bool panic_force_replay;
 	bool *panic_state;
 	bool (*panic_fallback)(struct tevent_context *ev, bool replay);
@@ -226,6 +239,10 @@ static void epoll_check_reopen(struct epoll_event_context *epoll_ev)
 		return;
 	}
 
+	/* the events harvested by the parent are not ours */
+	epoll_ev->num_ready = 0;
+	epoll_ev->next_ready = 0;
+
 	close(epoll_ev->epoll_fd);
 	epoll_ev->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (epoll_ev->epoll_fd == -1) {
@@ -619,16 +636,162 @@ static bool epoll_handle_hup_or_err(struct epoll_event_context *epoll_ev,
 	return false;
 }
 
+/*
+  forget a harvested event that wasn't dispatched yet,
+  its fde is going away
+*/
+static void epoll_drop_ready_event(struct epoll_event_context *epoll_ev,
+				   struct tevent_fd *fde)
+{
+	int i;
+
+	for (i = epoll_ev->next_ready; i < epoll_ev->num_ready; i++) {
+		if (epoll_ev->events[i].data.ptr == fde) {
+			epoll_ev->events[i].data.ptr = NULL;
+		}
+	}
+}
+
+/*
+  dispatch one event returned by epoll_wait()
+*/
+static int epoll_dispatch_event(struct epoll_event_context *epoll_ev,
+				struct epoll_event *event,
+				bool *invoked)
+{
+	struct tevent_fd *fde = talloc_get_type(event->data.ptr,
+					       struct tevent_fd);
+	uint16_t flags = 0;
+	struct tevent_fd *mpx_fde = NULL;
+
+	*invoked = false;
+
+	if (fde == NULL) {
+		epoll_panic(epoll_ev, "epoll_wait() gave bad data", true);
+		return -1;
+	}
+	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
+		/*
+		 * Save off the multiplexed event in case we need
+		 * to use it to call the handler function.
+		 */
+		mpx_fde = talloc_get_type_abort(fde->additional_data,
+						struct tevent_fd);
+	}
+	if (event->events & (EPOLLHUP|EPOLLERR)) {
+		bool handled_fde = epoll_handle_hup_or_err(epoll_ev, fde);
+		bool handled_mpx = epoll_handle_hup_or_err(epoll_ev, mpx_fde);
+
+		if (handled_fde && handled_mpx) {
+			bool panic_triggered = false;
+
+			/*
+			 * A panic frees epoll_ev, our caller
+			 * must not look at the other events.
+			 */
+			epoll_ev->panic_state = &panic_triggered;
+			epoll_update_event(epoll_ev, fde);
+			if (panic_triggered) {
+				return -1;
+			}
+			epoll_ev->panic_state = NULL;
+			return 0;
+		}
+
+		if (!handled_mpx) {
+			/*
+			 * If the mpx event was the one that needs
+			 * further handling, it's the TEVENT_FD_READ
+			 * event so switch over and call that handler.
+			 */
+			fde = mpx_fde;
+			mpx_fde = NULL;
+		}
+		flags |= TEVENT_FD_READ;
+	}
+	if (event->events & EPOLLIN) flags |= TEVENT_FD_READ;
+	if (event->events & EPOLLOUT) flags |= TEVENT_FD_WRITE;
+
+	if (flags & TEVENT_FD_WRITE) {
+		if (fde->flags & TEVENT_FD_WRITE) {
+			mpx_fde = NULL;
+		}
+		if (mpx_fde && mpx_fde->flags & TEVENT_FD_WRITE) {
+			fde = mpx_fde;
+			mpx_fde = NULL;
+		}
+	}
+
+	if (mpx_fde) {
+		/* Ensure we got the right fde. */
+		if ((flags & fde->flags) == 0) {
+			fde = mpx_fde;
+			mpx_fde = NULL;
+		}
+	}
+
+	/*
+	 * make sure we only pass the flags
+	 * the handler is expecting.
+	 */
+	flags &= fde->flags;
+	if (flags) {
+		*invoked = true;
+		return tevent_common_invoke_fd_handler(fde, flags, NULL);
+	}
+
+	return 0;
+}
+
+/*
+  dispatch the next harvested event that still has
+  something to do, the others are skipped
+*/
+static int epoll_dispatch_ready(struct epoll_event_context *epoll_ev,
+				bool *invoked)
+{
+	*invoked = false;
+
+	while (epoll_ev->next_ready < epoll_ev->num_ready) {
+		struct epoll_event *event =
+			&epoll_ev->events[epoll_ev->next_ready];
+		int ret;
+
+		/*
+		 * Consume the event before calling the handler,
+		 * it may free other fdes and with them their
+		 * pending events, or run a nested loop.
+		 */
+		epoll_ev->next_ready += 1;
+
+		if (event->data.ptr == NULL) {
+			/* the fde was freed after epoll_wait() */
+			continue;
+		}
+
+		ret = epoll_dispatch_event(epoll_ev, event, invoked);
+		if (ret != 0 || *invoked) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 /*
   event loop handling using epoll
 */
 static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval *tvalp)
 {
-	int ret, i;
-#define MAXEVENTS 1
-	struct epoll_event events[MAXEVENTS];
+	int ret;
+	int maxevents = 1;
 	int timeout = -1;
 	int wait_errno;
+	bool invoked;
+
+	if (epoll_ev->batch) {
+		maxevents = EPOLL_BATCH_MAXEVENTS;
+	}
 
 	if (tvalp) {
 		/* it's better to trigger timed events a bit later than too early */
@@ -640,8 +803,11 @@ static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval
 		return 0;
 	}
 
+	epoll_ev->num_ready = 0;
+	epoll_ev->next_ready = 0;
+
 	tevent_trace_point_callback(epoll_ev->ev, TEVENT_TRACE_BEFORE_WAIT);
-	ret = epoll_wait(epoll_ev->epoll_fd, events, MAXEVENTS, timeout);
+	ret = epoll_wait(epoll_ev->epoll_fd, epoll_ev->events, maxevents, timeout);
 	wait_errno = errno;
 	tevent_trace_point_callback(epoll_ev->ev, TEVENT_TRACE_AFTER_WAIT);
 
@@ -662,76 +828,11 @@ static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval
 		return 0;
 	}
 
-	for (i=0;i<ret;i++) {
-		struct tevent_fd *fde = talloc_get_type(events[i].data.ptr,
-						       struct tevent_fd);
-		uint16_t flags = 0;
-		struct tevent_fd *mpx_fde = NULL;
-
-		if (fde == NULL) {
-			epoll_panic(epoll_ev, "epoll_wait() gave bad data", true);
-			return -1;
-		}
-		if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
-			/*
-			 * Save off the multiplexed event in case we need
-			 * to use it to call the handler function.
-			 */
-			mpx_fde = talloc_get_type_abort(fde->additional_data,
-							struct tevent_fd);
-		}
-		if (events[i].events & (EPOLLHUP|EPOLLERR)) {
-			bool handled_fde = epoll_handle_hup_or_err(epoll_ev, fde);
-			bool handled_mpx = epoll_handle_hup_or_err(epoll_ev, mpx_fde);
-
-			if (handled_fde && handled_mpx) {
-				epoll_update_event(epoll_ev, fde);
-				continue;
-			}
-
-			if (!handled_mpx) {
-				/*
-				 * If the mpx event was the one that needs
-				 * further handling, it's the TEVENT_FD_READ
-				 * event so switch over and call that handler.
-				 */
-				fde = mpx_fde;
-				mpx_fde = NULL;
-			}
-			flags |= TEVENT_FD_READ;
-		}
-		if (events[i].events & EPOLLIN) flags |= TEVENT_FD_READ;
-		if (events[i].events & EPOLLOUT) flags |= TEVENT_FD_WRITE;
-
-		if (flags & TEVENT_FD_WRITE) {
-			if (fde->flags & TEVENT_FD_WRITE) {
-				mpx_fde = NULL;
-			}
-			if (mpx_fde && mpx_fde->flags & TEVENT_FD_WRITE) {
-				fde = mpx_fde;
-				mpx_fde = NULL;
-			}
-		}
-
-		if (mpx_fde) {
-			/* Ensure we got the right fde. */
-			if ((flags & fde->flags) == 0) {
-				fde = mpx_fde;
-				mpx_fde = NULL;
-			}
-		}
-
-		/*
-		 * make sure we only pass the flags
-		 * the handler is expecting.
-		 */
-		flags &= fde->flags;
-		if (flags) {
-			return tevent_common_invoke_fd_handler(fde, flags, NULL);
-		}
+	if (ret > 0) {
+		epoll_ev->num_ready = ret;
 	}
 
-	return 0;
+	return epoll_dispatch_ready(epoll_ev, &invoked);
 }
 
 /*
@@ -763,6 +864,22 @@ static int epoll_event_context_init(struct tevent_context *ev)
 	return 0;
 }
 
+static int epoll_batch_event_context_init(struct tevent_context *ev)
+{
+	struct epoll_event_context *epoll_ev = NULL;
+	int ret;
+
+	ret = epoll_event_context_init(ev);
+	if (ret != 0) {
+		return ret;
+	}
+
+	epoll_ev = talloc_get_type_abort(ev->additional_data,
+					 struct epoll_event_context);
+	epoll_ev->batch = true;
+	return 0;
+}
+
 /*
   destroy an fd_event
 */
@@ -788,6 +905,12 @@ static int epoll_event_fd_destructor(struct tevent_fd *fde)
 	 */
 	DLIST_REMOVE(ev->fd_events, fde);
 
+	/*
+	 * A handler dispatched from the same epoll_wait()
+	 * may free us before our event is dispatched.
+	 */
+	epoll_drop_ready_event(epoll_ev, fde);
+
 	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
 		mpx_fde = talloc_get_type_abort(fde->additional_data,
 						struct tevent_fd);
@@ -931,6 +1054,22 @@ static int epoll_event_loop_once(struct tevent_context *ev, const char *location
 		return 0;
 	}
 
+	if (epoll_ev->next_ready < epoll_ev->num_ready &&
+	    epoll_ev->pid == tevent_cached_getpid()) {
+		bool invoked;
+		int ret;
+
+		/*
+		 * Dispatch the events harvested by the last
+		 * epoll_wait() before asking for new ones, so
+		 * every ready fd gets its turn.
+		 */
+		ret = epoll_dispatch_ready(epoll_ev, &invoked);
+		if (ret != 0 || invoked) {
+			return ret;
+		}
+	}
+
 	if (epoll_ev->pid != tevent_cached_getpid()) {
 		epoll_ev->panic_state = &panic_triggered;
 		epoll_ev->panic_force_replay = true;
@@ -959,7 +1098,24 @@ static const struct tevent_ops epoll_event_ops = {
 	.loop_wait		= tevent_common_loop_wait,
 };
 
+static const struct tevent_ops epoll_batch_event_ops = {
+	.context_init		= epoll_batch_event_context_init,
+	.add_fd			= epoll_event_add_fd,
+	.set_fd_close_fn	= tevent_common_fd_set_close_fn,
+	.get_fd_flags		= tevent_common_fd_get_flags,
+	.set_fd_flags		= epoll_event_set_fd_flags,
+	.add_timer		= tevent_common_add_timer_v2,
+	.schedule_immediate	= tevent_common_schedule_immediate,
+	.add_signal		= tevent_common_add_signal,
+	.loop_once		= epoll_event_loop_once,
+	.loop_wait		= tevent_common_loop_wait,
+};
+
 _PRIVATE_ bool tevent_epoll_init(void)
 {
-	return tevent_register_backend("epoll", &epoll_event_ops);
+	if (!tevent_register_backend("epoll", &epoll_event_ops)) {
+		return false;
+	}
+	return tevent_register_backend("epoll_batch",
+				       &epoll_batch_event_ops);
 }
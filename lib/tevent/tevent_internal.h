@@ -225,6 +225,10 @@ struct tevent_timer {
 	bool busy;
 	bool destroyed;
 	struct timeval next_event;
+	/* position in ev->timers.heap */
+	size_t heap_idx;
+	/* orders timers with the same next_event */
+	uint64_t seq;
 	tevent_timer_handler_t handler;
 	/* this is private for the specific handler */
 	void *private_data;
@@ -331,7 +335,7 @@ struct tevent_context {
 	/* list of fd events - used by common code */
 	struct tevent_fd *fd_events;
 
-	/* list of timed events - used by common code */
+	/* list of timed events, unordered - used by common code */
 	struct tevent_timer *timer_events;
 
 	/* List of scheduled immediates */
@@ -404,11 +408,18 @@ struct tevent_context {
 	} wrapper;
 
 	/*
-	 * an optimization pointer into timer_events
-	 * used by used by common code via
-	 * tevent_common_add_timer_v2()
+	 * The timer_events ordered by next_event in a binary
+	 * min-heap, used by common code. The heap has room for
+	 * all timers of the context, also the ones not in the heap
+	 * right now, so putting one back never allocates.
 	 */
-	struct tevent_timer *last_zero_timer;
+	struct {
+		struct tevent_timer **heap;
+		size_t num;
+		size_t size;
+		size_t count;
+		uint64_t seq;
+	} timers;
 
 #ifdef HAVE_PTHREAD
 	struct tevent_context *prev, *next;
@@ -473,6 +484,9 @@ int tevent_common_invoke_immediate_handler(struct tevent_immediate *im,
 bool tevent_common_loop_immediate(struct tevent_context *ev);
 void tevent_common_threaded_activate_immediate(struct tevent_context *ev);
 
+void tevent_common_timer_unlink(struct tevent_context *ev,
+				struct tevent_timer *te);
+
 bool tevent_common_have_events(struct tevent_context *ev);
 int tevent_common_wakeup_init(struct tevent_context *ev);
 int tevent_common_wakeup_fd(int fd);
@@ -522,6 +536,9 @@ void tevent_epoll_set_panic_fallback(struct tevent_context *ev,
 			bool (*panic_fallback)(struct tevent_context *ev,
 					       bool replay));
 #endif
+#ifdef HAVE_TEVENT_IO_URING
+bool tevent_io_uring_init(void);
+#endif
 
 static inline void tevent_thread_call_depth_notify(
 			enum tevent_thread_call_depth_cmd cmd,
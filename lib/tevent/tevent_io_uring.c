@@ -0,0 +1,938 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   main select loop and event handling - io_uring implementation
+
+     ** NOTE! The following LGPL license applies to the tevent
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Every fd event gets a poll request on the ring. Changes to the fd
+  flags are only recorded when they happen, the poll requests are
+  adjusted just before the loop waits. All of them go to the kernel
+  with the same io_uring_enter() that waits for completions, with the
+  time to the next timer as the wait timeout.
+
+  The poll requests are one-shot: tevent fd events are level
+  triggered, and a handler that does not read all data has to be
+  called again. A multishot poll only completes again when new data
+  arrives. A handler that is done gets its poll request re-armed
+  together with all other changes, so this costs no extra syscall.
+
+  All completions found by one io_uring_enter() are queued and
+  dispatched one per tevent_loop_once(), in the order they arrived,
+  without entering the kernel again until the queue is empty.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/select.h"
+#include "system/shmem.h"
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "tevent.h"
+#include "tevent_internal.h"
+#include "tevent_util.h"
+
+#define URING_ENTRIES 256
+
+/* the cqe user_data for requests we don't care about */
+#define URING_USER_DATA_IGNORE 0
+
+struct uring_fd_slot {
+	/* the fd event using this slot, NULL if the slot is free */
+	struct tevent_fd *fde;
+
+	/* changes for every poll request, to detect stale completions */
+	uint32_t generation;
+
+	/* the TEVENT_FD_* flags of the poll request in flight */
+	uint16_t armed;
+
+	/* the TEVENT_FD_* flags reported, but not yet dispatched */
+	uint16_t ready;
+
+	/* the poll request might need to be changed */
+	bool dirty;
+
+	bool on_dirty_list;
+	bool on_ready_list;
+
+	uint32_t next_free;
+};
+
+struct uring_event_context {
+	/* a pointer back to the generic event_context */
+	struct tevent_context *ev;
+
+	/* the handle from io_uring_setup(2) */
+	int ring_fd;
+
+	pid_t pid;
+
+	/* the submission queue */
+	unsigned sq_entries;
+	unsigned sq_mask;
+	unsigned sq_tail;
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	struct io_uring_sqe *sqes;
+
+	/* the completion queue */
+	unsigned cq_mask;
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	struct io_uring_cqe *cqes;
+
+	void *ring_ptr;
+	size_t ring_len;
+	size_t sqes_len;
+
+	/* indexed by fde->additional_flags */
+	struct uring_fd_slot *slots;
+	uint32_t num_slots;
+	uint32_t free_slot;
+
+	/* slots whose poll request might need to be changed */
+	uint32_t *dirty;
+	uint32_t num_dirty;
+
+	/* slots with events to dispatch, in the order they arrived */
+	uint32_t *ready;
+	uint32_t ready_head;
+	uint32_t num_ready;
+};
+
+/*
+  called when an io_uring call fails
+*/
+static void uring_panic(struct uring_event_context *uring_ev,
+			const char *reason)
+{
+	tevent_debug(uring_ev->ev, TEVENT_DEBUG_FATAL,
+		     "%s (%s) - calling abort()\n",
+		     reason, strerror(errno));
+	abort();
+}
+
+static int uring_sys_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_sys_enter(int ring_fd, unsigned to_submit,
+			   unsigned min_complete, unsigned flags,
+			   void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, ring_fd, to_submit,
+		       min_complete, flags, arg, argsz);
+}
+
+/*
+ unmap and close the ring
+*/
+static void uring_ring_free(struct uring_event_context *uring_ev)
+{
+	if (uring_ev->sqes != NULL) {
+		munmap(uring_ev->sqes, uring_ev->sqes_len);
+		uring_ev->sqes = NULL;
+	}
+	if (uring_ev->ring_ptr != NULL) {
+		munmap(uring_ev->ring_ptr, uring_ev->ring_len);
+		uring_ev->ring_ptr = NULL;
+	}
+	if (uring_ev->ring_fd != -1) {
+		close(uring_ev->ring_fd);
+		uring_ev->ring_fd = -1;
+	}
+}
+
+/*
+ create and map the ring
+*/
+static int uring_ring_setup(struct uring_event_context *uring_ev)
+{
+	struct io_uring_params p = { .flags = IORING_SETUP_CLAMP, };
+	unsigned required = IORING_FEAT_SINGLE_MMAP |
+			    IORING_FEAT_NODROP |
+			    IORING_FEAT_EXT_ARG;
+	uint8_t *ptr = NULL;
+	unsigned *sq_array = NULL;
+	size_t sq_len, cq_len;
+	unsigned i;
+
+	uring_ev->ring_fd = uring_sys_setup(URING_ENTRIES, &p);
+	if (uring_ev->ring_fd == -1) {
+		return -1;
+	}
+
+	if ((p.features & required) != required) {
+		uring_ring_free(uring_ev);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	uring_ev->ring_len = MAX(sq_len, cq_len);
+
+	ptr = mmap(NULL, uring_ev->ring_len, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, uring_ev->ring_fd,
+		   IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED) {
+		uring_ring_free(uring_ev);
+		return -1;
+	}
+	uring_ev->ring_ptr = ptr;
+
+	uring_ev->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	uring_ev->sqes = mmap(NULL, uring_ev->sqes_len, PROT_READ|PROT_WRITE,
+			      MAP_SHARED|MAP_POPULATE, uring_ev->ring_fd,
+			      IORING_OFF_SQES);
+	if (uring_ev->sqes == MAP_FAILED) {
+		uring_ev->sqes = NULL;
+		uring_ring_free(uring_ev);
+		return -1;
+	}
+
+	uring_ev->sq_entries = p.sq_entries;
+	uring_ev->sq_mask = *(unsigned *)(ptr + p.sq_off.ring_mask);
+	uring_ev->sq_khead = (unsigned *)(ptr + p.sq_off.head);
+	uring_ev->sq_ktail = (unsigned *)(ptr + p.sq_off.tail);
+	uring_ev->sq_tail = *uring_ev->sq_ktail;
+
+	/* We always fill the sqes in order */
+	sq_array = (unsigned *)(ptr + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++) {
+		sq_array[i] = i;
+	}
+
+	uring_ev->cq_mask = *(unsigned *)(ptr + p.cq_off.ring_mask);
+	uring_ev->cq_khead = (unsigned *)(ptr + p.cq_off.head);
+	uring_ev->cq_ktail = (unsigned *)(ptr + p.cq_off.tail);
+	uring_ev->cqes = (struct io_uring_cqe *)(ptr + p.cq_off.cqes);
+
+	uring_ev->pid = tevent_cached_getpid();
+
+	return 0;
+}
+
+static int uring_ctx_destructor(struct uring_event_context *uring_ev)
+{
+	uring_ring_free(uring_ev);
+	return 0;
+}
+
+/*
+  submit the queued requests and optionally wait for completions
+*/
+static int uring_enter(struct uring_event_context *uring_ev,
+		       bool wait, const struct timeval *tvalp)
+{
+	unsigned to_submit;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg = { .ts = 0, };
+
+	to_submit = uring_ev->sq_tail -
+		__atomic_load_n(uring_ev->sq_khead, __ATOMIC_ACQUIRE);
+
+	if (!wait) {
+		if (to_submit == 0) {
+			return 0;
+		}
+		return uring_sys_enter(uring_ev->ring_fd, to_submit, 0, 0,
+				       NULL, 0);
+	}
+
+	if (tvalp != NULL) {
+		ts = (struct __kernel_timespec) {
+			.tv_sec = tvalp->tv_sec,
+			.tv_nsec = tvalp->tv_usec * 1000,
+		};
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+
+	return uring_sys_enter(uring_ev->ring_fd, to_submit, 1,
+			       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+			       &arg, sizeof(arg));
+}
+
+/*
+  get a free sqe, flushing the queue to the kernel if it's full
+*/
+static struct io_uring_sqe *uring_get_sqe(struct uring_event_context *uring_ev)
+{
+	struct io_uring_sqe *sqe = NULL;
+	unsigned head;
+
+	head = __atomic_load_n(uring_ev->sq_khead, __ATOMIC_ACQUIRE);
+	if (uring_ev->sq_tail - head >= uring_ev->sq_entries) {
+		int ret = uring_enter(uring_ev, false, NULL);
+		if (ret == -1) {
+			return NULL;
+		}
+		head = __atomic_load_n(uring_ev->sq_khead, __ATOMIC_ACQUIRE);
+		if (uring_ev->sq_tail - head >= uring_ev->sq_entries) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	sqe = &uring_ev->sqes[uring_ev->sq_tail & uring_ev->sq_mask];
+	*sqe = (struct io_uring_sqe) { .fd = -1, };
+
+	return sqe;
+}
+
+static void uring_commit_sqe(struct uring_event_context *uring_ev)
+{
+	uring_ev->sq_tail += 1;
+	__atomic_store_n(uring_ev->sq_ktail, uring_ev->sq_tail,
+			 __ATOMIC_RELEASE);
+}
+
+static uint64_t uring_user_data(uint32_t idx, uint32_t generation)
+{
+	return ((uint64_t)generation << 32) | idx;
+}
+
+/*
+  map from TEVENT_FD_* to POLLIN/POLLOUT
+*/
+static uint16_t uring_map_flags(uint16_t flags)
+{
+	uint16_t ret = 0;
+	if (flags & TEVENT_FD_READ) ret |= (POLLIN | POLLHUP);
+	if (flags & TEVENT_FD_WRITE) ret |= POLLOUT;
+	return ret;
+}
+
+static void uring_remove_poll(struct uring_event_context *uring_ev,
+			      uint32_t idx)
+{
+	struct uring_fd_slot *slot = &uring_ev->slots[idx];
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = uring_get_sqe(uring_ev);
+	if (sqe == NULL) {
+		uring_panic(uring_ev, "uring_get_sqe() failed");
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = uring_user_data(idx, slot->generation);
+	sqe->user_data = URING_USER_DATA_IGNORE;
+	uring_commit_sqe(uring_ev);
+
+	slot->armed = 0;
+}
+
+static void uring_add_poll(struct uring_event_context *uring_ev,
+			   uint32_t idx, uint16_t flags)
+{
+	struct uring_fd_slot *slot = &uring_ev->slots[idx];
+	struct io_uring_sqe *sqe = NULL;
+
+	sqe = uring_get_sqe(uring_ev);
+	if (sqe == NULL) {
+		uring_panic(uring_ev, "uring_get_sqe() failed");
+		return;
+	}
+
+	slot->generation += 1;
+	if (slot->generation == 0) {
+		slot->generation = 1;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = slot->fde->fd;
+	/* this ends up in the right half of poll32_events on any endian */
+	sqe->poll_events = uring_map_flags(flags);
+	sqe->user_data = uring_user_data(idx, slot->generation);
+	uring_commit_sqe(uring_ev);
+
+	slot->armed = flags;
+}
+
+static void uring_mark_dirty(struct uring_event_context *uring_ev,
+			     uint32_t idx)
+{
+	struct uring_fd_slot *slot = &uring_ev->slots[idx];
+
+	slot->dirty = true;
+	if (!slot->on_dirty_list) {
+		slot->on_dirty_list = true;
+		uring_ev->dirty[uring_ev->num_dirty++] = idx;
+	}
+}
+
+static void uring_mark_ready(struct uring_event_context *uring_ev,
+			     uint32_t idx, uint16_t flags)
+{
+	struct uring_fd_slot *slot = &uring_ev->slots[idx];
+
+	slot->ready |= flags;
+	if (slot->on_ready_list) {
+		return;
+	}
+
+	if (uring_ev->num_ready == uring_ev->num_slots) {
+		/* move the undispatched ones to the front */
+		uring_ev->num_ready -= uring_ev->ready_head;
+		memmove(uring_ev->ready,
+			uring_ev->ready + uring_ev->ready_head,
+			uring_ev->num_ready * sizeof(uring_ev->ready[0]));
+		uring_ev->ready_head = 0;
+	}
+
+	slot->on_ready_list = true;
+	uring_ev->ready[uring_ev->num_ready++] = idx;
+}
+
+/*
+  adjust the poll requests of all fd events that changed
+*/
+static void uring_flush_dirty(struct uring_event_context *uring_ev)
+{
+	uint32_t i;
+
+	for (i = 0; i < uring_ev->num_dirty; i++) {
+		uint32_t idx = uring_ev->dirty[i];
+		struct uring_fd_slot *slot = &uring_ev->slots[idx];
+		uint16_t want;
+
+		slot->on_dirty_list = false;
+
+		if (!slot->dirty) {
+			continue;
+		}
+		slot->dirty = false;
+
+		if (slot->fde == NULL) {
+			continue;
+		}
+		if (slot->ready != 0) {
+			/* re-armed after dispatching */
+			continue;
+		}
+
+		want = slot->fde->flags & (TEVENT_FD_READ|TEVENT_FD_WRITE);
+		if (want == slot->armed) {
+			continue;
+		}
+
+		if (slot->armed != 0) {
+			uring_remove_poll(uring_ev, idx);
+		}
+		if (want != 0) {
+			uring_add_poll(uring_ev, idx, want);
+		}
+	}
+
+	uring_ev->num_dirty = 0;
+}
+
+/*
+  get a slot for a new fd event
+*/
+static bool uring_slot_alloc(struct uring_event_context *uring_ev,
+			     struct tevent_fd *fde)
+{
+	struct uring_fd_slot *slot = NULL;
+	uint32_t idx;
+
+	if (uring_ev->free_slot == UINT32_MAX) {
+		uint32_t num = MAX(uring_ev->num_slots * 2, 64);
+		struct uring_fd_slot *slots = NULL;
+		uint32_t *dirty = NULL;
+		uint32_t *ready = NULL;
+		uint32_t i;
+
+		slots = talloc_realloc(uring_ev, uring_ev->slots,
+				       struct uring_fd_slot, num);
+		if (slots == NULL) {
+			return false;
+		}
+		uring_ev->slots = slots;
+
+		dirty = talloc_realloc(uring_ev, uring_ev->dirty,
+				       uint32_t, num);
+		if (dirty == NULL) {
+			return false;
+		}
+		uring_ev->dirty = dirty;
+
+		ready = talloc_realloc(uring_ev, uring_ev->ready,
+				       uint32_t, num);
+		if (ready == NULL) {
+			return false;
+		}
+		uring_ev->ready = ready;
+
+		for (i = num; i > uring_ev->num_slots; i--) {
+			slots[i-1] = (struct uring_fd_slot) {
+				.next_free = uring_ev->free_slot,
+			};
+			uring_ev->free_slot = i-1;
+		}
+		uring_ev->num_slots = num;
+	}
+
+	idx = uring_ev->free_slot;
+	slot = &uring_ev->slots[idx];
+	uring_ev->free_slot = slot->next_free;
+
+	slot->fde = fde;
+	slot->armed = 0;
+	slot->ready = 0;
+	slot->dirty = false;
+	fde->additional_flags = idx;
+
+	return true;
+}
+
+static void uring_slot_free(struct uring_event_context *uring_ev,
+			    uint32_t idx)
+{
+	struct uring_fd_slot *slot = &uring_ev->slots[idx];
+
+	slot->fde = NULL;
+	slot->armed = 0;
+	slot->ready = 0;
+	slot->dirty = false;
+	slot->next_free = uring_ev->free_slot;
+	uring_ev->free_slot = idx;
+}
+
+/*
+  recreate the ring when our pid changes, the child must not use the
+  ring of the parent
+*/
+static void uring_check_reopen(struct uring_event_context *uring_ev)
+{
+	uint32_t i;
+	int ret;
+
+	if (uring_ev->pid == tevent_cached_getpid()) {
+		return;
+	}
+
+	/* This only unmaps the ring in the child */
+	uring_ring_free(uring_ev);
+
+	ret = uring_ring_setup(uring_ev);
+	if (ret != 0) {
+		uring_panic(uring_ev, "io_uring_setup() failed");
+		return;
+	}
+
+	uring_ev->num_dirty = 0;
+	uring_ev->num_ready = 0;
+	uring_ev->ready_head = 0;
+
+	for (i = 0; i < uring_ev->num_slots; i++) {
+		struct uring_fd_slot *slot = &uring_ev->slots[i];
+
+		slot->armed = 0;
+		slot->ready = 0;
+		slot->on_dirty_list = false;
+		slot->on_ready_list = false;
+
+		if (slot->fde != NULL) {
+			uring_mark_dirty(uring_ev, i);
+		}
+	}
+}
+
+/*
+  note the result of a poll request
+*/
+static void uring_handle_cqe(struct uring_event_context *uring_ev,
+			     uint64_t user_data, int32_t res)
+{
+	uint32_t idx = user_data & UINT32_MAX;
+	uint32_t generation = user_data >> 32;
+	struct uring_fd_slot *slot = NULL;
+	struct tevent_fd *fde = NULL;
+	uint16_t flags = 0;
+	uint16_t revents;
+
+	if (user_data == URING_USER_DATA_IGNORE) {
+		return;
+	}
+	if (idx >= uring_ev->num_slots) {
+		return;
+	}
+
+	slot = &uring_ev->slots[idx];
+	fde = slot->fde;
+
+	if ((fde == NULL) || (slot->armed == 0) ||
+	    (slot->generation != generation)) {
+		/* stale, the poll request was changed or removed */
+		return;
+	}
+
+	slot->armed = 0;
+
+	if (res == -EBADF) {
+		/*
+		 * the fd was closed before the fd event was freed,
+		 * ignore it as the epoll backend does
+		 */
+		tevent_debug(uring_ev->ev, TEVENT_DEBUG_ERROR,
+			     "POLL_ADD EBADF for fde[%p] fd[%d] - disabling\n",
+			     fde, fde->fd);
+		uring_slot_free(uring_ev, idx);
+		DLIST_REMOVE(uring_ev->ev->fd_events, fde);
+		fde->wrapper = NULL;
+		fde->event_ctx = NULL;
+		return;
+	}
+
+	if (res < 0) {
+		revents = POLLERR;
+	} else {
+		revents = res;
+	}
+
+	if (revents & (POLLHUP|POLLERR)) {
+		/*
+		 * If we only wait for TEVENT_FD_WRITE, we should not
+		 * tell the event handler about it, and remove the
+		 * writable flag, as we only report errors when
+		 * waiting for read events to match the select
+		 * behavior.
+		 */
+		if (!(fde->flags & TEVENT_FD_READ)) {
+			TEVENT_FD_NOT_WRITEABLE(fde);
+			return;
+		}
+		flags |= TEVENT_FD_READ;
+	}
+	if (revents & POLLIN) {
+		flags |= TEVENT_FD_READ;
+	}
+	if (revents & POLLOUT) {
+		flags |= TEVENT_FD_WRITE;
+	}
+
+	flags &= fde->flags;
+	if (flags == 0) {
+		/* the flags changed meanwhile */
+		uring_mark_dirty(uring_ev, idx);
+		return;
+	}
+
+	uring_mark_ready(uring_ev, idx, flags);
+}
+
+/*
+  look at all completions the kernel has for us
+*/
+static void uring_harvest(struct uring_event_context *uring_ev)
+{
+	unsigned head = *uring_ev->cq_khead;
+	unsigned tail = __atomic_load_n(uring_ev->cq_ktail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe =
+			&uring_ev->cqes[head & uring_ev->cq_mask];
+
+		uring_handle_cqe(uring_ev, cqe->user_data, cqe->res);
+		head += 1;
+	}
+
+	__atomic_store_n(uring_ev->cq_khead, head, __ATOMIC_RELEASE);
+}
+
+/*
+  call the handler of the next fd event that is ready
+*/
+static bool uring_dispatch(struct uring_event_context *uring_ev, int *pret)
+{
+	while (uring_ev->ready_head < uring_ev->num_ready) {
+		uint32_t idx = uring_ev->ready[uring_ev->ready_head++];
+		struct uring_fd_slot *slot = &uring_ev->slots[idx];
+		struct tevent_fd *fde = slot->fde;
+		uint16_t flags;
+
+		slot->on_ready_list = false;
+
+		if ((fde == NULL) || (slot->ready == 0)) {
+			continue;
+		}
+
+		flags = slot->ready & fde->flags;
+		slot->ready = 0;
+
+		/* The poll request is re-armed after the handler */
+		uring_mark_dirty(uring_ev, idx);
+
+		if (flags == 0) {
+			continue;
+		}
+
+		*pret = tevent_common_invoke_fd_handler(fde, flags, NULL);
+		return true;
+	}
+
+	uring_ev->ready_head = 0;
+	uring_ev->num_ready = 0;
+
+	return false;
+}
+
+/*
+  event loop handling using io_uring
+*/
+static int uring_event_loop(struct uring_event_context *uring_ev,
+			    struct timeval *tvalp)
+{
+	struct tevent_context *ev = uring_ev->ev;
+	int ret = 0;
+	int wait_errno;
+
+	if (uring_dispatch(uring_ev, &ret)) {
+		/* still busy with the completions of the last wait */
+		return ret;
+	}
+
+	uring_flush_dirty(uring_ev);
+
+	if (ev->signal_events &&
+	    tevent_common_check_signal(ev)) {
+		return 0;
+	}
+
+	tevent_trace_point_callback(ev, TEVENT_TRACE_BEFORE_WAIT);
+	ret = uring_enter(uring_ev, true, tvalp);
+	wait_errno = errno;
+	tevent_trace_point_callback(ev, TEVENT_TRACE_AFTER_WAIT);
+
+	if (ret == -1 && wait_errno == EINTR && ev->signal_events) {
+		if (tevent_common_check_signal(ev)) {
+			return 0;
+		}
+	}
+
+	if (ret == -1 &&
+	    wait_errno != EINTR &&
+	    wait_errno != ETIME &&
+	    wait_errno != EAGAIN &&
+	    wait_errno != EBUSY) {
+		errno = wait_errno;
+		uring_panic(uring_ev, "io_uring_enter() failed");
+		return -1;
+	}
+
+	uring_harvest(uring_ev);
+
+	if (uring_dispatch(uring_ev, &ret)) {
+		return ret;
+	}
+
+	if (tvalp != NULL) {
+		/* we don't care about a possible delay here */
+		tevent_common_loop_timer_delay(ev);
+	}
+
+	return 0;
+}
+
+/*
+  create a uring_event_context structure.
+*/
+static int uring_event_context_init(struct tevent_context *ev)
+{
+	struct uring_event_context *uring_ev = NULL;
+	int ret;
+
+	/*
+	 * We might be called during tevent_re_initialise()
+	 * which means we need to free our old additional_data.
+	 */
+	TALLOC_FREE(ev->additional_data);
+
+	uring_ev = talloc_zero(ev, struct uring_event_context);
+	if (uring_ev == NULL) {
+		return -1;
+	}
+	uring_ev->ev = ev;
+	uring_ev->ring_fd = -1;
+	uring_ev->free_slot = UINT32_MAX;
+
+	ret = uring_ring_setup(uring_ev);
+	if (ret != 0) {
+		tevent_debug(ev, TEVENT_DEBUG_FATAL,
+			     "Failed to set up io_uring (%s).\n",
+			     strerror(errno));
+		talloc_free(uring_ev);
+		return -1;
+	}
+	talloc_set_destructor(uring_ev, uring_ctx_destructor);
+
+	ev->additional_data = uring_ev;
+	return 0;
+}
+
+/*
+  destroy an fd_event
+*/
+static int uring_event_fd_destructor(struct tevent_fd *fde)
+{
+	struct tevent_context *ev = fde->event_ctx;
+	struct uring_event_context *uring_ev = NULL;
+	uint32_t idx = fde->additional_flags;
+
+	if (ev == NULL) {
+		return tevent_common_fd_destructor(fde);
+	}
+
+	uring_ev = talloc_get_type_abort(ev->additional_data,
+					 struct uring_event_context);
+
+	uring_check_reopen(uring_ev);
+
+	if (uring_ev->slots[idx].armed != 0) {
+		int ret;
+
+		/*
+		 * The poll request holds a reference to the file, hand
+		 * the removal to the kernel right away, so that the
+		 * caller can close the fd and the peer sees that.
+		 */
+		uring_remove_poll(uring_ev, idx);
+		ret = uring_enter(uring_ev, false, NULL);
+		if (ret == -1) {
+			uring_panic(uring_ev, "io_uring_enter() failed");
+		}
+	}
+	uring_slot_free(uring_ev, idx);
+
+	return tevent_common_fd_destructor(fde);
+}
+
+/*
+  add a fd based event
+  return NULL on failure (memory allocation error)
+*/
+static struct tevent_fd *uring_event_add_fd(struct tevent_context *ev,
+					    TALLOC_CTX *mem_ctx,
+					    int fd, uint16_t flags,
+					    tevent_fd_handler_t handler,
+					    void *private_data,
+					    const char *handler_name,
+					    const char *location)
+{
+	struct uring_event_context *uring_ev =
+		talloc_get_type_abort(ev->additional_data,
+		struct uring_event_context);
+	struct tevent_fd *fde = NULL;
+
+	fde = tevent_common_add_fd(ev, mem_ctx, fd, flags,
+				   handler, private_data,
+				   handler_name, location);
+	if (fde == NULL) {
+		return NULL;
+	}
+
+	if (!uring_slot_alloc(uring_ev, fde)) {
+		TALLOC_FREE(fde);
+		return NULL;
+	}
+	talloc_set_destructor(fde, uring_event_fd_destructor);
+
+	uring_mark_dirty(uring_ev, fde->additional_flags);
+
+	return fde;
+}
+
+/*
+  set the fd event flags
+*/
+static void uring_event_set_fd_flags(struct tevent_fd *fde, uint16_t flags)
+{
+	struct tevent_context *ev = NULL;
+	struct uring_event_context *uring_ev = NULL;
+
+	if (fde->flags == flags) {
+		return;
+	}
+
+	ev = fde->event_ctx;
+	uring_ev = talloc_get_type_abort(ev->additional_data,
+					 struct uring_event_context);
+
+	fde->flags = flags;
+
+	/* This is picked up before the next wait */
+	uring_mark_dirty(uring_ev, fde->additional_flags);
+}
+
+/*
+  do a single event loop using the events defined in ev
+*/
+static int uring_event_loop_once(struct tevent_context *ev,
+				 const char *location)
+{
+	struct uring_event_context *uring_ev =
+		talloc_get_type_abort(ev->additional_data,
+		struct uring_event_context);
+	struct timeval tval;
+
+	if (ev->signal_events &&
+	    tevent_common_check_signal(ev)) {
+		return 0;
+	}
+
+	if (ev->threaded_contexts != NULL) {
+		tevent_common_threaded_activate_immediate(ev);
+	}
+
+	if (ev->immediate_events &&
+	    tevent_common_loop_immediate(ev)) {
+		return 0;
+	}
+
+	tval = tevent_common_loop_timer_delay(ev);
+	if (tevent_timeval_is_zero(&tval)) {
+		return 0;
+	}
+
+	uring_check_reopen(uring_ev);
+
+	return uring_event_loop(uring_ev, &tval);
+}
+
+static const struct tevent_ops uring_event_ops = {
+	.context_init		= uring_event_context_init,
+	.add_fd			= uring_event_add_fd,
+	.set_fd_close_fn	= tevent_common_fd_set_close_fn,
+	.get_fd_flags		= tevent_common_fd_get_flags,
+	.set_fd_flags		= uring_event_set_fd_flags,
+	.add_timer		= tevent_common_add_timer_v2,
+	.schedule_immediate	= tevent_common_schedule_immediate,
+	.add_signal		= tevent_common_add_signal,
+	.loop_once		= uring_event_loop_once,
+	.loop_wait		= tevent_common_loop_wait,
+};
+
+_PRIVATE_ bool tevent_io_uring_init(void)
+{
+	return tevent_register_backend("io_uring", &uring_event_ops);
+}
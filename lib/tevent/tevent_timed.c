@@ -148,12 +148,9 @@ static int tevent_common_timed_destructor(struct tevent_timer *te)
 		     "Destroying timer event %p \"%s\"\n",
 		     te, te->handler_name);
 
-	if (te->event_ctx->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-
 	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
-	DLIST_REMOVE(te->event_ctx->timer_events, te);
+	tevent_common_timer_unlink(te->event_ctx, te);
+	te->event_ctx->timers.count -= 1;
 
 	te->event_ctx = NULL;
 done:
@@ -165,61 +162,163 @@ done:
 	return 0;
 }
 
-static void tevent_common_insert_timer(struct tevent_context *ev,
-				       struct tevent_timer *te,
-				       bool optimize_zero)
+/*
+  The timers are kept in a binary min-heap ordered by next_event,
+  so adding, updating and removing a timer is O(log n). Timers with
+  the same next_event run in the order they were added, the
+  sequence number breaks those ties. Zero timers, used by some
+  callers instead of immediates, sort before all others.
+*/
+static bool tevent_timer_before(const struct tevent_timer *te1,
+				const struct tevent_timer *te2)
 {
-	struct tevent_timer *prev_te = NULL;
+	int ret;
 
-	if (te->destroyed) {
-		tevent_abort(ev, "tevent_timer use after free");
-		return;
+	ret = tevent_timeval_compare(&te1->next_event, &te2->next_event);
+	if (ret != 0) {
+		return (ret < 0);
 	}
+	return (te1->seq < te2->seq);
+}
 
-	/* keep the list ordered */
-	if (optimize_zero && tevent_timeval_is_zero(&te->next_event)) {
-		/*
-		 * Some callers use zero tevent_timer
-		 * instead of tevent_immediate events.
-		 *
-		 * As these can happen very often,
-		 * we remember the last zero timer
-		 * in the list.
-		 */
-		prev_te = ev->last_zero_timer;
-		ev->last_zero_timer = te;
-	} else {
-		struct tevent_timer *cur_te;
-
-		/*
-		 * we traverse the list from the tail
-		 * because it's much more likely that
-		 * timers are added at the end of the list
-		 */
-		for (cur_te = DLIST_TAIL(ev->timer_events);
-		     cur_te != NULL;
-		     cur_te = DLIST_PREV(cur_te))
-		{
-			int ret;
-
-			/*
-			 * if the new event comes before the current
-			 * we continue searching
-			 */
-			ret = tevent_timeval_compare(&te->next_event,
-						     &cur_te->next_event);
-			if (ret < 0) {
-				continue;
-			}
+static void tevent_timer_heap_set(struct tevent_context *ev,
+				  size_t idx,
+				  struct tevent_timer *te)
+{
+	ev->timers.heap[idx] = te;
+	te->heap_idx = idx;
+}
+
+static void tevent_timer_heap_up(struct tevent_context *ev, size_t idx)
+{
+	struct tevent_timer *te = ev->timers.heap[idx];
+
+	while (idx > 0) {
+		size_t parent = (idx - 1) / 2;
+
+		if (!tevent_timer_before(te, ev->timers.heap[parent])) {
+			break;
+		}
+		tevent_timer_heap_set(ev, idx, ev->timers.heap[parent]);
+		idx = parent;
+	}
 
+	tevent_timer_heap_set(ev, idx, te);
+}
+
+static void tevent_timer_heap_down(struct tevent_context *ev, size_t idx)
+{
+	struct tevent_timer *te = ev->timers.heap[idx];
+	size_t num = ev->timers.num;
+
+	while (true) {
+		size_t child = 2 * idx + 1;
+
+		if (child >= num) {
 			break;
 		}
+		if ((child + 1 < num) &&
+		    tevent_timer_before(ev->timers.heap[child + 1],
+					ev->timers.heap[child])) {
+			child += 1;
+		}
+		if (!tevent_timer_before(ev->timers.heap[child], te)) {
+			break;
+		}
+		tevent_timer_heap_set(ev, idx, ev->timers.heap[child]);
+		idx = child;
+	}
+
+	tevent_timer_heap_set(ev, idx, te);
+}
+
+static bool tevent_timer_in_heap(struct tevent_context *ev,
+				 struct tevent_timer *te)
+{
+	return ((te->heap_idx < ev->timers.num) &&
+		(ev->timers.heap[te->heap_idx] == te));
+}
+
+/* move a timer to its place after next_event changed */
+static void tevent_timer_heap_fix(struct tevent_context *ev, size_t idx)
+{
+	if ((idx > 0) &&
+	    tevent_timer_before(ev->timers.heap[idx],
+				ev->timers.heap[(idx - 1) / 2])) {
+		tevent_timer_heap_up(ev, idx);
+		return;
+	}
+	tevent_timer_heap_down(ev, idx);
+}
+
+/*
+  make room in the heap for one more timer of the context
+*/
+static bool tevent_common_reserve_timer(struct tevent_context *ev)
+{
+	if (ev->timers.count == ev->timers.size) {
+		size_t size = MAX(ev->timers.size * 2, 16);
+		struct tevent_timer **heap = NULL;
+
+		heap = talloc_realloc(ev, ev->timers.heap,
+				      struct tevent_timer *, size);
+		if (heap == NULL) {
+			return false;
+		}
+		ev->timers.heap = heap;
+		ev->timers.size = size;
+	}
+
+	ev->timers.count += 1;
+	return true;
+}
+
+static bool tevent_common_insert_timer(struct tevent_context *ev,
+				       struct tevent_timer *te)
+{
+	if (te->destroyed) {
+		tevent_abort(ev, "tevent_timer use after free");
+		return false;
+	}
 
-		prev_te = cur_te;
+	if (ev->timers.num == ev->timers.size) {
+		/* tevent_common_reserve_timer() prevents this */
+		tevent_abort(ev, "tevent_timer heap overflow");
+		return false;
 	}
 
+	te->seq = ev->timers.seq++;
+	tevent_timer_heap_set(ev, ev->timers.num, te);
+	ev->timers.num += 1;
+	tevent_timer_heap_up(ev, te->heap_idx);
+
 	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_ATTACH);
-	DLIST_ADD_AFTER(ev->timer_events, te, prev_te);
+	DLIST_ADD(ev->timer_events, te);
+
+	return true;
+}
+
+/*
+  remove a timer from the heap and the list of timers
+*/
+_PRIVATE_ void tevent_common_timer_unlink(struct tevent_context *ev,
+					  struct tevent_timer *te)
+{
+	size_t idx = te->heap_idx;
+
+	DLIST_REMOVE(ev->timer_events, te);
+
+	if (!tevent_timer_in_heap(ev, te)) {
+		return;
+	}
+
+	ev->timers.num -= 1;
+	if (idx == ev->timers.num) {
+		return;
+	}
+
+	tevent_timer_heap_set(ev, idx, ev->timers.heap[ev->timers.num]);
+	tevent_timer_heap_fix(ev, idx);
 }
 
 /*
@@ -233,8 +332,7 @@ static struct tevent_timer *tevent_common_add_timer_internal(
 					tevent_timer_handler_t handler,
 					void *private_data,
 					const char *handler_name,
-					const char *location,
-					bool optimize_zero)
+					const char *location)
 {
 	struct tevent_timer *te;
 
@@ -250,11 +348,11 @@ static struct tevent_timer *tevent_common_add_timer_internal(
 		.location	= location,
 	};
 
-	if (ev->timer_events == NULL) {
-		ev->last_zero_timer = NULL;
+	if (!tevent_common_reserve_timer(ev)) {
+		talloc_free(te);
+		return NULL;
 	}
-
-	tevent_common_insert_timer(ev, te, optimize_zero);
+	tevent_common_insert_timer(ev, te);
 
 	talloc_set_destructor(te, tevent_common_timed_destructor);
 
@@ -273,17 +371,9 @@ struct tevent_timer *tevent_common_add_timer(struct tevent_context *ev,
 					     const char *handler_name,
 					     const char *location)
 {
-	/*
-	 * do not use optimization, there are broken Samba
-	 * versions which use tevent_common_add_timer()
-	 * without using tevent_common_loop_timer_delay(),
-	 * it just uses DLIST_REMOVE(ev->timer_events, te)
-	 * and would leave ev->last_zero_timer behind.
-	 */
 	return tevent_common_add_timer_internal(ev, mem_ctx, next_event,
 						handler, private_data,
-						handler_name, location,
-						false);
+						handler_name, location);
 }
 
 struct tevent_timer *tevent_common_add_timer_v2(struct tevent_context *ev,
@@ -295,31 +385,35 @@ struct tevent_timer *tevent_common_add_timer_v2(struct tevent_context *ev,
 					        const char *location)
 {
 	/*
-	 * Here we turn on last_zero_timer optimization
+	 * This used to differ from tevent_common_add_timer() in
+	 * optimizing zero timers, the heap does that for both.
 	 */
 	return tevent_common_add_timer_internal(ev, mem_ctx, next_event,
 						handler, private_data,
-						handler_name, location,
-						true);
+						handler_name, location);
 }
 
 void tevent_update_timer(struct tevent_timer *te, struct timeval next_event)
 {
 	struct tevent_context *ev = te->event_ctx;
 
-	if (ev->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
 	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
 	DLIST_REMOVE(ev->timer_events, te);
 
 	te->next_event = next_event;
 
-	/*
-	 * Not doing the zero_timer optimization. This is for new code
-	 * that should know about immediates.
-	 */
-	tevent_common_insert_timer(ev, te, false);
+	if (!tevent_timer_in_heap(ev, te)) {
+		/* can't fail, the heap has room for all our timers */
+		tevent_common_insert_timer(ev, te);
+		return;
+	}
+
+	/* runs after the timers with the same time, as a new timer */
+	te->seq = ev->timers.seq++;
+	tevent_timer_heap_fix(ev, te->heap_idx);
+
+	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_ATTACH);
+	DLIST_ADD(ev->timer_events, te);
 }
 
 int tevent_common_invoke_timer_handler(struct tevent_timer *te,
@@ -341,10 +435,7 @@ int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 	 * handler because in a semi-async inner event loop called from the
 	 * handler we don't want to come across this event again -- vl
 	 */
-	if (te->event_ctx->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-	DLIST_REMOVE(te->event_ctx->timer_events, te);
+	tevent_common_timer_unlink(te->event_ctx, te);
 
 	TEVENT_DEBUG(te->event_ctx, TEVENT_DEBUG_TRACE,
 		     "Running timer event %p \"%s\"\n",
@@ -395,6 +486,7 @@ int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 	/* The callback was already called when freed from the handler. */
 	if (!te->destroyed) {
 		tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
+		te->event_ctx->timers.count -= 1;
 	}
 
 	te->wrapper = NULL;
@@ -417,15 +509,16 @@ int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 struct timeval tevent_common_loop_timer_delay(struct tevent_context *ev)
 {
 	struct timeval current_time = tevent_timeval_zero();
-	struct tevent_timer *te = ev->timer_events;
+	struct tevent_timer *te = NULL;
 	int ret;
 
-	if (!te) {
+	if (ev->timers.num == 0) {
 		/* have a default tick time of 30 seconds. This guarantees
 		   that code that uses its own timeout checking will be
 		   able to proceed eventually */
 		return tevent_timeval_set(30, 0);
 	}
+	te = ev->timers.heap[0];
 
 	/*
 	 * work out the right timeout for the next timed event
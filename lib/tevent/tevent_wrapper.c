@@ -291,10 +291,7 @@ static int tevent_wrapper_context_destructor(struct tevent_context *wrap_ev)
 		te->wrapper = NULL;
 		te->event_ctx = NULL;
 
-		if (main_ev->last_zero_timer == te) {
-			main_ev->last_zero_timer = DLIST_PREV(te);
-		}
-		DLIST_REMOVE(main_ev->timer_events, te);
+		tevent_common_timer_unlink(main_ev, te);
 	}
 
 	for (ie = main_ev->immediate_events; ie; ie = in) {
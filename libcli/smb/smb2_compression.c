@@ -0,0 +1,378 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 compression transform
+
+   Copyright (C) Samba Team
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "../libcli/smb/smb_common.h"
+#include "../libcli/smb/smb2_compression.h"
+#include "lib/compression/lzxpress.h"
+#include "lib/compression/lzxpress_huffman.h"
+#include "lib/util/iov_buf.h"
+
+bool smb2_compression_algo_supported(uint16_t algo)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		return true;
+	}
+
+	return false;
+}
+
+static NTSTATUS smb2_compression_decompress_payload(uint16_t algo,
+						    const uint8_t *in,
+						    size_t in_len,
+						    uint8_t *out,
+						    size_t out_len)
+{
+	ssize_t ret;
+
+	if (out_len == 0) {
+		/*
+		 * Nothing to do, both decompressors
+		 * would treat this as an error.
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (in_len > UINT32_MAX || out_len > UINT32_MAX) {
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		ret = lzxpress_decompress(in, in_len, out, out_len);
+		break;
+	case SMB2_COMPRESSION_LZ77_HUFFMAN:
+		ret = lzxpress_huffman_decompress(in, in_len, out, out_len);
+		break;
+	default:
+		DBG_INFO("Unsupported compression algorithm 0x%04x\n", algo);
+		return NT_STATUS_UNSUPPORTED_COMPRESSION;
+	}
+
+	if (ret < 0 || (size_t)ret != out_len) {
+		DBG_INFO("Decompression with algorithm 0x%04x returned %zd, "
+			 "expected %zu\n", algo, ret, out_len);
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_compression_decompress_unchained(TALLOC_CTX *mem_ctx,
+						      const uint8_t *buf,
+						      size_t buflen,
+						      size_t max_size,
+						      uint8_t **_out,
+						      size_t *_outlen)
+{
+	uint32_t original_size = IVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE);
+	uint16_t algo = SVAL(buf, SMB2_COMP_TF_ALGORITHM);
+	uint32_t offset = IVAL(buf, SMB2_COMP_TF_OFFSET);
+	const uint8_t *in = buf + SMB2_COMP_TF_HDR_SIZE;
+	size_t in_len = buflen - SMB2_COMP_TF_HDR_SIZE;
+	size_t out_len;
+	uint8_t *out = NULL;
+	NTSTATUS status;
+
+	if (offset > in_len) {
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+
+	out_len = (size_t)offset + original_size;
+	if (out_len > max_size) {
+		DBG_INFO("offset[%"PRIu32"] + original_size[%"PRIu32"] "
+			 "exceeds max_size[%zu]\n",
+			 offset, original_size, max_size);
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+
+	out = talloc_array(mem_ctx, uint8_t, out_len);
+	if (out == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/*
+	 * The first 'offset' bytes are not compressed.
+	 */
+	memcpy(out, in, offset);
+
+	status = smb2_compression_decompress_payload(algo,
+						     in + offset,
+						     in_len - offset,
+						     out + offset,
+						     original_size);
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(out);
+		return status;
+	}
+
+	*_out = out;
+	*_outlen = out_len;
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_compression_decompress_chained(TALLOC_CTX *mem_ctx,
+						    const uint8_t *buf,
+						    size_t buflen,
+						    size_t max_size,
+						    uint8_t **_out,
+						    size_t *_outlen)
+{
+	uint32_t original_size = IVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE);
+	size_t ofs = SMB2_COMP_TF_CHAINED_HDR_SIZE;
+	size_t out_ofs = 0;
+	uint8_t *out = NULL;
+	NTSTATUS status;
+
+	if (original_size > max_size) {
+		DBG_INFO("original_size[%"PRIu32"] exceeds max_size[%zu]\n",
+			 original_size, max_size);
+		return NT_STATUS_BAD_COMPRESSION_BUFFER;
+	}
+
+	out = talloc_array(mem_ctx, uint8_t, original_size);
+	if (out == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	while (ofs < buflen) {
+		const uint8_t *hdr = buf + ofs;
+		const uint8_t *payload = NULL;
+		size_t out_left = original_size - out_ofs;
+		uint16_t algo;
+		uint32_t length;
+		uint32_t payload_size;
+
+		if (buflen - ofs < SMB2_COMP_PAYLOAD_HDR_SIZE) {
+			goto bad;
+		}
+
+		algo = SVAL(hdr, SMB2_COMP_PAYLOAD_ALGORITHM);
+		length = IVAL(hdr, SMB2_COMP_PAYLOAD_LENGTH);
+		ofs += SMB2_COMP_PAYLOAD_HDR_SIZE;
+
+		if (length > buflen - ofs) {
+			goto bad;
+		}
+		payload = buf + ofs;
+		ofs += length;
+
+		switch (algo) {
+		case SMB2_COMPRESSION_NONE:
+			if (length > out_left) {
+				goto bad;
+			}
+			memcpy(out + out_ofs, payload, length);
+			out_ofs += length;
+			break;
+
+		case SMB2_COMPRESSION_PATTERN_V1:
+			/*
+			 * Pattern (1 byte), Reserved1 (1 byte),
+			 * Reserved2 (2 bytes), Repetitions (4 bytes)
+			 */
+			if (length != 8) {
+				goto bad;
+			}
+			payload_size = IVAL(payload, 4);
+			if (payload_size > out_left) {
+				goto bad;
+			}
+			memset(out + out_ofs, CVAL(payload, 0), payload_size);
+			out_ofs += payload_size;
+			break;
+
+		default:
+			/*
+			 * The length includes the
+			 * OriginalPayloadSize field.
+			 */
+			if (length < 4) {
+				goto bad;
+			}
+			payload_size = IVAL(payload, 0);
+			if (payload_size > out_left) {
+				goto bad;
+			}
+			status = smb2_compression_decompress_payload(
+					algo,
+					payload + 4,
+					length - 4,
+					out + out_ofs,
+					payload_size);
+			if (!NT_STATUS_IS_OK(status)) {
+				TALLOC_FREE(out);
+				return status;
+			}
+			out_ofs += payload_size;
+			break;
+		}
+	}
+
+	if (out_ofs != original_size) {
+		goto bad;
+	}
+
+	*_out = out;
+	*_outlen = original_size;
+	return NT_STATUS_OK;
+
+bad:
+	TALLOC_FREE(out);
+	return NT_STATUS_BAD_COMPRESSION_BUFFER;
+}
+
+NTSTATUS smb2_compression_decompress_pdu(TALLOC_CTX *mem_ctx,
+					 const uint8_t *buf,
+					 size_t buflen,
+					 size_t max_size,
+					 uint8_t **_out,
+					 size_t *_outlen)
+{
+	uint16_t flags;
+
+	/*
+	 * The chained header plus the first payload header
+	 * has the same size as the unchained header.
+	 */
+	if (buflen < SMB2_COMP_TF_HDR_SIZE) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (IVAL(buf, SMB2_COMP_TF_PROTOCOL_ID) != SMB2_COMP_TF_MAGIC) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	flags = SVAL(buf, SMB2_COMP_TF_FLAGS);
+	if (flags & SMB2_COMPRESSION_FLAG_CHAINED) {
+		return smb2_compression_decompress_chained(mem_ctx,
+							   buf,
+							   buflen,
+							   max_size,
+							   _out,
+							   _outlen);
+	}
+
+	return smb2_compression_decompress_unchained(mem_ctx,
+						     buf,
+						     buflen,
+						     max_size,
+						     _out,
+						     _outlen);
+}
+
+NTSTATUS smb2_compression_compress_pdu(TALLOC_CTX *mem_ctx,
+				       struct lzxhuff_compressor_mem *cmp_mem,
+				       bool chained,
+				       const struct iovec *vector,
+				       int count,
+				       uint8_t **_out,
+				       size_t *_outlen)
+{
+	TALLOC_CTX *frame = NULL;
+	ssize_t in_len;
+	uint8_t *in = NULL;
+	uint8_t *out = NULL;
+	size_t hdr_len;
+	size_t available;
+	ssize_t comp_len;
+
+	in_len = iov_buflen(vector, count);
+	if (in_len == -1 || (size_t)in_len > UINT32_MAX) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (chained) {
+		/*
+		 * A single LZ77+Huffman payload,
+		 * including OriginalPayloadSize.
+		 */
+		hdr_len = SMB2_COMP_TF_CHAINED_HDR_SIZE +
+			  SMB2_COMP_PAYLOAD_HDR_SIZE + 4;
+	} else {
+		hdr_len = SMB2_COMP_TF_HDR_SIZE;
+	}
+
+	/*
+	 * It's only worth it if we save at least 1/8,
+	 * this also means the compressor gives up
+	 * early on incompressible data.
+	 */
+	available = in_len - (in_len / 8);
+	if (available <= hdr_len) {
+		return NT_STATUS_COMPRESSION_DISABLED;
+	}
+	available -= hdr_len;
+
+	frame = talloc_stackframe();
+
+	in = iov_concat(frame, vector, count);
+	if (in == NULL) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (cmp_mem == NULL) {
+		cmp_mem = talloc(frame, struct lzxhuff_compressor_mem);
+		if (cmp_mem == NULL) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	out = talloc_array(mem_ctx, uint8_t, hdr_len + available);
+	if (out == NULL) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	comp_len = lzxpress_huffman_compress(cmp_mem,
+					     in,
+					     in_len,
+					     out + hdr_len,
+					     available);
+	TALLOC_FREE(frame);
+	if (comp_len < 0) {
+		TALLOC_FREE(out);
+		return NT_STATUS_COMPRESSION_DISABLED;
+	}
+
+	SIVAL(out, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(out, SMB2_COMP_TF_ORIGINAL_SIZE, in_len);
+	SSVAL(out, SMB2_COMP_TF_ALGORITHM, SMB2_COMPRESSION_LZ77_HUFFMAN);
+	if (chained) {
+		SSVAL(out, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+		SIVAL(out, SMB2_COMP_TF_LENGTH, comp_len + 4);
+		SIVAL(out,
+		      SMB2_COMP_TF_CHAINED_HDR_SIZE +
+		      SMB2_COMP_PAYLOAD_HDR_SIZE,
+		      in_len);
+	} else {
+		SSVAL(out, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+		SIVAL(out, SMB2_COMP_TF_OFFSET, 0);
+	}
+
+	*_out = out;
+	*_outlen = hdr_len + comp_len;
+	return NT_STATUS_OK;
+}
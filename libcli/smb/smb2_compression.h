@@ -0,0 +1,66 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 compression transform
+
+   Copyright (C) Samba Team
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIBCLI_SMB_SMB2_COMPRESSION_H_
+#define _LIBCLI_SMB_SMB2_COMPRESSION_H_
+
+struct iovec;
+struct lzxhuff_compressor_mem;
+
+/*
+ * Returns true if we are able to decompress payloads
+ * using the given SMB2_COMPRESSION_* algorithm.
+ */
+bool smb2_compression_algo_supported(uint16_t algo);
+
+/*
+ * Decompress a PDU starting with a chained or unchained
+ * SMB2_COMPRESSION_TRANSFORM header.
+ *
+ * max_size limits the size of the resulting PDU,
+ * NT_STATUS_BAD_COMPRESSION_BUFFER is returned
+ * if the transform header claims more.
+ */
+NTSTATUS smb2_compression_decompress_pdu(TALLOC_CTX *mem_ctx,
+					 const uint8_t *buf,
+					 size_t buflen,
+					 size_t max_size,
+					 uint8_t **_out,
+					 size_t *_outlen);
+
+/*
+ * Compress the PDU described by vector/count using LZ77+Huffman
+ * into a single buffer with a SMB2_COMPRESSION_TRANSFORM header.
+ *
+ * cmp_mem is the (reusable) scratch memory for the compressor.
+ *
+ * NT_STATUS_COMPRESSION_DISABLED is returned if the compressed
+ * result would not save at least 1/8 of the original size,
+ * the caller should send the PDU uncompressed in that case.
+ */
+NTSTATUS smb2_compression_compress_pdu(TALLOC_CTX *mem_ctx,
+				       struct lzxhuff_compressor_mem *cmp_mem,
+				       bool chained,
+				       const struct iovec *vector,
+				       int count,
+				       uint8_t **_out,
+				       size_t *_outlen);
+
+#endif /* _LIBCLI_SMB_SMB2_COMPRESSION_H_ */
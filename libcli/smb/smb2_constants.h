@@ -37,6 +37,28 @@
 
 #define SMB2_TF_FLAGS_ENCRYPTED     0x0001
 
+/* offsets into SMB2_COMPRESSION_TRANSFORM header elements */
+#define SMB2_COMP_TF_PROTOCOL_ID	0x00 /*  4 bytes */
+#define SMB2_COMP_TF_ORIGINAL_SIZE	0x04 /*  4 bytes */
+#define SMB2_COMP_TF_ALGORITHM		0x08 /*  2 bytes */
+#define SMB2_COMP_TF_FLAGS		0x0A /*  2 bytes */
+#define SMB2_COMP_TF_OFFSET		0x0C /*  4 bytes (unchained) */
+#define SMB2_COMP_TF_LENGTH		0x0C /*  4 bytes (chained) */
+
+#define SMB2_COMP_TF_HDR_SIZE		0x10 /* 16 bytes (unchained) */
+#define SMB2_COMP_TF_CHAINED_HDR_SIZE	0x08 /*  8 bytes (chained) */
+
+/* offsets into a chained SMB2_COMPRESSION_PAYLOAD header */
+#define SMB2_COMP_PAYLOAD_ALGORITHM	0x00 /*  2 bytes */
+#define SMB2_COMP_PAYLOAD_FLAGS		0x02 /*  2 bytes */
+#define SMB2_COMP_PAYLOAD_LENGTH	0x04 /*  4 bytes */
+#define SMB2_COMP_PAYLOAD_HDR_SIZE	0x08 /*  8 bytes */
+
+#define SMB2_COMP_TF_MAGIC 0x424D53FC /* 0xFC 'S' 'M' 'B' */
+
+#define SMB2_COMPRESSION_FLAG_NONE	0x0000
+#define SMB2_COMPRESSION_FLAG_CHAINED	0x0001
+
 /* offsets into header elements for a sync SMB2 request */
 #define SMB2_HDR_PROTOCOL_ID    0x00
 #define SMB2_HDR_LENGTH		0x04
@@ -161,6 +183,16 @@
 	(((uint64_t)1 << (((nonce_len_bytes) - 8)*8)) - 1) \
 	))
 
+/* Values for the SMB2_COMPRESSION_CAPABILITIES Context (>= 0x311) */
+#define SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE        0x00000000
+#define SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED     0x00000001
+
+#define SMB2_COMPRESSION_NONE                          0x0000
+#define SMB2_COMPRESSION_LZNT1                         0x0001
+#define SMB2_COMPRESSION_LZ77                          0x0002
+#define SMB2_COMPRESSION_LZ77_HUFFMAN                  0x0003
+#define SMB2_COMPRESSION_PATTERN_V1                    0x0004
+
 /* Values for the SMB2_TRANSPORT_CAPABILITIES Context (>= 0x311) */
 #define SMB2_ACCEPT_TRANSPORT_LEVEL_SECURITY           0x0001
 
@@ -297,10 +329,16 @@
 #define SMB2_CLOSE_FLAGS_FULL_INFORMATION (0x01)
 
 #define SMB2_READFLAG_READ_UNBUFFERED	0x01
+#define SMB2_READFLAG_REQUEST_COMPRESSED	0x02
 
 #define SMB2_WRITEFLAG_WRITE_THROUGH	0x00000001
 #define SMB2_WRITEFLAG_WRITE_UNBUFFERED	0x00000002
 
+/* Channel of SMB2 READ and WRITE requests */
+#define SMB2_CHANNEL_NONE		0x00000000
+#define SMB2_CHANNEL_RDMA_V1		0x00000001
+#define SMB2_CHANNEL_RDMA_V1_INVALIDATE	0x00000002
+
 /* 2.2.31 SMB2 IOCTL Request */
 #define SMB2_IOCTL_FLAG_IS_FSCTL		0x00000001
 
@@ -514,11 +514,10 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 	return NT_STATUS_HMAC_NOT_SUPPORTED;
 }
 
-NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
-			       struct iovec *vector,
-			       int count)
+NTSTATUS smb2_signing_sign_pdu_nolog(struct smb2_signing_key *signing_key,
+				     struct iovec *vector,
+				     int count)
 {
-	uint16_t sign_algo_id;
 	uint8_t *hdr;
 	uint64_t session_id;
 	uint8_t res[16];
@@ -547,7 +546,6 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 	}
 
 	if (!smb2_signing_key_valid(signing_key)) {
-		DBG_WARNING("No signing key for SMB2 signing\n");
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
@@ -555,13 +553,44 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 
 	SIVAL(hdr, SMB2_HDR_FLAGS, IVAL(hdr, SMB2_HDR_FLAGS) | SMB2_HDR_FLAG_SIGNED);
 
-	sign_algo_id = signing_key->sign_algo_id;
-
 	status = smb2_signing_calc_signature(signing_key,
-					     sign_algo_id,
+					     signing_key->sign_algo_id,
 					     vector,
 					     count,
 					     res);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	memcpy(hdr + SMB2_HDR_SIGNATURE, res, 16);
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
+			       struct iovec *vector,
+			       int count)
+{
+	const uint8_t *hdr = (const uint8_t *)vector[0].iov_base;
+	uint16_t sign_algo_id;
+	NTSTATUS status;
+
+	if (BVAL(hdr, SMB2_HDR_SESSION_ID) == 0) {
+		/*
+		 * do not sign messages with a zero session_id.
+		 * See MS-SMB2 3.2.4.1.1
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (!smb2_signing_key_valid(signing_key)) {
+		DBG_WARNING("No signing key for SMB2 signing\n");
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	sign_algo_id = signing_key->sign_algo_id;
+
+	status = smb2_signing_sign_pdu_nolog(signing_key, vector, count);
 	if (!NT_STATUS_IS_OK(status)) {
 		DBG_ERR("smb2_signing_calc_signature(sign_algo_id=%u) - %s\n",
 			(unsigned)sign_algo_id, nt_errstr(status));
@@ -574,8 +603,6 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 	DEBUG(5,("signed SMB2 message (sign_algo_id=%u)\n",
 		 (unsigned)sign_algo_id));
 
-	memcpy(hdr + SMB2_HDR_SIGNATURE, res, 16);
-
 	return NT_STATUS_OK;
 }
 
@@ -729,9 +756,9 @@ NTSTATUS smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 	return NT_STATUS_OK;
 }
 
-NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
-				  struct iovec *vector,
-				  int count)
+NTSTATUS smb2_signing_encrypt_pdu_nolog(struct smb2_signing_key *encryption_key,
+					struct iovec *vector,
+					int count)
 {
 	bool use_encryptv2 = false;
 	uint16_t cipher_id;
@@ -758,7 +785,6 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (!smb2_signing_key_valid(encryption_key)) {
-		DBG_WARNING("No encryption key for SMB2 signing\n");
 		return NT_STATUS_ACCESS_DENIED;
 	}
 	cipher_id = encryption_key->cipher_algo_id;
@@ -944,16 +970,36 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 		TALLOC_FREE(ctext);
 	}
 
-	DBG_INFO("Encrypted SMB2 message\n");
-
 	status = NT_STATUS_OK;
 out:
 	return status;
 }
 
-NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
+NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 				  struct iovec *vector,
 				  int count)
+{
+	NTSTATUS status;
+
+	status = smb2_signing_encrypt_pdu_nolog(encryption_key, vector, count);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_ACCESS_DENIED) &&
+	    !smb2_signing_key_valid(encryption_key))
+	{
+		DBG_WARNING("No encryption key for SMB2 signing\n");
+		return status;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	DBG_INFO("Encrypted SMB2 message\n");
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_signing_decrypt_pdu_nolog(struct smb2_signing_key *decryption_key,
+					struct iovec *vector,
+					int count)
 {
 	bool use_encryptv2 = false;
 	uint16_t cipher_id;
@@ -982,7 +1028,6 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (!smb2_signing_key_valid(decryption_key)) {
-		DBG_WARNING("No decryption key for SMB2 signing\n");
 		return NT_STATUS_ACCESS_DENIED;
 	}
 	cipher_id = decryption_key->cipher_algo_id;
@@ -1178,9 +1223,29 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 		TALLOC_FREE(ctext);
 	}
 
-	DBG_INFO("Decrypted SMB2 message\n");
-
 	status = NT_STATUS_OK;
 out:
 	return status;
 }
+
+NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
+				  struct iovec *vector,
+				  int count)
+{
+	NTSTATUS status;
+
+	status = smb2_signing_decrypt_pdu_nolog(decryption_key, vector, count);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_ACCESS_DENIED) &&
+	    !smb2_signing_key_valid(decryption_key))
+	{
+		DBG_WARNING("No decryption key for SMB2 signing\n");
+		return status;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	DBG_INFO("Decrypted SMB2 message\n");
+
+	return NT_STATUS_OK;
+}
@@ -97,4 +97,20 @@ NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 				  struct iovec *vector,
 				  int count);
 
+/*
+ * The same as above without the debug messages. Apart from the CCM
+ * ciphers without gnutls_aead_cipher_encryptv2() they don't allocate
+ * memory either, so they can be called from a worker thread with a
+ * key that no other thread uses.
+ */
+NTSTATUS smb2_signing_sign_pdu_nolog(struct smb2_signing_key *signing_key,
+				     struct iovec *vector,
+				     int count);
+NTSTATUS smb2_signing_encrypt_pdu_nolog(struct smb2_signing_key *encryption_key,
+					struct iovec *vector,
+					int count);
+NTSTATUS smb2_signing_decrypt_pdu_nolog(struct smb2_signing_key *decryption_key,
+					struct iovec *vector,
+					int count);
+
 #endif /* _LIBCLI_SMB_SMB2_SIGNING_H_ */
@@ -0,0 +1,236 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Tests for the SMB2 compression transform
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "replace.h"
+#include <talloc.h>
+#include "system/filesys.h"
+#include "lib/util/byteorder.h"
+#include "libcli/util/ntstatus.h"
+#include "libcli/smb/smb2_constants.h"
+#include "libcli/smb/smb2_compression.h"
+
+#define PDU_SIZE 70000
+
+static uint8_t *make_pdu(TALLOC_CTX *mem_ctx)
+{
+	static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+	uint8_t *pdu = talloc_array(mem_ctx, uint8_t, PDU_SIZE);
+	size_t i;
+
+	assert_non_null(pdu);
+	for (i = 0; i < PDU_SIZE; i++) {
+		pdu[i] = text[i % (sizeof(text) - 1)];
+	}
+	SIVAL(pdu, 0, SMB2_MAGIC);
+
+	return pdu;
+}
+
+static void round_trip(bool chained)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	uint8_t *pdu = make_pdu(mem_ctx);
+	struct iovec iov[2] = {
+		{ .iov_base = pdu, .iov_len = SMB2_HDR_BODY },
+		{ .iov_base = pdu + SMB2_HDR_BODY,
+		  .iov_len = PDU_SIZE - SMB2_HDR_BODY },
+	};
+	uint8_t *comp = NULL;
+	size_t comp_len = 0;
+	uint8_t *out = NULL;
+	size_t out_len = 0;
+	NTSTATUS status;
+
+	status = smb2_compression_compress_pdu(mem_ctx, NULL, chained,
+					       iov, ARRAY_SIZE(iov),
+					       &comp, &comp_len);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_true(comp_len < PDU_SIZE / 2);
+	assert_int_equal(IVAL(comp, SMB2_COMP_TF_PROTOCOL_ID),
+			 SMB2_COMP_TF_MAGIC);
+	assert_int_equal(IVAL(comp, SMB2_COMP_TF_ORIGINAL_SIZE), PDU_SIZE);
+	assert_int_equal(SVAL(comp, SMB2_COMP_TF_FLAGS),
+			 chained ? SMB2_COMPRESSION_FLAG_CHAINED :
+				   SMB2_COMPRESSION_FLAG_NONE);
+
+	status = smb2_compression_decompress_pdu(mem_ctx, comp, comp_len,
+						 PDU_SIZE, &out, &out_len);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(out_len, PDU_SIZE);
+	assert_memory_equal(out, pdu, PDU_SIZE);
+
+	/* The result must not exceed max_size */
+	status = smb2_compression_decompress_pdu(mem_ctx, comp, comp_len,
+						 PDU_SIZE - 1, &out, &out_len);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BAD_COMPRESSION_BUFFER));
+
+	/* Truncated input */
+	status = smb2_compression_decompress_pdu(mem_ctx, comp, comp_len / 2,
+						 PDU_SIZE, &out, &out_len);
+	assert_false(NT_STATUS_IS_OK(status));
+
+	talloc_free(mem_ctx);
+}
+
+static void test_round_trip_unchained(void **state)
+{
+	round_trip(false);
+}
+
+static void test_round_trip_chained(void **state)
+{
+	round_trip(true);
+}
+
+static void test_incompressible(void **state)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	uint8_t buf[8192];
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	uint8_t *comp = NULL;
+	size_t comp_len = 0;
+	NTSTATUS status;
+	size_t i;
+	uint32_t x = 0x12345678;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		/* xorshift, good enough to defeat LZ77 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x & 0xff;
+	}
+
+	status = smb2_compression_compress_pdu(mem_ctx, NULL, false,
+					       &iov, 1, &comp, &comp_len);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_COMPRESSION_DISABLED));
+	assert_null(comp);
+
+	talloc_free(mem_ctx);
+}
+
+static void test_chained_none_and_pattern(void **state)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	uint8_t buf[SMB2_COMP_TF_CHAINED_HDR_SIZE +
+		    SMB2_COMP_PAYLOAD_HDR_SIZE + 4 +
+		    SMB2_COMP_PAYLOAD_HDR_SIZE + 8];
+	uint8_t *p = buf;
+	uint8_t *out = NULL;
+	size_t out_len = 0;
+	NTSTATUS status;
+	size_t i;
+
+	SIVAL(p, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(p, SMB2_COMP_TF_ORIGINAL_SIZE, 4 + 100);
+	p += SMB2_COMP_TF_CHAINED_HDR_SIZE;
+
+	SSVAL(p, SMB2_COMP_PAYLOAD_ALGORITHM, SMB2_COMPRESSION_NONE);
+	SSVAL(p, SMB2_COMP_PAYLOAD_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+	SIVAL(p, SMB2_COMP_PAYLOAD_LENGTH, 4);
+	p += SMB2_COMP_PAYLOAD_HDR_SIZE;
+	memcpy(p, "SMB!", 4);
+	p += 4;
+
+	SSVAL(p, SMB2_COMP_PAYLOAD_ALGORITHM, SMB2_COMPRESSION_PATTERN_V1);
+	SSVAL(p, SMB2_COMP_PAYLOAD_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+	SIVAL(p, SMB2_COMP_PAYLOAD_LENGTH, 8);
+	p += SMB2_COMP_PAYLOAD_HDR_SIZE;
+	SCVAL(p, 0, 'x');
+	SCVAL(p, 1, 0);
+	SSVAL(p, 2, 0);
+	SIVAL(p, 4, 100);
+
+	status = smb2_compression_decompress_pdu(mem_ctx, buf, sizeof(buf),
+						 1024, &out, &out_len);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(out_len, 104);
+	assert_memory_equal(out, "SMB!", 4);
+	for (i = 4; i < out_len; i++) {
+		assert_int_equal(out[i], 'x');
+	}
+
+	/* The payloads need to add up to the original size */
+	SIVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE, 4 + 99);
+	status = smb2_compression_decompress_pdu(mem_ctx, buf, sizeof(buf),
+						 1024, &out, &out_len);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BAD_COMPRESSION_BUFFER));
+
+	SIVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE, 4 + 101);
+	status = smb2_compression_decompress_pdu(mem_ctx, buf, sizeof(buf),
+						 1024, &out, &out_len);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BAD_COMPRESSION_BUFFER));
+
+	talloc_free(mem_ctx);
+}
+
+static void test_unsupported_algorithm(void **state)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	uint8_t buf[SMB2_COMP_TF_HDR_SIZE + 16] = { 0, };
+	uint8_t *out = NULL;
+	size_t out_len = 0;
+	NTSTATUS status;
+
+	SIVAL(buf, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(buf, SMB2_COMP_TF_ORIGINAL_SIZE, 64);
+	SSVAL(buf, SMB2_COMP_TF_ALGORITHM, SMB2_COMPRESSION_LZNT1);
+	SSVAL(buf, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+	SIVAL(buf, SMB2_COMP_TF_OFFSET, 0);
+
+	status = smb2_compression_decompress_pdu(mem_ctx, buf, sizeof(buf),
+						 1024, &out, &out_len);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_UNSUPPORTED_COMPRESSION));
+
+	/* The offset can't point beyond the buffer */
+	SSVAL(buf, SMB2_COMP_TF_ALGORITHM, SMB2_COMPRESSION_LZ77_HUFFMAN);
+	SIVAL(buf, SMB2_COMP_TF_OFFSET, 17);
+	status = smb2_compression_decompress_pdu(mem_ctx, buf, sizeof(buf),
+						 1024, &out, &out_len);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BAD_COMPRESSION_BUFFER));
+
+	talloc_free(mem_ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_round_trip_unchained),
+		cmocka_unit_test(test_round_trip_chained),
+		cmocka_unit_test(test_incompressible),
+		cmocka_unit_test(test_chained_none_and_pattern),
+		cmocka_unit_test(test_unsupported_algorithm),
+	};
+
+	if (argc == 2) {
+		cmocka_set_test_filter(argv[1]);
+	}
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
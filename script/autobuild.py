@@ -341,6 +341,7 @@ tasks = {
             "fileserver",
             "fileserver_smb1",
             "fileserver_smb1_done",
+            "fileserver_perf",
             "maptoguest",
             "simpleserver",
             "backupfromdc",
@@ -410,6 +411,7 @@ tasks = {
             "fileserver",
             "fileserver_smb1",
             "fileserver_smb1_done",
+            "fileserver_perf",
             "maptoguest",
             "simpleserver",
             "backupfromdc",
@@ -464,6 +466,7 @@ tasks = {
             "fileserver",
             "fileserver_smb1",
             "fileserver_smb1_done",
+            "fileserver_perf",
             "maptoguest",
             "ktest", # ktest is also tested in samba-ktest-mit samba
                      # and samba-mitkrb5 but is tested here against
@@ -653,6 +653,7 @@ sub get_interface($)
 		admemidmapnss     => 60,
 		localadmember2    => 61,
 		admemautorid      => 62,
+		fileserverperf    => 63,
 
 		rootdnsforwarder  => 64,
 
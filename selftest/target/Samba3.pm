@@ -239,6 +239,7 @@ sub check_env($$)
 	fileserver          => [],
 	fileserver_smb1     => [],
 	fileserver_smb1_done => ["fileserver_smb1"],
+	fileserver_perf     => [],
 	maptoguest          => [],
 	ktest               => [],
 
@@ -2149,6 +2150,24 @@ sub setup_fileserver_smb1_done
 	return $self->return_alias_env($path, $dep_env);
 }
 
+#
+# A file server with the optional fast paths of smbd turned on, so
+# the normal SMB2 tests also run through them.
+#
+sub setup_fileserver_perf
+{
+	my ($self, $path) = @_;
+	my $conf = "
+[global]
+	smb2 io uring = yes
+	smb2 parallel crypto = yes
+	server smb direct = yes
+	shared stat cache size = 1024
+	case insensitive index size = 100000
+";
+	return $self->setup_fileserver($path, $conf, "FILESERVERPERF");
+}
+
 sub setup_ktest
 {
 	my ($self, $prefix) = @_;
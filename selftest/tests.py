@@ -411,6 +411,8 @@ plantestsuite("samba.unittests.smb1cli_session", "none",
               [os.path.join(bindir(), "default/libcli/smb/test_smb1cli_session")])
 plantestsuite("samba.unittests.smb_util_translate", "none",
               [os.path.join(bindir(), "default/libcli/smb/test_util_translate")])
+plantestsuite("samba.unittests.smb2_compression", "none",
+              [os.path.join(bindir(), "default/libcli/smb/test_smb2_compression")])
 
 plantestsuite("samba.unittests.talloc_keep_secret", "none",
               [os.path.join(bindir(), "default/lib/util/test_talloc_keep_secret")])
@@ -475,6 +477,9 @@ if ("HAVE_TCP_USER_TIMEOUT" in config_hash):
                   environ={'SOCKET_WRAPPER_DIR': ''})
 plantestsuite("samba.unittests.adouble", "none",
               [os.path.join(bindir(), "test_adouble")])
+if ("HAVE_SMBDIRECT" in config_hash):
+    plantestsuite("samba.unittests.smb2_smbdirect", "none",
+                  [os.path.join(bindir(), "test_smb2_smbdirect")])
 plantestsuite("samba.unittests.gnutls_aead_aes_256_cbc_hmac_sha512", "none",
               [os.path.join(bindir(), "test_gnutls_aead_aes_256_cbc_hmac_sha512")])
 plantestsuite("samba.unittests.encode_decode", "none",
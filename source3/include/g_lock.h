@@ -58,6 +58,9 @@ NTSTATUS g_lock_lock_cb_dump(struct g_lock_lock_cb_state *glck,
 NTSTATUS g_lock_lock_cb_writev(struct g_lock_lock_cb_state *glck,
 			       const TDB_DATA *dbufs,
 			       size_t num_dbufs);
+NTSTATUS g_lock_lock_cb_resize_data(struct g_lock_lock_cb_state *glck,
+				    size_t datalen,
+				    uint8_t **data);
 void g_lock_lock_cb_unlock(struct g_lock_lock_cb_state *glck);
 struct tevent_req *g_lock_lock_cb_watch_data_send(
 	TALLOC_CTX *mem_ctx,
@@ -50,9 +50,10 @@ struct byte_range_lock;
 typedef uint64_t br_off;
 
 /* Internal structure in brlock.tdb.
-   The data in brlock records is an unsorted linear array of these
-   records.  It is unnecessary to store the count as tdb provides the
-   size of the record */
+   The data in brlock records is a linear array of these records,
+   sorted by start offset. Locks with the same start keep the order
+   they were added in. It is unnecessary to store the count as tdb
+   provides the size of the record */
 
 struct lock_struct {
 	struct lock_context context;
@@ -96,6 +96,12 @@ NTSTATUS messaging_send_iov(struct messaging_context *msg_ctx,
 			    struct server_id server, uint32_t msg_type,
 			    const struct iovec *iov, int iovlen,
 			    const int *fds, size_t num_fds);
+int messaging_send_iov_multi(struct messaging_context *msg_ctx,
+			     const struct server_id *dsts,
+			     const struct iovec *dst_iov,
+			     size_t num_dsts, uint32_t msg_type,
+			     const struct iovec *iov, int iovlen,
+			     int *errors);
 void messaging_send_all(struct messaging_context *msg_ctx,
 			int msg_type, const void *buf, size_t len);
 
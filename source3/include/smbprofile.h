@@ -65,6 +65,8 @@ struct tevent_context;
 	SMBPROFILE_STATS_BYTES(syscall_recvfile) \
 	SMBPROFILE_STATS_BASIC(syscall_renameat) \
 	SMBPROFILE_STATS_BYTES(syscall_asys_fsync) \
+	SMBPROFILE_STATS_BASIC(syscall_io_uring_submit) \
+	SMBPROFILE_STATS_COUNT(io_uring_inflight) \
 	SMBPROFILE_STATS_BASIC(syscall_stat) \
 	SMBPROFILE_STATS_BASIC(syscall_fstat) \
 	SMBPROFILE_STATS_BASIC(syscall_lstat) \
@@ -110,6 +112,7 @@ struct tevent_context;
 	SMBPROFILE_STATS_COUNT(statcache_lookups) \
 	SMBPROFILE_STATS_COUNT(statcache_misses) \
 	SMBPROFILE_STATS_COUNT(statcache_hits) \
+	SMBPROFILE_STATS_COUNT(statcache_shared_hits) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
 	SMBPROFILE_STATS_SECTION_START(SMB, "SMB Calls") \
@@ -221,6 +224,12 @@ struct tevent_context;
 	SMBPROFILE_STATS_BASIC(NT_transact_set_user_quota) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
+	SMBPROFILE_STATS_SECTION_START(smb2_crypto, "SMB2 Crypto") \
+	SMBPROFILE_STATS_BYTES(smb2_encrypt) \
+	SMBPROFILE_STATS_BYTES(smb2_decrypt) \
+	SMBPROFILE_STATS_BYTES(smb2_sign) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
 	SMBPROFILE_STATS_SECTION_START(smb2, "SMB2 Calls") \
 	SMBPROFILE_STATS_IOBYTES(smb2_negprot) \
 	SMBPROFILE_STATS_IOBYTES(smb2_sesssetup) \
@@ -127,6 +127,55 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if (tdb_flags & TDB_MUTEX_LOCKING) {
+		bool try_seqlock = false;
+
+		try_seqlock = lp_parm_bool(-1, "dbwrap_tdb_seqlock_read",
+					   "*", try_seqlock);
+		try_seqlock = lp_parm_bool(-1, "dbwrap_tdb_seqlock_read",
+					   base, try_seqlock);
+
+		if (try_seqlock) {
+			tdb_flags |= TDB_SEQLOCK_READ;
+		}
+	}
+
+	{
+		bool try_resizable = false;
+
+		/*
+		 * Only matters when the tdb is created, lets
+		 * locking.tdb & friends cope with many more open
+		 * files than their hash size was chosen for.
+		 */
+		try_resizable = lp_parm_bool(-1, "dbwrap_tdb_resizable_hash",
+					     "*", try_resizable);
+		try_resizable = lp_parm_bool(-1, "dbwrap_tdb_resizable_hash",
+					     base, try_resizable);
+
+		if (try_resizable) {
+			tdb_flags |= TDB_RESIZABLE_HASH;
+		}
+	}
+
+	{
+		bool try_size_classes = false;
+
+		/*
+		 * Only matters when the tdb is created, keeps
+		 * allocations cheap in databases with many free
+		 * records of mixed sizes.
+		 */
+		try_size_classes = lp_parm_bool(-1, "dbwrap_tdb_size_classes",
+						"*", try_size_classes);
+		try_size_classes = lp_parm_bool(-1, "dbwrap_tdb_size_classes",
+						base, try_size_classes);
+
+		if (try_size_classes) {
+			tdb_flags |= TDB_SIZE_CLASSES;
+		}
+	}
+
 	if (lp_clustering()) {
 		const char *sockname;
 
@@ -393,6 +393,55 @@ NTSTATUS g_lock_lock_cb_writev(struct g_lock_lock_cb_state *cb_state,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Give the callback direct write access to the record data, resized
+ * to datalen bytes. The first MIN(datalen, old datalen) bytes keep
+ * their previous content. This allows callers to change a small part
+ * of a large record without passing all of it through
+ * g_lock_lock_cb_writev(). The returned pointer is valid until the
+ * next g_lock_lock_cb_writev() or g_lock_lock_cb_resize_data() call.
+ */
+NTSTATUS g_lock_lock_cb_resize_data(struct g_lock_lock_cb_state *cb_state,
+				    size_t datalen,
+				    uint8_t **data)
+{
+	struct g_lock *lck = cb_state->lck;
+	uint8_t *buf = NULL;
+
+	if (lck->data == cb_state->updated_data.dptr) {
+		/*
+		 * We already own the data from a previous update
+		 */
+		buf = talloc_realloc(cb_state->update_mem_ctx,
+				     cb_state->updated_data.dptr,
+				     uint8_t,
+				     datalen);
+		if ((buf == NULL) && (datalen != 0)) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	} else {
+		/*
+		 * Still pointing into the record as fetched, copy it
+		 */
+		size_t keep = MIN(datalen, lck->datalen);
+		buf = talloc_array(cb_state->update_mem_ctx, uint8_t, datalen);
+		if ((buf == NULL) && (datalen != 0)) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		if (keep != 0) {
+			memcpy(buf, lck->data, keep);
+		}
+	}
+
+	cb_state->updated_data = (TDB_DATA) { .dptr = buf, .dsize = datalen };
+	cb_state->modified = true;
+	lck->data = buf;
+	lck->datalen = datalen;
+
+	*data = buf;
+	return NT_STATUS_OK;
+}
+
 void g_lock_lock_cb_unlock(struct g_lock_lock_cb_state *cb_state)
 {
 	cb_state->unlock = true;
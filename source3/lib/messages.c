@@ -466,6 +466,25 @@ static const char *private_path(const char *name)
 	return talloc_asprintf(talloc_tos(), "%s/%s", lp_private_dir(), name);
 }
 
+/*
+ * Opt-in: pass messages between local processes through per peer
+ * shared memory rings instead of one sendmsg() per message
+ */
+static void messaging_maybe_enable_rings(void)
+{
+	int ret;
+
+	if (!lp_parm_bool(-1, "messaging", "shm rings", false)) {
+		return;
+	}
+
+	ret = messaging_dgm_enable_rings();
+	if (ret != 0) {
+		DBG_NOTICE("messaging_dgm_enable_rings failed: %s\n",
+			   strerror(ret));
+	}
+}
+
 static NTSTATUS messaging_init_internal(TALLOC_CTX *mem_ctx,
 					struct tevent_context *ev,
 					struct messaging_context **pmsg_ctx)
@@ -558,6 +577,8 @@ static NTSTATUS messaging_init_internal(TALLOC_CTX *mem_ctx,
 	}
 	talloc_set_destructor(ctx, messaging_context_destructor);
 
+	messaging_maybe_enable_rings();
+
 #ifdef CLUSTER_SUPPORT
 	if (lp_clustering()) {
 		ref = messaging_ctdb_ref(
@@ -674,6 +695,8 @@ NTSTATUS messaging_reinit(struct messaging_context *msg_ctx)
 		return map_nt_error_from_unix(ret);
 	}
 
+	messaging_maybe_enable_rings();
+
 	if (lp_clustering()) {
 		ref = messaging_ctdb_ref(
 			msg_ctx->per_process_talloc_ctx,
@@ -895,6 +918,131 @@ NTSTATUS messaging_send_iov(struct messaging_context *msg_ctx,
 	return NT_STATUS_OK;
 }
 
+static int messaging_send_iov_prefixed(struct messaging_context *msg_ctx,
+				       struct server_id dst, uint32_t msg_type,
+				       const struct iovec *prefix,
+				       const struct iovec *iov, int iovlen)
+{
+	struct iovec iov2[iovlen+1];
+	int n = 0;
+
+	if (prefix != NULL) {
+		iov2[n++] = *prefix;
+	}
+	if (iovlen > 0) {
+		memcpy(&iov2[n], iov, iovlen * sizeof(*iov));
+	}
+
+	return messaging_send_iov_from(msg_ctx, msg_ctx->id, dst, msg_type,
+				       iov2, n + iovlen, NULL, 0);
+}
+
+/*
+ * Send a message to many destinations. The payload in iov is
+ * shared, dst_iov (if not NULL) holds one iovec per destination
+ * that is sent in front of it. Local destinations are handed to
+ * messaging_dgm_send_multi() in one go. errors[i] receives the
+ * result for dsts[i] like messaging_send_iov_from() returns it.
+ */
+int messaging_send_iov_multi(struct messaging_context *msg_ctx,
+			     const struct server_id *dsts,
+			     const struct iovec *dst_iov,
+			     size_t num_dsts, uint32_t msg_type,
+			     const struct iovec *iov, int iovlen,
+			     int *errors)
+{
+	TALLOC_CTX *frame = NULL;
+	uint8_t *hdrs = NULL;
+	struct iovec *hdr_iov = NULL;
+	pid_t *pids = NULL;
+	size_t *idx = NULL;
+	int *dgm_errors = NULL;
+	int dst_iovlen = (dst_iov != NULL) ? 2 : 1;
+	size_t i, num_local = 0;
+	int ret;
+
+	if (num_dsts == 0) {
+		return 0;
+	}
+
+	frame = talloc_stackframe();
+
+	hdrs = talloc_array(frame, uint8_t, num_dsts * MESSAGE_HDR_LENGTH);
+	hdr_iov = talloc_array(frame, struct iovec, num_dsts * dst_iovlen);
+	pids = talloc_array(frame, pid_t, num_dsts);
+	idx = talloc_array(frame, size_t, num_dsts);
+	dgm_errors = talloc_array(frame, int, num_dsts);
+	if ((hdrs == NULL) || (hdr_iov == NULL) || (pids == NULL) ||
+	    (idx == NULL) || (dgm_errors == NULL)) {
+		TALLOC_FREE(frame);
+		return ENOMEM;
+	}
+
+	for (i=0; i<num_dsts; i++) {
+		struct server_id dst = dsts[i];
+		const struct iovec *prefix = NULL;
+		uint8_t *hdr = &hdrs[num_local * MESSAGE_HDR_LENGTH];
+		struct iovec *hiov = &hdr_iov[num_local * dst_iovlen];
+
+		if (dst_iov != NULL) {
+			prefix = &dst_iov[i];
+		}
+
+		if (server_id_is_disconnected(&dst)) {
+			errors[i] = EINVAL;
+			continue;
+		}
+
+		if (server_id_equal(&dst, &msg_ctx->id) ||
+		    (dst.vnn != msg_ctx->id.vnn)) {
+			errors[i] = messaging_send_iov_prefixed(
+				msg_ctx, dst, msg_type, prefix, iov, iovlen);
+			continue;
+		}
+
+		message_hdr_put(hdr, msg_type, msg_ctx->id, dst);
+		hiov[0] = (struct iovec) {
+			.iov_base = hdr, .iov_len = MESSAGE_HDR_LENGTH
+		};
+		if (prefix != NULL) {
+			hiov[1] = *prefix;
+		}
+
+		pids[num_local] = dst.pid;
+		idx[num_local] = i;
+		num_local += 1;
+	}
+
+	ret = messaging_dgm_send_multi(pids, num_local, hdr_iov, dst_iovlen,
+				       iov, iovlen, dgm_errors);
+	if (ret != 0) {
+		TALLOC_FREE(frame);
+		return ret;
+	}
+
+	for (i=0; i<num_local; i++) {
+		size_t d = idx[i];
+		int err = dgm_errors[i];
+
+		if (err == EACCES) {
+			/*
+			 * messaging_send_iov_from() retries as root
+			 */
+			err = messaging_send_iov_prefixed(
+				msg_ctx, dsts[d], msg_type,
+				(dst_iov != NULL) ? &dst_iov[d] : NULL,
+				iov, iovlen);
+		}
+		if (err == ECONNREFUSED) {
+			err = ENOENT;
+		}
+		errors[d] = err;
+	}
+
+	TALLOC_FREE(frame);
+	return 0;
+}
+
 struct send_all_state {
 	struct messaging_context *msg_ctx;
 	int msg_type;
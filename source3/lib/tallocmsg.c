@@ -52,6 +52,7 @@ static bool pool_usage_filter(struct messaging_rec *rec, void *private_data)
 	}
 
 	talloc_full_report_printf(NULL, f);
+	talloc_report_profile(f);
 
 	fclose(f);
 	/*
@@ -63,8 +64,52 @@ static bool pool_usage_filter(struct messaging_rec *rec, void *private_data)
 	return false;
 }
 
+static bool talloc_profile_filter(struct messaging_rec *rec,
+				  void *private_data)
+{
+	const char *arg = (const char *)rec->buf.data;
+	unsigned long long interval;
+	int error = 0;
+	int ret;
+
+	if (rec->msg_type != MSG_REQ_TALLOC_PROFILE) {
+		return false;
+	}
+
+	if ((rec->buf.length == 0) ||
+	    (arg[rec->buf.length - 1] != '\0')) {
+		DBG_DEBUG("Got invalid MSG_REQ_TALLOC_PROFILE\n");
+		return false;
+	}
+
+	DBG_DEBUG("Got MSG_REQ_TALLOC_PROFILE: %s\n", arg);
+
+	if (strequal(arg, "off")) {
+		talloc_disable_profile();
+		DBG_NOTICE("Disabled the talloc profile\n");
+		return false;
+	}
+
+	interval = smb_strtoull(arg, NULL, 10, &error, SMB_STR_FULL_STR_CONV);
+	if ((error != 0) || (interval == 0) || (interval > UINT_MAX)) {
+		DBG_WARNING("Invalid talloc profile interval: %s\n", arg);
+		return false;
+	}
+
+	ret = talloc_enable_profile(interval);
+	if (ret != 0) {
+		DBG_WARNING("talloc_enable_profile failed: %s\n",
+			    strerror(errno));
+		return false;
+	}
+	DBG_NOTICE("Sampling 1 in %llu talloc allocations\n", interval);
+
+	/* Stay registered, as in pool_usage_filter() */
+	return false;
+}
+
 /**
- * Register handler for MSG_REQ_POOL_USAGE
+ * Register handler for MSG_REQ_POOL_USAGE and MSG_REQ_TALLOC_PROFILE
  **/
 void register_msg_pool_usage(
 	TALLOC_CTX *mem_ctx, struct messaging_context *msg_ctx)
@@ -82,4 +127,16 @@ void register_msg_pool_usage(
 		return;
 	}
 	DBG_INFO("Registered MSG_REQ_POOL_USAGE\n");
+
+	req = messaging_filtered_read_send(
+		mem_ctx,
+		messaging_tevent_context(msg_ctx),
+		msg_ctx,
+		talloc_profile_filter,
+		NULL);
+	if (req == NULL) {
+		DBG_WARNING("messaging_filtered_read_send failed\n");
+		return;
+	}
+	DBG_INFO("Registered MSG_REQ_TALLOC_PROFILE\n");
 }
@@ -40,6 +40,12 @@
 
 #define ZERO_ZERO 0
 
+/*
+ * Files with at least this many locks get an interval index built
+ * when their record is cached for read/write checks.
+ */
+#define BRL_INDEX_MIN_LOCKS 32
+
 /* The open brlock.tdb database. */
 
 static struct db_context *brlock_db;
@@ -50,8 +56,15 @@ struct byte_range_lock {
 	const struct GUID *req_guid;
 	unsigned int num_locks;
 	bool modified;
-	struct lock_struct *lock_data;
+	struct lock_struct *lock_data; /* sorted by start */
 	struct db_record *record;
+
+	/*
+	 * Interval index over lock_data, see brl_index_build(). NULL
+	 * if not built, freed whenever locks are added or removed.
+	 */
+	uint64_t *index;
+	unsigned int index_leaves;
 };
 
 /****************************************************************************
@@ -356,6 +369,180 @@ static bool brl_conflict_other(const struct lock_struct *lock,
 	return false;
 }
 
+/****************************************************************************
+ The lock array is kept sorted by start offset, so all locks that can
+ overlap a range [start, last] are found before the first lock starting
+ after "last". Of those only the ones ending at or after "start" can
+ overlap, brl_overlap_next() finds them either by a linear walk or via
+ the interval index.
+****************************************************************************/
+
+/*
+ * The last byte covered by a lock, computed like byte_range_overlap()
+ * does. Ranges that wrap cover everything up to UINT64_MAX.
+ */
+
+static uint64_t brl_last(const struct lock_struct *lck)
+{
+	if (!byte_range_valid(lck->start, lck->size)) {
+		return UINT64_MAX;
+	}
+	return lck->start + lck->size - 1;
+}
+
+/*
+ * Index of the first lock starting after ofs
+ */
+
+static unsigned int brl_start_after(const struct lock_struct *locks,
+				    unsigned int num_locks,
+				    uint64_t ofs)
+{
+	unsigned int lo = 0;
+	unsigned int hi = num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start <= ofs) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Restore the sort order. This is an insertion sort: It keeps locks
+ * with the same start in their order and is linear for the almost
+ * sorted arrays that the POSIX split and merge code produces.
+ */
+
+static void brl_sort_locks(struct lock_struct *locks, unsigned int num_locks)
+{
+	unsigned int i;
+
+	for (i = 1; i < num_locks; i++) {
+		struct lock_struct tmp;
+		unsigned int j;
+
+		if (locks[i-1].start <= locks[i].start) {
+			continue;
+		}
+
+		tmp = locks[i];
+		j = brl_start_after(locks, i, tmp.start);
+		memmove(&locks[j+1], &locks[j], (i - j) * sizeof(*locks));
+		locks[j] = tmp;
+	}
+}
+
+/*
+ * The interval index is an implicit binary tree over the sorted lock
+ * array: Leaf index_leaves+i holds the last byte of lock i, every
+ * inner node holds the maximum of its children. A subtree whose
+ * maximum is before the start of a range can't hold an overlapping
+ * lock and is skipped, so finding the next overlapping lock is
+ * O(log(num_locks)).
+ */
+
+static bool brl_index_build(struct byte_range_lock *br_lck)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+	unsigned int leaves = 1;
+	unsigned int i;
+	uint64_t *tree = NULL;
+
+	while (leaves < br_lck->num_locks) {
+		leaves *= 2;
+	}
+
+	tree = talloc_zero_array(br_lck, uint64_t, leaves * 2);
+	if (tree == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < br_lck->num_locks; i++) {
+		tree[leaves + i] = brl_last(&locks[i]);
+	}
+	for (i = leaves - 1; i > 0; i--) {
+		tree[i] = MAX(tree[i*2], tree[i*2+1]);
+	}
+
+	TALLOC_FREE(br_lck->index);
+	br_lck->index = tree;
+	br_lck->index_leaves = leaves;
+	return true;
+}
+
+static unsigned int brl_index_find(const uint64_t *tree,
+				   unsigned int node,
+				   unsigned int lo,
+				   unsigned int hi,
+				   unsigned int from,
+				   unsigned int end,
+				   uint64_t start)
+{
+	unsigned int mid, ret;
+
+	if ((hi <= from) || (lo >= end) || (tree[node] < start)) {
+		return end;
+	}
+	if (hi - lo == 1) {
+		return lo;
+	}
+
+	mid = lo + (hi - lo) / 2;
+
+	ret = brl_index_find(tree, node*2, lo, mid, from, end, start);
+	if (ret != end) {
+		return ret;
+	}
+	return brl_index_find(tree, node*2+1, mid, hi, from, end, start);
+}
+
+/*
+ * Locks at or after the returned index can't overlap probe
+ */
+
+static unsigned int brl_overlap_end(const struct byte_range_lock *br_lck,
+				    const struct lock_struct *probe)
+{
+	return brl_start_after(br_lck->lock_data,
+			       br_lck->num_locks,
+			       brl_last(probe));
+}
+
+/*
+ * Return the first lock in [i, end) that might overlap probe, end if
+ * there is none. The caller still has to check the lock, this only
+ * filters by range.
+ */
+
+static unsigned int brl_overlap_next(const struct byte_range_lock *br_lck,
+				     const struct lock_struct *probe,
+				     unsigned int i,
+				     unsigned int end)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+
+	if (br_lck->index != NULL) {
+		return brl_index_find(br_lck->index,
+				      1,
+				      0,
+				      br_lck->index_leaves,
+				      i,
+				      end,
+				      probe->start);
+	}
+
+	while ((i < end) && (brl_last(&locks[i]) < probe->start)) {
+		i += 1;
+	}
+	return i;
+}
+
 /****************************************************************************
  Open up the brlock.tdb database.
 ****************************************************************************/
@@ -424,7 +611,7 @@ static int lock_compare(const struct lock_struct *lck1,
 NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 				  struct lock_struct *plock)
 {
-	unsigned int i;
+	unsigned int i, first, end;
 	files_struct *fsp = br_lck->fsp;
 	struct lock_struct *locks = br_lck->lock_data;
 	NTSTATUS status;
@@ -437,7 +624,10 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	end = brl_overlap_end(br_lck, plock);
+	first = brl_overlap_next(br_lck, plock, 0, end);
+
+	for (i = first; i < end; i = brl_overlap_next(br_lck, plock, i+1, end)) {
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -461,7 +651,7 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 
 	/* We can get the Windows lock, now see if it needs to
 	   be mapped into a lower level POSIX one, and if so can
-	   we get it ? */
+	   we get it ? Only locks in [first, end) can overlap. */
 
 	if (lp_posix_locking(fsp->conn->params)) {
 		int errno_ret;
@@ -470,8 +660,8 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 				plock->size,
 				plock->lock_type,
 				&plock->context,
-				locks,
-				br_lck->num_locks,
+				&locks[first],
+				end - first,
 				&errno_ret)) {
 
 			/* We don't know who blocked us. */
@@ -487,7 +677,8 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		}
 	}
 
-	/* no conflicts - add it to the list of locks */
+	/* no conflicts - add it to the list of locks, after all
+	   locks with the same or a lower start */
 	locks = talloc_realloc(br_lck, locks, struct lock_struct,
 			       (br_lck->num_locks + 1));
 	if (!locks) {
@@ -495,10 +686,14 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		goto fail;
 	}
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
+	i = brl_start_after(locks, br_lck->num_locks, plock->start);
+	memmove(&locks[i+1], &locks[i],
+		(br_lck->num_locks - i) * sizeof(struct lock_struct));
+	memcpy(&locks[i], plock, sizeof(struct lock_struct));
 	br_lck->num_locks += 1;
 	br_lck->lock_data = locks;
 	br_lck->modified = True;
+	TALLOC_FREE(br_lck->index);
 
 	return NT_STATUS_OK;
  fail:
@@ -889,21 +1084,14 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
-
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
-
-	if (i < count) {
-		memmove(&tp[i+1], &tp[i],
-			(count - i)*sizeof(struct lock_struct));
-	}
-	memcpy(&tp[i], plock, sizeof(struct lock_struct));
+	/*
+	 * Add the lock in order, sorted by lock start. Splitting may
+	 * have moved the upper part of an existing lock behind
+	 * following locks, so sort the result.
+	 */
+	memcpy(&tp[count], plock, sizeof(struct lock_struct));
 	count++;
+	brl_sort_locks(tp, count);
 
 	/* We can get the POSIX lock, now see if it needs to
 	   be mapped into a lower level POSIX one, and if so can
@@ -950,6 +1138,7 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 
 	br_lck->num_locks = count;
 	TALLOC_FREE(br_lck->lock_data);
+	TALLOC_FREE(br_lck->index);
 	br_lck->lock_data = tp;
 	locks = tp;
 	br_lck->modified = True;
@@ -1061,14 +1250,24 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 	}
 #endif
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	/* Candidates all start at plock->start, look there only. */
+	i = 0;
+	if (plock->start > 0) {
+		i = brl_start_after(locks, br_lck->num_locks, plock->start - 1);
+	}
+
+	for (; i < br_lck->num_locks; i++) {
 		struct lock_struct *lock = &locks[i];
 
+		if (lock->start != plock->start) {
+			/* we didn't find it */
+			return False;
+		}
+
 		/* Only remove our own locks that match in start, size, and flavour. */
 		if (brl_same_context(&lock->context, &plock->context) &&
 					lock->fnum == plock->fnum &&
 					lock->lock_flav == WINDOWS_LOCK &&
-					lock->start == plock->start &&
 					lock->size == plock->size ) {
 			deleted_lock_type = lock->lock_type;
 			break;
@@ -1087,16 +1286,23 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 	ARRAY_DEL_ELEMENT(locks, i, br_lck->num_locks);
 	br_lck->num_locks -= 1;
 	br_lck->modified = True;
+	TALLOC_FREE(br_lck->index);
 
 	/* Unlock the underlying POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
+		unsigned int first, end;
+
+		/* Only locks in [first, end) can overlap. */
+		end = brl_overlap_end(br_lck, plock);
+		first = brl_overlap_next(br_lck, plock, 0, end);
+
 		release_posix_lock_windows_flavour(br_lck->fsp,
 				plock->start,
 				plock->size,
 				deleted_lock_type,
 				&plock->context,
-				locks,
-				br_lck->num_locks);
+				&locks[first],
+				end - first);
 	}
 
 	contend_level2_oplocks_end(br_lck->fsp, LEVEL2_CONTEND_WINDOWS_BRL);
@@ -1202,6 +1408,9 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 		return True;
 	}
 
+	/* A split moves the upper part of a lock, restore the order. */
+	brl_sort_locks(tp, count);
+
 	/* Unlock any POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
 		release_posix_lock_posix_flavour(br_lck->fsp,
@@ -1230,6 +1439,7 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 
 	br_lck->num_locks = count;
 	TALLOC_FREE(br_lck->lock_data);
+	TALLOC_FREE(br_lck->index);
 	locks = tp;
 	br_lck->lock_data = tp;
 	br_lck->modified = True;
@@ -1276,12 +1486,15 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 		  const struct lock_struct *rw_probe)
 {
 	bool ret = True;
-	unsigned int i;
+	unsigned int i, end;
 	struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	end = brl_overlap_end(br_lck, rw_probe);
+	for (i = brl_overlap_next(br_lck, rw_probe, 0, end);
+	     i < end;
+	     i = brl_overlap_next(br_lck, rw_probe, i+1, end)) {
 		/*
 		 * Our own locks don't conflict.
 		 */
@@ -1344,7 +1557,7 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 		enum brl_type *plock_type,
 		enum brl_flavour lock_flav)
 {
-	unsigned int i;
+	unsigned int i, end;
 	struct lock_struct lock;
 	const struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
@@ -1359,7 +1572,10 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_flav = lock_flav;
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	end = brl_overlap_end(br_lck, &lock);
+	for (i = brl_overlap_next(br_lck, &lock, 0, end);
+	     i < end;
+	     i = brl_overlap_next(br_lck, &lock, i+1, end)) {
 		const struct lock_struct *exlock = &locks[i];
 		bool conflict = False;
 
@@ -1680,7 +1896,7 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 
 static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 {
-	unsigned i;
+	unsigned i, j;
 	struct lock_struct *locks = br_lck->lock_data;
 
 	if (!br_lck->modified) {
@@ -1688,19 +1904,22 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		goto done;
 	}
 
-	i = 0;
-
-	while (i < br_lck->num_locks) {
+	/*
+	 * Autocleanup, drop locks of processes that conflicted and
+	 * do not exist anymore. Keep the others in order.
+	 */
+	for (i = 0, j = 0; i < br_lck->num_locks; i++) {
 		if (locks[i].context.pid.pid == 0) {
-			/*
-			 * Autocleanup, the process conflicted and does not
-			 * exist anymore.
-			 */
-			locks[i] = locks[br_lck->num_locks-1];
-			br_lck->num_locks -= 1;
-		} else {
-			i += 1;
+			continue;
 		}
+		if (i != j) {
+			locks[j] = locks[i];
+		}
+		j += 1;
+	}
+	if (j != br_lck->num_locks) {
+		br_lck->num_locks = j;
+		TALLOC_FREE(br_lck->index);
 	}
 
 	if (br_lck->num_locks == 0) {
@@ -1758,6 +1977,13 @@ static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 		DEBUG(1, ("talloc_memdup failed\n"));
 		return false;
 	}
+
+	/*
+	 * Only a no-op pass over the locks for records we wrote
+	 * ourselves, sorts records from older versions.
+	 */
+	brl_sort_locks(br_lck->lock_data, br_lck->num_locks);
+
 	return true;
 }
 
@@ -1912,6 +2138,15 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 	br_lock->modified = false;
 	br_lock->record = NULL;
 
+	/*
+	 * The cached record is checked on every read and write until
+	 * the next lock change, index it for files with many locks.
+	 * Without the index we fall back to walking the locks.
+	 */
+	if (br_lock->num_locks >= BRL_INDEX_MIN_LOCKS) {
+		brl_index_build(br_lock);
+	}
+
 	/*
 	 * Cache the brlock struct, invalidated when the dbwrap_seqnum
 	 * changes. See beginning of this routine.
@@ -557,6 +557,127 @@ static NTSTATUS locking_tdb_data_store(
 	return status;
 }
 
+/*
+ * Within the g_lock callback g_lock.c holds a private copy of the
+ * record that is written to locking.tdb once when the callback
+ * returns. Adding or removing a single share entry, which is all a
+ * compatible open or close does, can be done directly in that copy
+ * instead of fetching and re-assembling the whole record.
+ */
+
+struct locking_tdb_data_peek_state {
+	struct locking_tdb_data *ltdb;
+	bool ok;
+};
+
+static void locking_tdb_data_peek_fn(
+	struct server_id exclusive,
+	size_t num_shared,
+	const struct server_id *shared,
+	const uint8_t *data,
+	size_t datalen,
+	void *private_data)
+{
+	struct locking_tdb_data_peek_state *state = private_data;
+	state->ok = locking_tdb_data_get(state->ltdb, data, datalen);
+}
+
+/*
+ * Return a view into the g_lock callback's copy of the record if we
+ * are within the callback and the record already has share entries.
+ * The view must not be modified directly, use
+ * locking_tdb_data_splice() for that.
+ */
+static bool locking_tdb_data_peek(
+	TDB_DATA key, TALLOC_CTX *mem_ctx, struct locking_tdb_data **ltdb)
+{
+	struct locking_tdb_data_peek_state state = { .ok = false };
+	NTSTATUS status;
+
+	if (!share_mode_g_lock_within_cb(key)) {
+		return false;
+	}
+
+	state.ltdb = talloc_zero(mem_ctx, struct locking_tdb_data);
+	if (state.ltdb == NULL) {
+		return false;
+	}
+
+	status = g_lock_lock_cb_dump(current_share_mode_glck,
+				     locking_tdb_data_peek_fn,
+				     &state);
+	if (!NT_STATUS_IS_OK(status) ||
+	    !state.ok ||
+	    (state.ltdb->num_share_entries == 0)) {
+		TALLOC_FREE(state.ltdb);
+		return false;
+	}
+
+	*ltdb = state.ltdb;
+	return true;
+}
+
+/*
+ * Replace num_remove share entries starting at idx with num_insert
+ * entries from insert in the g_lock callback's copy of the record
+ * described by ltdb. ltdb is invalid afterwards.
+ */
+static NTSTATUS locking_tdb_data_splice(
+	const struct locking_tdb_data *ltdb,
+	size_t idx,
+	size_t num_remove,
+	const struct share_mode_entry_buf *insert,
+	size_t num_insert)
+{
+	size_t entries_ofs = sizeof(uint32_t) + ltdb->share_mode_data_len;
+	size_t old_len = entries_ofs +
+		ltdb->num_share_entries * SHARE_MODE_ENTRY_SIZE;
+	size_t tail_ofs = entries_ofs + (idx + num_remove) *
+		SHARE_MODE_ENTRY_SIZE;
+	size_t new_tail_ofs = entries_ofs + (idx + num_insert) *
+		SHARE_MODE_ENTRY_SIZE;
+	size_t new_len = new_tail_ofs + (old_len - tail_ofs);
+	uint8_t *buf = NULL;
+	size_t i;
+	NTSTATUS status;
+
+	SMB_ASSERT(idx + num_remove <= ltdb->num_share_entries);
+
+	status = g_lock_lock_cb_resize_data(current_share_mode_glck,
+					    MAX(old_len, new_len),
+					    &buf);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("g_lock_lock_cb_resize_data failed: %s\n",
+			  nt_errstr(status));
+		return status;
+	}
+
+	if (tail_ofs != new_tail_ofs) {
+		memmove(buf + new_tail_ofs,
+			buf + tail_ofs,
+			old_len - tail_ofs);
+	}
+
+	for (i=0; i<num_insert; i++) {
+		memcpy(buf + entries_ofs + (idx + i) * SHARE_MODE_ENTRY_SIZE,
+		       insert[i].buf,
+		       SHARE_MODE_ENTRY_SIZE);
+	}
+
+	if (new_len < old_len) {
+		status = g_lock_lock_cb_resize_data(current_share_mode_glck,
+						    new_len,
+						    &buf);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_DEBUG("g_lock_lock_cb_resize_data failed: %s\n",
+				  nt_errstr(status));
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
 /*******************************************************************
  Get all share mode entries for a dev/inode pair.
 ********************************************************************/
@@ -1985,18 +2106,23 @@ bool set_share_mode(struct share_mode_lock *lck,
 	struct share_mode_entry e = { .pid.pid = 0 };
 	struct share_mode_entry_buf e_buf;
 	NTSTATUS status;
-	bool ok, found;
+	bool ok, found, in_place;
 
 	TDB_DATA dbufs[3];
 	size_t num_dbufs = 0;
 
-	status = locking_tdb_data_fetch(key, talloc_tos(), &ltdb);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_ERR("locking_tdb_data_fetch failed: %s\n",
-			nt_errstr(status));
-		return false;
+	in_place = locking_tdb_data_peek(key, talloc_tos(), &ltdb);
+	if (!in_place) {
+		status = locking_tdb_data_fetch(key, talloc_tos(), &ltdb);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("locking_tdb_data_fetch failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
 	}
-	DBG_DEBUG("num_share_modes=%zu\n", ltdb->num_share_entries);
+	DBG_DEBUG("num_share_modes=%zu, in_place=%d\n",
+		  ltdb->num_share_entries,
+		  (int)in_place);
 
 	idx = share_mode_entry_find(
 		ltdb->share_entries,
@@ -2042,6 +2168,15 @@ bool set_share_mode(struct share_mode_lock *lck,
 
 	DBG_DEBUG("idx=%zu, found=%d\n", idx, (int)found);
 
+	if (in_place) {
+		status = locking_tdb_data_splice(ltdb, idx, 0, &e_buf, 1);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("locking_tdb_data_splice failed: %s\n",
+				nt_errstr(status));
+		}
+		goto done;
+	}
+
 	if (idx > 0) {
 		dbufs[num_dbufs] = (TDB_DATA) {
 			.dptr = discard_const_p(uint8_t, ltdb->share_entries),
@@ -2359,6 +2494,77 @@ NTSTATUS share_mode_count_entries(struct file_id fid, size_t *num_share_modes)
 	return NT_STATUS_OK;
 }
 
+/*
+ * Write back what share_mode_entry_do()'s fn did to entry idx
+ * directly into the g_lock callback's copy of the record.
+ */
+static bool share_mode_entry_do_in_place(
+	struct share_mode_data *d,
+	const struct locking_tdb_data *ltdb,
+	size_t idx,
+	struct server_id pid,
+	uint64_t share_file_id,
+	const struct share_mode_entry *e)
+{
+	bool last = (ltdb->num_share_entries == 1);
+	struct share_mode_entry_buf buf;
+	NTSTATUS status;
+	bool ok;
+
+	if (e->stale) {
+		if (DEBUGLEVEL>=10) {
+			DBG_DEBUG("share_mode_entry:\n");
+			NDR_PRINT_DEBUG(share_mode_entry, discard_const_p(
+						void, e));
+		}
+
+		status = locking_tdb_data_splice(ltdb, idx, 1, NULL, 0);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("locking_tdb_data_splice failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
+
+		if (last) {
+			/*
+			 * Delete the whole record right away, as
+			 * share_mode_entry_do() does
+			 */
+			d->modified = true;
+			status = share_mode_data_store(d);
+			if (!NT_STATUS_IS_OK(status)) {
+				DBG_ERR("share_mode_data_store failed: %s\n",
+					nt_errstr(status));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	if (!last) {
+		/*
+		 * Make sure the sorting order stays intact
+		 */
+		SMB_ASSERT(server_id_equal(&e->pid, &pid));
+		SMB_ASSERT(e->share_file_id == share_file_id);
+	}
+
+	ok = share_mode_entry_put(e, &buf);
+	if (!ok) {
+		DBG_DEBUG("share_mode_entry_put failed\n");
+		return false;
+	}
+
+	status = locking_tdb_data_splice(ltdb, idx, 1, &buf, 1);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("locking_tdb_data_splice failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+
+	return true;
+}
+
 static bool share_mode_entry_do(
 	struct share_mode_data *d,
 	struct server_id pid,
@@ -2377,15 +2583,21 @@ static bool share_mode_entry_do(
 	struct share_mode_entry e;
 	uint8_t *e_ptr = NULL;
 	NTSTATUS status;
+	bool in_place;
 	bool ret = false;
 
-	status = locking_tdb_data_fetch(key, talloc_tos(), &ltdb);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_ERR("locking_tdb_data_fetch failed: %s\n",
-			nt_errstr(status));
-		return false;
+	in_place = locking_tdb_data_peek(key, talloc_tos(), &ltdb);
+	if (!in_place) {
+		status = locking_tdb_data_fetch(key, talloc_tos(), &ltdb);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("locking_tdb_data_fetch failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
 	}
-	DBG_DEBUG("num_share_modes=%zu\n", ltdb->num_share_entries);
+	DBG_DEBUG("num_share_modes=%zu, in_place=%d\n",
+		  ltdb->num_share_entries,
+		  (int)in_place);
 
 	idx = share_mode_entry_find(
 		ltdb->share_entries,
@@ -2417,6 +2629,12 @@ static bool share_mode_entry_do(
 		goto done;
 	}
 
+	if (in_place) {
+		ret = share_mode_entry_do_in_place(d, ltdb, idx, pid,
+						   share_file_id, &e);
+		goto done;
+	}
+
 	e_ptr = discard_const_p(uint8_t, ltdb->share_entries) +
 		idx * SHARE_MODE_ENTRY_SIZE;
 
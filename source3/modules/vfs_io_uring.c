@@ -45,6 +45,7 @@ struct open_how;
 #include "lib/util/tevent_unix.h"
 #include "lib/util/sys_rw.h"
 #include "lib/util/iov_buf.h"
+#include "lib/util/bitmap.h"
 #include "smbprofile.h"
 #include <liburing.h>
 
@@ -59,6 +60,24 @@ struct vfs_io_uring_config {
 	bool need_retry;
 	struct vfs_io_uring_request *queue;
 	struct vfs_io_uring_request *pending;
+	size_t num_pending;
+	/*
+	 * With io_uring:batch_submit the queue is only run once per
+	 * event loop iteration, via this immediate.
+	 */
+	struct tevent_context *ev;
+	struct tevent_immediate *im;
+	/* The io_uring:registered_files slots in use, or NULL */
+	struct bitmap *fixed_files;
+};
+
+/*
+ * The registered file slot of an fsp.
+ */
+struct vfs_io_uring_fsp {
+	struct vfs_io_uring_config *config;
+	int fd;
+	int slot;
 };
 
 struct vfs_io_uring_request {
@@ -68,6 +87,8 @@ struct vfs_io_uring_request {
 	struct tevent_req *req;
 	void (*completion_fn)(struct vfs_io_uring_request *cur,
 			      const char *location);
+	/* sqe.fd is a registered file slot */
+	bool fixed_file;
 	struct timespec start_time;
 	struct timespec end_time;
 	SMBPROFILE_BYTES_ASYNC_STATE(profile_bytes);
@@ -86,6 +107,9 @@ static void vfs_io_uring_finish_req(struct vfs_io_uring_request *cur,
 	void *state = _tevent_req_data(req);
 
 	talloc_set_destructor(state, NULL);
+	if (cur->list_head == &cur->config->pending) {
+		cur->config->num_pending--;
+	}
 	if (cur->list_head != NULL) {
 		DLIST_REMOVE((*cur->list_head), cur);
 		cur->list_head = NULL;
@@ -118,6 +142,7 @@ static void vfs_io_uring_config_destroy(struct vfs_io_uring_config *config,
 
 	if (config->uring.ring_fd != -1) {
 		/* TODO: cancel queued and pending requests */
+		TALLOC_FREE(config->im);
 		TALLOC_FREE(config->fde);
 		io_uring_queue_exit(&config->uring);
 		config->uring.ring_fd = -1;
@@ -156,6 +181,9 @@ static int vfs_io_uring_request_state_deny_destructor(void *_state)
 	cur->req = NULL;
 
 	/* remove ourself from any list */
+	if (cur->list_head == &cur->config->pending) {
+		cur->config->num_pending--;
+	}
 	DLIST_REMOVE((*cur->list_head), cur);
 	cur->list_head = NULL;
 
@@ -179,6 +207,7 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	int ret;
 	struct vfs_io_uring_config *config;
 	unsigned num_entries;
+	unsigned num_fixed_files;
 	bool sqpoll;
 	unsigned flags = 0;
 
@@ -242,9 +271,173 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 		return -1;
 	}
 
+	config->ev = handle->conn->sconn->ev_ctx;
+
+	if (lp_parm_bool(SNUM(handle->conn),
+			 "io_uring",
+			 "batch_submit",
+			 false))
+	{
+		config->im = tevent_create_immediate(config);
+		if (config->im == NULL) {
+			SMB_VFS_NEXT_DISCONNECT(handle);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	num_fixed_files = lp_parm_ulong(SNUM(handle->conn),
+					"io_uring",
+					"registered_files",
+					0);
+	num_fixed_files = MIN(num_fixed_files, UINT16_MAX);
+	if (num_fixed_files > 0) {
+#ifdef HAVE_IO_URING_REGISTER_FILES_SPARSE
+		ret = io_uring_register_files_sparse(&config->uring,
+						     num_fixed_files);
+		if (ret < 0) {
+			DBG_NOTICE("io_uring_register_files_sparse(%u) "
+				   "failed: %s, not using registered files\n",
+				   num_fixed_files,
+				   strerror(-ret));
+		} else {
+			config->fixed_files = bitmap_talloc(config,
+							    num_fixed_files);
+			if (config->fixed_files == NULL) {
+				SMB_VFS_NEXT_DISCONNECT(handle);
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+#else
+		DBG_NOTICE("io_uring:registered_files is not supported "
+			   "by this liburing\n");
+#endif
+	}
+
 	return 0;
 }
 
+static void vfs_io_uring_fsp_ext_destroy(void *p_data)
+{
+	struct vfs_io_uring_fsp *ext = (struct vfs_io_uring_fsp *)p_data;
+	struct vfs_io_uring_config *config = ext->config;
+	int fd = -1;
+	int ret;
+
+	if (config->uring.ring_fd == -1 || config->fixed_files == NULL) {
+		return;
+	}
+
+	/*
+	 * The registered file holds a reference to the file, it has to
+	 * go away with the fsp's fd. Requests still in flight keep their
+	 * own reference.
+	 */
+	ret = io_uring_register_files_update(&config->uring,
+					     ext->slot,
+					     &fd,
+					     1);
+	if (ret < 0) {
+		DBG_ERR("io_uring_register_files_update(%d) failed: %s\n",
+			ext->slot,
+			strerror(-ret));
+		/* don't reuse the slot */
+		return;
+	}
+	bitmap_clear(config->fixed_files, ext->slot);
+}
+
+/*
+ * Returns the fd to use in the sqe for fsp, which is a registered file
+ * slot if *fixed_file is set.
+ */
+static int vfs_io_uring_fsp_fd(vfs_handle_struct *handle,
+			       struct vfs_io_uring_config *config,
+			       struct files_struct *fsp,
+			       bool *fixed_file)
+{
+	struct vfs_io_uring_fsp *ext = NULL;
+	int fd = fsp_get_io_fd(fsp);
+	int slot;
+	int ret;
+
+	*fixed_file = false;
+
+	if (config->fixed_files == NULL) {
+		return fd;
+	}
+
+	ext = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (ext != NULL) {
+		if (ext->fd == fd) {
+			*fixed_file = true;
+			return ext->slot;
+		}
+		/* The fsp got a new fd */
+		VFS_REMOVE_FSP_EXTENSION(handle, fsp);
+		ext = NULL;
+	}
+
+	slot = bitmap_find(config->fixed_files, 0);
+	if (slot == -1) {
+		/* All slots are in use, just use the fd */
+		return fd;
+	}
+
+	ret = io_uring_register_files_update(&config->uring, slot, &fd, 1);
+	if (ret < 0) {
+		DBG_NOTICE("io_uring_register_files_update(%d) failed: %s\n",
+			   slot,
+			   strerror(-ret));
+		return fd;
+	}
+	bitmap_set(config->fixed_files, slot);
+
+	ext = VFS_ADD_FSP_EXTENSION(handle,
+				    fsp,
+				    struct vfs_io_uring_fsp,
+				    vfs_io_uring_fsp_ext_destroy);
+	if (ext == NULL) {
+		struct vfs_io_uring_fsp tmp = {
+			.config = config,
+			.fd = fd,
+			.slot = slot,
+		};
+		vfs_io_uring_fsp_ext_destroy(&tmp);
+		return fd;
+	}
+	*ext = (struct vfs_io_uring_fsp) {
+		.config = config,
+		.fd = fd,
+		.slot = slot,
+	};
+
+	*fixed_file = true;
+	return slot;
+}
+
+static int vfs_io_uring_close(vfs_handle_struct *handle,
+			      struct files_struct *fsp)
+{
+	VFS_REMOVE_FSP_EXTENSION(handle, fsp);
+	return SMB_VFS_NEXT_CLOSE(handle, fsp);
+}
+
+static int vfs_io_uring_submit(struct vfs_io_uring_config *config)
+{
+	int ret;
+
+	START_PROFILE(syscall_io_uring_submit);
+	SMBPROFILE_COUNT_INCREMENT(io_uring_inflight,
+				   profile_p,
+				   config->num_pending);
+	ret = io_uring_submit(&config->uring);
+	END_PROFILE(syscall_io_uring_submit);
+
+	return ret;
+}
+
 static void _vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
 {
 	struct vfs_io_uring_request *cur = NULL, *next = NULL;
@@ -279,12 +472,13 @@ static void _vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
 		*sqe = cur->sqe;
 		DLIST_ADD_END(config->pending, cur);
 		cur->list_head = &config->pending;
+		config->num_pending++;
 		SMBPROFILE_BYTES_ASYNC_SET_BUSY(cur->profile_bytes);
 
 		cur->start_time = start_time;
 	}
 
-	ret = io_uring_submit(&config->uring);
+	ret = vfs_io_uring_submit(config);
 	if (ret == -EAGAIN || ret == -EBUSY) {
 		/* We just retry later */
 	} else if (ret < 0) {
@@ -390,14 +584,40 @@ static void vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
 	config->busy = false;
 }
 
+static void vfs_io_uring_queue_run_immediate(struct tevent_context *ev,
+					     struct tevent_immediate *im,
+					     void *private_data)
+{
+	struct vfs_io_uring_config *config = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_config);
+
+	vfs_io_uring_queue_run(config);
+}
+
 static void vfs_io_uring_request_submit(struct vfs_io_uring_request *cur)
 {
 	struct vfs_io_uring_config *config = cur->config;
 
+	if (cur->fixed_file) {
+		io_uring_sqe_set_flags(&cur->sqe, IOSQE_FIXED_FILE);
+	}
 	io_uring_sqe_set_data(&cur->sqe, cur);
 	DLIST_ADD_END(config->queue, cur);
 	cur->list_head = &config->queue;
 
+	if (config->im != NULL && !config->busy) {
+		/*
+		 * io_uring:batch_submit: everything queued while
+		 * processing the current event goes to the kernel with
+		 * one io_uring_enter() before tevent waits again.
+		 */
+		tevent_schedule_immediate(config->im,
+					  config->ev,
+					  vfs_io_uring_queue_run_immediate,
+					  config);
+		return;
+	}
+
 	vfs_io_uring_queue_run(config);
 }
 
@@ -418,6 +638,7 @@ static void vfs_io_uring_fd_handler(struct tevent_context *ev,
 
 struct vfs_io_uring_pread_state {
 	struct files_struct *fsp;
+	int fd;
 	off_t offset;
 	struct iovec iov;
 	size_t nread;
@@ -464,6 +685,10 @@ static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *hand
 	}
 
 	state->fsp = fsp;
+	state->fd = vfs_io_uring_fsp_fd(handle,
+					config,
+					fsp,
+					&state->ur.fixed_file);
 	state->offset = offset;
 	state->iov.iov_base = (void *)data;
 	state->iov.iov_len = n;
@@ -480,7 +705,7 @@ static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *hand
 static void vfs_io_uring_pread_submit(struct vfs_io_uring_pread_state *state)
 {
 	io_uring_prep_readv(&state->ur.sqe,
-			    fsp_get_io_fd(state->fsp),
+			    state->fd,
 			    &state->iov, 1,
 			    state->offset);
 	vfs_io_uring_request_submit(&state->ur);
@@ -566,6 +791,7 @@ static ssize_t vfs_io_uring_pread_recv(struct tevent_req *req,
 
 struct vfs_io_uring_pwrite_state {
 	struct files_struct *fsp;
+	int fd;
 	off_t offset;
 	struct iovec iov;
 	size_t nwritten;
@@ -612,6 +838,10 @@ static struct tevent_req *vfs_io_uring_pwrite_send(struct vfs_handle_struct *han
 	}
 
 	state->fsp = fsp;
+	state->fd = vfs_io_uring_fsp_fd(handle,
+					config,
+					fsp,
+					&state->ur.fixed_file);
 	state->offset = offset;
 	state->iov.iov_base = discard_const(data);
 	state->iov.iov_len = n;
@@ -628,7 +858,7 @@ static struct tevent_req *vfs_io_uring_pwrite_send(struct vfs_handle_struct *han
 static void vfs_io_uring_pwrite_submit(struct vfs_io_uring_pwrite_state *state)
 {
 	io_uring_prep_writev(&state->ur.sqe,
-			     fsp_get_io_fd(state->fsp),
+			     state->fd,
 			     &state->iov, 1,
 			     state->offset);
 	vfs_io_uring_request_submit(&state->ur);
@@ -727,6 +957,7 @@ static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *hand
 	struct tevent_req *req = NULL;
 	struct vfs_io_uring_fsync_state *state = NULL;
 	struct vfs_io_uring_config *config = NULL;
+	int fd;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config,
 				struct vfs_io_uring_config,
@@ -745,8 +976,9 @@ static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *hand
 				     state->ur.profile_bytes, 0);
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
 
+	fd = vfs_io_uring_fsp_fd(handle, config, fsp, &state->ur.fixed_file);
 	io_uring_prep_fsync(&state->ur.sqe,
-			    fsp_get_io_fd(fsp),
+			    fd,
 			    0); /* fsync_flags */
 	vfs_io_uring_request_submit(&state->ur);
 
@@ -806,6 +1038,7 @@ static int vfs_io_uring_fsync_recv(struct tevent_req *req,
 
 static struct vfs_fn_pointers vfs_io_uring_fns = {
 	.connect_fn = vfs_io_uring_connect,
+	.close_fn = vfs_io_uring_close,
 	.pread_send_fn = vfs_io_uring_pread_send,
 	.pread_recv_fn = vfs_io_uring_pread_recv,
 	.pwrite_send_fn = vfs_io_uring_pwrite_send,
@@ -250,6 +250,7 @@ static const struct loadparm_service _sDefault =
 	.server_smb_encrypt = SMB_ENCRYPTION_DEFAULT,
 	.kernel_share_modes = false,
 	.durable_handles = true,
+	.smb2_compression_min_size = 4096,
 	.check_parent_directory_delete_on_close = false,
 	.param_opt = NULL,
 	.smbd_search_ask_sharemode = true,
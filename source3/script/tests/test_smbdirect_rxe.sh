@@ -0,0 +1,95 @@
+#!/bin/sh
+#
+# Copy a file to and from smbd over SMB Direct with the Linux kernel
+# client. This needs root, mount.cifs and an RDMA device, e.g. a
+# soft-RoCE (rdma_rxe) link on the interface $SERVER_IP is on:
+#
+#   rdma link add rxe0 type rxe netdev eth0
+#
+# Without those the test is skipped, which includes the normal
+# socket_wrapper based selftest environments.
+#
+
+if [ $# -lt 4 ]; then
+	cat <<EOF
+Usage: test_smbdirect_rxe.sh SERVER_IP USERNAME PASSWORD PREFIX
+EOF
+	exit 1
+fi
+
+SERVER_IP="$1"
+USERNAME="$2"
+PASSWORD="$3"
+PREFIX="$4"
+shift 4
+
+incdir=$(dirname $0)/../../../testprogs/blackbox
+. $incdir/subunit.sh
+
+failed=0
+TESTNAME="smbdirect_rxe"
+
+skip()
+{
+	subunit_start_test "$TESTNAME"
+	echo "$1" | subunit_skip_test "$TESTNAME"
+	testok $0 $failed
+}
+
+if [ "$(id -u)" != 0 ]; then
+	skip "Test needs to run as root"
+fi
+if ! command -v mount.cifs >/dev/null 2>&1; then
+	skip "Test needs mount.cifs"
+fi
+if [ -z "$(ls /sys/class/infiniband 2>/dev/null)" ]; then
+	skip "Test needs an RDMA device, e.g. rdma_rxe"
+fi
+
+#
+# The kernel client has to reach $SERVER_IP on a real interface
+# with an RDMA link, socket_wrapper addresses don't count.
+#
+rdma_netdevs=$(rdma link show 2>/dev/null |
+	sed -n 's/.* netdev \([^ ]*\).*/\1/p')
+on_rdma_netdev=no
+for dev in $rdma_netdevs; do
+	if ip -o addr show dev "$dev" 2>/dev/null |
+		grep -q "inet6\? $SERVER_IP/"; then
+		on_rdma_netdev=yes
+	fi
+done
+if [ "$on_rdma_netdev" != yes ]; then
+	skip "$SERVER_IP is not on an interface with an RDMA link"
+fi
+
+mnt="$PREFIX/smbdirect_mnt"
+src="$PREFIX/smbdirect_src"
+dst="$PREFIX/smbdirect_dst"
+
+mkdir -p "$mnt"
+dd if=/dev/urandom of="$src" bs=1M count=64 2>/dev/null
+
+testit "mount with rdma" \
+	mount -t cifs "//$SERVER_IP/tmp" "$mnt" \
+	-o "rdma,vers=3.1.1,username=$USERNAME,password=$PASSWORD,cache=none" ||
+	failed=$(expr $failed + 1)
+
+if [ $failed = 0 ]; then
+	testit "write over rdma" \
+		dd if="$src" of="$mnt/smbdirect.dat" bs=1M ||
+		failed=$(expr $failed + 1)
+	testit "read over rdma" \
+		dd if="$mnt/smbdirect.dat" of="$dst" bs=1M ||
+		failed=$(expr $failed + 1)
+	testit "cmp of read and written files" cmp "$src" "$dst" ||
+		failed=$(expr $failed + 1)
+
+	rm -f "$mnt/smbdirect.dat"
+	umount "$mnt"
+fi
+
+rm -f "$src" "$dst"
+rmdir "$mnt"
+
+testok $0 $failed
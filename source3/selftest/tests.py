@@ -120,6 +120,8 @@ fileserver_tests = [
          "LOCK11",
          "LOCK12",
          "LOCK13",
+         "LOCK-BENCH",
+         "OPEN-BENCH",
          "UNLINK", "BROWSE", "ATTR", "TRANS2", "TORTURE",
          "OPLOCK1", "OPLOCK2", "OPLOCK4", "STREAMERROR",
          "DIR", "DIR1", "DIR-CREATETIME", "TCON", "TCONDEV", "RW1", "RW2", "RW3", "LARGE_READX", "RW-SIGNING",
@@ -537,6 +539,12 @@ local_tests = [
     "LOCAL-MESSAGING-FDPASS2a",
     "LOCAL-MESSAGING-FDPASS2b",
     "LOCAL-MESSAGING-SEND-ALL",
+    "LOCAL-MESSAGING-SEND-MULTI",
+    "LOCAL-MESSAGING-RING-ORDER",
+    "LOCAL-MESSAGING-RING-FULL",
+    "LOCAL-MESSAGING-RING-RX-GONE",
+    "LOCAL-MESSAGING-RING-TX-GONE",
+    "LOCAL-MESSAGING-RING-TX-CLOSED",
     "LOCAL-PTHREADPOOL-TEVENT",
     "LOCAL-CANONICALIZE-PATH",
     "LOCAL-DBWRAP-WATCH1",
@@ -1709,6 +1717,35 @@ for options in options_list:
                    "none",
                    smbclient3, "$SERVER", "$PREFIX", options, "-U$USERNAME%$PASSWORD " + configuration])
 
+#
+# fileserver_perf runs smbd with "smb2 io uring = yes",
+# "smb2 parallel crypto = yes", "server smb direct = yes",
+# "shared stat cache size" and "case insensitive index size"
+#
+perf_tests = ["smb2.read", "smb2.rw", "smb2.compound"]
+for c in ["aes-128-ccm", "aes-128-gcm", "aes-256-ccm", "aes-256-gcm"]:
+    perf_tests.append("smb2.session.encryption-%s" % c)
+for s in ["hmac-sha-256", "aes-128-cmac", "aes-128-gmac"]:
+    perf_tests.append("smb2.session.signing-%s" % s)
+for t in perf_tests:
+    plansmbtorture4testsuite(t, "fileserver_perf", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+
+for options in ["-mSMB3", "-mSMB3 --client-protection=sign", "-mSMB3 --client-protection=encrypt"]:
+    plantestsuite("samba3.blackbox.smbclient_large_file %s NTLM" % options, "fileserver_perf:local",
+                  [os.path.join(samba3srcdir, "script/tests/test_smbclient_large_file.sh"),
+                   "none",
+                   smbclient3, "$SERVER", "$PREFIX", options, "-U$USERNAME%$PASSWORD " + configuration])
+
+for t in ["CASE-INSENSITIVE-CACHE",
+          "CASE-INSENSITIVE-BENCH",
+          "CASE-INSENSITIVE-INDEX"]:
+    plantestsuite("samba3.smbtorture_s3.plain.%s" % t, "fileserver_perf", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//$SERVER_IP/tmp', '$USERNAME', '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH", "-mSMB3"])
+
+if "HAVE_SMBDIRECT" in config_hash:
+    plantestsuite("samba3.blackbox.smbdirect_rxe", "fileserver_perf:local",
+                  [os.path.join(samba3srcdir, "script/tests/test_smbdirect_rxe.sh"),
+                   "$SERVER_IP", "$USERNAME", "$PASSWORD", "$PREFIX"])
+
 for alias in ["foo", "bar"]:
     plantestsuite("samba3.blackbox.smbclient_netbios_aliases [%s]" % alias, "ad_member:local",
                   [os.path.join(samba3srcdir, "script/tests/test_smbclient_netbios_aliases.sh"),
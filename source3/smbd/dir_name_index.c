@@ -0,0 +1,552 @@
+/*
+   Unix SMB/CIFS implementation.
+   Case insensitive name index for large directories
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Every create of a new file by a Windows client needs to prove that
+ * no case variant of the name exists. Without help from the VFS
+ * (SMB_VFS_GET_REAL_FILENAME_AT) that is a full directory scan, which
+ * makes filling a directory quadratic.
+ *
+ * With "case insensitive index size" the first scan of a directory
+ * keeps all names in an in-memory index keyed by the upper cased
+ * name. An index is only used while the directory's mtime, ctime,
+ * link count and size are unchanged, any change by another process
+ * or node throws it away. Creates by this smbd don't invalidate it:
+ * a lookup that finds no variant remembers the name. Right before
+ * creating that name, open checks that the directory still matches
+ * the index. Right after the create, the index takes the name and
+ * the directory's new timestamps.
+ *
+ * Taking over the timestamps hides changes by others that happened
+ * since the index was last checked. Without the check before the
+ * create, a case variant created by another smbd between our lookup
+ * and our create would never be found. What remains are the short
+ * windows between the stat before the create and the create, and
+ * between the create and the stat after it.
+ *
+ * A file system with coarse timestamps gives all changes within one
+ * clock tick the same ctime. A change right after we looked at the
+ * directory would then not be seen, so an index is only used if its
+ * ctime was at least one tick old when we last checked it. Linux
+ * file systems with multigrain timestamps give every change after a
+ * stat a new ctime, which we notice by a ctime later than the coarse
+ * clock. Their indexes can be used right away.
+ *
+ * The indexes are per smbd process and limited in total size, the
+ * least recently used ones are dropped first.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "lib/util/dlinklist.h"
+#include "lib/dbwrap/dbwrap.h"
+#include "lib/dbwrap/dbwrap_rbt.h"
+
+struct dir_name_index {
+	struct dir_name_index *prev, *next;
+	int snum;
+	struct file_id id;
+	dev_t dev;
+	struct timespec mtime;
+	struct timespec ctime;
+	nlink_t nlink;
+	off_t size;
+	struct timespec checked; /* when we saw mtime and ctime */
+	struct db_context *names; /* upper cased -> on disk name */
+	size_t num_names;
+	char *pending; /* upper cased name we said does not exist */
+	bool pending_checked; /* unchanged right before the create */
+};
+
+static struct dir_name_index *dir_name_indexes;
+static size_t dir_name_index_total;
+static struct dir_name_index *dir_name_index_pending;
+
+/* devices with a new ctime for every change after a stat */
+static dev_t *dir_name_index_fine_devs;
+
+static int dir_name_index_destructor(struct dir_name_index *idx)
+{
+	DLIST_REMOVE(dir_name_indexes, idx);
+	dir_name_index_total -= idx->num_names;
+	if (dir_name_index_pending == idx) {
+		dir_name_index_pending = NULL;
+	}
+	return 0;
+}
+
+static void dir_name_index_forget_pending(void)
+{
+	struct dir_name_index *idx = dir_name_index_pending;
+
+	if (idx == NULL) {
+		return;
+	}
+	TALLOC_FREE(idx->pending);
+	idx->pending_checked = false;
+	dir_name_index_pending = NULL;
+}
+
+static bool dir_name_index_fine_dev(dev_t dev)
+{
+	size_t i, num = talloc_array_length(dir_name_index_fine_devs);
+
+	for (i = 0; i < num; i++) {
+		if (dir_name_index_fine_devs[i] == dev) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Called right after every stat of a directory. A ctime later than
+ * the coarse clock can only come from a file system that switches
+ * to fine grained timestamps once the ctime was looked at.
+ */
+static void dir_name_index_check_fine(const struct stat_ex *st)
+{
+#ifdef CLOCK_REALTIME_COARSE
+	struct timespec coarse;
+	size_t num;
+	dev_t *devs = NULL;
+	int ret;
+
+	if (dir_name_index_fine_dev(st->st_ex_dev)) {
+		return;
+	}
+
+	ret = clock_gettime(CLOCK_REALTIME_COARSE, &coarse);
+	if ((ret != 0) || (timespec_compare(&st->st_ex_ctime, &coarse) <= 0)) {
+		return;
+	}
+
+	num = talloc_array_length(dir_name_index_fine_devs);
+	devs = talloc_realloc(
+		NULL, dir_name_index_fine_devs, dev_t, num + 1);
+	if (devs == NULL) {
+		return;
+	}
+	devs[num] = st->st_ex_dev;
+	dir_name_index_fine_devs = devs;
+
+	DBG_DEBUG("Device %ju has fine grained ctimes\n",
+		  (uintmax_t)st->st_ex_dev);
+#endif
+}
+
+static void dir_name_index_set_stat(struct dir_name_index *idx,
+				    const struct stat_ex *st)
+{
+	idx->dev = st->st_ex_dev;
+	idx->mtime = st->st_ex_mtime;
+	idx->ctime = st->st_ex_ctime;
+	idx->nlink = st->st_ex_nlink;
+	idx->size = st->st_ex_size;
+	idx->checked = timespec_current();
+}
+
+/*
+ * Can a change after we last checked the directory have left its
+ * timestamps alone? Not if the file system gives every change a new
+ * ctime, or if the ctime was at least one clock tick old back then.
+ * File systems without sub-second timestamps get two seconds.
+ */
+static bool dir_name_index_settled(struct dir_name_index *idx)
+{
+	int64_t tick = 10 * 1000 * 1000;
+
+	if (dir_name_index_fine_dev(idx->dev)) {
+		return true;
+	}
+	if (idx->ctime.tv_nsec == 0) {
+		tick = 2 * 1000 * 1000 * 1000LL;
+	}
+	return (nsec_time_diff(&idx->checked, &idx->ctime) >= tick);
+}
+
+static bool dir_name_index_valid(struct dir_name_index *idx,
+				 int snum,
+				 struct file_id id,
+				 const struct stat_ex *st)
+{
+	return ((idx->snum == snum) &&
+		file_id_equal(&idx->id, &id) &&
+		(timespec_compare(&idx->mtime, &st->st_ex_mtime) == 0) &&
+		(timespec_compare(&idx->ctime, &st->st_ex_ctime) == 0) &&
+		(idx->nlink == st->st_ex_nlink) &&
+		(idx->size == st->st_ex_size));
+}
+
+static struct dir_name_index *dir_name_index_find(int snum,
+						  struct file_id id)
+{
+	struct dir_name_index *idx = NULL;
+
+	for (idx = dir_name_indexes; idx != NULL; idx = idx->next) {
+		if ((idx->snum == snum) && file_id_equal(&idx->id, &id)) {
+			return idx;
+		}
+	}
+	return NULL;
+}
+
+static bool dir_name_index_add(struct dir_name_index *idx,
+			       const char *upper,
+			       const char *dname)
+{
+	TDB_DATA key = string_term_tdb_data(upper);
+	TDB_DATA value = string_term_tdb_data(dname);
+	NTSTATUS status;
+
+	if (dbwrap_exists(idx->names, key)) {
+		/*
+		 * Case variants on a case sensitive file system, the
+		 * scan returns the first one as well.
+		 */
+		return true;
+	}
+
+	status = dbwrap_store(idx->names, key, value, 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	idx->num_names += 1;
+	dir_name_index_total += 1;
+	return true;
+}
+
+static void dir_name_index_trim(size_t max_names)
+{
+	while ((dir_name_index_total > max_names) &&
+	       (dir_name_indexes != NULL)) {
+		struct dir_name_index *lru = DLIST_TAIL(dir_name_indexes);
+		TALLOC_FREE(lru);
+	}
+}
+
+/*
+ * Scan the directory for "upper" like get_real_filename_full_scan_at()
+ * does, collecting all names into a new index on the way. The index
+ * is dropped if the directory is too large or changes during the
+ * scan, the answer is still valid then.
+ */
+static NTSTATUS dir_name_index_scan(struct files_struct *dirfsp,
+				    struct file_id id,
+				    size_t max_names,
+				    const char *upper,
+				    TALLOC_CTX *mem_ctx,
+				    char **found_name,
+				    struct dir_name_index **_idx)
+{
+	struct connection_struct *conn = dirfsp->conn;
+	struct dir_name_index *idx = NULL;
+	struct smb_Dir *dir_hnd = NULL;
+	struct stat_ex st = dirfsp->fsp_name->st;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	char *found = NULL;
+	NTSTATUS status;
+
+	idx = talloc_zero(NULL, struct dir_name_index);
+	if (idx == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	idx->snum = SNUM(conn);
+	idx->id = id;
+	dir_name_index_set_stat(idx, &st);
+
+	DLIST_ADD(dir_name_indexes, idx);
+	talloc_set_destructor(idx, dir_name_index_destructor);
+
+	idx->names = db_open_rbt(idx);
+	if (idx->names == NULL) {
+		TALLOC_FREE(idx);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	status = OpenDir_from_pathref(talloc_tos(), dirfsp, NULL, 0, &dir_hnd);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_NOTICE("OpenDir_from_pathref(%s) failed: %s\n",
+			   fsp_str_dbg(dirfsp),
+			   nt_errstr(status));
+		TALLOC_FREE(idx);
+		return status;
+	}
+
+	while ((dname = ReadDirName(dir_hnd, &talloced)) != NULL) {
+		char *dname_upper = NULL;
+
+		if (ISDOT(dname) || ISDOTDOT(dname)) {
+			TALLOC_FREE(talloced);
+			continue;
+		}
+
+		dname_upper = talloc_strdup_upper(talloc_tos(), dname);
+		if (dname_upper == NULL) {
+			TALLOC_FREE(talloced);
+			TALLOC_FREE(dir_hnd);
+			TALLOC_FREE(found);
+			TALLOC_FREE(idx);
+			return NT_STATUS_NO_MEMORY;
+		}
+
+		if ((found == NULL) && (strcmp(dname_upper, upper) == 0)) {
+			found = talloc_strdup(mem_ctx, dname);
+			if (found == NULL) {
+				TALLOC_FREE(dname_upper);
+				TALLOC_FREE(talloced);
+				TALLOC_FREE(dir_hnd);
+				TALLOC_FREE(idx);
+				return NT_STATUS_NO_MEMORY;
+			}
+		}
+
+		if ((idx != NULL) &&
+		    (!dir_name_index_add(idx, dname_upper, dname) ||
+		     (idx->num_names > max_names))) {
+			DBG_DEBUG("Not indexing %s\n", fsp_str_dbg(dirfsp));
+			TALLOC_FREE(idx);
+		}
+
+		TALLOC_FREE(dname_upper);
+		TALLOC_FREE(talloced);
+
+		if ((idx == NULL) && (found != NULL)) {
+			break;
+		}
+	}
+	TALLOC_FREE(dir_hnd);
+
+	if (idx != NULL) {
+		/*
+		 * Someone changed the directory while we listed it,
+		 * we might have missed a name.
+		 */
+		status = vfs_stat_fsp(dirfsp);
+		if (!NT_STATUS_IS_OK(status) ||
+		    !dir_name_index_valid(
+			    idx, idx->snum, id, &dirfsp->fsp_name->st)) {
+			TALLOC_FREE(idx);
+		}
+	}
+
+	if (idx != NULL) {
+		dir_name_index_check_fine(&dirfsp->fsp_name->st);
+		dir_name_index_set_stat(idx, &dirfsp->fsp_name->st);
+	}
+
+	if (idx != NULL) {
+		DBG_DEBUG("Indexed %zu names in %s\n",
+			  idx->num_names,
+			  fsp_str_dbg(dirfsp));
+	}
+	*_idx = idx;
+
+	if (found == NULL) {
+		return NT_STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+	*found_name = found;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Find a case insensitive match for "name" in "dirfsp" via the index,
+ * building it if required. NT_STATUS_NOT_SUPPORTED means the caller
+ * has to scan the directory itself.
+ */
+NTSTATUS dir_name_index_lookup(struct files_struct *dirfsp,
+			       const char *name,
+			       TALLOC_CTX *mem_ctx,
+			       char **found_name)
+{
+	struct connection_struct *conn = dirfsp->conn;
+	size_t max_names = lp_case_insensitive_index_size();
+	struct dir_name_index *idx = NULL;
+	struct file_id id;
+	char *upper = NULL;
+	TDB_DATA value;
+	NTSTATUS status;
+
+	if ((max_names == 0) || conn->case_sensitive) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	dir_name_index_forget_pending();
+
+	status = vfs_stat_fsp(dirfsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+	dir_name_index_check_fine(&dirfsp->fsp_name->st);
+	id = vfs_file_id_from_sbuf(conn, &dirfsp->fsp_name->st);
+
+	upper = talloc_strdup_upper(talloc_tos(), name);
+	if (upper == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	idx = dir_name_index_find(SNUM(conn), id);
+	if ((idx != NULL) &&
+	    (!dir_name_index_valid(
+		     idx, SNUM(conn), id, &dirfsp->fsp_name->st) ||
+	     !dir_name_index_settled(idx))) {
+		DBG_DEBUG("Index for %s is outdated\n", fsp_str_dbg(dirfsp));
+		TALLOC_FREE(idx);
+	}
+
+	if (idx == NULL) {
+		status = dir_name_index_scan(
+			dirfsp, id, max_names, upper, mem_ctx, found_name, &idx);
+		if (idx == NULL) {
+			TALLOC_FREE(upper);
+			return status;
+		}
+	} else {
+		status = dbwrap_fetch(idx->names,
+				      mem_ctx,
+				      string_term_tdb_data(upper),
+				      &value);
+		if (NT_STATUS_IS_OK(status)) {
+			*found_name = (char *)value.dptr;
+		} else if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+			status = NT_STATUS_OBJECT_NAME_NOT_FOUND;
+		}
+	}
+
+	/*
+	 * idx itself never exceeds max_names, it survives the trim
+	 */
+	DLIST_PROMOTE(dir_name_indexes, idx);
+	dir_name_index_trim(max_names);
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+		/*
+		 * Most likely the client is about to create "name"
+		 */
+		idx->pending = talloc_move(idx, &upper);
+		dir_name_index_pending = idx;
+	}
+
+	TALLOC_FREE(upper);
+	return status;
+}
+
+/*
+ * Called right before this smbd creates "name" in "dirfsp". If the
+ * last lookup did not find "name", check that nobody changed the
+ * directory since, dir_name_index_created() relies on that.
+ */
+void dir_name_index_prepare_create(struct files_struct *dirfsp,
+				   const char *name)
+{
+	struct dir_name_index *idx = dir_name_index_pending;
+	struct connection_struct *conn = dirfsp->conn;
+	struct file_id id;
+	NTSTATUS status;
+
+	if (idx == NULL) {
+		return;
+	}
+
+	idx->pending_checked = false;
+
+	if (!strequal(idx->pending, name)) {
+		dir_name_index_forget_pending();
+		return;
+	}
+
+	status = vfs_stat_fsp(dirfsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		dir_name_index_forget_pending();
+		return;
+	}
+	dir_name_index_check_fine(&dirfsp->fsp_name->st);
+	id = vfs_file_id_from_sbuf(conn, &dirfsp->fsp_name->st);
+
+	if ((idx->snum != SNUM(conn)) || !file_id_equal(&idx->id, &id)) {
+		dir_name_index_forget_pending();
+		return;
+	}
+
+	if (!dir_name_index_valid(idx, SNUM(conn), id, &dirfsp->fsp_name->st) ||
+	    !dir_name_index_settled(idx)) {
+		DBG_DEBUG("%s changed since the lookup\n",
+			  fsp_str_dbg(dirfsp));
+		TALLOC_FREE(idx);
+		return;
+	}
+
+	idx->pending_checked = true;
+}
+
+/*
+ * Called right after this smbd created "name" in "dirfsp". If
+ * dir_name_index_prepare_create() found the index up to date, add
+ * "name" and take over the directory's new timestamps instead of
+ * dropping the index on the next lookup.
+ */
+void dir_name_index_created(struct files_struct *dirfsp, const char *name)
+{
+	struct dir_name_index *idx = dir_name_index_pending;
+	struct connection_struct *conn = dirfsp->conn;
+	char *upper = NULL;
+	struct file_id id;
+	NTSTATUS status;
+	bool checked;
+	bool ok;
+
+	if (idx == NULL) {
+		return;
+	}
+
+	checked = idx->pending_checked && strequal(idx->pending, name);
+	dir_name_index_forget_pending();
+
+	if (!checked) {
+		return;
+	}
+
+	status = vfs_stat_fsp(dirfsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		return;
+	}
+	dir_name_index_check_fine(&dirfsp->fsp_name->st);
+	id = vfs_file_id_from_sbuf(conn, &dirfsp->fsp_name->st);
+	if ((idx->snum != SNUM(conn)) || !file_id_equal(&idx->id, &id)) {
+		return;
+	}
+
+	upper = talloc_strdup_upper(talloc_tos(), name);
+	if (upper == NULL) {
+		TALLOC_FREE(idx);
+		return;
+	}
+	ok = dir_name_index_add(idx, upper, name);
+	TALLOC_FREE(upper);
+	if (!ok) {
+		TALLOC_FREE(idx);
+		return;
+	}
+	dir_name_index_set_stat(idx, &dirfsp->fsp_name->st);
+
+	dir_name_index_trim(lp_case_insensitive_index_size());
+}
@@ -313,6 +313,14 @@ NTSTATUS get_real_filename_full_scan_at(struct files_struct *dirfsp,
 		}
 	}
 
+	if (!mangled) {
+		status = dir_name_index_lookup(dirfsp, name, mem_ctx, found_name);
+		if (!NT_STATUS_EQUAL(status, NT_STATUS_NOT_SUPPORTED)) {
+			TALLOC_FREE(unmangled_name);
+			return status;
+		}
+	}
+
 	/* open the directory */
 	status = OpenDir_from_pathref(talloc_tos(), dirfsp, NULL, 0, &cur_dir);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -414,14 +422,12 @@ NTSTATUS get_real_filename_at(struct files_struct *dirfsp,
  * vfs_stat() the last component. This will be taken care of by an
  * attempt to do a openat_pathref_fsp().
  */
-static bool get_real_filename_cache_key(
+static bool get_real_filename_cache_key_fid(
 	TALLOC_CTX *mem_ctx,
-	struct files_struct *dirfsp,
+	struct file_id fid,
 	const char *name,
 	DATA_BLOB *_key)
 {
-	struct file_id fid = vfs_file_id_from_sbuf(
-		dirfsp->conn, &dirfsp->fsp_name->st);
 	char *upper = NULL;
 	uint8_t *key = NULL;
 	size_t namelen, keylen;
@@ -452,6 +458,105 @@ static bool get_real_filename_cache_key(
 	return true;
 }
 
+static bool get_real_filename_cache_key(
+	TALLOC_CTX *mem_ctx,
+	struct files_struct *dirfsp,
+	const char *name,
+	DATA_BLOB *_key)
+{
+	struct file_id fid = vfs_file_id_from_sbuf(
+		dirfsp->conn, &dirfsp->fsp_name->st);
+
+	return get_real_filename_cache_key_fid(mem_ctx, fid, name, _key);
+}
+
+/*
+ * Drop the case insensitive name cache entry for a share relative
+ * path that was just removed or renamed away. The entries are
+ * verified on use, but without this a file re-created with a
+ * different case would be looked up under the old name first.
+ */
+void filename_forget_real_filename(connection_struct *conn, const char *path)
+{
+	struct smb_filename *parent = NULL;
+	const char *name = NULL;
+	char *dirname = NULL;
+	char *upper = NULL;
+	DATA_BLOB cache_key = { .data = NULL };
+	struct file_id fid;
+	bool ok;
+	int ret;
+
+	if (!lp_stat_cache() || conn->case_sensitive) {
+		return;
+	}
+	if (!smbd_shared_stat_cache_enabled()) {
+		/*
+		 * The per process cache is cleaned up on the next
+		 * failed lookup, not worth the parent stat.
+		 */
+		return;
+	}
+
+	name = strrchr_m(path, '/');
+	if (name == NULL) {
+		name = path;
+	} else {
+		name += 1;
+	}
+
+	/*
+	 * The key needs the parent's file_id. Only stat the parent
+	 * if the name is cached for any directory at all.
+	 */
+	upper = talloc_strdup_upper(talloc_tos(), name);
+	if (upper == NULL) {
+		return;
+	}
+	ok = smbd_shared_stat_cache_have_name((DATA_BLOB) {
+		.data = (uint8_t *)upper,
+		.length = talloc_get_size(upper),
+	});
+	TALLOC_FREE(upper);
+	if (!ok) {
+		return;
+	}
+
+	if (name == path) {
+		dirname = talloc_strdup(talloc_tos(), ".");
+	} else {
+		dirname = talloc_strndup(talloc_tos(), path, name - path - 1);
+	}
+	if (dirname == NULL) {
+		return;
+	}
+
+	parent = synthetic_smb_fname(
+		talloc_tos(), dirname, NULL, NULL, 0, 0);
+	TALLOC_FREE(dirname);
+	if (parent == NULL) {
+		return;
+	}
+
+	ret = SMB_VFS_STAT(conn, parent);
+	if (ret == -1) {
+		TALLOC_FREE(parent);
+		return;
+	}
+	fid = vfs_file_id_from_sbuf(conn, &parent->st);
+	TALLOC_FREE(parent);
+
+	ok = get_real_filename_cache_key_fid(
+		talloc_tos(), fid, name, &cache_key);
+	if (!ok) {
+		return;
+	}
+
+	smbd_shared_stat_cache_delete(cache_key);
+	memcache_delete(NULL, GETREALFILENAME_CACHE, cache_key);
+	TALLOC_FREE(cache_key.data);
+}
+
 /*
  * Lightweight function to just get last component
  * for rename / enumerate directory calls.
@@ -785,6 +890,7 @@ static NTSTATUS openat_pathref_fsp_case_insensitive(
 	if (lp_stat_cache()) {
 		char *base_name = smb_fname_rel->base_name;
 		DATA_BLOB value = { .data = NULL };
+		DATA_BLOB shared_value = { .data = NULL };
 
 		ok = get_real_filename_cache_key(
 			talloc_tos(), dirfsp, base_name, &cache_key);
@@ -799,15 +905,28 @@ static NTSTATUS openat_pathref_fsp_case_insensitive(
 
 		ok = memcache_lookup(
 			NULL, GETREALFILENAME_CACHE, cache_key, &value);
-		if (!ok) {
-			DO_PROFILE_INC(statcache_misses);
-			goto lookup;
+		if (ok) {
+			DO_PROFILE_INC(statcache_hits);
+		} else {
+			/*
+			 * Another smbd might have seen this name
+			 */
+			ok = smbd_shared_stat_cache_lookup(talloc_tos(),
+							   dirfsp->conn,
+							   cache_key,
+							   &shared_value);
+			if (!ok) {
+				DO_PROFILE_INC(statcache_misses);
+				goto lookup;
+			}
+			DO_PROFILE_INC(statcache_shared_hits);
+			value = shared_value;
 		}
-		DO_PROFILE_INC(statcache_hits);
 
 		TALLOC_FREE(smb_fname_rel->base_name);
 		smb_fname_rel->base_name = talloc_memdup(
 			smb_fname_rel, value.data, value.length);
+		data_blob_free(&shared_value);
 		if (smb_fname_rel->base_name == NULL) {
 			TALLOC_FREE(cache_key.data);
 			return NT_STATUS_NO_MEMORY;
@@ -827,6 +946,7 @@ static NTSTATUS openat_pathref_fsp_case_insensitive(
 		}
 
 		memcache_delete(NULL, GETREALFILENAME_CACHE, cache_key);
+		smbd_shared_stat_cache_delete(cache_key);
 	}
 
 lookup:
@@ -860,6 +980,7 @@ lookup:
 		};
 
 		memcache_add(NULL, GETREALFILENAME_CACHE, cache_key, value);
+		smbd_shared_stat_cache_add(dirfsp->conn, cache_key, value);
 	}
 
 	TALLOC_FREE(cache_key.data);
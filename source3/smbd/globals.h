@@ -289,6 +289,12 @@ void remove_smb2_chained_fsp(files_struct *fsp);
 NTSTATUS smbd_smb2_request_verify_creditcharge(struct smbd_smb2_request *req,
 					       uint32_t data_length);
 
+NTSTATUS smbd_smb2_request_verify_channel(struct smbd_smb2_request *req,
+					  uint32_t channel,
+					  uint16_t info_offset,
+					  uint16_t info_length,
+					  DATA_BLOB *_info);
+
 NTSTATUS smbd_smb2_request_verify_sizes(struct smbd_smb2_request *req,
 					size_t expected_body_size);
 
@@ -349,11 +355,18 @@ bool push_deferred_open_message_smb2(struct smbd_smb2_request *smb2req,
 				struct deferred_open_record *open_rec);
 
 struct smbXsrv_client;
+struct lzxhuff_compressor_mem;
 
 struct smbXsrv_preauth {
 	uint8_t sha512_value[64];
 };
 
+struct smbd_smb2_crypto_stats {
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t nsec;
+};
+
 struct smbXsrv_connection {
 	struct smbXsrv_connection *prev, *next;
 
@@ -374,6 +387,19 @@ struct smbXsrv_connection {
 		struct tevent_queue *shutdown_wait_queue;
 		int sock;
 		struct tevent_fd *fde;
+		/*
+		 * If "smb2 io uring" is enabled, the SMB2 reads and
+		 * writes on sock go through this ring, instead of
+		 * waiting for fde to become readable or writeable.
+		 */
+		struct smbd_smb2_io_uring *uring;
+		/*
+		 * Set if the client came in over SMB Direct (RDMA),
+		 * sock is then our end of a socketpair with the
+		 * transport, which is also used for the data of
+		 * SMB2 READ and WRITE requests with an RDMA channel.
+		 */
+		struct smbd_smbdirect_connection *smbdirect;
 
 		struct {
 			bool got_session;
@@ -471,8 +497,22 @@ struct smbXsrv_connection {
 			size_t pktlen;
 			uint8_t *pktbuf;
 		} request_read_state;
+		/*
+		 * Requests waiting to be dispatched in arrival
+		 * order, see smbd_smb2_decrypt_job_queue().
+		 */
+		struct smbd_smb2_decrypt_job *decrypt_jobs;
+		size_t num_decrypt_jobs;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
+		/*
+		 * Logged when the connection goes away
+		 */
+		struct {
+			struct smbd_smb2_crypto_stats encrypt;
+			struct smbd_smb2_crypto_stats decrypt;
+			struct smbd_smb2_crypto_stats sign;
+		} crypto;
 
 		struct {
 			/*
@@ -542,6 +582,34 @@ struct smbXsrv_connection {
 			bool posix_extensions_negotiated;
 		} server;
 
+		struct {
+			/*
+			 * true if the client may send us
+			 * SMB2_COMPRESSION_TRANSFORM messages.
+			 */
+			bool negotiated;
+			bool chained;
+			/*
+			 * The algorithm we use to compress responses,
+			 * SMB2_COMPRESSION_NONE if we don't.
+			 */
+			uint16_t send_algo;
+			/*
+			 * Lazily allocated scratch memory
+			 * for the compressor.
+			 */
+			struct lzxhuff_compressor_mem *cmp_mem;
+			/*
+			 * The number of eligible responses we still
+			 * send uncompressed, as the last attempt didn't
+			 * compress well, and the current backoff
+			 * which grows while the payload stays
+			 * incompressible.
+			 */
+			uint32_t skip;
+			uint32_t backoff;
+		} compression;
+
 		struct smbXsrv_preauth preauth;
 
 		struct smbd_smb2_request *requests;
@@ -769,6 +837,12 @@ struct smbd_smb2_request {
 	 */
 	struct tevent_req *subreq;
 
+	/*
+	 * The response is encrypted or signed
+	 * on the worker pool.
+	 */
+	struct smbd_smb2_crypto_job *crypto_job;
+
 #define SMBD_SMB2_TF_IOV_OFS 0
 #define SMBD_SMB2_HDR_IOV_OFS 1
 #define SMBD_SMB2_BODY_IOV_OFS 2
@@ -812,6 +886,20 @@ struct smbd_smb2_request {
 
 #define SMBD_SMB2_SHORT_RECEIVEFILE_WRITE_LEN (SMB2_HDR_BODY + 0x30)
 
+/*
+ * A decompressed request can't be larger than what
+ * the NBT header would allow without compression.
+ */
+#define SMBD_SMB2_MAX_DECOMPRESSED_SIZE 0xFFFFFF
+
+/*
+ * With "smb2 parallel crypto" only PDUs of at least this size are worth
+ * handing to a worker thread, and we stop reading from the socket
+ * while this many requests are waiting to be dispatched.
+ */
+#define SMBD_SMB2_PARALLEL_CRYPTO_MIN (64 * 1024)
+#define SMBD_SMB2_PARALLEL_CRYPTO_MAX_JOBS 16
+
 	struct {
 		/*
 		 * vector[0] TRANSPORT HEADER (empty)
@@ -862,6 +950,16 @@ struct smbd_smb2_request {
 #define OUTVEC_ALLOC_SIZE (SMB2_HDR_BODY + 9)
 		uint8_t _hdr[OUTVEC_ALLOC_SIZE];
 		uint8_t _body[0x58];
+		/*
+		 * Used instead of vector if the response
+		 * was compressed:
+		 *
+		 * compressed_vector[0] TRANSPORT HEADER
+		 * compressed_vector[1] SMB2_TRANSFORM (optional)
+		 * compressed_vector[2] SMB2_COMPRESSION_TRANSFORM
+		 */
+		struct iovec compressed_vector[3];
+		int compressed_count;
 	} out;
 };
 
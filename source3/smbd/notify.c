@@ -596,6 +596,11 @@ void notify_fname(connection_struct *conn, uint32_t action, uint32_t filter,
 		path += 2;
 	}
 
+	if ((action == NOTIFY_ACTION_REMOVED) ||
+	    (action == NOTIFY_ACTION_OLD_NAME)) {
+		filename_forget_real_filename(conn, path);
+	}
+
 	notify_trigger(notify_ctx, action, filter, conn->connectpath, path);
 }
 
@@ -702,13 +702,19 @@ static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 
 {
 	struct notifyd_trigger_state *tstate = private_data;
-	struct notify_event_msg msg = { .action = tstate->msg->action,
-					.when = tstate->msg->when };
-	struct iovec iov[2];
+	struct iovec iov;
 	size_t path_len = key.dsize;
 	struct notifyd_instance *instances = NULL;
 	size_t num_instances = 0;
+	TALLOC_CTX *frame = NULL;
+	struct notify_event_msg *msgs = NULL;
+	struct server_id *dsts = NULL;
+	struct iovec *dst_iov = NULL;
+	size_t *idx = NULL;
+	int *errors = NULL;
+	size_t num_dsts = 0;
 	size_t i;
+	int ret;
 
 	if (!notifyd_parse_entry(data.dptr, data.dsize, &instances,
 				 &num_instances)) {
@@ -721,16 +727,34 @@ static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 		  (int)key.dsize,
 		  (char *)key.dptr);
 
-	iov[0].iov_base = &msg;
-	iov[0].iov_len = offsetof(struct notify_event_msg, path);
-	iov[1].iov_base = tstate->msg->path + path_len + 1;
-	iov[1].iov_len = strlen((char *)(iov[1].iov_base)) + 1;
+	if (num_instances == 0) {
+		return;
+	}
+
+	frame = talloc_stackframe();
+
+	/*
+	 * All watchers get the same path, only the header with
+	 * private_data differs. Send them all in one go.
+	 */
+	msgs = talloc_array(frame, struct notify_event_msg, num_instances);
+	dsts = talloc_array(frame, struct server_id, num_instances);
+	dst_iov = talloc_array(frame, struct iovec, num_instances);
+	idx = talloc_array(frame, size_t, num_instances);
+	errors = talloc_array(frame, int, num_instances);
+	if ((msgs == NULL) || (dsts == NULL) || (dst_iov == NULL) ||
+	    (idx == NULL) || (errors == NULL)) {
+		DBG_WARNING("talloc_array failed\n");
+		TALLOC_FREE(frame);
+		return;
+	}
+
+	iov.iov_base = tstate->msg->path + path_len + 1;
+	iov.iov_len = strlen((char *)(iov.iov_base)) + 1;
 
 	for (i=0; i<num_instances; i++) {
 		struct notifyd_instance *instance = &instances[i];
-		struct server_id_buf idbuf;
 		uint32_t i_filter;
-		NTSTATUS status;
 
 		if (tstate->covered_by_sys_notify) {
 			if (tstate->recursive) {
@@ -750,17 +774,39 @@ static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 			continue;
 		}
 
-		msg.private_data = instance->instance.private_data;
+		msgs[num_dsts] = (struct notify_event_msg) {
+			.action = tstate->msg->action,
+			.when = tstate->msg->when,
+			.private_data = instance->instance.private_data,
+		};
+		dsts[num_dsts] = instance->client;
+		dst_iov[num_dsts] = (struct iovec) {
+			.iov_base = &msgs[num_dsts],
+			.iov_len = offsetof(struct notify_event_msg, path),
+		};
+		idx[num_dsts] = i;
+		num_dsts += 1;
+	}
 
-		status = messaging_send_iov(
-			tstate->msg_ctx, instance->client,
-			MSG_PVFS_NOTIFY, iov, ARRAY_SIZE(iov), NULL, 0);
+	ret = messaging_send_iov_multi(
+		tstate->msg_ctx, dsts, dst_iov, num_dsts,
+		MSG_PVFS_NOTIFY, &iov, 1, errors);
+	if (ret != 0) {
+		DBG_WARNING("messaging_send_iov_multi failed: %s\n",
+			    strerror(ret));
+		TALLOC_FREE(frame);
+		return;
+	}
 
-		DBG_DEBUG("messaging_send_iov to %s returned %s\n",
+	for (i=0; i<num_dsts; i++) {
+		struct notifyd_instance *instance = &instances[idx[i]];
+		struct server_id_buf idbuf;
+
+		DBG_DEBUG("messaging_send_iov_multi to %s returned %s\n",
 			  server_id_str_buf(instance->client, &idbuf),
-			  nt_errstr(status));
+			  strerror(errors[i]));
 
-		if (NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_NOT_FOUND) &&
+		if ((errors[i] == ENOENT) &&
 		    procid_is_local(&instance->client)) {
 			/*
 			 * That process has died
@@ -769,11 +815,13 @@ static void notifyd_trigger_parser(TDB_DATA key, TDB_DATA data,
 			continue;
 		}
 
-		if (!NT_STATUS_IS_OK(status)) {
-			DBG_WARNING("messaging_send_iov returned %s\n",
-				    nt_errstr(status));
+		if (errors[i] != 0) {
+			DBG_WARNING("messaging_send_iov_multi returned %s\n",
+				    strerror(errors[i]));
 		}
 	}
+
+	TALLOC_FREE(frame);
 }
 
 /*
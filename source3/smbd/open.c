@@ -1492,6 +1492,12 @@ static NTSTATUS open_file(struct smb_request *req,
 			}
 		}
 
+		if (!file_existed && (local_flags & O_CREAT) &&
+		    !fsp_is_alternate_stream(fsp)) {
+			dir_name_index_prepare_create(
+				dirfsp, smb_fname_atname->base_name);
+		}
+
 		/*
 		 * Actually do the open - if O_TRUNC is needed handle it
 		 * below under the share mode lock.
@@ -1519,6 +1525,11 @@ static NTSTATUS open_file(struct smb_request *req,
 			return status;
 		}
 
+		if (*p_file_created && !fsp_is_alternate_stream(fsp)) {
+			dir_name_index_created(dirfsp,
+					       smb_fname_atname->base_name);
+		}
+
 		if (local_flags & O_NONBLOCK) {
 			/*
 			 * GPFS can return ETIMEDOUT for pread on
@@ -2110,6 +2121,148 @@ NTSTATUS send_break_message(struct messaging_context *msg_ctx,
 	return status;
 }
 
+/*
+ * Break messages collected while walking the share mode entries.
+ * A write to a file many clients have open for reading or an open
+ * against many read leases breaks all of them, send those in one
+ * messaging_send_iov_multi() call.
+ */
+
+struct break_message_batch {
+	struct messaging_context *msg_ctx;
+	struct file_id id;
+	size_t num_breaks;
+	struct server_id *dsts;
+	struct iovec *blobs;
+};
+
+struct break_message_batch *break_message_batch_create(
+	TALLOC_CTX *mem_ctx,
+	struct messaging_context *msg_ctx,
+	const struct file_id *id)
+{
+	struct break_message_batch *b = NULL;
+
+	b = talloc(mem_ctx, struct break_message_batch);
+	if (b == NULL) {
+		return NULL;
+	}
+	*b = (struct break_message_batch) {
+		.msg_ctx = msg_ctx, .id = *id,
+	};
+	return b;
+}
+
+/*
+ * Queue a break message for "e", if we're out of memory send it
+ * right away.
+ */
+
+void break_message_batch_add(struct break_message_batch *b,
+			     const struct share_mode_entry *e,
+			     uint16_t break_to)
+{
+	struct oplock_break_message msg = {
+		.id = b->id,
+		.share_file_id = e->share_file_id,
+		.break_to = break_to,
+	};
+	struct server_id *dsts = NULL;
+	struct iovec *blobs = NULL;
+	enum ndr_err_code ndr_err;
+	DATA_BLOB blob;
+
+	if (DEBUGLVL(10)) {
+		struct server_id_buf buf;
+		DBG_DEBUG("Queueing break message to %s\n",
+			  server_id_str_buf(e->pid, &buf));
+		NDR_PRINT_DEBUG(oplock_break_message, &msg);
+	}
+
+	dsts = talloc_realloc(b, b->dsts, struct server_id,
+			      b->num_breaks + 1);
+	if (dsts == NULL) {
+		goto send_now;
+	}
+	b->dsts = dsts;
+
+	blobs = talloc_realloc(b, b->blobs, struct iovec, b->num_breaks + 1);
+	if (blobs == NULL) {
+		goto send_now;
+	}
+	b->blobs = blobs;
+
+	ndr_err = ndr_push_struct_blob(
+		&blob,
+		b,
+		&msg,
+		(ndr_push_flags_fn_t)ndr_push_oplock_break_message);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_WARNING("ndr_push_oplock_break_message failed: %s\n",
+			    ndr_errstr(ndr_err));
+		return;
+	}
+
+	b->dsts[b->num_breaks] = e->pid;
+	b->blobs[b->num_breaks] = (struct iovec) {
+		.iov_base = blob.data, .iov_len = blob.length,
+	};
+	b->num_breaks += 1;
+	return;
+
+send_now:
+	send_break_message(b->msg_ctx, &b->id, e, break_to);
+}
+
+void break_message_batch_send(struct break_message_batch *b)
+{
+	int *errors = NULL;
+	size_t i;
+	int ret;
+
+	if (b->num_breaks == 0) {
+		return;
+	}
+
+	errors = talloc_array(b, int, b->num_breaks);
+	if (errors == NULL) {
+		DBG_WARNING("talloc_array failed\n");
+		return;
+	}
+
+	ret = messaging_send_iov_multi(b->msg_ctx,
+				       b->dsts,
+				       b->blobs,
+				       b->num_breaks,
+				       MSG_SMB_BREAK_REQUEST,
+				       NULL,
+				       0,
+				       errors);
+	if (ret != 0) {
+		DEBUG(3, ("Could not send oplock break messages: %s\n",
+			  strerror(ret)));
+		goto done;
+	}
+
+	for (i=0; i<b->num_breaks; i++) {
+		struct server_id_buf buf;
+
+		if (errors[i] == 0) {
+			continue;
+		}
+		DEBUG(3, ("Could not send oplock break message to %s: %s\n",
+			  server_id_str_buf(b->dsts[i], &buf),
+			  strerror(errors[i])));
+	}
+
+done:
+	for (i=0; i<b->num_breaks; i++) {
+		TALLOC_FREE(b->blobs[i].iov_base);
+	}
+	TALLOC_FREE(errors);
+	b->num_breaks = 0;
+}
+
 struct validate_oplock_types_state {
 	bool valid;
 	bool batch;
@@ -2526,6 +2679,7 @@ struct delay_for_oplock_state {
 	bool have_other_lease;
 	uint32_t total_lease_types;
 	bool delay;
+	struct break_message_batch *breaks;
 };
 
 static bool delay_for_oplock_fn(
@@ -2670,8 +2824,7 @@ static bool delay_for_oplock_fn(
 	DBG_DEBUG("breaking from %d to %d\n",
 		  (int)e_lease_type,
 		  (int)break_to);
-	send_break_message(
-		fsp->conn->sconn->msg_ctx, &fsp->file_id, e, break_to);
+	break_message_batch_add(state->breaks, e, break_to);
 	if (e_lease_type & state->delay_mask) {
 		state->delay = true;
 	}
@@ -2750,8 +2903,16 @@ static NTSTATUS delay_for_oplock(files_struct *fsp,
 		break;
 	}
 
+	state.breaks = break_message_batch_create(
+		talloc_tos(), fsp->conn->sconn->msg_ctx, &fsp->file_id);
+	if (state.breaks == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
 	state.total_lease_types = SMB2_LEASE_NONE;
 	ok = share_mode_forall_entries(lck, delay_for_oplock_fn, &state);
+	break_message_batch_send(state.breaks);
+	TALLOC_FREE(state.breaks);
 	if (!ok) {
 		return NT_STATUS_INTERNAL_ERROR;
 	}
@@ -4591,6 +4752,9 @@ static NTSTATUS mkdir_internal(connection_struct *conn,
 		}
 	}
 
+	dir_name_index_prepare_create(parent_dir_fname->fsp,
+				      smb_fname_atname->base_name);
+
 	ret = SMB_VFS_MKDIRAT(conn,
 			      parent_dir_fname->fsp,
 			      smb_fname_atname,
@@ -4599,6 +4763,9 @@ static NTSTATUS mkdir_internal(connection_struct *conn,
 		return map_nt_error_from_unix(errno);
 	}
 
+	dir_name_index_created(parent_dir_fname->fsp,
+			       smb_fname_atname->base_name);
+
 	/*
 	 * Make this a pathref fsp for now. open_directory() will reopen as a
 	 * full fsp.
@@ -236,6 +236,16 @@ bool smbd_setup_mdns_registration(struct tevent_context *ev,
 				  TALLOC_CTX *mem_ctx,
 				  uint16_t port);
 
+/* The following definitions come from smbd/dir_name_index.c  */
+
+NTSTATUS dir_name_index_lookup(struct files_struct *dirfsp,
+			       const char *name,
+			       TALLOC_CTX *mem_ctx,
+			       char **found_name);
+void dir_name_index_prepare_create(struct files_struct *dirfsp,
+				   const char *name);
+void dir_name_index_created(struct files_struct *dirfsp, const char *name);
+
 /* The following definitions come from smbd/dosmode.c  */
 
 mode_t unix_mode(connection_struct *conn, int dosmode,
@@ -354,6 +364,7 @@ NTSTATUS get_real_filename_at(struct files_struct *dirfsp,
 			      const char *name,
 			      TALLOC_CTX *mem_ctx,
 			      char **found_name);
+void filename_forget_real_filename(connection_struct *conn, const char *path);
 
 /* The following definitions come from smbd/files.c  */
 
@@ -725,6 +736,15 @@ NTSTATUS send_break_message(struct messaging_context *msg_ctx,
 			    const struct file_id *id,
 			    const struct share_mode_entry *exclusive,
 			    uint16_t break_to);
+struct break_message_batch;
+struct break_message_batch *break_message_batch_create(
+	TALLOC_CTX *mem_ctx,
+	struct messaging_context *msg_ctx,
+	const struct file_id *id);
+void break_message_batch_add(struct break_message_batch *b,
+			     const struct share_mode_entry *e,
+			     uint16_t break_to);
+void break_message_batch_send(struct break_message_batch *b);
 struct deferred_open_record;
 bool is_deferred_open_async(const struct deferred_open_record *rec);
 bool defer_smb1_sharing_violation(struct smb_request *req);
@@ -1088,6 +1108,20 @@ bool is_share_read_only_for_token(const char *username,
 NTSTATUS srvstr_push_fn(const char *base_ptr, uint16_t smb_flags2, void *dest,
 		      const char *src, int dest_len, int flags, size_t *ret_len);
 
+/* The following definitions come from smbd/statcache_shared.c  */
+
+void smbd_shared_stat_cache_init(void);
+bool smbd_shared_stat_cache_lookup(TALLOC_CTX *mem_ctx,
+				   struct connection_struct *conn,
+				   DATA_BLOB key,
+				   DATA_BLOB *value);
+void smbd_shared_stat_cache_add(struct connection_struct *conn,
+				DATA_BLOB key,
+				DATA_BLOB value);
+void smbd_shared_stat_cache_delete(DATA_BLOB key);
+bool smbd_shared_stat_cache_have_name(DATA_BLOB name);
+bool smbd_shared_stat_cache_enabled(void);
+
 /* The following definitions come from smbd/statvfs.c  */
 
 int sys_statvfs(const char *path, struct vfs_statvfs_struct *statbuf);
@@ -58,6 +58,7 @@
 #include "g_lock.h"
 #include "lib/global_contexts.h"
 #include "source3/lib/substitute.h"
+#include "smbd/smb2_smbdirect.h"
 
 #ifdef CLUSTER_SUPPORT
 #include "ctdb_protocol.h"
@@ -949,6 +950,40 @@ static void smbd_open_socket_close_fn(struct tevent_context *ev,
 	close(fd);
 }
 
+/*
+ * Returns false if the child can't serve the client
+ * and should just exit.
+ */
+static bool smbd_child_reinit_after_fork(struct messaging_context *msg_ctx,
+					 struct tevent_context *ev)
+{
+	NTSTATUS status;
+
+	status = smbd_reinit_after_fork(msg_ctx, ev, true);
+	if (NT_STATUS_IS_OK(status)) {
+		return true;
+	}
+
+	if (NT_STATUS_EQUAL(status, NT_STATUS_TOO_MANY_OPENED_FILES)) {
+		DEBUG(0,("child process cannot initialize "
+			 "because too many files are open\n"));
+		return false;
+	}
+	if (lp_clustering() &&
+	    (NT_STATUS_EQUAL(status, NT_STATUS_INTERNAL_DB_ERROR) ||
+	     NT_STATUS_EQUAL(status, NT_STATUS_CONNECTION_REFUSED))) {
+		DEBUG(1, ("child process cannot initialize "
+			  "because connection to CTDB "
+			  "has failed: %s\n",
+			  nt_errstr(status)));
+		return false;
+	}
+
+	DEBUG(0,("reinit_after_fork() failed\n"));
+	smb_panic("reinit_after_fork() failed");
+	return false;
+}
+
 static void smbd_accept_connection(struct tevent_context *ev,
 				   struct tevent_fd *fde,
 				   uint16_t flags,
@@ -988,7 +1023,6 @@ static void smbd_accept_connection(struct tevent_context *ev,
 	pid = fork();
 	if (pid == 0) {
 		char addrstr[INET6_ADDRSTRLEN];
-		NTSTATUS status = NT_STATUS_OK;
 
 		/*
 		 * Can't use TALLOC_FREE here. Nulling out the argument to it
@@ -1001,28 +1035,8 @@ static void smbd_accept_connection(struct tevent_context *ev,
 		 * them, counting worker smbds. */
 		CatchChild();
 
-		status = smbd_reinit_after_fork(msg_ctx, ev, true);
-		if (!NT_STATUS_IS_OK(status)) {
-			if (NT_STATUS_EQUAL(status,
-					    NT_STATUS_TOO_MANY_OPENED_FILES)) {
-				DEBUG(0,("child process cannot initialize "
-					 "because too many files are open\n"));
-				goto exit;
-			}
-			if (lp_clustering() &&
-			    (NT_STATUS_EQUAL(
-				    status, NT_STATUS_INTERNAL_DB_ERROR) ||
-			     NT_STATUS_EQUAL(
-				    status, NT_STATUS_CONNECTION_REFUSED))) {
-				DEBUG(1, ("child process cannot initialize "
-					  "because connection to CTDB "
-					  "has failed: %s\n",
-					  nt_errstr(status)));
-				goto exit;
-			}
-
-			DEBUG(0,("reinit_after_fork() failed\n"));
-			smb_panic("reinit_after_fork() failed");
+		if (!smbd_child_reinit_after_fork(msg_ctx, ev)) {
+			goto exit;
 		}
 
 		print_sockaddr(addrstr, sizeof(addrstr), &addr);
@@ -1071,6 +1085,135 @@ static void smbd_accept_connection(struct tevent_context *ev,
 	force_check_log_size();
 }
 
+/*
+ * An SMB Direct connection request. Unlike for a TCP connection,
+ * the child takes the request from the listener, as librdmacm keeps
+ * the state of an accepted connection in the process that got the
+ * event. We don't look at the listener again until the child is
+ * done with that.
+ */
+static void smbd_smbdirect_connection_request(
+	struct smbd_smbdirect_listener *listener,
+	void *private_data)
+{
+	struct smbd_parent_context *parent = talloc_get_type_abort(
+		private_data, struct smbd_parent_context);
+	struct tevent_context *ev = parent->ev_ctx;
+	struct messaging_context *msg_ctx = parent->msg_ctx;
+	NTSTATUS status;
+	int pipe_fds[2];
+	int fd = -1;
+	pid_t pid;
+	int ret;
+
+	if (parent->interactive) {
+		reinit_after_fork(msg_ctx, ev, true);
+		status = smbd_smbdirect_accept(listener, ev, &fd);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("smbd_smbdirect_accept failed: %s\n",
+				nt_errstr(status));
+			return;
+		}
+		smbd_process(ev, msg_ctx, fd, true);
+		exit_server_cleanly("end of interactive mode");
+		return;
+	}
+
+	if (!allowable_number_of_smbd_processes(parent)) {
+		smbd_smbdirect_listener_reject(listener);
+		return;
+	}
+
+	ret = pipe(pipe_fds);
+	if (ret == -1) {
+		DBG_ERR("pipe() failed: %s\n", strerror(errno));
+		smbd_smbdirect_listener_reject(listener);
+		return;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		close(pipe_fds[0]);
+
+		status = smbd_smbdirect_accept(listener, ev, &fd);
+
+		/*
+		 * Let the parent go on with the next request
+		 */
+		close(pipe_fds[1]);
+
+		/*
+		 * Can't use TALLOC_FREE here. Nulling out the argument to it
+		 * would overwrite memory we've just freed.
+		 */
+		talloc_free(parent);
+		parent = NULL;
+		listener = NULL;
+
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_NOTICE("smbd_smbdirect_accept failed: %s\n",
+				   nt_errstr(status));
+			goto exit;
+		}
+
+		/* Stop zombies, the parent explicitly handles
+		 * them, counting worker smbds. */
+		CatchChild();
+
+		if (!smbd_child_reinit_after_fork(msg_ctx, ev)) {
+			goto exit;
+		}
+
+		process_set_title("smbd[rdma]", "SMB Direct client");
+
+		smbd_process(ev, msg_ctx, fd, false);
+	 exit:
+		exit_server_cleanly("end of child");
+		return;
+	}
+
+	close(pipe_fds[1]);
+
+	if (pid < 0) {
+		DBG_ERR("fork() failed: %s\n", strerror(errno));
+		close(pipe_fds[0]);
+		smbd_smbdirect_listener_reject(listener);
+		return;
+	}
+
+	smbd_smbdirect_listener_wait(listener, pipe_fds[0]);
+	add_child_pid(parent, pid);
+
+	force_check_log_size();
+}
+
+static void smbd_open_smbdirect_listener(struct smbd_parent_context *parent,
+					 struct tevent_context *ev_ctx,
+					 const struct sockaddr_storage *ifss)
+{
+	struct smbd_smbdirect_listener *listener = NULL;
+	char addrstr[INET6_ADDRSTRLEN];
+
+	listener = smbd_smbdirect_listener_create(
+		parent,
+		ev_ctx,
+		ifss,
+		SMBD_SMBDIRECT_PORT,
+		smbd_smbdirect_connection_request,
+		parent);
+	if (listener == NULL) {
+		/*
+		 * Not every interface has an RDMA device,
+		 * TCP still works.
+		 */
+		print_sockaddr(addrstr, sizeof(addrstr), ifss);
+		DBG_WARNING("No SMB Direct listener on [%s]:%u: %s\n",
+			    addrstr,
+			    SMBD_SMBDIRECT_PORT,
+			    strerror(errno));
+	}
+}
+
 static bool smbd_open_one_socket(struct smbd_parent_context *parent,
 				 struct tevent_context *ev_ctx,
 				 const struct sockaddr_storage *ifss,
@@ -1260,6 +1403,45 @@ static bool open_sockets_smbd(struct smbd_parent_context *parent,
 		return false;
 	}
 
+	if (lp_server_smb_direct()) {
+		if (lp_interfaces() && lp_bind_interfaces_only()) {
+			for (i = 0; i < num_interfaces; i++) {
+				const struct sockaddr_storage *ifss =
+					iface_n_sockaddr_storage(i);
+				if (ifss == NULL) {
+					continue;
+				}
+				smbd_open_smbdirect_listener(parent,
+							     ev_ctx,
+							     ifss);
+			}
+		} else {
+			const char *sock_addr;
+			char *sock_tok;
+			const char *sock_ptr;
+
+#ifdef HAVE_IPV6
+			sock_addr = "::,0.0.0.0";
+#else
+			sock_addr = "0.0.0.0";
+#endif
+
+			for (sock_ptr=sock_addr;
+			     next_token_talloc(talloc_tos(), &sock_ptr,
+					       &sock_tok, " \t,"); ) {
+				struct sockaddr_storage ss;
+
+				if (!interpret_string_addr(&ss, sock_tok,
+						AI_NUMERICHOST|AI_PASSIVE)) {
+					continue;
+				}
+				smbd_open_smbdirect_listener(parent,
+							     ev_ctx,
+							     &ss);
+			}
+		}
+	}
+
         /* Listen to messages */
 
 	messaging_register(msg_ctx, NULL, MSG_SHUTDOWN, msg_exit_server);
@@ -1814,6 +1996,17 @@ extern void build_options(bool screen);
 
 	init_structs();
 
+	if (lp_parm_bool(-1, "smbd", "talloc slab", false)) {
+		/*
+		 * The forked children inherit this, it caches the
+		 * small chunks freed in the main thread.
+		 */
+		if (talloc_enable_slab() != 0) {
+			DBG_WARNING("talloc slab cache not available: %s\n",
+				    strerror(errno));
+		}
+	}
+
 	if (!profile_setup(msg_ctx, False)) {
 		DEBUG(0,("ERROR: failed to setup profiling\n"));
 		return -1;
@@ -1972,6 +2165,8 @@ extern void build_options(bool screen);
 		exit_daemon("Samba cannot init leases", EACCES);
 	}
 
+	smbd_shared_stat_cache_init();
+
 	if (!smbd_notifyd_init(
 		    msg_ctx,
 		    cmdline_daemon_cfg->interactive,
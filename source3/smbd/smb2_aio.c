@@ -329,10 +329,15 @@ NTSTATUS schedule_smb2_aio_read(connection_struct *conn,
 		return NT_STATUS_RETRY;
 	}
 
-	/* Create the out buffer. */
-	*preadbuf = data_blob_talloc(ctx, NULL, smb_maxcnt);
+	/*
+	 * Create the out buffer, unless the caller
+	 * provides one, e.g. for RDMA.
+	 */
 	if (preadbuf->data == NULL) {
-		return NT_STATUS_NO_MEMORY;
+		*preadbuf = data_blob_talloc(ctx, NULL, smb_maxcnt);
+		if (preadbuf->data == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
 	}
 
 	if (!(aio_ex = create_aio_extra(smbreq->smb2req, fsp, 0))) {
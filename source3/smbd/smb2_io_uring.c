@@ -0,0 +1,390 @@
+/*
+   Unix SMB/CIFS implementation.
+   Client socket I/O for the SMB2 server via io_uring
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+
+#ifdef HAVE_LIBURING
+/*
+ * See the comment in source3/modules/vfs_io_uring.c
+ */
+struct open_how;
+#ifdef HAVE_STRUCT_OPEN_HOW_LIBURING_COMPAT_H
+#define open_how __ignore_liburing_compat_h_open_how
+#include <liburing/compat.h>
+#undef open_how
+#endif /* HAVE_STRUCT_OPEN_HOW_LIBURING_COMPAT_H */
+#endif /* HAVE_LIBURING */
+
+#include "includes.h"
+#include "system/network.h"
+#include "smbd/smb2_io_uring.h"
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+
+/*
+ * We never have more than a recvmsg and a sendmsg in flight,
+ * plus their cancels when shutting down.
+ */
+#define SMBD_SMB2_IO_URING_ENTRIES 8
+
+struct smbd_smb2_io_uring_op {
+	bool queued;
+	bool pending;
+	smbd_smb2_io_uring_done_fn done_fn;
+};
+
+struct smbd_smb2_io_uring {
+	struct io_uring uring;
+	struct tevent_context *ev;
+	struct tevent_fd *fde;
+	struct tevent_immediate *im;
+	int sock;
+	struct smbd_smb2_io_uring_op recv;
+	struct smbd_smb2_io_uring_op send;
+	void *private_data;
+};
+
+static void smbd_smb2_io_uring_fd_handler(struct tevent_context *ev,
+					  struct tevent_fd *fde,
+					  uint16_t flags,
+					  void *private_data);
+
+static int smbd_smb2_io_uring_destructor(struct smbd_smb2_io_uring *ring)
+{
+	struct smbd_smb2_io_uring_op *ops[] = { &ring->recv, &ring->send };
+	struct io_uring_cqe *cqe = NULL;
+	size_t i;
+	int ret;
+
+	TALLOC_FREE(ring->fde);
+	TALLOC_FREE(ring->im);
+
+	/*
+	 * The kernel may still be using the buffers of the pending
+	 * operations, which our caller is about to free. So we cancel them
+	 * and wait until they are gone.
+	 */
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		struct io_uring_sqe *sqe = NULL;
+
+		if (!ops[i]->pending) {
+			continue;
+		}
+		sqe = io_uring_get_sqe(&ring->uring);
+		if (sqe == NULL) {
+			break;
+		}
+		io_uring_prep_cancel(sqe, ops[i], 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+
+	ret = io_uring_submit(&ring->uring);
+
+	while (ret >= 0 && (ring->recv.pending || ring->send.pending)) {
+		struct smbd_smb2_io_uring_op *op = NULL;
+
+		ret = io_uring_wait_cqe(&ring->uring, &cqe);
+		if (ret == -EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret < 0) {
+			DBG_ERR("io_uring_wait_cqe() failed: %s\n",
+				strerror(-ret));
+			break;
+		}
+		op = (struct smbd_smb2_io_uring_op *)io_uring_cqe_get_data(cqe);
+		if (op != NULL) {
+			op->pending = false;
+		}
+		io_uring_cqe_seen(&ring->uring, cqe);
+	}
+
+	io_uring_queue_exit(&ring->uring);
+	return 0;
+}
+
+struct smbd_smb2_io_uring *smbd_smb2_io_uring_create(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	int sock,
+	smbd_smb2_io_uring_done_fn recv_done,
+	smbd_smb2_io_uring_done_fn send_done,
+	void *private_data)
+{
+	struct smbd_smb2_io_uring *ring = NULL;
+	int ret;
+
+	ring = talloc_zero(mem_ctx, struct smbd_smb2_io_uring);
+	if (ring == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ring->ev = ev;
+	ring->sock = sock;
+	ring->recv.done_fn = recv_done;
+	ring->send.done_fn = send_done;
+	ring->private_data = private_data;
+
+	ring->im = tevent_create_immediate(ring);
+	if (ring->im == NULL) {
+		TALLOC_FREE(ring);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ret = io_uring_queue_init(SMBD_SMB2_IO_URING_ENTRIES, &ring->uring, 0);
+	if (ret < 0) {
+		TALLOC_FREE(ring);
+		errno = -ret;
+		return NULL;
+	}
+	talloc_set_destructor(ring, smbd_smb2_io_uring_destructor);
+
+#ifdef HAVE_IO_URING_RING_DONTFORK
+	ret = io_uring_ring_dontfork(&ring->uring);
+	if (ret < 0) {
+		TALLOC_FREE(ring);
+		errno = -ret;
+		return NULL;
+	}
+#endif /* HAVE_IO_URING_RING_DONTFORK */
+
+	ring->fde = tevent_add_fd(ev,
+				  ring,
+				  ring->uring.ring_fd,
+				  TEVENT_FD_READ,
+				  smbd_smb2_io_uring_fd_handler,
+				  ring);
+	if (ring->fde == NULL) {
+		TALLOC_FREE(ring);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return ring;
+}
+
+bool smbd_smb2_io_uring_recv_pending(struct smbd_smb2_io_uring *ring)
+{
+	return ring->recv.pending;
+}
+
+bool smbd_smb2_io_uring_send_pending(struct smbd_smb2_io_uring *ring)
+{
+	return ring->send.pending;
+}
+
+/*
+ * Submit everything queued while handling the current event with a single
+ * io_uring_enter(), a recvmsg for the next request usually goes together
+ * with the sendmsg for the last response.
+ */
+static void smbd_smb2_io_uring_submit(struct tevent_context *ev,
+				      struct tevent_immediate *im,
+				      void *private_data)
+{
+	struct smbd_smb2_io_uring *ring = talloc_get_type_abort(
+		private_data, struct smbd_smb2_io_uring);
+	struct smbd_smb2_io_uring_op *ops[] = { &ring->recv, &ring->send };
+	struct smbd_smb2_io_uring_op *failed[ARRAY_SIZE(ops)];
+	void *done_private_data = ring->private_data;
+	size_t i, num_failed = 0;
+	int ret;
+
+	ret = io_uring_submit(&ring->uring);
+	if (ret == -EAGAIN || ret == -EBUSY || ret == -EINTR) {
+		/* We just retry later */
+		tevent_schedule_immediate(ring->im,
+					  ring->ev,
+					  smbd_smb2_io_uring_submit,
+					  ring);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		if (!ops[i]->queued) {
+			continue;
+		}
+		ops[i]->queued = false;
+		if (ret < 0) {
+			ops[i]->pending = false;
+			failed[num_failed++] = ops[i];
+		}
+	}
+
+	/*
+	 * The completion functions may free the ring.
+	 */
+	for (i = 0; i < num_failed; i++) {
+		failed[i]->done_fn(done_private_data, ret);
+	}
+}
+
+static int smbd_smb2_io_uring_queue(struct smbd_smb2_io_uring *ring,
+				    struct smbd_smb2_io_uring_op *op,
+				    struct io_uring_sqe **_sqe)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if (op->pending) {
+		return EBUSY;
+	}
+
+	sqe = io_uring_get_sqe(&ring->uring);
+	if (sqe == NULL) {
+		return ENOSPC;
+	}
+
+	op->queued = true;
+	op->pending = true;
+
+	tevent_schedule_immediate(ring->im,
+				  ring->ev,
+				  smbd_smb2_io_uring_submit,
+				  ring);
+
+	*_sqe = sqe;
+	return 0;
+}
+
+int smbd_smb2_io_uring_recvmsg(struct smbd_smb2_io_uring *ring,
+			       struct msghdr *msg)
+{
+	struct io_uring_sqe *sqe = NULL;
+	unsigned flags = 0;
+	int ret;
+
+	ret = smbd_smb2_io_uring_queue(ring, &ring->recv, &sqe);
+	if (ret != 0) {
+		return ret;
+	}
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	io_uring_prep_recvmsg(sqe, ring->sock, msg, flags);
+	io_uring_sqe_set_data(sqe, &ring->recv);
+	return 0;
+}
+
+int smbd_smb2_io_uring_sendmsg(struct smbd_smb2_io_uring *ring,
+			       struct msghdr *msg)
+{
+	struct io_uring_sqe *sqe = NULL;
+	unsigned flags = 0;
+	int ret;
+
+	ret = smbd_smb2_io_uring_queue(ring, &ring->send, &sqe);
+	if (ret != 0) {
+		return ret;
+	}
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	io_uring_prep_sendmsg(sqe, ring->sock, msg, flags);
+	io_uring_sqe_set_data(sqe, &ring->send);
+	return 0;
+}
+
+static void smbd_smb2_io_uring_fd_handler(struct tevent_context *ev,
+					  struct tevent_fd *fde,
+					  uint16_t flags,
+					  void *private_data)
+{
+	struct smbd_smb2_io_uring *ring = talloc_get_type_abort(
+		private_data, struct smbd_smb2_io_uring);
+	struct {
+		smbd_smb2_io_uring_done_fn fn;
+		int res;
+	} done[2];
+	void *done_private_data = ring->private_data;
+	struct io_uring_cqe *cqe = NULL;
+	unsigned cqhead;
+	unsigned nr = 0;
+	size_t i, num_done = 0;
+
+	io_uring_for_each_cqe(&ring->uring, cqhead, cqe) {
+		struct smbd_smb2_io_uring_op *op =
+			(struct smbd_smb2_io_uring_op *)
+			io_uring_cqe_get_data(cqe);
+
+		nr++;
+		if (op == NULL || !op->pending) {
+			continue;
+		}
+		op->pending = false;
+		done[num_done].fn = op->done_fn;
+		done[num_done].res = cqe->res;
+		num_done++;
+		if (num_done == ARRAY_SIZE(done)) {
+			break;
+		}
+	}
+
+	io_uring_cq_advance(&ring->uring, nr);
+
+	/*
+	 * The completion functions may free the ring,
+	 * so we don't touch it after this point.
+	 */
+	for (i = 0; i < num_done; i++) {
+		done[i].fn(done_private_data, done[i].res);
+	}
+}
+
+#else /* HAVE_LIBURING */
+
+struct smbd_smb2_io_uring *smbd_smb2_io_uring_create(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	int sock,
+	smbd_smb2_io_uring_done_fn recv_done,
+	smbd_smb2_io_uring_done_fn send_done,
+	void *private_data)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+bool smbd_smb2_io_uring_recv_pending(struct smbd_smb2_io_uring *ring)
+{
+	return false;
+}
+
+bool smbd_smb2_io_uring_send_pending(struct smbd_smb2_io_uring *ring)
+{
+	return false;
+}
+
+int smbd_smb2_io_uring_recvmsg(struct smbd_smb2_io_uring *ring,
+			       struct msghdr *msg)
+{
+	return ENOSYS;
+}
+
+int smbd_smb2_io_uring_sendmsg(struct smbd_smb2_io_uring *ring,
+			       struct msghdr *msg)
+{
+	return ENOSYS;
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,60 @@
+/*
+   Unix SMB/CIFS implementation.
+   Client socket I/O for the SMB2 server via io_uring
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SMBD_SMB2_IO_URING_H_
+#define _SMBD_SMB2_IO_URING_H_
+
+struct smbd_smb2_io_uring;
+
+/*
+ * The completion functions get the result of the recvmsg/sendmsg,
+ * which is the number of bytes transferred or a negative errno.
+ *
+ * They may free the ring.
+ */
+typedef void (*smbd_smb2_io_uring_done_fn)(void *private_data, int res);
+
+/*
+ * Returns NULL with errno set if io_uring is not available,
+ * in which case the caller should fall back to polling the socket.
+ */
+struct smbd_smb2_io_uring *smbd_smb2_io_uring_create(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	int sock,
+	smbd_smb2_io_uring_done_fn recv_done,
+	smbd_smb2_io_uring_done_fn send_done,
+	void *private_data);
+
+bool smbd_smb2_io_uring_recv_pending(struct smbd_smb2_io_uring *ring);
+bool smbd_smb2_io_uring_send_pending(struct smbd_smb2_io_uring *ring);
+
+/*
+ * Queue a recvmsg or sendmsg on the socket. Only one of each can be
+ * pending at a time. The msghdr and the buffers it points to must stay
+ * valid until the completion function is called or the ring is freed.
+ *
+ * Everything queued while processing one event is submitted together,
+ * just before tevent waits for the next event.
+ */
+int smbd_smb2_io_uring_recvmsg(struct smbd_smb2_io_uring *ring,
+			       struct msghdr *msg);
+int smbd_smb2_io_uring_sendmsg(struct smbd_smb2_io_uring *ring,
+			       struct msghdr *msg);
+
+#endif /* _SMBD_SMB2_IO_URING_H_ */
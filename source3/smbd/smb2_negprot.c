@@ -162,6 +162,7 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 	struct smb2_negotiate_context *in_preauth = NULL;
 	struct smb2_negotiate_context *in_cipher = NULL;
 	struct smb2_negotiate_context *in_sign_algo = NULL;
+	struct smb2_negotiate_context *in_compression = NULL;
 	struct smb2_negotiate_contexts out_c = { .num_contexts = 0, };
 	struct smb2_negotiate_context *in_posix = NULL;
 	const struct smb311_capabilities default_smb3_capabilities =
@@ -356,6 +357,8 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 					SMB2_ENCRYPTION_CAPABILITIES);
 	in_sign_algo = smb2_negotiate_context_find(&in_c,
 					SMB2_SIGNING_CAPABILITIES);
+	in_compression = smb2_negotiate_context_find(&in_c,
+					SMB2_COMPRESSION_CAPABILITIES);
 
 	/* negprot_spnego() returns the server guid in the first 16 bytes */
 	negprot_spnego_blob = negprot_spnego(req, xconn);
@@ -657,6 +660,114 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		}
 	}
 
+	if (in_compression != NULL && lp_server_smb2_compression()) {
+		size_t needed = 8;
+		uint16_t algo_count;
+		uint32_t in_flags;
+		uint32_t out_flags = SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE;
+		bool lz77 = false;
+		bool lz77_huffman = false;
+		bool pattern_v1 = false;
+		uint16_t algos[3];
+		size_t num_algos = 0;
+		const uint8_t *p;
+		uint8_t buf[8 + sizeof(algos)];
+		size_t i;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		algo_count = SVAL(in_compression->data.data, 0);
+		if (algo_count == 0) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+		in_flags = IVAL(in_compression->data.data, 4);
+
+		p = in_compression->data.data + needed;
+		needed += algo_count * 2;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		for (i=0; i < algo_count; i++) {
+			uint16_t v;
+
+			v = SVAL(p, 0);
+			p += 2;
+
+			switch (v) {
+			case SMB2_COMPRESSION_LZ77:
+				lz77 = true;
+				break;
+			case SMB2_COMPRESSION_LZ77_HUFFMAN:
+				lz77_huffman = true;
+				break;
+			case SMB2_COMPRESSION_PATTERN_V1:
+				pattern_v1 = true;
+				break;
+			}
+		}
+
+		/*
+		 * We list the algorithms in our order of
+		 * preference, we only ever compress responses
+		 * with LZ77+Huffman, but we're able to
+		 * decompress LZ77 requests.
+		 */
+		if (lz77_huffman) {
+			algos[num_algos++] = SMB2_COMPRESSION_LZ77_HUFFMAN;
+		}
+		if (lz77) {
+			algos[num_algos++] = SMB2_COMPRESSION_LZ77;
+		}
+
+		if (num_algos > 0 &&
+		    (in_flags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED))
+		{
+			out_flags = SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED;
+			if (pattern_v1) {
+				algos[num_algos++] = SMB2_COMPRESSION_PATTERN_V1;
+			}
+		}
+
+		if (num_algos == 0) {
+			/*
+			 * No overlap, MS-SMB2 3.3.5.4 requires
+			 * a single NONE algorithm in the response.
+			 */
+			algos[num_algos++] = SMB2_COMPRESSION_NONE;
+		}
+
+		SSVAL(buf, 0, num_algos); /* CompressionAlgorithmCount */
+		SSVAL(buf, 2, 0);         /* Padding */
+		SIVAL(buf, 4, out_flags); /* Flags */
+		for (i=0; i < num_algos; i++) {
+			SSVAL(buf, 8 + i*2, algos[i]);
+		}
+
+		status = smb2_negotiate_context_add(
+			req,
+			&out_c,
+			SMB2_COMPRESSION_CAPABILITIES,
+			buf,
+			8 + num_algos * 2);
+		if (!NT_STATUS_IS_OK(status)) {
+			return smbd_smb2_request_error(req, status);
+		}
+
+		xconn->smb2.compression.negotiated =
+			(algos[0] != SMB2_COMPRESSION_NONE);
+		xconn->smb2.compression.send_algo = lz77_huffman ?
+			SMB2_COMPRESSION_LZ77_HUFFMAN : SMB2_COMPRESSION_NONE;
+		xconn->smb2.compression.chained =
+			(out_flags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED);
+	}
+
 	status = smb311_capabilities_check(&default_smb3_capabilities,
 					   "smb2srv_negprot",
 					   DBGLVL_NOTICE,
@@ -669,8 +780,14 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		return smbd_smb2_request_error(req, status);
 	}
 
+	/*
+	 * An SMB Direct connection can't be passed
+	 * to another smbd, so it can't join a
+	 * multi-channel session either.
+	 */
 	if (protocol >= PROTOCOL_SMB3_00 &&
-	    xconn->client->server_multi_channel_enabled)
+	    xconn->client->server_multi_channel_enabled &&
+	    xconn->transport.smbdirect == NULL)
 	{
 		if (in_capabilities & SMB2_CAP_MULTI_CHANNEL) {
 			capabilities |= SMB2_CAP_MULTI_CHANNEL;
@@ -822,7 +939,9 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		return smbd_smb2_request_done(req, outbody, &outdyn);
 	}
 
-	if (!xconn->client->server_multi_channel_enabled) {
+	if (!xconn->client->server_multi_channel_enabled ||
+	    xconn->transport.smbdirect != NULL)
+	{
 		/*
 		 * Only deal with the client guid database
 		 * if multi-channel is enabled.
@@ -1133,17 +1133,6 @@ static void process_kernel_oplock_break(struct messaging_context *msg_ctx,
 	add_oplock_timeout_handler(fsp);
 }
 
-static void send_break_to_none(struct messaging_context *msg_ctx,
-			       const struct file_id *id,
-			       const struct share_mode_entry *e)
-{
-	NTSTATUS status;
-	status = send_break_message(msg_ctx, id, e, OPLOCK_NONE);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_DEBUG("send_break_message failed: %s\n",
-			  nt_errstr(status));
-	}
-}
 struct break_to_none_state {
 	struct smbd_server_connection *sconn;
 	struct file_id id;
@@ -1151,6 +1140,7 @@ struct break_to_none_state {
 	struct GUID client_guid;
 	size_t num_read_leases;
 	uint32_t total_lease_types;
+	struct break_message_batch *breaks;
 };
 
 static bool do_break_lease_to_none(struct share_mode_entry *e,
@@ -1201,7 +1191,7 @@ static bool do_break_lease_to_none(struct share_mode_entry *e,
 		  e->lease_key.data[0],
 		  e->lease_key.data[1]);
 
-	send_break_to_none(state->sconn->msg_ctx, &state->id, e);
+	break_message_batch_add(state->breaks, e, OPLOCK_NONE);
 
 	return false;
 }
@@ -1243,7 +1233,7 @@ static bool do_break_oplock_to_none(struct share_mode_entry *e,
 	/* Paranoia .... */
 	SMB_ASSERT(!EXCLUSIVE_OPLOCK_TYPE(e->op_type));
 
-	send_break_to_none(state->sconn->msg_ctx, &state->id, e);
+	break_message_batch_add(state->breaks, e, OPLOCK_NONE);
 
 	return false;
 }
@@ -1301,6 +1291,14 @@ static void contend_level2_oplocks_begin_default(files_struct *fsp,
 		return;
 	}
 
+	state.breaks = break_message_batch_create(
+		lck, state.sconn->msg_ctx, &state.id);
+	if (state.breaks == NULL) {
+		DBG_WARNING("break_message_batch_create failed\n");
+		TALLOC_FREE(lck);
+		return;
+	}
+
 	/*
 	 * Walk leases and oplocks separately: We have to send one break per
 	 * lease. If we have multiple share_mode_entry having a common lease,
@@ -1318,6 +1316,8 @@ static void contend_level2_oplocks_begin_default(files_struct *fsp,
 		DBG_WARNING("share_mode_forall_entries failed\n");
 	}
 
+	break_message_batch_send(state.breaks);
+
 	{
 		/*
 		 * Lazy update here. It might be that all leases
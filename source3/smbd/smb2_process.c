@@ -47,6 +47,7 @@
 #include "libcli/smb/smbXcli_base.h"
 #include "lib/util/time_basic.h"
 #include "source3/lib/substitute.h"
+#include "smbd/smb2_smbdirect.h"
 
 /* Internal message queue for deferred opens. */
 struct pending_message_list {
@@ -1208,6 +1209,30 @@ NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 	/* Ensure child is set to blocking mode */
 	set_blocking(sock_fd,True);
 
+	/*
+	 * For SMB Direct sock_fd is a socketpair with the
+	 * transport, the addresses come from the RDMA
+	 * connection.
+	 */
+	xconn->transport.smbdirect = smbd_smbdirect_connection_claim(xconn,
+								     sock_fd);
+	if (xconn->transport.smbdirect != NULL) {
+		ret = smbd_smbdirect_connection_addresses(
+			xconn->transport.smbdirect,
+			xconn,
+			&local_address,
+			&remote_address);
+		if (ret != 0) {
+			int saved_errno = errno;
+			DBG_ERR("smbd_smbdirect_connection_addresses "
+				"failed - %s\n",
+				strerror(saved_errno));
+			TALLOC_FREE(frame);
+			return map_nt_error_from_unix_common(saved_errno);
+		}
+		goto got_addresses;
+	}
+
 	set_socket_options(sock_fd, "SO_KEEPALIVE");
 	set_socket_options(sock_fd, lp_socket_options());
 
@@ -1253,6 +1278,7 @@ NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 		return map_nt_error_from_unix_common(saved_errno);
 	}
 
+got_addresses:
 	if (tsocket_address_is_inet(remote_address, "ip")) {
 		remaddr = tsocket_address_inet_addr_string(remote_address,
 							   talloc_tos());
@@ -27,6 +27,7 @@
 #include "../lib/util/tevent_ntstatus.h"
 #include "rpc_server/srv_pipe_hnd.h"
 #include "lib/util/sys_rw_data.h"
+#include "smbd/smb2_smbdirect.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
@@ -39,13 +40,28 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 					      uint32_t in_length,
 					      uint64_t in_offset,
 					      uint32_t in_minimum,
-					      uint32_t in_remaining);
+					      uint32_t in_remaining,
+					      bool in_rdma);
 static NTSTATUS smbd_smb2_read_recv(struct tevent_req *req,
 				    TALLOC_CTX *mem_ctx,
 				    DATA_BLOB *out_data,
 				    uint32_t *out_remaining);
+static struct tevent_req *smbd_smb2_read_rdma_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_request *smb2req,
+	struct files_struct *in_fsp,
+	uint8_t in_flags,
+	uint32_t in_length,
+	uint64_t in_offset,
+	uint32_t in_minimum,
+	uint32_t in_remaining,
+	DATA_BLOB in_channel_info);
+static NTSTATUS smbd_smb2_read_rdma_recv(struct tevent_req *req,
+					 uint32_t *out_remaining);
 
 static void smbd_smb2_request_read_done(struct tevent_req *subreq);
+static void smbd_smb2_request_read_rdma_done(struct tevent_req *subreq);
 NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -58,7 +74,11 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 	uint64_t in_file_id_volatile;
 	struct files_struct *in_fsp;
 	uint32_t in_minimum_count;
+	uint32_t in_channel;
 	uint32_t in_remaining_bytes;
+	uint16_t in_channel_info_offset;
+	uint16_t in_channel_info_length;
+	DATA_BLOB in_channel_info;
 	struct tevent_req *subreq;
 
 	status = smbd_smb2_request_verify_sizes(req, 0x31);
@@ -77,7 +97,10 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 	in_file_id_persistent	= BVAL(inbody, 0x10);
 	in_file_id_volatile	= BVAL(inbody, 0x18);
 	in_minimum_count	= IVAL(inbody, 0x20);
+	in_channel		= IVAL(inbody, 0x24);
 	in_remaining_bytes	= IVAL(inbody, 0x28);
+	in_channel_info_offset	= SVAL(inbody, 0x2C);
+	in_channel_info_length	= SVAL(inbody, 0x2E);
 
 	/* check the max read size */
 	if (in_length > xconn->smb2.server.max_read) {
@@ -87,6 +110,22 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 		return smbd_smb2_request_error(req, NT_STATUS_INVALID_PARAMETER);
 	}
 
+	status = smbd_smb2_request_verify_channel(req,
+						  in_channel,
+						  in_channel_info_offset,
+						  in_channel_info_length,
+						  &in_channel_info);
+	if (!NT_STATUS_IS_OK(status)) {
+		return smbd_smb2_request_error(req, status);
+	}
+
+	if (in_channel_info.length > 0 &&
+	    in_length > smbd_smbdirect_max_read_write_size(
+			xconn->transport.smbdirect))
+	{
+		return smbd_smb2_request_error(req, NT_STATUS_INVALID_PARAMETER);
+	}
+
 	status = smbd_smb2_request_verify_creditcharge(req, in_length);
 	if (!NT_STATUS_IS_OK(status)) {
 		return smbd_smb2_request_error(req, status);
@@ -97,13 +136,34 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 		return smbd_smb2_request_error(req, NT_STATUS_FILE_CLOSED);
 	}
 
+	if (in_channel_info.length > 0) {
+		subreq = smbd_smb2_read_rdma_send(req, req->sconn->ev_ctx,
+						  req, in_fsp,
+						  in_flags,
+						  in_length,
+						  in_offset,
+						  in_minimum_count,
+						  in_remaining_bytes,
+						  in_channel_info);
+		if (subreq == NULL) {
+			return smbd_smb2_request_error(req,
+						       NT_STATUS_NO_MEMORY);
+		}
+		tevent_req_set_callback(subreq,
+					smbd_smb2_request_read_rdma_done,
+					req);
+
+		return smbd_smb2_request_pending_queue(req, subreq, 500);
+	}
+
 	subreq = smbd_smb2_read_send(req, req->sconn->ev_ctx,
 				     req, in_fsp,
 				     in_flags,
 				     in_length,
 				     in_offset,
 				     in_minimum_count,
-				     in_remaining_bytes);
+				     in_remaining_bytes,
+				     false);
 	if (subreq == NULL) {
 		return smbd_smb2_request_error(req, NT_STATUS_NO_MEMORY);
 	}
@@ -182,6 +242,58 @@ static void smbd_smb2_request_read_done(struct tevent_req *subreq)
 	}
 }
 
+/*
+ * With an RDMA channel the data went straight into the client
+ * memory, the response just tells how much that was.
+ */
+static void smbd_smb2_request_read_rdma_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(subreq,
+					struct smbd_smb2_request);
+	DATA_BLOB outbody;
+	uint32_t out_data_remaining = 0;
+	NTSTATUS status;
+	NTSTATUS error; /* transport error */
+
+	status = smbd_smb2_read_rdma_recv(subreq, &out_data_remaining);
+	TALLOC_FREE(subreq);
+	if (!NT_STATUS_IS_OK(status)) {
+		error = smbd_smb2_request_error(req, status);
+		if (!NT_STATUS_IS_OK(error)) {
+			smbd_server_connection_terminate(req->xconn,
+							 nt_errstr(error));
+			return;
+		}
+		return;
+	}
+
+	outbody = smbd_smb2_generate_outbody(req, 0x10);
+	if (outbody.data == NULL) {
+		error = smbd_smb2_request_error(req, NT_STATUS_NO_MEMORY);
+		if (!NT_STATUS_IS_OK(error)) {
+			smbd_server_connection_terminate(req->xconn,
+							 nt_errstr(error));
+			return;
+		}
+		return;
+	}
+
+	SSVAL(outbody.data, 0x00, 0x10 + 1);	/* struct size */
+	SCVAL(outbody.data, 0x02, 0);		/* data offset */
+	SCVAL(outbody.data, 0x03, 0);		/* reserved */
+	SIVAL(outbody.data, 0x04, 0);		/* data length */
+	SIVAL(outbody.data, 0x08,
+	      out_data_remaining);		/* data remaining */
+	SIVAL(outbody.data, 0x0C, 0);		/* reserved */
+
+	error = smbd_smb2_request_done(req, outbody, NULL);
+	if (!NT_STATUS_IS_OK(error)) {
+		smbd_server_connection_terminate(req->xconn,
+						 nt_errstr(error));
+		return;
+	}
+}
+
 struct smbd_smb2_read_state {
 	struct smbd_smb2_request *smb2req;
 	struct smb_request *smbreq;
@@ -452,7 +564,8 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 					      uint32_t in_length,
 					      uint64_t in_offset,
 					      uint32_t in_minimum,
-					      uint32_t in_remaining)
+					      uint32_t in_remaining,
+					      bool in_rdma)
 {
 	NTSTATUS status;
 	struct tevent_req *req = NULL;
@@ -492,10 +605,31 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 
 	state->fsp = fsp;
 
+	if (in_rdma && in_length > 0) {
+		/*
+		 * Read into memory the RDMA device can
+		 * write to the client from directly.
+		 */
+		uint8_t *buf = smbd_smbdirect_buffer_alloc(
+			state,
+			smb2req->xconn->transport.smbdirect,
+			in_length);
+		if (buf == NULL) {
+			tevent_req_nterror(req,
+				map_nt_error_from_unix_common(errno));
+			return tevent_req_post(req, ev);
+		}
+		state->out_data = data_blob_const(buf, in_length);
+	}
+
 	if (IS_IPC(smbreq->conn)) {
 		struct tevent_req *subreq = NULL;
 
-		state->out_data = data_blob_talloc(state, NULL, in_length);
+		if (state->out_data.data == NULL) {
+			state->out_data = data_blob_talloc(state,
+							   NULL,
+							   in_length);
+		}
 		if (in_length > 0 && tevent_req_nomem(state->out_data.data, req)) {
 			return tevent_req_post(req, ev);
 		}
@@ -561,20 +695,27 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
-	/* Try sendfile in preference. */
-	status = schedule_smb2_sendfile_read(smb2req, state);
-	if (NT_STATUS_IS_OK(status)) {
-		tevent_req_done(req);
-		return tevent_req_post(req, ev);
-	} else {
-		if (!NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
-			tevent_req_nterror(req, status);
+	/*
+	 * Try sendfile in preference, but RDMA reads
+	 * never go over the socket.
+	 */
+	if (!in_rdma) {
+		status = schedule_smb2_sendfile_read(smb2req, state);
+		if (NT_STATUS_IS_OK(status)) {
+			tevent_req_done(req);
 			return tevent_req_post(req, ev);
+		} else {
+			if (!NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+				tevent_req_nterror(req, status);
+				return tevent_req_post(req, ev);
+			}
 		}
 	}
 
 	/* Ok, read into memory. Allocate the out buffer. */
-	state->out_data = data_blob_talloc(state, NULL, in_length);
+	if (state->out_data.data == NULL) {
+		state->out_data = data_blob_talloc(state, NULL, in_length);
+	}
 	if (in_length > 0 && tevent_req_nomem(state->out_data.data, req)) {
 		return tevent_req_post(req, ev);
 	}
@@ -670,3 +811,145 @@ static NTSTATUS smbd_smb2_read_recv(struct tevent_req *req,
 
 	return NT_STATUS_OK;
 }
+
+struct smbd_smb2_read_rdma_state {
+	struct tevent_context *ev;
+	struct smbd_smb2_request *smb2req;
+	DATA_BLOB channel_info;
+	struct tevent_req *read_subreq;
+	DATA_BLOB out_data;
+	uint32_t out_remaining;
+};
+
+static void smbd_smb2_read_rdma_read_done(struct tevent_req *subreq);
+static void smbd_smb2_read_rdma_write_done(struct tevent_req *subreq);
+
+static bool smbd_smb2_read_rdma_cancel(struct tevent_req *req)
+{
+	struct smbd_smb2_read_rdma_state *state =
+		tevent_req_data(req,
+		struct smbd_smb2_read_rdma_state);
+
+	/*
+	 * Once the data is being moved to the client
+	 * it's too late.
+	 */
+	if (state->read_subreq == NULL) {
+		return false;
+	}
+
+	return tevent_req_cancel(state->read_subreq);
+}
+
+static struct tevent_req *smbd_smb2_read_rdma_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_request *smb2req,
+	struct files_struct *in_fsp,
+	uint8_t in_flags,
+	uint32_t in_length,
+	uint64_t in_offset,
+	uint32_t in_minimum,
+	uint32_t in_remaining,
+	DATA_BLOB in_channel_info)
+{
+	struct tevent_req *req = NULL;
+	struct smbd_smb2_read_rdma_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smb2_read_rdma_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->smb2req = smb2req;
+	state->channel_info = in_channel_info;
+
+	subreq = smbd_smb2_read_send(state, ev,
+				     smb2req, in_fsp,
+				     in_flags,
+				     in_length,
+				     in_offset,
+				     in_minimum,
+				     in_remaining,
+				     true);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_read_rdma_read_done, req);
+	state->read_subreq = subreq;
+
+	tevent_req_set_cancel_fn(req, smbd_smb2_read_rdma_cancel);
+	return req;
+}
+
+static void smbd_smb2_read_rdma_read_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(subreq,
+				 struct tevent_req);
+	struct smbd_smb2_read_rdma_state *state = tevent_req_data(req,
+					struct smbd_smb2_read_rdma_state);
+	NTSTATUS status;
+
+	state->read_subreq = NULL;
+	tevent_req_set_cancel_fn(req, NULL);
+
+	status = smbd_smb2_read_recv(subreq,
+				     state,
+				     &state->out_data,
+				     &state->out_remaining);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+
+	subreq = smbd_smbdirect_rdma_write_send(
+		state,
+		state->ev,
+		state->smb2req->xconn->transport.smbdirect,
+		state->channel_info,
+		state->out_data.data,
+		state->out_data.length);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_read_rdma_write_done, req);
+}
+
+static void smbd_smb2_read_rdma_write_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(subreq,
+				 struct tevent_req);
+	NTSTATUS status;
+
+	status = smbd_smbdirect_rdma_write_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static NTSTATUS smbd_smb2_read_rdma_recv(struct tevent_req *req,
+					 uint32_t *out_remaining)
+{
+	struct smbd_smb2_read_rdma_state *state = tevent_req_data(req,
+					struct smbd_smb2_read_rdma_state);
+	NTSTATUS status;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+
+	/*
+	 * [MS-SMB2] 3.3.5.12: DataRemaining is the
+	 * number of bytes written to the client.
+	 */
+	*out_remaining = state->out_data.length;
+
+	tevent_req_received(req);
+	return NT_STATUS_OK;
+}
@@ -24,14 +24,18 @@
 #include "smbd/smbd.h"
 #include "smbd/globals.h"
 #include "smbd/smbXsrv_open.h"
+#include "smbd/smb2_io_uring.h"
 #include "lib/param/param.h"
 #include "../libcli/smb/smb_common.h"
+#include "../libcli/smb/smb2_compression.h"
+#include "lib/compression/lzxpress_huffman.h"
 #include "../lib/tsocket/tsocket.h"
 #include "../lib/util/tevent_ntstatus.h"
 #include "smbprofile.h"
 #include "../lib/util/bitmap.h"
 #include "../librpc/gen_ndr/krb5pac.h"
 #include "lib/util/iov_buf.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 #include "auth.h"
 #include "libcli/smb/smbXcli_base.h"
 #include "source3/lib/substitute.h"
@@ -58,6 +62,8 @@ static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 struct tevent_fd *fde,
 					 uint16_t flags,
 					 void *private_data);
+static void smbd_smb2_io_uring_recv_done(void *private_data, int ret);
+static void smbd_smb2_io_uring_send_done(void *private_data, int ret);
 static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn);
 
 static const struct smbd_smb2_dispatch_table {
@@ -342,6 +348,26 @@ static NTSTATUS smbd_initialize_smb2(struct smbXsrv_connection *xconn,
 	}
 #endif
 
+	if (lp_smb2_io_uring()) {
+		xconn->transport.uring = smbd_smb2_io_uring_create(
+					xconn,
+					xconn->client->raw_ev_ctx,
+					xconn->transport.sock,
+					smbd_smb2_io_uring_recv_done,
+					smbd_smb2_io_uring_send_done,
+					xconn);
+		if (xconn->transport.uring == NULL) {
+			DBG_NOTICE("io_uring not available, "
+				   "polling the socket instead: %s\n",
+				   strerror(errno));
+		} else {
+			/*
+			 * The ring tells us when data arrives.
+			 */
+			TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+		}
+	}
+
 	return NT_STATUS_OK;
 }
 
@@ -372,8 +398,239 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 	return true;
 }
 
+/*
+ * One encryption, decryption or signing of a PDU, done inline or
+ * on the worker pool. The time it takes is accounted to the
+ * connection and to the smb2_encrypt, smb2_decrypt and smb2_sign
+ * profile counters.
+ */
+enum smbd_smb2_crypto_op {
+	SMBD_SMB2_CRYPTO_ENCRYPT,
+	SMBD_SMB2_CRYPTO_DECRYPT,
+	SMBD_SMB2_CRYPTO_SIGN,
+	SMBD_SMB2_CRYPTO_CHECK,
+};
+
+struct smbd_smb2_crypto {
+	enum smbd_smb2_crypto_op op;
+	struct smb2_signing_key *key;
+	struct iovec *vector;
+	int count;
+	size_t len;
+	uint64_t nsec;
+	NTSTATUS status;
+	SMBPROFILE_BYTES_ASYNC_STATE(profile_bytes);
+};
+
+/*
+ * With "smb2 parallel crypto" large responses are encrypted or
+ * signed on the worker pool. Meanwhile we go on with other requests,
+ * so responses may go out in a different order than without it,
+ * which is fine for SMB2. The credits have been granted already.
+ */
+struct smbd_smb2_crypto_job {
+	struct smbd_smb2_request *req;
+	struct smbd_smb2_crypto crypto;
+	bool orphaned;
+};
+
+static void smbd_smb2_crypto_start(struct smbd_smb2_crypto *c,
+				   enum smbd_smb2_crypto_op op,
+				   struct smb2_signing_key *key,
+				   struct iovec *vector,
+				   int count)
+{
+	ssize_t len = iov_buflen(vector, count);
+
+	*c = (struct smbd_smb2_crypto) {
+		.op = op,
+		.key = key,
+		.vector = vector,
+		.count = count,
+		.len = MAX(len, 0),
+		.status = NT_STATUS_INTERNAL_ERROR,
+	};
+
+	switch (op) {
+	case SMBD_SMB2_CRYPTO_ENCRYPT:
+		SMBPROFILE_BYTES_ASYNC_START(smb2_encrypt, profile_p,
+					     c->profile_bytes, c->len);
+		break;
+	case SMBD_SMB2_CRYPTO_DECRYPT:
+		SMBPROFILE_BYTES_ASYNC_START(smb2_decrypt, profile_p,
+					     c->profile_bytes, c->len);
+		break;
+	case SMBD_SMB2_CRYPTO_SIGN:
+	case SMBD_SMB2_CRYPTO_CHECK:
+		SMBPROFILE_BYTES_ASYNC_START(smb2_sign, profile_p,
+					     c->profile_bytes, c->len);
+		break;
+	}
+}
+
+/*
+ * This may run on a worker thread, so it only
+ * uses the functions that don't log.
+ */
+static void smbd_smb2_crypto_run(struct smbd_smb2_crypto *c)
+{
+	struct timespec start_time;
+	struct timespec end_time;
+
+	clock_gettime_mono(&start_time);
+
+	switch (c->op) {
+	case SMBD_SMB2_CRYPTO_ENCRYPT:
+		c->status = smb2_signing_encrypt_pdu_nolog(c->key,
+							   c->vector,
+							   c->count);
+		break;
+	case SMBD_SMB2_CRYPTO_DECRYPT:
+		c->status = smb2_signing_decrypt_pdu_nolog(c->key,
+							   c->vector,
+							   c->count);
+		break;
+	case SMBD_SMB2_CRYPTO_SIGN:
+		c->status = smb2_signing_sign_pdu_nolog(c->key,
+							c->vector,
+							c->count);
+		break;
+	case SMBD_SMB2_CRYPTO_CHECK:
+		/*
+		 * Never offloaded, see smbd_smb2_crypto_can_offload()
+		 */
+		c->status = NT_STATUS_INTERNAL_ERROR;
+		break;
+	}
+
+	clock_gettime_mono(&end_time);
+	c->nsec = nsec_time_diff(&end_time, &start_time);
+}
+
+static void smbd_smb2_crypto_end(struct smbXsrv_connection *xconn,
+				 struct smbd_smb2_crypto *c)
+{
+	struct smbd_smb2_crypto_stats *stats = NULL;
+
+	SMBPROFILE_BYTES_ASYNC_END(c->profile_bytes);
+
+	switch (c->op) {
+	case SMBD_SMB2_CRYPTO_ENCRYPT:
+		stats = &xconn->smb2.crypto.encrypt;
+		break;
+	case SMBD_SMB2_CRYPTO_DECRYPT:
+		stats = &xconn->smb2.crypto.decrypt;
+		break;
+	case SMBD_SMB2_CRYPTO_SIGN:
+	case SMBD_SMB2_CRYPTO_CHECK:
+		stats = &xconn->smb2.crypto.sign;
+		break;
+	}
+
+	stats->count += 1;
+	stats->bytes += c->len;
+	stats->nsec += c->nsec;
+}
+
+static NTSTATUS smbd_smb2_crypto_pdu(struct smbXsrv_connection *xconn,
+				     enum smbd_smb2_crypto_op op,
+				     struct smb2_signing_key *key,
+				     struct iovec *vector,
+				     int count)
+{
+	struct smbd_smb2_crypto c;
+	struct timespec start_time;
+	struct timespec end_time;
+
+	smbd_smb2_crypto_start(&c, op, key, vector, count);
+
+	clock_gettime_mono(&start_time);
+
+	switch (op) {
+	case SMBD_SMB2_CRYPTO_ENCRYPT:
+		c.status = smb2_signing_encrypt_pdu(key, vector, count);
+		break;
+	case SMBD_SMB2_CRYPTO_DECRYPT:
+		c.status = smb2_signing_decrypt_pdu(key, vector, count);
+		break;
+	case SMBD_SMB2_CRYPTO_SIGN:
+		c.status = smb2_signing_sign_pdu(key, vector, count);
+		break;
+	case SMBD_SMB2_CRYPTO_CHECK:
+		c.status = smb2_signing_check_pdu(key, vector, count);
+		break;
+	}
+
+	clock_gettime_mono(&end_time);
+	c.nsec = nsec_time_diff(&end_time, &start_time);
+
+	smbd_smb2_crypto_end(xconn, &c);
+
+	return c.status;
+}
+
+/*
+ * Whether "smb2 parallel crypto" wants this
+ * operation to run on the worker pool.
+ */
+static bool smbd_smb2_crypto_can_offload(struct smbXsrv_connection *xconn,
+					 enum smbd_smb2_crypto_op op,
+					 const struct smb2_signing_key *key,
+					 ssize_t len)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+
+	if (!lp_smb2_parallel_crypto()) {
+		return false;
+	}
+	if (pthreadpool_tevent_max_threads(sconn->pool) == 0) {
+		return false;
+	}
+	if (len < SMBD_SMB2_PARALLEL_CRYPTO_MIN) {
+		return false;
+	}
+	if (!smb2_signing_key_valid(key)) {
+		return false;
+	}
+
+	if (op == SMBD_SMB2_CRYPTO_SIGN) {
+		return true;
+	}
+	if (op == SMBD_SMB2_CRYPTO_CHECK) {
+		return false;
+	}
+
+	/*
+	 * Without gnutls_aead_cipher_encryptv2() the CCM ciphers
+	 * need temporary buffers from talloc, which must not be
+	 * used from a worker thread.
+	 */
+	switch (key->cipher_algo_id) {
+	case SMB2_ENCRYPTION_AES128_GCM:
+	case SMB2_ENCRYPTION_AES256_GCM:
+		return true;
+#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_CCM
+	case SMB2_ENCRYPTION_AES128_CCM:
+	case SMB2_ENCRYPTION_AES256_CCM:
+		return true;
+#endif
+	default:
+		break;
+	}
+
+	return false;
+}
+
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	if (req->crypto_job != NULL) {
+		/*
+		 * A worker still uses our buffers,
+		 * smbd_smb2_crypto_job_done() frees us.
+		 */
+		req->crypto_job->orphaned = true;
+		return -1;
+	}
 	TALLOC_FREE(req->first_enc_key);
 	TALLOC_FREE(req->last_sign_key);
 	return 0;
@@ -425,6 +682,7 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 					       NTTIME now,
 					       uint8_t *buf,
 					       size_t buflen,
+					       bool tf_decrypted,
 					       struct smbd_smb2_request *req,
 					       struct iovec **piov,
 					       int *pnum_iov)
@@ -437,6 +695,7 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 	size_t verified_buflen = 0;
 	uint8_t *tf = NULL;
 	size_t tf_len = 0;
+	bool decompressed = false;
 
 	/*
 	 * Note: index '0' is reserved for the transport protocol
@@ -533,15 +792,78 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			tf_iov[1].iov_base = (void *)hdr;
 			tf_iov[1].iov_len = enc_len;
 
-			status = smb2_signing_decrypt_pdu(s->global->decryption_key,
-							  tf_iov, 2);
+			if (tf_decrypted) {
+				/*
+				 * The leading transform was already
+				 * decrypted on the worker pool, see
+				 * smbd_smb2_decrypt_job_fn().
+				 */
+				tf_decrypted = false;
+			} else {
+				status = smbd_smb2_crypto_pdu(
+					xconn,
+					SMBD_SMB2_CRYPTO_DECRYPT,
+					s->global->decryption_key,
+					tf_iov, 2);
+				if (!NT_STATUS_IS_OK(status)) {
+					TALLOC_FREE(iov_alloc);
+					return status;
+				}
+			}
+
+			verified_buflen = taken + enc_len;
+			len = enc_len;
+		}
+
+		if ((len >= 4) && (IVAL(hdr, 0) == SMB2_COMP_TF_MAGIC)) {
+			uint8_t *dbuf = NULL;
+			size_t dbuf_len = 0;
+			NTSTATUS status;
+
+			if (!xconn->smb2.compression.negotiated) {
+				DEBUG(10, ("Got SMB2_COMPRESSION_TRANSFORM "
+					   "header, but compression was not "
+					   "negotiated\n"));
+				goto inval;
+			}
+
+			/*
+			 * The compressed message needs to cover the
+			 * rest of the (decrypted) PDU and it can't be
+			 * nested.
+			 */
+			if (decompressed || (taken + len != buflen)) {
+				DEBUG(10, ("Got unexpected "
+					   "SMB2_COMPRESSION_TRANSFORM "
+					   "header\n"));
+				goto inval;
+			}
+
+			status = smb2_compression_decompress_pdu(mem_ctx,
+								 hdr,
+								 len,
+								 SMBD_SMB2_MAX_DECOMPRESSED_SIZE,
+								 &dbuf,
+								 &dbuf_len);
 			if (!NT_STATUS_IS_OK(status)) {
+				DBG_INFO("Failed to decompress PDU: %s\n",
+					 nt_errstr(status));
 				TALLOC_FREE(iov_alloc);
 				return status;
 			}
+			decompressed = true;
 
-			verified_buflen = taken + enc_len;
-			len = enc_len;
+			/*
+			 * Continue parsing the decompressed
+			 * buffer, it's still protected
+			 * by the transform header (if any).
+			 */
+			first_hdr = dbuf;
+			hdr = dbuf;
+			buflen = dbuf_len;
+			len = dbuf_len;
+			taken = 0;
+			verified_buflen = (tf != NULL) ? dbuf_len : 0;
 		}
 
 		/*
@@ -707,6 +1029,7 @@ static NTSTATUS smbd_smb2_request_create(struct smbXsrv_connection *xconn,
 						now,
 						inpdu,
 						size,
+						false,
 						req, &req->in.vector,
 						&req->in.vector_count);
 	if (!NT_STATUS_IS_OK(status)) {
@@ -1555,7 +1878,39 @@ void smbXsrv_connection_disconnect_transport(struct smbXsrv_connection *xconn,
 	}
 
 	xconn->transport.status = status;
+
+	if (lp_smb2_parallel_crypto() &&
+	    ((xconn->smb2.crypto.encrypt.count != 0) ||
+	     (xconn->smb2.crypto.decrypt.count != 0) ||
+	     (xconn->smb2.crypto.sign.count != 0)))
+	{
+		DBG_NOTICE("crypto: encrypt %"PRIu64" PDUs %"PRIu64" bytes "
+			   "%"PRIu64" usec, decrypt %"PRIu64" PDUs "
+			   "%"PRIu64" bytes %"PRIu64" usec, "
+			   "sign %"PRIu64" PDUs %"PRIu64" bytes "
+			   "%"PRIu64" usec\n",
+			   xconn->smb2.crypto.encrypt.count,
+			   xconn->smb2.crypto.encrypt.bytes,
+			   xconn->smb2.crypto.encrypt.nsec / 1000,
+			   xconn->smb2.crypto.decrypt.count,
+			   xconn->smb2.crypto.decrypt.bytes,
+			   xconn->smb2.crypto.decrypt.nsec / 1000,
+			   xconn->smb2.crypto.sign.count,
+			   xconn->smb2.crypto.sign.bytes,
+			   xconn->smb2.crypto.sign.nsec / 1000);
+	}
+
+	/*
+	 * The ring waits for its pending I/O to be cancelled,
+	 * so it has to go before the send queue and the socket.
+	 */
+	TALLOC_FREE(xconn->transport.uring);
 	TALLOC_FREE(xconn->transport.fde);
+	/*
+	 * This waits for the device to be done
+	 * with RDMA reads and writes in flight.
+	 */
+	TALLOC_FREE(xconn->transport.smbdirect);
 	if (xconn->transport.sock != -1) {
 		xconn->transport.sock = -1;
 	}
@@ -2017,16 +2372,20 @@ static NTSTATUS smb2_send_async_interim_response(const struct smbd_smb2_request
 	 * we need to sign/encrypt here with the last/first key we remembered
 	 */
 	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
-		status = smb2_signing_encrypt_pdu(req->first_enc_key,
+		status = smbd_smb2_crypto_pdu(xconn,
+					SMBD_SMB2_CRYPTO_ENCRYPT,
+					req->first_enc_key,
 					firsttf,
 					nreq->out.vector_count - first_idx);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
 	} else if (smb2_signing_key_valid(req->last_sign_key)) {
-		status = smb2_signing_sign_pdu(req->last_sign_key,
-					       outhdr_v,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		status = smbd_smb2_crypto_pdu(xconn,
+					      SMBD_SMB2_CRYPTO_SIGN,
+					      req->last_sign_key,
+					      outhdr_v,
+					      SMBD_SMB2_NUM_IOV_PER_REQ - 1);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -2425,7 +2784,9 @@ static void smbd_smb2_request_pending_timer(struct tevent_context *ev,
 		struct smbXsrv_session *x = req->session;
 		struct smb2_signing_key *encryption_key = x->global->encryption_key;
 
-		status = smb2_signing_encrypt_pdu(encryption_key,
+		status = smbd_smb2_crypto_pdu(xconn,
+					SMBD_SMB2_CRYPTO_ENCRYPT,
+					encryption_key,
 					&state->vector[1+SMBD_SMB2_TF_IOV_OFS],
 					SMBD_SMB2_NUM_IOV_PER_REQ);
 		if (!NT_STATUS_IS_OK(status)) {
@@ -2732,6 +3093,73 @@ NTSTATUS smbd_smb2_request_verify_creditcharge(struct smbd_smb2_request *req,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Validate the Channel of an SMB2 READ or WRITE request and return
+ * the SMB_DIRECT_BUFFER_DESCRIPTOR_V1 array for the RDMA transfer,
+ * which is left empty for SMB2_CHANNEL_NONE.
+ */
+NTSTATUS smbd_smb2_request_verify_channel(struct smbd_smb2_request *req,
+					  uint32_t channel,
+					  uint16_t info_offset,
+					  uint16_t info_length,
+					  DATA_BLOB *_info)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	size_t dyn_ofs = SMB2_HDR_BODY + SMBD_SMB2_IN_BODY_LEN(req);
+	size_t dyn_len = SMBD_SMB2_IN_DYN_LEN(req);
+	uint8_t *dyn_ptr = SMBD_SMB2_IN_DYN_PTR(req);
+
+	*_info = data_blob_null;
+
+	switch (channel) {
+	case SMB2_CHANNEL_NONE:
+		return NT_STATUS_OK;
+	case SMB2_CHANNEL_RDMA_V1:
+		if (xconn->protocol < PROTOCOL_SMB3_00) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		break;
+	case SMB2_CHANNEL_RDMA_V1_INVALIDATE:
+		/*
+		 * We don't do remote invalidation, which is fine,
+		 * the client invalidates the memory region itself
+		 * if it isn't invalidated by the server.
+		 */
+		if (xconn->protocol < PROTOCOL_SMB3_02) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		break;
+	default:
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (xconn->transport.smbdirect == NULL) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (req->do_encryption) {
+		/*
+		 * The data would go over the wire unencrypted,
+		 * we don't negotiate RDMA transforms.
+		 */
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	if (info_length == 0 || dyn_ptr == NULL) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (info_offset < dyn_ofs) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	if (info_offset - dyn_ofs + info_length > dyn_len) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	*_info = data_blob_const(dyn_ptr + (info_offset - dyn_ofs),
+				 info_length);
+	return NT_STATUS_OK;
+}
+
 NTSTATUS smbd_smb2_request_verify_sizes(struct smbd_smb2_request *req,
 					size_t expected_body_size)
 {
@@ -3201,9 +3629,11 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 			req->do_signing = true;
 		}
 
-		status = smb2_signing_check_pdu(signing_key,
-						SMBD_SMB2_IN_HDR_IOV(req),
-						SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		status = smbd_smb2_crypto_pdu(xconn,
+					      SMBD_SMB2_CRYPTO_CHECK,
+					      signing_key,
+					      SMBD_SMB2_IN_HDR_IOV(req),
+					      SMBD_SMB2_NUM_IOV_PER_REQ - 1);
 		if (NT_STATUS_EQUAL(status, NT_STATUS_ACCESS_DENIED) &&
 		    opcode == SMB2_OP_SESSSETUP && !has_channel &&
 		    NT_STATUS_IS_OK(session_status))
@@ -3607,13 +4037,124 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+/*
+ * The maximum number of eligible responses we send
+ * uncompressed after compression didn't pay off.
+ */
+#define SMBD_SMB2_COMPRESSION_MAX_BACKOFF 64
+
+static bool smbd_smb2_request_want_compression(struct smbd_smb2_request *req,
+					       size_t len)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	int min_size;
+
+	if (xconn->smb2.compression.send_algo == SMB2_COMPRESSION_NONE) {
+		return false;
+	}
+
+	if (req->tcon == NULL || req->tcon->compat == NULL) {
+		return false;
+	}
+
+	min_size = lp_smb2_compression_min_size(SNUM(req->tcon->compat));
+	if (min_size <= 0 || len < (size_t)min_size) {
+		return false;
+	}
+
+	if (xconn->smb2.compression.skip > 0) {
+		xconn->smb2.compression.skip -= 1;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Try to compress the given part of the response into
+ * *comp_iov. Returns NT_STATUS_COMPRESSION_DISABLED
+ * if the response should go out uncompressed.
+ */
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req,
+					   const struct iovec *vector,
+					   int count,
+					   struct iovec *comp_iov)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	uint8_t *buf = NULL;
+	size_t buflen = 0;
+	ssize_t len;
+	NTSTATUS status;
+
+	len = iov_buflen(vector, count);
+	if (len == -1) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	if (!smbd_smb2_request_want_compression(req, len)) {
+		return NT_STATUS_COMPRESSION_DISABLED;
+	}
+
+	if (xconn->smb2.compression.cmp_mem == NULL) {
+		xconn->smb2.compression.cmp_mem = talloc(
+			xconn, struct lzxhuff_compressor_mem);
+		if (xconn->smb2.compression.cmp_mem == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	status = smb2_compression_compress_pdu(req,
+					       xconn->smb2.compression.cmp_mem,
+					       xconn->smb2.compression.chained,
+					       vector,
+					       count,
+					       &buf,
+					       &buflen);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_COMPRESSION_DISABLED)) {
+		/*
+		 * The payload is not compressible, don't waste
+		 * cpu on the next responses. The backoff doubles
+		 * as long as this repeats.
+		 */
+		xconn->smb2.compression.backoff = MIN(
+			MAX(xconn->smb2.compression.backoff * 2, 1),
+			SMBD_SMB2_COMPRESSION_MAX_BACKOFF);
+		xconn->smb2.compression.skip = xconn->smb2.compression.backoff;
+		DBG_DEBUG("Response of %zd bytes not compressible, "
+			  "skipping the next %"PRIu32" responses\n",
+			  len, xconn->smb2.compression.skip);
+		return status;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	xconn->smb2.compression.backoff = 0;
+
+	DBG_DEBUG("Compressed response from %zd to %zu bytes\n",
+		  len, buflen);
+
+	*comp_iov = (struct iovec) {
+		.iov_base = buf,
+		.iov_len = buflen,
+	};
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_request_reply_crypto(struct smbd_smb2_request *req,
+					       enum smbd_smb2_crypto_op op,
+					       struct smb2_signing_key *key,
+					       struct iovec *vector,
+					       int count);
+static NTSTATUS smbd_smb2_request_reply_finish(struct smbd_smb2_request *req);
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
 	int first_idx = 1;
 	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,first_idx);
 	struct iovec *outhdr = SMBD_SMB2_OUT_HDR_IOV(req);
-	struct iovec *outdyn = SMBD_SMB2_OUT_DYN_IOV(req);
 	NTSTATUS status;
 	bool ok;
 
@@ -3688,9 +4229,11 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		 * compound chain will not change, we can to sign here
 		 * with the last signing key we remembered.
 		 */
-		status = smb2_signing_sign_pdu(req->last_sign_key,
-					       lasthdr,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		status = smbd_smb2_crypto_pdu(xconn,
+					      SMBD_SMB2_CRYPTO_SIGN,
+					      req->last_sign_key,
+					      lasthdr,
+					      SMBD_SMB2_NUM_IOV_PER_REQ - 1);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -3764,30 +4307,196 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	 * now check if we need to sign the current response
 	 */
 	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
-		status = smb2_signing_encrypt_pdu(req->first_enc_key,
-					firsttf,
-					req->out.vector_count - first_idx);
-		if (!NT_STATUS_IS_OK(status)) {
+		struct iovec *enc_vector = firsttf;
+		int enc_count = req->out.vector_count - first_idx;
+
+		/*
+		 * Compression happens before encryption,
+		 * the SMB2_COMPRESSION_TRANSFORM header is
+		 * within the encrypted payload.
+		 */
+		status = smbd_smb2_request_compress(
+			req,
+			firsttf + 1,
+			enc_count - 1,
+			&req->out.compressed_vector[2]);
+		if (NT_STATUS_IS_OK(status)) {
+			req->out.compressed_vector[0] = req->out.vector[0];
+			req->out.compressed_vector[1] = *firsttf;
+			req->out.compressed_count = 3;
+
+			enc_vector = &req->out.compressed_vector[1];
+			enc_count = 2;
+		} else if (!NT_STATUS_EQUAL(status,
+					    NT_STATUS_COMPRESSION_DISABLED)) {
 			return status;
 		}
+
+		return smbd_smb2_request_reply_crypto(req,
+						      SMBD_SMB2_CRYPTO_ENCRYPT,
+						      req->first_enc_key,
+						      enc_vector,
+						      enc_count);
 	} else if (req->do_signing) {
 		struct smbXsrv_session *x = req->session;
 		struct smb2_signing_key *signing_key =
 			smbd_smb2_signing_key(x, xconn, NULL);
 
-		status = smb2_signing_sign_pdu(signing_key,
-					       outhdr,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		return smbd_smb2_request_reply_crypto(req,
+						      SMBD_SMB2_CRYPTO_SIGN,
+						      signing_key,
+						      outhdr,
+						      SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+	}
+
+	return smbd_smb2_request_reply_finish(req);
+}
+
+static void smbd_smb2_crypto_job_fn(void *private_data);
+static void smbd_smb2_crypto_job_done(struct tevent_req *subreq);
+
+static NTSTATUS smbd_smb2_request_reply_crypto(struct smbd_smb2_request *req,
+					       enum smbd_smb2_crypto_op op,
+					       struct smb2_signing_key *key,
+					       struct iovec *vector,
+					       int count)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct smbd_smb2_crypto_job *job = NULL;
+	struct tevent_req *subreq = NULL;
+	ssize_t len = iov_buflen(vector, count);
+	NTSTATUS status;
+
+	/*
+	 * The preauth hash of a session setup or negprot
+	 * response has to be ready for the next request.
+	 */
+	if ((req->preauth != NULL) ||
+	    !smbd_smb2_crypto_can_offload(xconn, op, key, len))
+	{
+		status = smbd_smb2_crypto_pdu(xconn, op, key, vector, count);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
+		return smbd_smb2_request_reply_finish(req);
 	}
-	TALLOC_FREE(req->first_enc_key);
-
-	if (req->preauth != NULL) {
-		gnutls_hash_hd_t hash_hnd = NULL;
-		size_t i;
-		int rc;
+
+	job = talloc_zero(req, struct smbd_smb2_crypto_job);
+	if (job == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	job->req = req;
+
+	if (op == SMBD_SMB2_CRYPTO_SIGN) {
+		/*
+		 * The gnutls hmac handle of the session or channel
+		 * key is not thread safe, req->first_enc_key is
+		 * a private copy already.
+		 */
+		status = smb2_signing_key_copy(job, key, &key);
+		if (!NT_STATUS_IS_OK(status)) {
+			TALLOC_FREE(job);
+			return status;
+		}
+	}
+
+	smbd_smb2_crypto_start(&job->crypto, op, key, vector, count);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(job->crypto.profile_bytes);
+
+	subreq = pthreadpool_tevent_job_send(job,
+					     xconn->client->raw_ev_ctx,
+					     sconn->pool,
+					     smbd_smb2_crypto_job_fn,
+					     job);
+	if (subreq == NULL) {
+		SMBPROFILE_BYTES_ASYNC_END(job->crypto.profile_bytes);
+		TALLOC_FREE(job);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_crypto_job_done, job);
+
+	req->crypto_job = job;
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_crypto_job_fn(void *private_data)
+{
+	struct smbd_smb2_crypto_job *job = talloc_get_type_abort(
+		private_data, struct smbd_smb2_crypto_job);
+
+	SMBPROFILE_BYTES_ASYNC_SET_BUSY(job->crypto.profile_bytes);
+	smbd_smb2_crypto_run(&job->crypto);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(job->crypto.profile_bytes);
+}
+
+static void smbd_smb2_crypto_job_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_crypto_job *job = tevent_req_callback_data(
+		subreq, struct smbd_smb2_crypto_job);
+	struct smbd_smb2_request *req = job->req;
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	req->crypto_job = NULL;
+
+	if (job->orphaned) {
+		/*
+		 * The request was freed while the worker
+		 * was using its buffers, see
+		 * smbd_smb2_request_destructor().
+		 */
+		SMBPROFILE_BYTES_ASYNC_END(job->crypto.profile_bytes);
+		TALLOC_FREE(req);
+		return;
+	}
+
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			job->crypto.status = map_nt_error_from_unix_common(ret);
+		} else {
+			/*
+			 * If we get EAGAIN from pthreadpool_tevent_job_recv()
+			 * this means the lower level pthreadpool failed to
+			 * create a new thread. Fallback to sync processing in
+			 * that case to allow some progress for the client.
+			 */
+			smbd_smb2_crypto_job_fn(job);
+		}
+	}
+
+	smbd_smb2_crypto_end(xconn, &job->crypto);
+	status = job->crypto.status;
+	TALLOC_FREE(job);
+
+	if (NT_STATUS_IS_OK(status)) {
+		status = smbd_smb2_request_reply_finish(req);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+static NTSTATUS smbd_smb2_request_reply_finish(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	int first_idx = 1;
+	int last_idx = req->current_idx - SMBD_SMB2_NUM_IOV_PER_REQ;
+	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,first_idx);
+	struct iovec *outdyn = SMBD_SMB2_IDX_DYN_IOV(req,out,last_idx);
+	NTSTATUS status;
+	bool ok;
+
+	TALLOC_FREE(req->first_enc_key);
+
+	if (req->preauth != NULL) {
+		gnutls_hash_hd_t hash_hnd = NULL;
+		size_t i;
+		int rc;
 
 		rc = gnutls_hash_init(&hash_hnd, GNUTLS_DIG_SHA512);
 		if (rc < 0) {
@@ -3843,6 +4552,24 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		/* Dynamic part is NULL. Chop it off,
 		   We're going to send it via sendfile. */
 		req->out.vector_count -= 1;
+	} else if (firsttf->iov_len == 0) {
+		/*
+		 * Compression happens after signing,
+		 * if there's no encryption.
+		 */
+		status = smbd_smb2_request_compress(
+			req,
+			firsttf,
+			req->out.vector_count - first_idx,
+			&req->out.compressed_vector[2]);
+		if (NT_STATUS_IS_OK(status)) {
+			req->out.compressed_vector[0] = req->out.vector[0];
+			req->out.compressed_vector[1] = *firsttf;
+			req->out.compressed_count = 3;
+		} else if (!NT_STATUS_EQUAL(status,
+					    NT_STATUS_COMPRESSION_DISABLED)) {
+			return status;
+		}
 	}
 
 	/*
@@ -3854,6 +4581,16 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	req->queue_entry.mem_ctx = req;
 	req->queue_entry.vector = req->out.vector;
 	req->queue_entry.count = req->out.vector_count;
+
+	if (req->out.compressed_count != 0) {
+		ok = smb2_setup_nbt_length(req->out.compressed_vector,
+					   req->out.compressed_count);
+		if (!ok) {
+			return NT_STATUS_INVALID_PARAMETER_MIX;
+		}
+		req->queue_entry.vector = req->out.compressed_vector;
+		req->queue_entry.count = req->out.compressed_count;
+	}
 	DLIST_ADD_END(xconn->smb2.send_queue, &req->queue_entry);
 	xconn->smb2.send_queue_len++;
 
@@ -4547,6 +5284,42 @@ static bool is_smb2_recvfile_write(struct smbd_smb2_request_read_state *state)
 	return true;
 }
 
+static NTSTATUS smbd_smb2_request_want_read(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
+	int ret;
+
+	if (xconn->transport.uring == NULL) {
+		TEVENT_FD_READABLE(xconn->transport.fde);
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * The ring owns the receive side of the socket, the fd event
+	 * must not call recvmsg() while an IORING_OP_RECVMSG is
+	 * pending on the same socket.
+	 */
+	TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+
+	if (smbd_smb2_io_uring_recv_pending(xconn->transport.uring)) {
+		return NT_STATUS_OK;
+	}
+
+	state->msg = (struct msghdr) {
+		.msg_iov = state->vector,
+		.msg_iovlen = state->count,
+	};
+
+	ret = smbd_smb2_io_uring_recvmsg(xconn->transport.uring, &state->msg);
+	if (ret != 0) {
+		NTSTATUS status = map_nt_error_from_unix_common(ret);
+		smbXsrv_connection_disconnect_transport(xconn, status);
+		return status;
+	}
+
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn)
 {
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
@@ -4581,6 +5354,14 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->smb2.num_decrypt_jobs >= SMBD_SMB2_PARALLEL_CRYPTO_MAX_JOBS) {
+		/*
+		 * smbd_smb2_decrypt_jobs_run() asks again
+		 * once the oldest one is dispatched.
+		 */
+		return NT_STATUS_OK;
+	}
+
 	/* ask for the next request */
 	req = smbd_smb2_request_allocate(xconn);
 	if (req == NULL) {
@@ -4599,9 +5380,7 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		.count = 1,
 	};
 
-	TEVENT_FD_READABLE(xconn->transport.fde);
-
-	return NT_STATUS_OK;
+	return smbd_smb2_request_want_read(xconn);
 }
 
 NTSTATUS smbd_smb2_process_negprot(struct smbXsrv_connection *xconn,
@@ -4777,6 +5556,16 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->transport.uring != NULL &&
+	    smbd_smb2_io_uring_send_pending(xconn->transport.uring))
+	{
+		/*
+		 * smbd_smb2_io_uring_send_done() will continue
+		 * with the rest of the queue.
+		 */
+		return NT_STATUS_OK;
+	}
+
 	while (xconn->smb2.send_queue != NULL) {
 		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
 		unsigned sendmsg_flags = 0;
@@ -4851,6 +5640,18 @@ static NTSTATUS smbd_smb2_flush_with_sendmsg(struct smbXsrv_connection *xconn)
 			.msg_iovlen = e->count,
 		};
 
+		if (xconn->transport.uring != NULL) {
+			ret = smbd_smb2_io_uring_sendmsg(xconn->transport.uring,
+							 &e->msg);
+			if (ret != 0) {
+				status = map_nt_error_from_unix_common(ret);
+				smbXsrv_connection_disconnect_transport(xconn,
+									status);
+				return status;
+			}
+			return NT_STATUS_OK;
+		}
+
 #ifdef MSG_NOSIGNAL
 		sendmsg_flags |= MSG_NOSIGNAL;
 #endif
@@ -4914,14 +5715,368 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 	return NT_STATUS_OK;
 }
 
-static NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, size_t n)
+static NTSTATUS smbd_smb2_request_process_incoming(
+	struct smbXsrv_connection *xconn,
+	struct smbd_smb2_request *req,
+	uint8_t *pktbuf,
+	size_t pktlen,
+	size_t unread_bytes,
+	bool tf_decrypted)
 {
 	struct smbd_server_connection *sconn = xconn->client->sconn;
+	NTSTATUS status;
+	NTTIME now;
+
+	now = timeval_to_nttime(&req->request_time);
+
+	status = smbd_smb2_inbuf_parse_compound(xconn,
+						now,
+						pktbuf,
+						pktlen,
+						tf_decrypted,
+						req,
+						&req->in.vector,
+						&req->in.vector_count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (unread_bytes > 0) {
+		req->smb1req = talloc_zero(req, struct smb_request);
+		if (req->smb1req == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		req->smb1req->unread_bytes = unread_bytes;
+	}
+
+	req->current_idx = 1;
+
+	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
+		 req->current_idx, req->in.vector_count));
+
+	status = smbd_smb2_request_validate(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_setup_out(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_dispatch(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	sconn->num_requests++;
+
+	/* The timeout_processing function isn't run nearly
+	   often enough to implement 'max log size' without
+	   overrunning the size of the file by many megabytes.
+	   This is especially true if we are running at debug
+	   level 10.  Checking every 50 SMB2s is a nice
+	   tradeoff of performance vs log file size overrun. */
+
+	if ((sconn->num_requests % 50) == 0 &&
+	    need_to_check_log_size()) {
+		change_to_root_user();
+		check_log_size();
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * With "smb2 parallel crypto" large encrypted requests are decrypted
+ * on the worker pool while we go on reading the next ones from the socket.
+ * All requests, decrypted in parallel or not, are dispatched in the order
+ * they arrived, so compound ordering and the credit windows see exactly
+ * what they would see without it.
+ */
+struct smbd_smb2_decrypt_job {
+	struct smbd_smb2_decrypt_job *prev, *next;
+	struct smbXsrv_connection *xconn;
+	struct smbd_smb2_request *req;
+	uint8_t *pktbuf;
+	size_t pktlen;
+	struct iovec tf_iov[2];
+	struct smbd_smb2_crypto crypto;
+	bool busy;
+	bool decrypted;
+};
+
+/*
+ * Returns the session whose key decrypts the PDU if it's worth
+ * doing that on the worker pool, NULL otherwise.
+ */
+static struct smbXsrv_session *smbd_smb2_decrypt_job_session(
+	struct smbXsrv_connection *xconn,
+	const struct smbd_smb2_request_read_state *state)
+{
+	struct smbXsrv_session *session = NULL;
+	const uint8_t *tf = state->pktbuf;
+	NTTIME now;
+	uint64_t uid;
+
+	if (!lp_smb2_parallel_crypto()) {
+		return NULL;
+	}
+	if (state->doing_receivefile) {
+		return NULL;
+	}
+	if (state->pktlen < SMB2_TF_HDR_SIZE) {
+		return NULL;
+	}
+	if (xconn->protocol < PROTOCOL_SMB3_00) {
+		return NULL;
+	}
+	if (IVAL(tf, 0) != SMB2_TF_MAGIC) {
+		return NULL;
+	}
+	if (SMB2_TF_HDR_SIZE + IVAL(tf, SMB2_TF_MSG_SIZE) != state->pktlen) {
+		/*
+		 * Several transforms in one PDU,
+		 * leave that to smbd_smb2_inbuf_parse_compound().
+		 */
+		return NULL;
+	}
+
+	uid = BVAL(tf, SMB2_TF_SESSION_ID);
+	now = timeval_to_nttime(&state->req->request_time);
+
+	/*
+	 * Requests queued before this one, such as a LOGOFF, are only
+	 * processed later, so the session might be gone or expired by
+	 * the time this request is dispatched. Using it here is still
+	 * safe: the job works on its own copy of the decryption key,
+	 * and a session never gets a different key once it has one.
+	 * A session without a key yet is not offloaded. At dispatch
+	 * smbd_smb2_inbuf_parse_compound() looks the session up again
+	 * by the id in the (authenticated) transform header and fails
+	 * the request as usual if it's no longer valid.
+	 *
+	 * Errors are left to smbd_smb2_inbuf_parse_compound()
+	 */
+	(void)smb2srv_session_lookup_conn(xconn, uid, now, &session);
+	if (session == NULL) {
+		return NULL;
+	}
+
+	if (!smbd_smb2_crypto_can_offload(xconn,
+					  SMBD_SMB2_CRYPTO_DECRYPT,
+					  session->global->decryption_key,
+					  state->pktlen - SMB2_TF_HDR_SIZE))
+	{
+		return NULL;
+	}
+
+	return session;
+}
+
+static void smbd_smb2_decrypt_job_fn(void *private_data);
+static void smbd_smb2_decrypt_job_done(struct tevent_req *subreq);
+
+static int smbd_smb2_decrypt_job_destructor(struct smbd_smb2_decrypt_job *job)
+{
+	/*
+	 * The worker still uses the buffer and the key,
+	 * smbd_smb2_decrypt_job_done() frees us.
+	 */
+	job->xconn = NULL;
+	return -1;
+}
+
+static NTSTATUS smbd_smb2_decrypt_job_queue(struct smbXsrv_connection *xconn,
+					    struct smbd_smb2_request *req,
+					    uint8_t *pktbuf,
+					    size_t pktlen,
+					    struct smbXsrv_session *session)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct smbd_smb2_decrypt_job *job = NULL;
+	struct smb2_signing_key *key = NULL;
+	struct tevent_req *subreq = NULL;
+	NTSTATUS status;
+
+	job = talloc_zero(xconn, struct smbd_smb2_decrypt_job);
+	if (job == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	job->xconn = xconn;
+	job->req = talloc_steal(job, req);
+	job->pktbuf = pktbuf;
+	job->pktlen = pktlen;
+	job->crypto.status = NT_STATUS_OK;
+
+	DLIST_ADD_END(xconn->smb2.decrypt_jobs, job);
+	xconn->smb2.num_decrypt_jobs += 1;
+
+	if (session == NULL) {
+		/*
+		 * Just waiting for its turn
+		 */
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * The gnutls cipher handle of the session key is not
+	 * thread safe, each job gets its own.
+	 */
+	status = smb2_signing_key_copy(job,
+				       session->global->decryption_key,
+				       &key);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	job->tf_iov[0] = (struct iovec) {
+		.iov_base = pktbuf,
+		.iov_len = SMB2_TF_HDR_SIZE,
+	};
+	job->tf_iov[1] = (struct iovec) {
+		.iov_base = pktbuf + SMB2_TF_HDR_SIZE,
+		.iov_len = pktlen - SMB2_TF_HDR_SIZE,
+	};
+
+	smbd_smb2_crypto_start(&job->crypto,
+			       SMBD_SMB2_CRYPTO_DECRYPT,
+			       key,
+			       job->tf_iov,
+			       2);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(job->crypto.profile_bytes);
+
+	subreq = pthreadpool_tevent_job_send(job,
+					     xconn->client->raw_ev_ctx,
+					     sconn->pool,
+					     smbd_smb2_decrypt_job_fn,
+					     job);
+	if (subreq == NULL) {
+		SMBPROFILE_BYTES_ASYNC_END(job->crypto.profile_bytes);
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_decrypt_job_done, job);
+
+	job->busy = true;
+	job->decrypted = true;
+	talloc_set_destructor(job, smbd_smb2_decrypt_job_destructor);
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_decrypt_job_fn(void *private_data)
+{
+	struct smbd_smb2_decrypt_job *job = talloc_get_type_abort(
+		private_data, struct smbd_smb2_decrypt_job);
+
+	SMBPROFILE_BYTES_ASYNC_SET_BUSY(job->crypto.profile_bytes);
+	smbd_smb2_crypto_run(&job->crypto);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(job->crypto.profile_bytes);
+}
+
+static NTSTATUS smbd_smb2_decrypt_jobs_run(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_decrypt_job *job = NULL;
+	NTSTATUS status;
+
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		return NT_STATUS_OK;
+	}
+
+	while ((job = xconn->smb2.decrypt_jobs) != NULL) {
+		struct smbd_smb2_request *req = NULL;
+		uint8_t *pktbuf = job->pktbuf;
+		size_t pktlen = job->pktlen;
+		bool tf_decrypted = job->decrypted;
+
+		if (job->busy) {
+			break;
+		}
+
+		DLIST_REMOVE(xconn->smb2.decrypt_jobs, job);
+		xconn->smb2.num_decrypt_jobs -= 1;
+
+		req = talloc_steal(xconn, job->req);
+		status = job->crypto.status;
+		TALLOC_FREE(job);
+
+		if (!NT_STATUS_IS_OK(status)) {
+			TALLOC_FREE(req);
+			return status;
+		}
+
+		status = smbd_smb2_request_process_incoming(xconn,
+							    req,
+							    pktbuf,
+							    pktlen,
+							    0,
+							    tf_decrypted);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return smbd_smb2_request_next_incoming(xconn);
+}
+
+static void smbd_smb2_decrypt_job_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_decrypt_job *job = tevent_req_callback_data(
+		subreq, struct smbd_smb2_decrypt_job);
+	struct smbXsrv_connection *xconn = job->xconn;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(job, NULL);
+	job->busy = false;
+
+	if (xconn == NULL) {
+		/*
+		 * The connection is gone
+		 */
+		SMBPROFILE_BYTES_ASYNC_END(job->crypto.profile_bytes);
+		TALLOC_FREE(job);
+		return;
+	}
+
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			job->crypto.status = map_nt_error_from_unix_common(ret);
+		} else {
+			/*
+			 * If we get EAGAIN from pthreadpool_tevent_job_recv()
+			 * this means the lower level pthreadpool failed to
+			 * create a new thread. Fallback to sync processing in
+			 * that case to allow some progress for the client.
+			 */
+			smbd_smb2_decrypt_job_fn(job);
+		}
+	}
+
+	smbd_smb2_crypto_end(xconn, &job->crypto);
+
+	status = smbd_smb2_decrypt_jobs_run(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+static NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, size_t n)
+{
 	struct smbd_smb2_request_read_state *state = &xconn->smb2.request_read_state;
 	struct smbd_smb2_request *req = NULL;
 	size_t min_recvfile_size = UINT32_MAX;
+	struct smbXsrv_session *session = NULL;
+	uint8_t *pktbuf = NULL;
+	size_t pktlen;
+	size_t unread_bytes = 0;
 	NTSTATUS status;
-	NTTIME now;
 	bool ok;
 
 	ok = iov_advance(&state->vector, &state->count, n);
@@ -4987,6 +6142,24 @@ static NTSTATUS smbd_smb2_advance_incoming(struct smbXsrv_connection *xconn, siz
 		goto got_full;
 	}
 
+	if (xconn->transport.uring != NULL) {
+		/*
+		 * A receivefile write reads the rest of the PDU
+		 * from the socket directly, which doesn't mix with
+		 * a recvmsg that is already queued in the ring.
+		 */
+		state->min_recv_size = 0;
+	}
+
+	if (xconn->smb2.decrypt_jobs != NULL) {
+		/*
+		 * A receivefile write would have to be dispatched
+		 * before we read the next PDU from the socket,
+		 * but it has to wait for the requests in front of it.
+		 */
+		state->min_recv_size = 0;
+	}
+
 	if (state->min_recv_size != 0) {
 		min_recvfile_size = SMBD_SMB2_SHORT_RECEIVEFILE_WRITE_LEN;
 		min_recvfile_size += state->min_recv_size;
@@ -5044,68 +6217,48 @@ got_full:
 	}
 
 	req = state->req;
+	pktbuf = state->pktbuf;
+	pktlen = state->pktlen;
+	if (state->doing_receivefile) {
+		unread_bytes = state->pktfull - state->pktlen;
+	}
 
 	req->request_time = timeval_current();
-	now = timeval_to_nttime(&req->request_time);
-
-	status = smbd_smb2_inbuf_parse_compound(xconn,
-						now,
-						state->pktbuf,
-						state->pktlen,
-						req,
-						&req->in.vector,
-						&req->in.vector_count);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
 
-	if (state->doing_receivefile) {
-		req->smb1req = talloc_zero(req, struct smb_request);
-		if (req->smb1req == NULL) {
-			return NT_STATUS_NO_MEMORY;
+	session = smbd_smb2_decrypt_job_session(xconn, state);
+	if (session != NULL || xconn->smb2.decrypt_jobs != NULL) {
+		/*
+		 * Either this request gets decrypted on the worker
+		 * pool or it has to wait for the ones that are.
+		 */
+		status = smbd_smb2_decrypt_job_queue(xconn, req,
+						     pktbuf, pktlen,
+						     session);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
 		}
-		req->smb1req->unread_bytes = state->pktfull - state->pktlen;
+
+		*state = (struct smbd_smb2_request_read_state) {
+			.req = NULL,
+		};
+
+		return smbd_smb2_request_next_incoming(xconn);
 	}
 
 	*state = (struct smbd_smb2_request_read_state) {
 		.req = NULL,
 	};
 
-	req->current_idx = 1;
-
-	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
-		 req->current_idx, req->in.vector_count));
-
-	status = smbd_smb2_request_validate(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
-	status = smbd_smb2_request_setup_out(req);
+	status = smbd_smb2_request_process_incoming(xconn,
+						    req,
+						    pktbuf,
+						    pktlen,
+						    unread_bytes,
+						    false);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
 	}
 
-	status = smbd_smb2_request_dispatch(req);
-	if (!NT_STATUS_IS_OK(status)) {
-		return status;
-	}
-
-	sconn->num_requests++;
-
-	/* The timeout_processing function isn't run nearly
-	   often enough to implement 'max log size' without
-	   overrunning the size of the file by many megabytes.
-	   This is especially true if we are running at debug
-	   level 10.  Checking every 50 SMB2s is a nice
-	   tradeoff of performance vs log file size overrun. */
-
-	if ((sconn->num_requests % 50) == 0 &&
-	    need_to_check_log_size()) {
-		change_to_root_user();
-		check_log_size();
-	}
-
 	status = smbd_smb2_request_next_incoming(xconn);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
@@ -5144,6 +6297,15 @@ static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->transport.uring != NULL) {
+		/*
+		 * See smbd_smb2_request_want_read(), reads go
+		 * through the ring.
+		 */
+		TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+		return NT_STATUS_OK;
+	}
+
 	if (state->req == NULL) {
 		TEVENT_FD_NOT_READABLE(xconn->transport.fde);
 		return NT_STATUS_OK;
@@ -5204,6 +6366,138 @@ again:
 	return NT_STATUS_OK;
 }
 
+static NTSTATUS smbd_smb2_io_uring_received(struct smbXsrv_connection *xconn,
+					    int ret)
+{
+	int err;
+	bool retry;
+	NTSTATUS status;
+
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (ret == 0) {
+		/* propagate end of file */
+		status = NT_STATUS_END_OF_FILE;
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+	if (ret < 0) {
+		errno = -ret;
+		ret = -1;
+	}
+	err = socket_error_from_errno(ret, errno, &retry);
+	if (retry) {
+		/* retry later */
+		return smbd_smb2_request_want_read(xconn);
+	}
+	if (err != 0) {
+		status = map_nt_error_from_unix_common(err);
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+
+	status = smbd_smb2_advance_incoming(xconn, ret);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_PENDING) ||
+	    NT_STATUS_EQUAL(status, NT_STATUS_RETRY))
+	{
+		/* we have more to read */
+		return smbd_smb2_request_want_read(xconn);
+	}
+
+	return status;
+}
+
+static void smbd_smb2_io_uring_recv_done(void *private_data, int ret)
+{
+	struct smbXsrv_connection *xconn =
+		talloc_get_type_abort(private_data,
+		struct smbXsrv_connection);
+	NTSTATUS status;
+
+	status = smbd_smb2_io_uring_received(xconn, ret);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
+static NTSTATUS smbd_smb2_io_uring_sent(struct smbXsrv_connection *xconn,
+					int ret)
+{
+	struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
+	int err;
+	bool retry;
+	NTSTATUS status;
+
+	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
+		/*
+		 * we're not supposed to do any io
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (e == NULL) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	if (ret == 0) {
+		/* propagate end of file */
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+	if (ret < 0) {
+		errno = -ret;
+		ret = -1;
+	}
+	err = socket_error_from_errno(ret, errno, &retry);
+	if (retry) {
+		/* retry now, the ring waits for the socket */
+		return smbd_smb2_flush_send_queue(xconn);
+	}
+	if (err != 0) {
+		status = map_nt_error_from_unix_common(err);
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+
+	status = smbd_smb2_advance_send_queue(xconn, &e, ret);
+	if (!NT_STATUS_IS_OK(status) &&
+	    !NT_STATUS_EQUAL(status, NT_STATUS_RETRY))
+	{
+		smbXsrv_connection_disconnect_transport(xconn,
+							status);
+		return status;
+	}
+
+	/*
+	 * Send the rest of e (for NT_STATUS_RETRY) or the next
+	 * entry in the queue, or restart reading if we were
+	 * waiting for the queue to drain.
+	 */
+	return smbd_smb2_flush_send_queue(xconn);
+}
+
+static void smbd_smb2_io_uring_send_done(void *private_data, int ret)
+{
+	struct smbXsrv_connection *xconn =
+		talloc_get_type_abort(private_data,
+		struct smbXsrv_connection);
+	NTSTATUS status;
+
+	status = smbd_smb2_io_uring_sent(xconn, ret);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 struct tevent_fd *fde,
 					 uint16_t flags,
@@ -0,0 +1,2301 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB Direct (RDMA) transport for the SMB2 server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/network.h"
+#include "../lib/tsocket/tsocket.h"
+#include "../lib/util/tevent_ntstatus.h"
+#include "lib/util/dlinklist.h"
+#include "lib/util/util_net.h"
+#include "smbd/smb2_smbdirect.h"
+
+#ifdef HAVE_SMBDIRECT
+
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+
+/*
+ * [MS-SMBD] 2.2 Message Syntax
+ */
+#define SMB_DIRECT_VERSION_1			0x0100
+#define SMB_DIRECT_NEGOTIATE_REQUEST_SIZE	0x14
+#define SMB_DIRECT_NEGOTIATE_RESPONSE_SIZE	0x20
+#define SMB_DIRECT_DATA_MIN_SIZE		0x14
+#define SMB_DIRECT_DATA_OFFSET			0x18
+#define SMB_DIRECT_RESPONSE_REQUESTED		0x0001
+#define SMB_DIRECT_BUFFER_DESCRIPTOR_V1_SIZE	0x10
+
+/*
+ * Our side of the negotiation, these are the defaults
+ * from [MS-SMBD] 3.1.1.1.
+ */
+#define SMBD_SMBDIRECT_RECV_CREDIT_MAX		255
+#define SMBD_SMBDIRECT_SEND_CREDIT_MAX		255
+#define SMBD_SMBDIRECT_MAX_SEND_SIZE		1364
+#define SMBD_SMBDIRECT_MAX_RECEIVE_SIZE		8192
+#define SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE	(1024*1024)
+#define SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE	(1024*1024)
+
+/*
+ * Limits of our own: RDMA work requests in flight, buffer descriptors
+ * per SMB2 READ or WRITE, bytes queued for smbd before we stop reposting
+ * receives (which makes the client run out of credits) and registered
+ * buffers we keep for reuse.
+ */
+#define SMBD_SMBDIRECT_MAX_RDMA_WRS		64
+#define SMBD_SMBDIRECT_MAX_DESCRIPTORS		16
+#define SMBD_SMBDIRECT_DELIVER_MAX		(4*1024*1024)
+#define SMBD_SMBDIRECT_NUM_FREE_BUFFERS		8
+#define SMBD_SMBDIRECT_NEGOTIATE_TIMEOUT	120
+#define SMBD_SMBDIRECT_LISTEN_BACKLOG		10
+
+/*
+ * The wr_id of every work request points to one of these,
+ * so the completion handler knows what completed.
+ */
+enum smbd_smbdirect_wr_type {
+	SMBD_SMBDIRECT_WR_RECV,
+	SMBD_SMBDIRECT_WR_SEND,
+	SMBD_SMBDIRECT_WR_RDMA,
+};
+
+struct smbd_smbdirect_recv_io {
+	enum smbd_smbdirect_wr_type type;
+	struct smbd_smbdirect_recv_io *prev, *next;
+	uint8_t *buf;
+};
+
+struct smbd_smbdirect_send_io {
+	enum smbd_smbdirect_wr_type type;
+	struct smbd_smbdirect_send_io *prev, *next;
+	uint8_t *buf;
+};
+
+struct smbd_smbdirect_rdma_state;
+
+struct smbd_smbdirect_rdma_seg {
+	enum smbd_smbdirect_wr_type type;
+	struct smbd_smbdirect_rdma_state *state;
+	uint64_t remote_addr;
+	uint32_t rkey;
+	uint32_t length;
+	size_t local_ofs;
+};
+
+/*
+ * A reassembled PDU on its way to smbd, with the 4 byte length header.
+ */
+struct smbd_smbdirect_deliver {
+	struct smbd_smbdirect_deliver *prev, *next;
+	uint8_t *buf;
+	size_t len;
+	size_t ofs;
+};
+
+struct smbd_smbdirect_buffer {
+	struct smbd_smbdirect_buffer *prev, *next;
+	struct smbd_smbdirect_connection *conn;
+	bool in_use;
+	uint8_t *data;
+	size_t size;
+	struct ibv_mr *mr;
+};
+
+enum smbd_smbdirect_state {
+	SMBD_SMBDIRECT_ACCEPTING,
+	SMBD_SMBDIRECT_CONNECTED,
+	SMBD_SMBDIRECT_DISCONNECTED,
+};
+
+struct smbd_smbdirect_connection {
+	struct tevent_context *ev;
+	enum smbd_smbdirect_state state;
+	bool negotiated;
+	bool negotiate_failed;
+	bool claimed;
+
+	struct rdma_event_channel *cm_channel;
+	struct rdma_cm_id *cm_id;
+	struct tevent_fd *cm_fde;
+	struct ibv_pd *pd;
+	struct ibv_comp_channel *comp_channel;
+	struct ibv_cq *cq;
+	struct tevent_fd *cq_fde;
+	struct tevent_timer *negotiate_te;
+	uint8_t initiator_depth;
+	uint8_t responder_resources;
+
+	struct tsocket_address *local_address;
+	struct tsocket_address *remote_address;
+
+	/*
+	 * Our end of the socketpair, smbd_sock is the one
+	 * smbd_process() reads requests from.
+	 */
+	int sock;
+	int smbd_sock;
+	struct tevent_fd *sock_fde;
+
+	uint32_t max_send_size;
+	uint32_t peer_max_fragmented_size;
+
+	struct {
+		uint8_t *bufs;
+		struct ibv_mr *mr;
+		struct smbd_smbdirect_recv_io ios[SMBD_SMBDIRECT_RECV_CREDIT_MAX];
+		struct smbd_smbdirect_recv_io *deferred;
+		/* receives posted */
+		uint16_t posted;
+		/* credits the peer holds */
+		uint16_t granted;
+		/* credits the peer asks for */
+		uint16_t target;
+		/* the PDU being reassembled */
+		struct smbd_smbdirect_deliver *msg;
+	} recv;
+
+	struct {
+		uint8_t *bufs;
+		struct ibv_mr *mr;
+		struct smbd_smbdirect_send_io ios[SMBD_SMBDIRECT_SEND_CREDIT_MAX];
+		struct smbd_smbdirect_send_io *free;
+		uint16_t inflight;
+		uint16_t credits;
+		bool response_requested;
+		/* the PDU from smbd being read and fragmented */
+		uint8_t hdr[4];
+		size_t hdr_ofs;
+		uint8_t *msg;
+		size_t msg_len;
+		size_t msg_ofs;
+		size_t sent_ofs;
+	} send;
+
+	struct {
+		struct smbd_smbdirect_deliver *queue;
+		size_t queued;
+	} deliver;
+
+	struct {
+		struct smbd_smbdirect_rdma_state *queue;
+		uint16_t wrs_inflight;
+		uint16_t reads_inflight;
+	} rdma;
+
+	struct {
+		struct smbd_smbdirect_buffer *free;
+		struct smbd_smbdirect_buffer *used;
+		size_t num_free;
+	} buffers;
+};
+
+/*
+ * There is at most one SMB Direct connection per smbd process,
+ * connections over RDMA are never passed to another process.
+ */
+static struct smbd_smbdirect_connection *smbd_smbdirect_conn;
+
+struct smbd_smbdirect_rdma_state {
+	struct smbd_smbdirect_rdma_state *prev, *next;
+	struct tevent_req *req;
+	struct smbd_smbdirect_connection *conn;
+	enum ibv_wr_opcode opcode;
+	uint8_t *data;
+	uint32_t lkey;
+	struct ibv_mr *tmp_mr;
+	struct smbd_smbdirect_rdma_seg *segs;
+	size_t num_segs;
+	size_t next_seg;
+	size_t num_pending;
+	NTSTATUS status;
+};
+
+static void smbd_smbdirect_connection_disconnect(
+	struct smbd_smbdirect_connection *conn,
+	NTSTATUS status);
+static void smbd_smbdirect_send_pending(struct smbd_smbdirect_connection *conn);
+static void smbd_smbdirect_rdma_pump(struct smbd_smbdirect_connection *conn);
+static void smbd_smbdirect_rdma_maybe_done(
+	struct smbd_smbdirect_rdma_state *state);
+
+/*
+ * The listener
+ */
+
+struct smbd_smbdirect_listener {
+	struct tevent_context *ev;
+	pid_t pid;
+	struct rdma_event_channel *channel;
+	struct rdma_cm_id *cm_id;
+	struct tevent_fd *fde;
+	struct tevent_fd *wait_fde;
+	smbd_smbdirect_listener_fn fn;
+	void *private_data;
+};
+
+static int smbd_smbdirect_listener_destructor(
+	struct smbd_smbdirect_listener *l)
+{
+	TALLOC_FREE(l->wait_fde);
+	TALLOC_FREE(l->fde);
+
+	if (l->pid != getpid()) {
+		/*
+		 * A forked child must not destroy the listening
+		 * id, the kernel object belongs to the parent as
+		 * well. Just drop our reference to it.
+		 */
+		close(l->channel->fd);
+		return 0;
+	}
+
+	if (l->cm_id != NULL) {
+		rdma_destroy_id(l->cm_id);
+	}
+	rdma_destroy_event_channel(l->channel);
+	return 0;
+}
+
+static void smbd_smbdirect_listener_handler(struct tevent_context *ev,
+					    struct tevent_fd *fde,
+					    uint16_t flags,
+					    void *private_data)
+{
+	struct smbd_smbdirect_listener *l = talloc_get_type_abort(
+		private_data, struct smbd_smbdirect_listener);
+
+	l->fn(l, l->private_data);
+}
+
+/*
+ * We fork a child for every connection while the parent keeps its
+ * verbs resources. Unless the kernel does copy-on-fork for pinned
+ * memory itself, libibverbs has to mark that memory as not to be
+ * inherited, and it only does so if ibv_fork_init() ran before the
+ * first resource was created.
+ */
+static int smbd_smbdirect_fork_init(void)
+{
+	static bool initialized;
+	int ret;
+
+	if (initialized) {
+		return 0;
+	}
+
+	ret = ibv_fork_init();
+	if (ret != 0) {
+		return ret;
+	}
+
+	initialized = true;
+	return 0;
+}
+
+struct smbd_smbdirect_listener *smbd_smbdirect_listener_create(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	const struct sockaddr_storage *addr,
+	uint16_t port,
+	smbd_smbdirect_listener_fn fn,
+	void *private_data)
+{
+	struct smbd_smbdirect_listener *l = NULL;
+	struct sockaddr_storage ss = *addr;
+	int ret;
+
+	ret = smbd_smbdirect_fork_init();
+	if (ret != 0) {
+		errno = ret;
+		return NULL;
+	}
+
+	l = talloc_zero(mem_ctx, struct smbd_smbdirect_listener);
+	if (l == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	l->ev = ev;
+	l->pid = getpid();
+	l->fn = fn;
+	l->private_data = private_data;
+
+	l->channel = rdma_create_event_channel();
+	if (l->channel == NULL) {
+		int saved_errno = errno;
+		TALLOC_FREE(l);
+		errno = saved_errno;
+		return NULL;
+	}
+	talloc_set_destructor(l, smbd_smbdirect_listener_destructor);
+
+	/*
+	 * Children read the connection request from this fd,
+	 * it must not block if there is nothing there.
+	 */
+	set_blocking(l->channel->fd, false);
+	smb_set_close_on_exec(l->channel->fd);
+
+	ret = rdma_create_id(l->channel, &l->cm_id, l, RDMA_PS_TCP);
+	if (ret != 0) {
+		int saved_errno = errno;
+		l->cm_id = NULL;
+		TALLOC_FREE(l);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	set_sockaddr_port((struct sockaddr *)(void *)&ss, port);
+
+	ret = rdma_bind_addr(l->cm_id, (struct sockaddr *)(void *)&ss);
+	if (ret != 0) {
+		int saved_errno = errno;
+		TALLOC_FREE(l);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	ret = rdma_listen(l->cm_id, SMBD_SMBDIRECT_LISTEN_BACKLOG);
+	if (ret != 0) {
+		int saved_errno = errno;
+		TALLOC_FREE(l);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	l->fde = tevent_add_fd(ev,
+			       l,
+			       l->channel->fd,
+			       TEVENT_FD_READ,
+			       smbd_smbdirect_listener_handler,
+			       l);
+	if (l->fde == NULL) {
+		TALLOC_FREE(l);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return l;
+}
+
+static void smbd_smbdirect_listener_wait_handler(struct tevent_context *ev,
+						 struct tevent_fd *fde,
+						 uint16_t flags,
+						 void *private_data)
+{
+	struct smbd_smbdirect_listener *l = talloc_get_type_abort(
+		private_data, struct smbd_smbdirect_listener);
+	char c;
+	ssize_t n;
+
+	n = read(tevent_fd_get_fd(fde), &c, sizeof(c));
+	if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	}
+
+	/*
+	 * The child has taken the connection request
+	 * (or died trying), look for the next one.
+	 */
+	TALLOC_FREE(l->wait_fde);
+	TEVENT_FD_READABLE(l->fde);
+}
+
+void smbd_smbdirect_listener_wait(struct smbd_smbdirect_listener *listener,
+				  int fd)
+{
+	TALLOC_FREE(listener->wait_fde);
+
+	listener->wait_fde = tevent_add_fd(listener->ev,
+					   listener,
+					   fd,
+					   TEVENT_FD_READ,
+					   smbd_smbdirect_listener_wait_handler,
+					   listener);
+	if (listener->wait_fde == NULL) {
+		/*
+		 * We can't tell when the child is done,
+		 * so we just keep going.
+		 */
+		close(fd);
+		return;
+	}
+	tevent_fd_set_auto_close(listener->wait_fde);
+
+	TEVENT_FD_NOT_READABLE(listener->fde);
+}
+
+static int smbd_smbdirect_listener_get_request(
+	struct smbd_smbdirect_listener *l,
+	struct rdma_cm_id **_cm_id,
+	struct rdma_conn_param *_param)
+{
+	struct rdma_cm_event *event = NULL;
+	int ret;
+
+	ret = rdma_get_cm_event(l->channel, &event);
+	if (ret != 0) {
+		return errno;
+	}
+
+	if (event->event != RDMA_CM_EVENT_CONNECT_REQUEST) {
+		DBG_NOTICE("Ignoring %s on the listener\n",
+			   rdma_event_str(event->event));
+		rdma_ack_cm_event(event);
+		return EAGAIN;
+	}
+
+	*_cm_id = event->id;
+	*_param = event->param.conn;
+	_param->private_data = NULL;
+	_param->private_data_len = 0;
+
+	/*
+	 * rdma_migrate_id() waits for all events
+	 * of the id to be acknowledged.
+	 */
+	rdma_ack_cm_event(event);
+	return 0;
+}
+
+void smbd_smbdirect_listener_reject(struct smbd_smbdirect_listener *listener)
+{
+	struct rdma_cm_id *cm_id = NULL;
+	struct rdma_conn_param param;
+	int ret;
+
+	ret = smbd_smbdirect_listener_get_request(listener, &cm_id, &param);
+	if (ret != 0) {
+		return;
+	}
+
+	rdma_reject(cm_id, NULL, 0);
+	rdma_destroy_id(cm_id);
+}
+
+/*
+ * Registered buffers
+ */
+
+static struct smbd_smbdirect_buffer *smbd_smbdirect_buffer_find(
+	struct smbd_smbdirect_connection *conn,
+	const uint8_t *data,
+	size_t length)
+{
+	struct smbd_smbdirect_buffer *buf = NULL;
+
+	for (buf = conn->buffers.used; buf != NULL; buf = buf->next) {
+		if (data < buf->data) {
+			continue;
+		}
+		if (data + length > buf->data + buf->size) {
+			continue;
+		}
+		return buf;
+	}
+
+	return NULL;
+}
+
+static int smbd_smbdirect_buffer_destructor(struct smbd_smbdirect_buffer *buf)
+{
+	struct smbd_smbdirect_connection *conn = buf->conn;
+
+	if (conn != NULL) {
+		if (buf->in_use) {
+			DLIST_REMOVE(conn->buffers.used, buf);
+		} else {
+			DLIST_REMOVE(conn->buffers.free, buf);
+			conn->buffers.num_free -= 1;
+		}
+	}
+	if (buf->mr != NULL) {
+		ibv_dereg_mr(buf->mr);
+		buf->mr = NULL;
+	}
+	return 0;
+}
+
+/*
+ * Destructor of the data handed out by smbd_smbdirect_buffer_alloc(),
+ * it keeps the memory registered for the next SMB2 READ or WRITE.
+ */
+static int smbd_smbdirect_buffer_data_destructor(uint8_t *data)
+{
+	struct smbd_smbdirect_connection *conn = smbd_smbdirect_conn;
+	struct smbd_smbdirect_buffer *buf = NULL;
+
+	if (conn == NULL) {
+		return 0;
+	}
+	if (conn->state == SMBD_SMBDIRECT_DISCONNECTED) {
+		return 0;
+	}
+	if (conn->buffers.num_free >= SMBD_SMBDIRECT_NUM_FREE_BUFFERS) {
+		return 0;
+	}
+
+	buf = smbd_smbdirect_buffer_find(conn, data, 0);
+	if (buf == NULL || buf->data != data) {
+		return 0;
+	}
+
+	DLIST_REMOVE(conn->buffers.used, buf);
+	buf->in_use = false;
+	DLIST_ADD(conn->buffers.free, buf);
+	conn->buffers.num_free += 1;
+
+	/*
+	 * talloc copes with destructors moving the chunk
+	 * somewhere else and refusing to be freed.
+	 */
+	talloc_set_destructor(data, NULL);
+	talloc_steal(conn, data);
+	return -1;
+}
+
+uint8_t *smbd_smbdirect_buffer_alloc(TALLOC_CTX *mem_ctx,
+				     struct smbd_smbdirect_connection *conn,
+				     size_t size)
+{
+	struct smbd_smbdirect_buffer *buf = NULL;
+
+	if (size > SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	buf = conn->buffers.free;
+	if (buf != NULL) {
+		DLIST_REMOVE(conn->buffers.free, buf);
+		conn->buffers.num_free -= 1;
+	} else {
+		uint8_t *data = NULL;
+
+		data = talloc_size(conn, SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE);
+		if (data == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		buf = talloc_zero(data, struct smbd_smbdirect_buffer);
+		if (buf == NULL) {
+			TALLOC_FREE(data);
+			errno = ENOMEM;
+			return NULL;
+		}
+		buf->conn = conn;
+		buf->data = data;
+		buf->size = SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE;
+
+		buf->mr = ibv_reg_mr(conn->pd,
+				     buf->data,
+				     buf->size,
+				     IBV_ACCESS_LOCAL_WRITE);
+		if (buf->mr == NULL) {
+			int saved_errno = errno;
+			TALLOC_FREE(data);
+			errno = saved_errno;
+			return NULL;
+		}
+		talloc_set_destructor(buf, smbd_smbdirect_buffer_destructor);
+	}
+
+	buf->in_use = true;
+	DLIST_ADD(conn->buffers.used, buf);
+	talloc_set_destructor(buf->data, smbd_smbdirect_buffer_data_destructor);
+
+	return talloc_steal(mem_ctx, buf->data);
+}
+
+/*
+ * Posting work requests
+ */
+
+static int smbd_smbdirect_post_recv(struct smbd_smbdirect_connection *conn,
+				    struct smbd_smbdirect_recv_io *io)
+{
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)io->buf,
+		.length = SMBD_SMBDIRECT_MAX_RECEIVE_SIZE,
+		.lkey = conn->recv.mr->lkey,
+	};
+	struct ibv_recv_wr wr = {
+		.wr_id = (uintptr_t)io,
+		.sg_list = &sge,
+		.num_sge = 1,
+	};
+	struct ibv_recv_wr *bad_wr = NULL;
+	int ret;
+
+	ret = ibv_post_recv(conn->cm_id->qp, &wr, &bad_wr);
+	if (ret != 0) {
+		return ret;
+	}
+
+	conn->recv.posted += 1;
+	return 0;
+}
+
+static int smbd_smbdirect_post_send(struct smbd_smbdirect_connection *conn,
+				    struct smbd_smbdirect_send_io *io,
+				    size_t length)
+{
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)io->buf,
+		.length = length,
+		.lkey = conn->send.mr->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.wr_id = (uintptr_t)io,
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED,
+	};
+	struct ibv_send_wr *bad_wr = NULL;
+	int ret;
+
+	ret = ibv_post_send(conn->cm_id->qp, &wr, &bad_wr);
+	if (ret != 0) {
+		return ret;
+	}
+
+	DLIST_REMOVE(conn->send.free, io);
+	conn->send.inflight += 1;
+	return 0;
+}
+
+/*
+ * Hand out the credits for receives posted since the last message.
+ */
+static uint16_t smbd_smbdirect_grant_credits(
+	struct smbd_smbdirect_connection *conn)
+{
+	uint16_t credits = conn->recv.posted - conn->recv.granted;
+
+	conn->recv.granted += credits;
+	return credits;
+}
+
+static bool smbd_smbdirect_need_grant(struct smbd_smbdirect_connection *conn)
+{
+	if (conn->recv.posted <= conn->recv.granted) {
+		return false;
+	}
+
+	/*
+	 * Don't send a message just to grant credits
+	 * while the peer has more than half of what it wants.
+	 */
+	return conn->recv.granted <= conn->recv.target / 2;
+}
+
+/*
+ * Send the PDU from smbd as a sequence of data transfer messages
+ * ([MS-SMBD] 2.2.3), plus messages that only grant credits.
+ */
+static void smbd_smbdirect_send_pending(struct smbd_smbdirect_connection *conn)
+{
+	if (!conn->negotiated) {
+		return;
+	}
+
+	while (conn->state != SMBD_SMBDIRECT_DISCONNECTED &&
+	       conn->send.free != NULL &&
+	       conn->send.credits > 0)
+	{
+		struct smbd_smbdirect_send_io *io = conn->send.free;
+		bool have_data = false;
+		uint32_t data_length = 0;
+		uint32_t remaining = 0;
+		uint16_t flags = 0;
+		uint16_t granted;
+		size_t length;
+		int ret;
+
+		if (conn->send.msg != NULL &&
+		    conn->send.msg_ofs == conn->send.msg_len)
+		{
+			have_data = true;
+		}
+
+		if (!have_data &&
+		    !conn->send.response_requested &&
+		    !smbd_smbdirect_need_grant(conn))
+		{
+			break;
+		}
+
+		if (have_data) {
+			size_t left = conn->send.msg_len - conn->send.sent_ofs;
+
+			data_length = MIN(left,
+					  conn->max_send_size -
+					  SMB_DIRECT_DATA_OFFSET);
+			remaining = left - data_length;
+			memcpy(io->buf + SMB_DIRECT_DATA_OFFSET,
+			       conn->send.msg + conn->send.sent_ofs,
+			       data_length);
+		}
+
+		if (conn->send.credits == 1) {
+			/*
+			 * This is our last credit, ask for more.
+			 */
+			flags |= SMB_DIRECT_RESPONSE_REQUESTED;
+		}
+
+		granted = smbd_smbdirect_grant_credits(conn);
+
+		SSVAL(io->buf, 0x00, SMBD_SMBDIRECT_SEND_CREDIT_MAX);
+		SSVAL(io->buf, 0x02, granted);
+		SSVAL(io->buf, 0x04, flags);
+		SSVAL(io->buf, 0x06, 0);
+		SIVAL(io->buf, 0x08, remaining);
+		if (data_length > 0) {
+			SIVAL(io->buf, 0x0C, SMB_DIRECT_DATA_OFFSET);
+			SIVAL(io->buf, 0x10, data_length);
+			SIVAL(io->buf, 0x14, 0);
+			length = SMB_DIRECT_DATA_OFFSET + data_length;
+		} else {
+			SIVAL(io->buf, 0x0C, 0);
+			SIVAL(io->buf, 0x10, 0);
+			length = SMB_DIRECT_DATA_MIN_SIZE;
+		}
+
+		ret = smbd_smbdirect_post_send(conn, io, length);
+		if (ret != 0) {
+			conn->recv.granted -= granted;
+			smbd_smbdirect_connection_disconnect(
+				conn, map_nt_error_from_unix_common(ret));
+			return;
+		}
+		conn->send.credits -= 1;
+		conn->send.response_requested = false;
+
+		if (!have_data) {
+			continue;
+		}
+
+		conn->send.sent_ofs += data_length;
+		if (conn->send.sent_ofs == conn->send.msg_len) {
+			TALLOC_FREE(conn->send.msg);
+			conn->send.msg_len = 0;
+			conn->send.msg_ofs = 0;
+			conn->send.sent_ofs = 0;
+			TEVENT_FD_READABLE(conn->sock_fde);
+		}
+	}
+}
+
+/*
+ * Pass the reassembled PDUs on to smbd
+ */
+static void smbd_smbdirect_deliver_pending(
+	struct smbd_smbdirect_connection *conn)
+{
+	struct smbd_smbdirect_deliver *d = NULL;
+
+	while ((d = conn->deliver.queue) != NULL) {
+		ssize_t n;
+
+		n = send(conn->sock,
+			 d->buf + d->ofs,
+			 d->len - d->ofs,
+			 MSG_NOSIGNAL);
+		if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+			TEVENT_FD_WRITEABLE(conn->sock_fde);
+			return;
+		}
+		if (n <= 0) {
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_CONNECTION_DISCONNECTED);
+			return;
+		}
+
+		d->ofs += n;
+		conn->deliver.queued -= n;
+		if (d->ofs < d->len) {
+			continue;
+		}
+
+		DLIST_REMOVE(conn->deliver.queue, d);
+		TALLOC_FREE(d);
+	}
+
+	TEVENT_FD_NOT_WRITEABLE(conn->sock_fde);
+
+	/*
+	 * smbd caught up, so we can give the client
+	 * the receive credits back.
+	 */
+	while (conn->recv.deferred != NULL) {
+		struct smbd_smbdirect_recv_io *io = conn->recv.deferred;
+		int ret;
+
+		DLIST_REMOVE(conn->recv.deferred, io);
+		ret = smbd_smbdirect_post_recv(conn, io);
+		if (ret != 0) {
+			smbd_smbdirect_connection_disconnect(
+				conn, map_nt_error_from_unix_common(ret));
+			return;
+		}
+	}
+
+	smbd_smbdirect_send_pending(conn);
+}
+
+static void smbd_smbdirect_sock_read(struct smbd_smbdirect_connection *conn)
+{
+	ssize_t n;
+
+	if (conn->send.msg == NULL) {
+		size_t len;
+
+		n = read(conn->sock,
+			 conn->send.hdr + conn->send.hdr_ofs,
+			 sizeof(conn->send.hdr) - conn->send.hdr_ofs);
+		if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+			return;
+		}
+		if (n <= 0) {
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_END_OF_FILE);
+			return;
+		}
+		conn->send.hdr_ofs += n;
+		if (conn->send.hdr_ofs < sizeof(conn->send.hdr)) {
+			return;
+		}
+		conn->send.hdr_ofs = 0;
+
+		len = smb_len_tcp(conn->send.hdr);
+		if (len == 0) {
+			return;
+		}
+		if (CVAL(conn->send.hdr, 0) != 0) {
+			DBG_ERR("smbd sent NBT message type 0x%02x, "
+				"which SMB Direct can't carry\n",
+				CVAL(conn->send.hdr, 0));
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_INVALID_NETWORK_RESPONSE);
+			return;
+		}
+		if (len > conn->peer_max_fragmented_size) {
+			DBG_ERR("PDU of %zu bytes exceeds the client's "
+				"max fragmented size of %"PRIu32"\n",
+				len, conn->peer_max_fragmented_size);
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_BUFFER_OVERFLOW);
+			return;
+		}
+
+		conn->send.msg = talloc_array(conn, uint8_t, len);
+		if (conn->send.msg == NULL) {
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_NO_MEMORY);
+			return;
+		}
+		conn->send.msg_len = len;
+		conn->send.msg_ofs = 0;
+		conn->send.sent_ofs = 0;
+	}
+
+	n = read(conn->sock,
+		 conn->send.msg + conn->send.msg_ofs,
+		 conn->send.msg_len - conn->send.msg_ofs);
+	if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	}
+	if (n <= 0) {
+		smbd_smbdirect_connection_disconnect(
+			conn, NT_STATUS_END_OF_FILE);
+		return;
+	}
+	conn->send.msg_ofs += n;
+	if (conn->send.msg_ofs < conn->send.msg_len) {
+		return;
+	}
+
+	/*
+	 * We read the next PDU when this one is sent.
+	 */
+	TEVENT_FD_NOT_READABLE(conn->sock_fde);
+	smbd_smbdirect_send_pending(conn);
+}
+
+static void smbd_smbdirect_sock_handler(struct tevent_context *ev,
+					struct tevent_fd *fde,
+					uint16_t flags,
+					void *private_data)
+{
+	struct smbd_smbdirect_connection *conn = talloc_get_type_abort(
+		private_data, struct smbd_smbdirect_connection);
+
+	if (flags & TEVENT_FD_WRITE) {
+		smbd_smbdirect_deliver_pending(conn);
+	}
+	if (conn->state == SMBD_SMBDIRECT_DISCONNECTED) {
+		return;
+	}
+	if (flags & TEVENT_FD_READ) {
+		smbd_smbdirect_sock_read(conn);
+	}
+}
+
+/*
+ * Receiving
+ */
+
+static NTSTATUS smbd_smbdirect_negotiate(struct smbd_smbdirect_connection *conn,
+					 const uint8_t *buf,
+					 size_t len)
+{
+	struct smbd_smbdirect_send_io *io = conn->send.free;
+	uint16_t min_version;
+	uint16_t max_version;
+	uint16_t credits_requested;
+	uint32_t max_receive_size;
+	uint32_t max_fragmented_size;
+	NTSTATUS status = NT_STATUS_OK;
+	uint16_t granted;
+	int ret;
+
+	if (len < SMB_DIRECT_NEGOTIATE_REQUEST_SIZE) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	min_version		= SVAL(buf, 0x00);
+	max_version		= SVAL(buf, 0x02);
+	credits_requested	= SVAL(buf, 0x06);
+	max_receive_size	= IVAL(buf, 0x0C);
+	max_fragmented_size	= IVAL(buf, 0x10);
+
+	if (min_version > SMB_DIRECT_VERSION_1 ||
+	    max_version < SMB_DIRECT_VERSION_1)
+	{
+		status = NT_STATUS_NOT_SUPPORTED;
+	} else if (credits_requested == 0 ||
+		   max_receive_size < 128 ||
+		   max_fragmented_size < 131072)
+	{
+		status = NT_STATUS_INVALID_PARAMETER;
+	}
+
+	conn->recv.target = MIN(credits_requested,
+				SMBD_SMBDIRECT_RECV_CREDIT_MAX);
+	conn->max_send_size = MIN(max_receive_size,
+				  SMBD_SMBDIRECT_MAX_SEND_SIZE);
+	conn->peer_max_fragmented_size = max_fragmented_size;
+
+	/*
+	 * The response doesn't need a credit, the client posted
+	 * a receive for it before sending the request.
+	 */
+	granted = smbd_smbdirect_grant_credits(conn);
+
+	SSVAL(io->buf, 0x00, SMB_DIRECT_VERSION_1);
+	SSVAL(io->buf, 0x02, SMB_DIRECT_VERSION_1);
+	SSVAL(io->buf, 0x04,
+	      NT_STATUS_IS_OK(status) ? SMB_DIRECT_VERSION_1 : 0);
+	SSVAL(io->buf, 0x06, 0);
+	SSVAL(io->buf, 0x08, SMBD_SMBDIRECT_SEND_CREDIT_MAX);
+	SSVAL(io->buf, 0x0A, granted);
+	SIVAL(io->buf, 0x0C, NT_STATUS_V(status));
+	SIVAL(io->buf, 0x10, SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE);
+	SIVAL(io->buf, 0x14, conn->max_send_size);
+	SIVAL(io->buf, 0x18, SMBD_SMBDIRECT_MAX_RECEIVE_SIZE);
+	SIVAL(io->buf, 0x1C, SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE);
+
+	ret = smbd_smbdirect_post_send(conn,
+				       io,
+				       SMB_DIRECT_NEGOTIATE_RESPONSE_SIZE);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	TALLOC_FREE(conn->negotiate_te);
+
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_NOTICE("Negotiation failed: %s\n", nt_errstr(status));
+		/*
+		 * We disconnect when the response is sent.
+		 */
+		conn->negotiate_failed = true;
+		return NT_STATUS_OK;
+	}
+
+	conn->negotiated = true;
+	TEVENT_FD_READABLE(conn->sock_fde);
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smbdirect_data_received(
+	struct smbd_smbdirect_connection *conn,
+	const uint8_t *buf,
+	size_t len)
+{
+	struct smbd_smbdirect_deliver *msg = conn->recv.msg;
+	uint16_t credits_requested;
+	uint16_t credits_granted;
+	uint16_t flags;
+	uint32_t remaining;
+	uint32_t data_offset;
+	uint32_t data_length;
+
+	if (len < SMB_DIRECT_DATA_MIN_SIZE) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	credits_requested	= SVAL(buf, 0x00);
+	credits_granted		= SVAL(buf, 0x02);
+	flags			= SVAL(buf, 0x04);
+	remaining		= IVAL(buf, 0x08);
+	data_offset		= IVAL(buf, 0x0C);
+	data_length		= IVAL(buf, 0x10);
+
+	if (conn->recv.granted == 0) {
+		DBG_ERR("Client sent without a credit\n");
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	conn->recv.granted -= 1;
+
+	if (credits_granted > UINT16_MAX - conn->send.credits) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+	conn->send.credits += credits_granted;
+
+	conn->recv.target = MIN(MAX(credits_requested, 1),
+				SMBD_SMBDIRECT_RECV_CREDIT_MAX);
+
+	if (flags & SMB_DIRECT_RESPONSE_REQUESTED) {
+		conn->send.response_requested = true;
+	}
+
+	if (data_length == 0) {
+		return NT_STATUS_OK;
+	}
+
+	if ((data_offset % 8) != 0 ||
+	    data_offset < SMB_DIRECT_DATA_OFFSET ||
+	    data_offset > len ||
+	    data_length > len - data_offset)
+	{
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (msg == NULL) {
+		size_t total = (size_t)data_length + remaining;
+
+		if (total > SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE) {
+			DBG_ERR("PDU of %zu bytes exceeds our "
+				"max fragmented size\n", total);
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+
+		msg = talloc_zero(conn, struct smbd_smbdirect_deliver);
+		if (msg == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		msg->len = NBT_HDR_SIZE + total;
+		msg->buf = talloc_array(msg, uint8_t, msg->len);
+		if (msg->buf == NULL) {
+			TALLOC_FREE(msg);
+			return NT_STATUS_NO_MEMORY;
+		}
+		_smb_setlen_tcp(msg->buf, total);
+		msg->ofs = NBT_HDR_SIZE;
+		conn->recv.msg = msg;
+	}
+
+	if (msg->ofs + data_length + remaining != msg->len) {
+		DBG_ERR("Inconsistent fragment: %zu + %"PRIu32" + %"PRIu32
+			" != %zu\n",
+			msg->ofs, data_length, remaining, msg->len);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	memcpy(msg->buf + msg->ofs, buf + data_offset, data_length);
+	msg->ofs += data_length;
+
+	if (remaining != 0) {
+		return NT_STATUS_OK;
+	}
+
+	conn->recv.msg = NULL;
+	msg->ofs = 0;
+	DLIST_ADD_END(conn->deliver.queue, msg);
+	conn->deliver.queued += msg->len;
+
+	smbd_smbdirect_deliver_pending(conn);
+	return NT_STATUS_OK;
+}
+
+static void smbd_smbdirect_recv_done(struct smbd_smbdirect_connection *conn,
+				     struct smbd_smbdirect_recv_io *io,
+				     const struct ibv_wc *wc)
+{
+	NTSTATUS status;
+	int ret;
+
+	conn->recv.posted -= 1;
+
+	if (conn->state == SMBD_SMBDIRECT_DISCONNECTED) {
+		return;
+	}
+
+	if (wc->status != IBV_WC_SUCCESS) {
+		DBG_NOTICE("Receive failed: %s\n",
+			   ibv_wc_status_str(wc->status));
+		smbd_smbdirect_connection_disconnect(
+			conn, NT_STATUS_CONNECTION_DISCONNECTED);
+		return;
+	}
+
+	if (!conn->negotiated) {
+		if (conn->negotiate_failed) {
+			return;
+		}
+		conn->recv.granted -= 1;
+
+		/*
+		 * Repost first, so the response grants all receives.
+		 */
+		ret = smbd_smbdirect_post_recv(conn, io);
+		if (ret != 0) {
+			smbd_smbdirect_connection_disconnect(
+				conn, map_nt_error_from_unix_common(ret));
+			return;
+		}
+		status = smbd_smbdirect_negotiate(conn, io->buf, wc->byte_len);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbd_smbdirect_connection_disconnect(conn, status);
+		}
+		return;
+	}
+
+	status = smbd_smbdirect_data_received(conn, io->buf, wc->byte_len);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_smbdirect_connection_disconnect(conn, status);
+		return;
+	}
+	if (conn->state == SMBD_SMBDIRECT_DISCONNECTED) {
+		return;
+	}
+
+	if (conn->deliver.queued > SMBD_SMBDIRECT_DELIVER_MAX) {
+		DLIST_ADD_END(conn->recv.deferred, io);
+		return;
+	}
+
+	ret = smbd_smbdirect_post_recv(conn, io);
+	if (ret != 0) {
+		smbd_smbdirect_connection_disconnect(
+			conn, map_nt_error_from_unix_common(ret));
+		return;
+	}
+}
+
+static void smbd_smbdirect_send_done(struct smbd_smbdirect_connection *conn,
+				     struct smbd_smbdirect_send_io *io,
+				     const struct ibv_wc *wc)
+{
+	DLIST_ADD(conn->send.free, io);
+	conn->send.inflight -= 1;
+
+	if (wc->status != IBV_WC_SUCCESS) {
+		DBG_NOTICE("Send failed: %s\n",
+			   ibv_wc_status_str(wc->status));
+		smbd_smbdirect_connection_disconnect(
+			conn, NT_STATUS_CONNECTION_DISCONNECTED);
+		return;
+	}
+
+	if (conn->negotiate_failed) {
+		smbd_smbdirect_connection_disconnect(
+			conn, NT_STATUS_NOT_SUPPORTED);
+		return;
+	}
+}
+
+static void smbd_smbdirect_rdma_seg_done(struct smbd_smbdirect_connection *conn,
+					 struct smbd_smbdirect_rdma_seg *seg,
+					 const struct ibv_wc *wc)
+{
+	struct smbd_smbdirect_rdma_state *state = seg->state;
+
+	conn->rdma.wrs_inflight -= 1;
+	if (state->opcode == IBV_WR_RDMA_READ) {
+		conn->rdma.reads_inflight -= 1;
+	}
+	state->num_pending -= 1;
+
+	if (wc->status != IBV_WC_SUCCESS) {
+		DBG_NOTICE("RDMA %s failed: %s\n",
+			   state->opcode == IBV_WR_RDMA_READ ?
+			   "read" : "write",
+			   ibv_wc_status_str(wc->status));
+		if (NT_STATUS_IS_OK(state->status)) {
+			state->status = NT_STATUS_CONNECTION_DISCONNECTED;
+		}
+		state->next_seg = state->num_segs;
+		smbd_smbdirect_connection_disconnect(
+			conn, NT_STATUS_CONNECTION_DISCONNECTED);
+	}
+
+	smbd_smbdirect_rdma_maybe_done(state);
+}
+
+static int smbd_smbdirect_poll_cq(struct smbd_smbdirect_connection *conn)
+{
+	struct ibv_wc wcs[16];
+	int total = 0;
+	int n;
+
+	do {
+		int i;
+
+		n = ibv_poll_cq(conn->cq, ARRAY_SIZE(wcs), wcs);
+		if (n < 0) {
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_CONNECTION_DISCONNECTED);
+			return total;
+		}
+
+		for (i = 0; i < n; i++) {
+			const struct ibv_wc *wc = &wcs[i];
+			enum smbd_smbdirect_wr_type *type =
+				(enum smbd_smbdirect_wr_type *)
+				(uintptr_t)wc->wr_id;
+
+			switch (*type) {
+			case SMBD_SMBDIRECT_WR_RECV:
+				smbd_smbdirect_recv_done(
+					conn,
+					(struct smbd_smbdirect_recv_io *)type,
+					wc);
+				break;
+			case SMBD_SMBDIRECT_WR_SEND:
+				smbd_smbdirect_send_done(
+					conn,
+					(struct smbd_smbdirect_send_io *)type,
+					wc);
+				break;
+			case SMBD_SMBDIRECT_WR_RDMA:
+				smbd_smbdirect_rdma_seg_done(
+					conn,
+					(struct smbd_smbdirect_rdma_seg *)type,
+					wc);
+				break;
+			}
+		}
+		total += n;
+	} while (n == ARRAY_SIZE(wcs));
+
+	return total;
+}
+
+static void smbd_smbdirect_cq_handler(struct tevent_context *ev,
+				      struct tevent_fd *fde,
+				      uint16_t flags,
+				      void *private_data)
+{
+	struct smbd_smbdirect_connection *conn = talloc_get_type_abort(
+		private_data, struct smbd_smbdirect_connection);
+	struct ibv_cq *cq = NULL;
+	void *cq_context = NULL;
+	int ret;
+
+	ret = ibv_get_cq_event(conn->comp_channel, &cq, &cq_context);
+	if (ret != 0) {
+		if (errno == EINTR || errno == EAGAIN) {
+			return;
+		}
+		smbd_smbdirect_connection_disconnect(
+			conn, map_nt_error_from_unix_common(errno));
+		return;
+	}
+	ibv_ack_cq_events(cq, 1);
+
+	/*
+	 * Rearm before polling, so we don't miss anything
+	 * that completes in between.
+	 */
+	ret = ibv_req_notify_cq(cq, 0);
+	if (ret != 0) {
+		smbd_smbdirect_connection_disconnect(
+			conn, map_nt_error_from_unix_common(ret));
+	}
+
+	smbd_smbdirect_poll_cq(conn);
+
+	smbd_smbdirect_send_pending(conn);
+	smbd_smbdirect_rdma_pump(conn);
+}
+
+static void smbd_smbdirect_cm_handler(struct tevent_context *ev,
+				      struct tevent_fd *fde,
+				      uint16_t flags,
+				      void *private_data)
+{
+	struct smbd_smbdirect_connection *conn = talloc_get_type_abort(
+		private_data, struct smbd_smbdirect_connection);
+	struct rdma_cm_event *event = NULL;
+
+	while (rdma_get_cm_event(conn->cm_channel, &event) == 0) {
+		enum rdma_cm_event_type type = event->event;
+
+		rdma_ack_cm_event(event);
+
+		switch (type) {
+		case RDMA_CM_EVENT_ESTABLISHED:
+			if (conn->state == SMBD_SMBDIRECT_ACCEPTING) {
+				conn->state = SMBD_SMBDIRECT_CONNECTED;
+			}
+			break;
+		case RDMA_CM_EVENT_CONNECT_ERROR:
+		case RDMA_CM_EVENT_UNREACHABLE:
+		case RDMA_CM_EVENT_REJECTED:
+		case RDMA_CM_EVENT_DISCONNECTED:
+		case RDMA_CM_EVENT_DEVICE_REMOVAL:
+		case RDMA_CM_EVENT_ADDR_CHANGE:
+		case RDMA_CM_EVENT_TIMEWAIT_EXIT:
+			DBG_DEBUG("%s\n", rdma_event_str(type));
+			smbd_smbdirect_connection_disconnect(
+				conn, NT_STATUS_CONNECTION_DISCONNECTED);
+			break;
+		default:
+			DBG_DEBUG("Ignoring %s\n", rdma_event_str(type));
+			break;
+		}
+	}
+}
+
+static void smbd_smbdirect_negotiate_timeout(struct tevent_context *ev,
+					     struct tevent_timer *te,
+					     struct timeval current_time,
+					     void *private_data)
+{
+	struct smbd_smbdirect_connection *conn = talloc_get_type_abort(
+		private_data, struct smbd_smbdirect_connection);
+
+	TALLOC_FREE(conn->negotiate_te);
+	smbd_smbdirect_connection_disconnect(conn, NT_STATUS_IO_TIMEOUT);
+}
+
+/*
+ * Move the QP into the error state and wait until the device
+ * is done with all our send side work requests.
+ */
+static void smbd_smbdirect_connection_flush(
+	struct smbd_smbdirect_connection *conn)
+{
+	struct ibv_qp_attr attr = {
+		.qp_state = IBV_QPS_ERR,
+	};
+	int i;
+
+	if (conn->cm_id == NULL || conn->cm_id->qp == NULL) {
+		return;
+	}
+
+	ibv_modify_qp(conn->cm_id->qp, &attr, IBV_QP_STATE);
+
+	for (i = 0; i < 1000; i++) {
+		if (conn->rdma.wrs_inflight == 0 && conn->send.inflight == 0) {
+			break;
+		}
+		if (smbd_smbdirect_poll_cq(conn) == 0) {
+			smb_msleep(1);
+		}
+	}
+}
+
+static void smbd_smbdirect_connection_disconnect(
+	struct smbd_smbdirect_connection *conn,
+	NTSTATUS status)
+{
+	struct smbd_smbdirect_rdma_state *state = NULL;
+	struct smbd_smbdirect_rdma_state *next = NULL;
+
+	if (conn->state == SMBD_SMBDIRECT_DISCONNECTED) {
+		return;
+	}
+
+	DBG_NOTICE("Disconnecting: %s\n", nt_errstr(status));
+
+	conn->state = SMBD_SMBDIRECT_DISCONNECTED;
+	TALLOC_FREE(conn->negotiate_te);
+
+	if (conn->cm_id != NULL) {
+		rdma_disconnect(conn->cm_id);
+	}
+
+	/*
+	 * smbd sees the end of the stream and goes away.
+	 */
+	TALLOC_FREE(conn->sock_fde);
+	if (conn->sock != -1) {
+		close(conn->sock);
+		conn->sock = -1;
+	}
+
+	/*
+	 * The posted work requests get flushed,
+	 * the queued ones are not posted anymore.
+	 */
+	for (state = conn->rdma.queue; state != NULL; state = next) {
+		next = state->next;
+
+		state->next_seg = state->num_segs;
+		if (NT_STATUS_IS_OK(state->status)) {
+			state->status = NT_STATUS_CONNECTION_DISCONNECTED;
+		}
+		smbd_smbdirect_rdma_maybe_done(state);
+	}
+}
+
+static int smbd_smbdirect_connection_destructor(
+	struct smbd_smbdirect_connection *conn)
+{
+	struct smbd_smbdirect_rdma_state *state = NULL;
+	struct smbd_smbdirect_buffer *buf = NULL;
+
+	if (smbd_smbdirect_conn == conn) {
+		smbd_smbdirect_conn = NULL;
+	}
+
+	TALLOC_FREE(conn->negotiate_te);
+	TALLOC_FREE(conn->cm_fde);
+
+	smbd_smbdirect_connection_disconnect(conn, NT_STATUS_LOCAL_DISCONNECT);
+	smbd_smbdirect_connection_flush(conn);
+	TALLOC_FREE(conn->cq_fde);
+
+	while ((state = conn->rdma.queue) != NULL) {
+		DLIST_REMOVE(conn->rdma.queue, state);
+		state->conn = NULL;
+		if (state->tmp_mr != NULL) {
+			ibv_dereg_mr(state->tmp_mr);
+			state->tmp_mr = NULL;
+		}
+		if (state->req != NULL) {
+			tevent_req_nterror(state->req,
+					   NT_STATUS_CONNECTION_DISCONNECTED);
+		}
+	}
+
+	while ((buf = conn->buffers.free) != NULL) {
+		talloc_free(buf->data);
+	}
+	while ((buf = conn->buffers.used) != NULL) {
+		DLIST_REMOVE(conn->buffers.used, buf);
+		buf->conn = NULL;
+		buf->in_use = false;
+		if (buf->mr != NULL) {
+			ibv_dereg_mr(buf->mr);
+			buf->mr = NULL;
+		}
+	}
+
+	if (conn->recv.mr != NULL) {
+		ibv_dereg_mr(conn->recv.mr);
+	}
+	if (conn->send.mr != NULL) {
+		ibv_dereg_mr(conn->send.mr);
+	}
+	if (conn->cm_id != NULL && conn->cm_id->qp != NULL) {
+		rdma_destroy_qp(conn->cm_id);
+	}
+	if (conn->cq != NULL) {
+		ibv_destroy_cq(conn->cq);
+	}
+	if (conn->comp_channel != NULL) {
+		ibv_destroy_comp_channel(conn->comp_channel);
+	}
+	if (conn->pd != NULL) {
+		ibv_dealloc_pd(conn->pd);
+	}
+	if (conn->cm_id != NULL) {
+		rdma_destroy_id(conn->cm_id);
+	}
+	if (conn->cm_channel != NULL) {
+		rdma_destroy_event_channel(conn->cm_channel);
+	}
+	if (!conn->claimed && conn->smbd_sock != -1) {
+		close(conn->smbd_sock);
+	}
+	return 0;
+}
+
+static int smbd_smbdirect_addr_from_cm(TALLOC_CTX *mem_ctx,
+				       struct sockaddr *sa,
+				       struct tsocket_address **_addr)
+{
+	socklen_t sa_socklen;
+
+	switch (sa->sa_family) {
+	case AF_INET:
+		sa_socklen = sizeof(struct sockaddr_in);
+		break;
+#ifdef HAVE_IPV6
+	case AF_INET6:
+		sa_socklen = sizeof(struct sockaddr_in6);
+		break;
+#endif
+	default:
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+
+	return tsocket_address_bsd_from_sockaddr(mem_ctx,
+						 sa,
+						 sa_socklen,
+						 _addr);
+}
+
+static NTSTATUS smbd_smbdirect_connection_setup(
+	struct smbd_smbdirect_connection *conn,
+	const struct rdma_conn_param *remote)
+{
+	struct rdma_cm_id *cm_id = conn->cm_id;
+	struct ibv_device_attr attr;
+	struct ibv_qp_init_attr qp_attr = {
+		.qp_type = IBV_QPT_RC,
+		.sq_sig_all = 1,
+		.cap = {
+			.max_send_wr = SMBD_SMBDIRECT_SEND_CREDIT_MAX +
+				       SMBD_SMBDIRECT_MAX_RDMA_WRS,
+			.max_recv_wr = SMBD_SMBDIRECT_RECV_CREDIT_MAX,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+		},
+	};
+	int cqe = qp_attr.cap.max_send_wr + qp_attr.cap.max_recv_wr;
+	size_t i;
+	int ret;
+
+	ret = smbd_smbdirect_addr_from_cm(conn,
+					  rdma_get_local_addr(cm_id),
+					  &conn->local_address);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(errno);
+	}
+	ret = smbd_smbdirect_addr_from_cm(conn,
+					  rdma_get_peer_addr(cm_id),
+					  &conn->remote_address);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(errno);
+	}
+
+	ret = ibv_query_device(cm_id->verbs, &attr);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+	conn->initiator_depth = MIN(remote->responder_resources,
+				    attr.max_qp_init_rd_atom);
+	conn->initiator_depth = MAX(conn->initiator_depth, 1);
+	conn->responder_resources = MIN(remote->initiator_depth,
+					attr.max_qp_rd_atom);
+
+	conn->pd = ibv_alloc_pd(cm_id->verbs);
+	if (conn->pd == NULL) {
+		return map_nt_error_from_unix_common(errno);
+	}
+
+	conn->comp_channel = ibv_create_comp_channel(cm_id->verbs);
+	if (conn->comp_channel == NULL) {
+		return map_nt_error_from_unix_common(errno);
+	}
+	set_blocking(conn->comp_channel->fd, false);
+	smb_set_close_on_exec(conn->comp_channel->fd);
+
+	conn->cq = ibv_create_cq(cm_id->verbs,
+				 cqe,
+				 conn,
+				 conn->comp_channel,
+				 0);
+	if (conn->cq == NULL) {
+		return map_nt_error_from_unix_common(errno);
+	}
+	ret = ibv_req_notify_cq(conn->cq, 0);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	qp_attr.send_cq = conn->cq;
+	qp_attr.recv_cq = conn->cq;
+	ret = rdma_create_qp(cm_id, conn->pd, &qp_attr);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(errno);
+	}
+
+	conn->recv.bufs = talloc_array(conn,
+				       uint8_t,
+				       SMBD_SMBDIRECT_RECV_CREDIT_MAX *
+				       SMBD_SMBDIRECT_MAX_RECEIVE_SIZE);
+	if (conn->recv.bufs == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	conn->recv.mr = ibv_reg_mr(conn->pd,
+				   conn->recv.bufs,
+				   talloc_get_size(conn->recv.bufs),
+				   IBV_ACCESS_LOCAL_WRITE);
+	if (conn->recv.mr == NULL) {
+		return map_nt_error_from_unix_common(errno);
+	}
+
+	conn->send.bufs = talloc_array(conn,
+				       uint8_t,
+				       SMBD_SMBDIRECT_SEND_CREDIT_MAX *
+				       SMBD_SMBDIRECT_MAX_SEND_SIZE);
+	if (conn->send.bufs == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	conn->send.mr = ibv_reg_mr(conn->pd,
+				   conn->send.bufs,
+				   talloc_get_size(conn->send.bufs),
+				   IBV_ACCESS_LOCAL_WRITE);
+	if (conn->send.mr == NULL) {
+		return map_nt_error_from_unix_common(errno);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(conn->send.ios); i++) {
+		struct smbd_smbdirect_send_io *io = &conn->send.ios[i];
+
+		io->type = SMBD_SMBDIRECT_WR_SEND;
+		io->buf = conn->send.bufs + i * SMBD_SMBDIRECT_MAX_SEND_SIZE;
+		DLIST_ADD_END(conn->send.free, io);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(conn->recv.ios); i++) {
+		struct smbd_smbdirect_recv_io *io = &conn->recv.ios[i];
+
+		io->type = SMBD_SMBDIRECT_WR_RECV;
+		io->buf = conn->recv.bufs + i * SMBD_SMBDIRECT_MAX_RECEIVE_SIZE;
+		ret = smbd_smbdirect_post_recv(conn, io);
+		if (ret != 0) {
+			return map_nt_error_from_unix_common(ret);
+		}
+	}
+
+	/*
+	 * The client may send the negotiate request without a grant.
+	 */
+	conn->recv.granted = 1;
+	conn->recv.target = 1;
+
+	conn->cq_fde = tevent_add_fd(conn->ev,
+				     conn,
+				     conn->comp_channel->fd,
+				     TEVENT_FD_READ,
+				     smbd_smbdirect_cq_handler,
+				     conn);
+	if (conn->cq_fde == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	set_blocking(conn->cm_channel->fd, false);
+	smb_set_close_on_exec(conn->cm_channel->fd);
+
+	conn->cm_fde = tevent_add_fd(conn->ev,
+				     conn,
+				     conn->cm_channel->fd,
+				     TEVENT_FD_READ,
+				     smbd_smbdirect_cm_handler,
+				     conn);
+	if (conn->cm_fde == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	conn->negotiate_te = tevent_add_timer(
+		conn->ev,
+		conn,
+		timeval_current_ofs(SMBD_SMBDIRECT_NEGOTIATE_TIMEOUT, 0),
+		smbd_smbdirect_negotiate_timeout,
+		conn);
+	if (conn->negotiate_te == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smbdirect_connection_socketpair(
+	struct smbd_smbdirect_connection *conn)
+{
+	int fds[2];
+	int ret;
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(errno);
+	}
+	conn->sock = fds[0];
+	conn->smbd_sock = fds[1];
+
+	set_blocking(conn->sock, false);
+	smb_set_close_on_exec(conn->sock);
+	smb_set_close_on_exec(conn->smbd_sock);
+
+	/*
+	 * We start reading responses after the SMB Direct
+	 * negotiation, smbd doesn't send anything before
+	 * the first request anyway.
+	 */
+	conn->sock_fde = tevent_add_fd(conn->ev,
+				       conn,
+				       conn->sock,
+				       0,
+				       smbd_smbdirect_sock_handler,
+				       conn);
+	if (conn->sock_fde == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smbd_smbdirect_accept(struct smbd_smbdirect_listener *listener,
+			       struct tevent_context *ev,
+			       int *_sock)
+{
+	struct smbd_smbdirect_connection *conn = NULL;
+	struct rdma_cm_id *cm_id = NULL;
+	struct rdma_conn_param remote;
+	struct rdma_conn_param param;
+	NTSTATUS status;
+	int ret;
+
+	if (smbd_smbdirect_conn != NULL) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	ret = smbd_smbdirect_listener_get_request(listener, &cm_id, &remote);
+	if (ret != 0) {
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	conn = talloc_zero(ev, struct smbd_smbdirect_connection);
+	if (conn == NULL) {
+		rdma_reject(cm_id, NULL, 0);
+		rdma_destroy_id(cm_id);
+		return NT_STATUS_NO_MEMORY;
+	}
+	conn->ev = ev;
+	conn->state = SMBD_SMBDIRECT_ACCEPTING;
+	conn->sock = -1;
+	conn->smbd_sock = -1;
+
+	conn->cm_channel = rdma_create_event_channel();
+	if (conn->cm_channel == NULL) {
+		status = map_nt_error_from_unix_common(errno);
+		rdma_reject(cm_id, NULL, 0);
+		rdma_destroy_id(cm_id);
+		TALLOC_FREE(conn);
+		return status;
+	}
+	talloc_set_destructor(conn, smbd_smbdirect_connection_destructor);
+
+	/*
+	 * From now on the events for this connection
+	 * no longer go to the listener.
+	 */
+	ret = rdma_migrate_id(cm_id, conn->cm_channel);
+	if (ret != 0) {
+		status = map_nt_error_from_unix_common(errno);
+		rdma_reject(cm_id, NULL, 0);
+		rdma_destroy_id(cm_id);
+		TALLOC_FREE(conn);
+		return status;
+	}
+	conn->cm_id = cm_id;
+
+	status = smbd_smbdirect_connection_setup(conn, &remote);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("Setting up the connection failed: %s\n",
+			nt_errstr(status));
+		rdma_reject(conn->cm_id, NULL, 0);
+		TALLOC_FREE(conn);
+		return status;
+	}
+
+	status = smbd_smbdirect_connection_socketpair(conn);
+	if (!NT_STATUS_IS_OK(status)) {
+		rdma_reject(conn->cm_id, NULL, 0);
+		TALLOC_FREE(conn);
+		return status;
+	}
+
+	param = (struct rdma_conn_param) {
+		.initiator_depth = conn->initiator_depth,
+		.responder_resources = conn->responder_resources,
+		.rnr_retry_count = 7,
+	};
+
+	ret = rdma_accept(conn->cm_id, &param);
+	if (ret != 0) {
+		status = map_nt_error_from_unix_common(errno);
+		DBG_ERR("rdma_accept() failed: %s\n", strerror(errno));
+		TALLOC_FREE(conn);
+		return status;
+	}
+
+	smbd_smbdirect_conn = conn;
+	*_sock = conn->smbd_sock;
+	return NT_STATUS_OK;
+}
+
+struct smbd_smbdirect_connection *smbd_smbdirect_connection_claim(
+	TALLOC_CTX *mem_ctx,
+	int sock)
+{
+	struct smbd_smbdirect_connection *conn = smbd_smbdirect_conn;
+
+	if (conn == NULL || conn->claimed || conn->smbd_sock != sock) {
+		return NULL;
+	}
+
+	conn->claimed = true;
+	return talloc_steal(mem_ctx, conn);
+}
+
+int smbd_smbdirect_connection_addresses(
+	struct smbd_smbdirect_connection *conn,
+	TALLOC_CTX *mem_ctx,
+	struct tsocket_address **_local,
+	struct tsocket_address **_remote)
+{
+	struct tsocket_address *local = NULL;
+	struct tsocket_address *remote = NULL;
+
+	local = tsocket_address_copy(conn->local_address, mem_ctx);
+	if (local == NULL) {
+		return -1;
+	}
+	remote = tsocket_address_copy(conn->remote_address, mem_ctx);
+	if (remote == NULL) {
+		TALLOC_FREE(local);
+		return -1;
+	}
+
+	*_local = local;
+	*_remote = remote;
+	return 0;
+}
+
+size_t smbd_smbdirect_max_read_write_size(
+	struct smbd_smbdirect_connection *conn)
+{
+	return SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE;
+}
+
+/*
+ * RDMA reads and writes
+ */
+
+static void smbd_smbdirect_rdma_maybe_done(
+	struct smbd_smbdirect_rdma_state *state)
+{
+	struct smbd_smbdirect_connection *conn = state->conn;
+
+	if (state->next_seg < state->num_segs || state->num_pending > 0) {
+		return;
+	}
+
+	DLIST_REMOVE(conn->rdma.queue, state);
+	state->conn = NULL;
+	if (state->tmp_mr != NULL) {
+		ibv_dereg_mr(state->tmp_mr);
+		state->tmp_mr = NULL;
+	}
+
+	if (state->req == NULL) {
+		return;
+	}
+	if (!NT_STATUS_IS_OK(state->status)) {
+		tevent_req_nterror(state->req, state->status);
+		return;
+	}
+	tevent_req_done(state->req);
+}
+
+static int smbd_smbdirect_rdma_post(struct smbd_smbdirect_connection *conn,
+				    struct smbd_smbdirect_rdma_state *state,
+				    struct smbd_smbdirect_rdma_seg *seg)
+{
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)(state->data + seg->local_ofs),
+		.length = seg->length,
+		.lkey = state->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.wr_id = (uintptr_t)seg,
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = state->opcode,
+		.send_flags = IBV_SEND_SIGNALED,
+		.wr = {
+			.rdma = {
+				.remote_addr = seg->remote_addr,
+				.rkey = seg->rkey,
+			},
+		},
+	};
+	struct ibv_send_wr *bad_wr = NULL;
+
+	return ibv_post_send(conn->cm_id->qp, &wr, &bad_wr);
+}
+
+/*
+ * Post what fits into the send queue, in the order the SMB2
+ * requests came in. RDMA reads are also limited by the number
+ * the client is prepared to serve at the same time.
+ */
+static void smbd_smbdirect_rdma_pump(struct smbd_smbdirect_connection *conn)
+{
+	struct smbd_smbdirect_rdma_state *state = NULL;
+	struct smbd_smbdirect_rdma_state *next = NULL;
+
+	for (state = conn->rdma.queue; state != NULL; state = next) {
+		next = state->next;
+
+		while (state->next_seg < state->num_segs) {
+			struct smbd_smbdirect_rdma_seg *seg =
+				&state->segs[state->next_seg];
+			int ret;
+
+			if (conn->state == SMBD_SMBDIRECT_DISCONNECTED) {
+				return;
+			}
+			if (conn->rdma.wrs_inflight >=
+			    SMBD_SMBDIRECT_MAX_RDMA_WRS)
+			{
+				return;
+			}
+			if (state->opcode == IBV_WR_RDMA_READ &&
+			    conn->rdma.reads_inflight >= conn->initiator_depth)
+			{
+				return;
+			}
+
+			ret = smbd_smbdirect_rdma_post(conn, state, seg);
+			if (ret != 0) {
+				state->status =
+					map_nt_error_from_unix_common(ret);
+				state->next_seg = state->num_segs;
+				break;
+			}
+
+			state->next_seg += 1;
+			state->num_pending += 1;
+			conn->rdma.wrs_inflight += 1;
+			if (state->opcode == IBV_WR_RDMA_READ) {
+				conn->rdma.reads_inflight += 1;
+			}
+		}
+
+		smbd_smbdirect_rdma_maybe_done(state);
+	}
+}
+
+static int smbd_smbdirect_rdma_state_destructor(
+	struct smbd_smbdirect_rdma_state *state)
+{
+	struct smbd_smbdirect_connection *conn = state->conn;
+
+	if (conn == NULL) {
+		return 0;
+	}
+
+	state->req = NULL;
+	state->next_seg = state->num_segs;
+
+	if (state->num_pending > 0) {
+		/*
+		 * The device may still access our buffer.
+		 * The connection is not usable after this anyway.
+		 */
+		smbd_smbdirect_connection_disconnect(conn,
+						     NT_STATUS_REQUEST_ABORTED);
+		smbd_smbdirect_connection_flush(conn);
+	}
+
+	if (state->conn != NULL) {
+		DLIST_REMOVE(conn->rdma.queue, state);
+		state->conn = NULL;
+	}
+	if (state->tmp_mr != NULL) {
+		ibv_dereg_mr(state->tmp_mr);
+		state->tmp_mr = NULL;
+	}
+	return 0;
+}
+
+static struct tevent_req *smbd_smbdirect_rdma_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	uint8_t *data,
+	size_t length,
+	enum ibv_wr_opcode opcode)
+{
+	struct tevent_req *req = NULL;
+	struct smbd_smbdirect_rdma_state *state = NULL;
+	struct smbd_smbdirect_buffer *buf = NULL;
+	size_t num_descs;
+	size_t ofs = 0;
+	size_t i;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smbdirect_rdma_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->req = req;
+	state->opcode = opcode;
+	state->data = data;
+	state->status = NT_STATUS_OK;
+
+	/*
+	 * The completions come in from the CQ handler,
+	 * don't run the callers from there.
+	 */
+	tevent_req_defer_callback(req, ev);
+
+	if (conn->state == SMBD_SMBDIRECT_DISCONNECTED || !conn->negotiated) {
+		tevent_req_nterror(req, NT_STATUS_CONNECTION_DISCONNECTED);
+		return tevent_req_post(req, ev);
+	}
+
+	num_descs = channel_info.length / SMB_DIRECT_BUFFER_DESCRIPTOR_V1_SIZE;
+	if ((channel_info.length % SMB_DIRECT_BUFFER_DESCRIPTOR_V1_SIZE) != 0 ||
+	    num_descs == 0 ||
+	    num_descs > SMBD_SMBDIRECT_MAX_DESCRIPTORS ||
+	    length > SMBD_SMBDIRECT_MAX_READ_WRITE_SIZE)
+	{
+		tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
+		return tevent_req_post(req, ev);
+	}
+
+	state->segs = talloc_zero_array(state,
+					struct smbd_smbdirect_rdma_seg,
+					num_descs);
+	if (tevent_req_nomem(state->segs, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	for (i = 0; i < num_descs && ofs < length; i++) {
+		const uint8_t *desc = channel_info.data +
+			i * SMB_DIRECT_BUFFER_DESCRIPTOR_V1_SIZE;
+		struct smbd_smbdirect_rdma_seg *seg = NULL;
+		uint32_t desc_length = IVAL(desc, 0x0C);
+
+		if (desc_length == 0) {
+			continue;
+		}
+
+		seg = &state->segs[state->num_segs++];
+		seg->type = SMBD_SMBDIRECT_WR_RDMA;
+		seg->state = state;
+		seg->remote_addr = BVAL(desc, 0x00);
+		seg->rkey = IVAL(desc, 0x08);
+		seg->length = MIN(desc_length, length - ofs);
+		seg->local_ofs = ofs;
+		ofs += seg->length;
+	}
+
+	if (ofs < length) {
+		/*
+		 * The client buffers are too small
+		 */
+		tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER);
+		return tevent_req_post(req, ev);
+	}
+
+	if (length == 0) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	buf = smbd_smbdirect_buffer_find(conn, data, length);
+	if (buf != NULL) {
+		state->lkey = buf->mr->lkey;
+	} else {
+		state->tmp_mr = ibv_reg_mr(conn->pd,
+					   data,
+					   length,
+					   IBV_ACCESS_LOCAL_WRITE);
+		if (state->tmp_mr == NULL) {
+			tevent_req_nterror(req,
+				map_nt_error_from_unix_common(errno));
+			return tevent_req_post(req, ev);
+		}
+		state->lkey = state->tmp_mr->lkey;
+	}
+
+	state->conn = conn;
+	DLIST_ADD_END(conn->rdma.queue, state);
+	talloc_set_destructor(state, smbd_smbdirect_rdma_state_destructor);
+
+	smbd_smbdirect_rdma_pump(conn);
+
+	return req;
+}
+
+struct tevent_req *smbd_smbdirect_rdma_write_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	const uint8_t *data,
+	size_t length)
+{
+	return smbd_smbdirect_rdma_send(mem_ctx,
+					ev,
+					conn,
+					channel_info,
+					discard_const_p(uint8_t, data),
+					length,
+					IBV_WR_RDMA_WRITE);
+}
+
+NTSTATUS smbd_smbdirect_rdma_write_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
+
+struct tevent_req *smbd_smbdirect_rdma_read_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	uint8_t *data,
+	size_t length)
+{
+	return smbd_smbdirect_rdma_send(mem_ctx,
+					ev,
+					conn,
+					channel_info,
+					data,
+					length,
+					IBV_WR_RDMA_READ);
+}
+
+NTSTATUS smbd_smbdirect_rdma_read_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_ntstatus(req);
+}
+
+#else /* HAVE_SMBDIRECT */
+
+struct smbd_smbdirect_listener *smbd_smbdirect_listener_create(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	const struct sockaddr_storage *addr,
+	uint16_t port,
+	smbd_smbdirect_listener_fn fn,
+	void *private_data)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void smbd_smbdirect_listener_wait(struct smbd_smbdirect_listener *listener,
+				  int fd)
+{
+	close(fd);
+}
+
+void smbd_smbdirect_listener_reject(struct smbd_smbdirect_listener *listener)
+{
+	return;
+}
+
+NTSTATUS smbd_smbdirect_accept(struct smbd_smbdirect_listener *listener,
+			       struct tevent_context *ev,
+			       int *_sock)
+{
+	return NT_STATUS_NOT_SUPPORTED;
+}
+
+struct smbd_smbdirect_connection *smbd_smbdirect_connection_claim(
+	TALLOC_CTX *mem_ctx,
+	int sock)
+{
+	return NULL;
+}
+
+int smbd_smbdirect_connection_addresses(
+	struct smbd_smbdirect_connection *conn,
+	TALLOC_CTX *mem_ctx,
+	struct tsocket_address **_local,
+	struct tsocket_address **_remote)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+size_t smbd_smbdirect_max_read_write_size(
+	struct smbd_smbdirect_connection *conn)
+{
+	return 0;
+}
+
+uint8_t *smbd_smbdirect_buffer_alloc(TALLOC_CTX *mem_ctx,
+				     struct smbd_smbdirect_connection *conn,
+				     size_t size)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+struct tevent_req *smbd_smbdirect_rdma_write_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	const uint8_t *data,
+	size_t length)
+{
+	return NULL;
+}
+
+NTSTATUS smbd_smbdirect_rdma_write_recv(struct tevent_req *req)
+{
+	return NT_STATUS_NOT_SUPPORTED;
+}
+
+struct tevent_req *smbd_smbdirect_rdma_read_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	uint8_t *data,
+	size_t length)
+{
+	return NULL;
+}
+
+NTSTATUS smbd_smbdirect_rdma_read_recv(struct tevent_req *req)
+{
+	return NT_STATUS_NOT_SUPPORTED;
+}
+
+#endif /* HAVE_SMBDIRECT */
@@ -0,0 +1,125 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB Direct (RDMA) transport for the SMB2 server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SMBD_SMB2_SMBDIRECT_H_
+#define _SMBD_SMB2_SMBDIRECT_H_
+
+/*
+ * The default port for SMB Direct over iWARP, [MS-SMBD] 2.1.
+ * The Linux kernel client tries it first on all RDMA transports.
+ */
+#define SMBD_SMBDIRECT_PORT 5445
+
+struct tsocket_address;
+struct smbd_smbdirect_listener;
+struct smbd_smbdirect_connection;
+
+/*
+ * Called in the parent when the listener has a connection request
+ * pending. The callback has to call either smbd_smbdirect_accept(),
+ * typically in a forked child followed by smbd_smbdirect_listener_wait()
+ * in the parent, or smbd_smbdirect_listener_reject().
+ */
+typedef void (*smbd_smbdirect_listener_fn)(
+	struct smbd_smbdirect_listener *listener,
+	void *private_data);
+
+/*
+ * Returns NULL with errno set if there is no RDMA device we can
+ * listen on, or if smbd was built without SMB Direct support.
+ */
+struct smbd_smbdirect_listener *smbd_smbdirect_listener_create(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	const struct sockaddr_storage *addr,
+	uint16_t port,
+	smbd_smbdirect_listener_fn fn,
+	void *private_data);
+
+/*
+ * Stop looking at connection requests until fd is closed by the
+ * child that accepts the pending one. Takes ownership of fd.
+ */
+void smbd_smbdirect_listener_wait(struct smbd_smbdirect_listener *listener,
+				  int fd);
+
+void smbd_smbdirect_listener_reject(struct smbd_smbdirect_listener *listener);
+
+/*
+ * Accept the pending connection request and return the socket
+ * smbd_process() should use. The SMB2 PDUs are passed over it with
+ * the usual 4 byte length header, the SMB Direct framing and credits
+ * are handled by the transport in the same tevent context.
+ *
+ * The connection is picked up again by smbd_smbdirect_connection_claim()
+ * from smbd_add_connection().
+ */
+NTSTATUS smbd_smbdirect_accept(struct smbd_smbdirect_listener *listener,
+			       struct tevent_context *ev,
+			       int *_sock);
+
+struct smbd_smbdirect_connection *smbd_smbdirect_connection_claim(
+	TALLOC_CTX *mem_ctx,
+	int sock);
+
+int smbd_smbdirect_connection_addresses(
+	struct smbd_smbdirect_connection *conn,
+	TALLOC_CTX *mem_ctx,
+	struct tsocket_address **_local,
+	struct tsocket_address **_remote);
+
+/*
+ * The largest RDMA read or write we do for a single SMB2 READ or WRITE.
+ */
+size_t smbd_smbdirect_max_read_write_size(
+	struct smbd_smbdirect_connection *conn);
+
+/*
+ * A talloc buffer of at least size bytes, which is registered with the
+ * RDMA device, so RDMA reads and writes go straight to and from it.
+ * Freed buffers are kept registered for reuse.
+ */
+uint8_t *smbd_smbdirect_buffer_alloc(TALLOC_CTX *mem_ctx,
+				     struct smbd_smbdirect_connection *conn,
+				     size_t size);
+
+/*
+ * Move data between our memory and the client memory described by
+ * the SMB_DIRECT_BUFFER_DESCRIPTOR_V1 array from an SMB2 READ or
+ * WRITE request. The data should come from smbd_smbdirect_buffer_alloc(),
+ * other memory is registered just for the transfer.
+ */
+struct tevent_req *smbd_smbdirect_rdma_write_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	const uint8_t *data,
+	size_t length);
+NTSTATUS smbd_smbdirect_rdma_write_recv(struct tevent_req *req);
+
+struct tevent_req *smbd_smbdirect_rdma_read_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smbdirect_connection *conn,
+	DATA_BLOB channel_info,
+	uint8_t *data,
+	size_t length);
+NTSTATUS smbd_smbdirect_rdma_read_recv(struct tevent_req *req);
+
+#endif /* _SMBD_SMB2_SMBDIRECT_H_ */
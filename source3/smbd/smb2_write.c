@@ -24,6 +24,7 @@
 #include "../libcli/smb/smb_common.h"
 #include "../lib/util/tevent_ntstatus.h"
 #include "rpc_server/srv_pipe_hnd.h"
+#include "smbd/smb2_smbdirect.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_SMB2
@@ -37,8 +38,20 @@ static struct tevent_req *smbd_smb2_write_send(TALLOC_CTX *mem_ctx,
 					       uint32_t in_flags);
 static NTSTATUS smbd_smb2_write_recv(struct tevent_req *req,
 				     uint32_t *out_count);
+static NTSTATUS smbd_smb2_write_rdma_recv(struct tevent_req *req,
+					  uint32_t *out_count);
+static struct tevent_req *smbd_smb2_write_rdma_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_request *smb2req,
+	struct files_struct *in_fsp,
+	DATA_BLOB in_channel_info,
+	uint32_t in_length,
+	uint64_t in_offset,
+	uint32_t in_flags);
 
 static void smbd_smb2_request_write_done(struct tevent_req *subreq);
+static void smbd_smb2_request_write_rdma_done(struct tevent_req *subreq);
 NTSTATUS smbd_smb2_request_process_write(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -52,6 +65,11 @@ NTSTATUS smbd_smb2_request_process_write(struct smbd_smb2_request *req)
 	uint64_t in_file_id_volatile;
 	struct files_struct *in_fsp;
 	uint32_t in_flags;
+	uint32_t in_channel;
+	uint32_t in_remaining_bytes;
+	uint16_t in_channel_info_offset;
+	uint16_t in_channel_info_length;
+	DATA_BLOB in_channel_info;
 	size_t in_dyn_len = 0;
 	uint8_t *in_dyn_ptr = NULL;
 	struct tevent_req *subreq;
@@ -67,8 +85,71 @@ NTSTATUS smbd_smb2_request_process_write(struct smbd_smb2_request *req)
 	in_offset		= BVAL(inbody, 0x08);
 	in_file_id_persistent	= BVAL(inbody, 0x10);
 	in_file_id_volatile	= BVAL(inbody, 0x18);
+	in_channel		= IVAL(inbody, 0x20);
+	in_remaining_bytes	= IVAL(inbody, 0x24);
+	in_channel_info_offset	= SVAL(inbody, 0x28);
+	in_channel_info_length	= SVAL(inbody, 0x2A);
 	in_flags		= IVAL(inbody, 0x2C);
 
+	status = smbd_smb2_request_verify_channel(req,
+						  in_channel,
+						  in_channel_info_offset,
+						  in_channel_info_length,
+						  &in_channel_info);
+	if (!NT_STATUS_IS_OK(status)) {
+		return smbd_smb2_request_error(req, status);
+	}
+
+	if (in_channel_info.length > 0) {
+		/*
+		 * The data is read from the client memory,
+		 * the request only carries the descriptors.
+		 */
+		if (in_data_length != 0) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+		if (in_remaining_bytes > xconn->smb2.server.max_write ||
+		    in_remaining_bytes > smbd_smbdirect_max_read_write_size(
+				xconn->transport.smbdirect))
+		{
+			DBG_NOTICE("client ignored max write: 0x%08X\n",
+				   in_remaining_bytes);
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		status = smbd_smb2_request_verify_creditcharge(
+				req, in_remaining_bytes);
+		if (!NT_STATUS_IS_OK(status)) {
+			return smbd_smb2_request_error(req, status);
+		}
+
+		in_fsp = file_fsp_smb2(req,
+				       in_file_id_persistent,
+				       in_file_id_volatile);
+		if (in_fsp == NULL) {
+			return smbd_smb2_request_error(req,
+						       NT_STATUS_FILE_CLOSED);
+		}
+
+		subreq = smbd_smb2_write_rdma_send(req, req->sconn->ev_ctx,
+						   req, in_fsp,
+						   in_channel_info,
+						   in_remaining_bytes,
+						   in_offset,
+						   in_flags);
+		if (subreq == NULL) {
+			return smbd_smb2_request_error(req,
+						       NT_STATUS_NO_MEMORY);
+		}
+		tevent_req_set_callback(subreq,
+					smbd_smb2_request_write_rdma_done,
+					req);
+
+		return smbd_smb2_request_pending_queue(req, subreq, 500);
+	}
+
 	if (in_data_offset != (SMB2_HDR_BODY + SMBD_SMB2_IN_BODY_LEN(req))) {
 		return smbd_smb2_request_error(req, NT_STATUS_INVALID_PARAMETER);
 	}
@@ -122,18 +203,42 @@ NTSTATUS smbd_smb2_request_process_write(struct smbd_smb2_request *req)
 	return smbd_smb2_request_pending_queue(req, subreq, 500);
 }
 
+static void smbd_smb2_request_write_reply(struct smbd_smb2_request *req,
+					  NTSTATUS status,
+					  uint32_t out_count);
+
 static void smbd_smb2_request_write_done(struct tevent_req *subreq)
 {
 	struct smbd_smb2_request *req = tevent_req_callback_data(subreq,
 					struct smbd_smb2_request);
-	DATA_BLOB outbody;
-	DATA_BLOB outdyn;
 	uint32_t out_count = 0;
 	NTSTATUS status;
-	NTSTATUS error; /* transport error */
 
 	status = smbd_smb2_write_recv(subreq, &out_count);
 	TALLOC_FREE(subreq);
+	smbd_smb2_request_write_reply(req, status, out_count);
+}
+
+static void smbd_smb2_request_write_rdma_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(subreq,
+					struct smbd_smb2_request);
+	uint32_t out_count = 0;
+	NTSTATUS status;
+
+	status = smbd_smb2_write_rdma_recv(subreq, &out_count);
+	TALLOC_FREE(subreq);
+	smbd_smb2_request_write_reply(req, status, out_count);
+}
+
+static void smbd_smb2_request_write_reply(struct smbd_smb2_request *req,
+					  NTSTATUS status,
+					  uint32_t out_count)
+{
+	DATA_BLOB outbody;
+	DATA_BLOB outdyn;
+	NTSTATUS error; /* transport error */
+
 	if (!NT_STATUS_IS_OK(status)) {
 		error = smbd_smb2_request_error(req, status);
 		if (!NT_STATUS_IS_OK(error)) {
@@ -440,3 +545,152 @@ static NTSTATUS smbd_smb2_write_recv(struct tevent_req *req,
 	tevent_req_received(req);
 	return NT_STATUS_OK;
 }
+
+/*
+ * SMB2 WRITE with an RDMA channel: fetch the data
+ * from the client memory, then write it out.
+ */
+struct smbd_smb2_write_rdma_state {
+	struct tevent_context *ev;
+	struct smbd_smb2_request *smb2req;
+	struct files_struct *fsp;
+	uint64_t in_offset;
+	uint32_t in_flags;
+	DATA_BLOB data;
+	struct tevent_req *write_subreq;
+	uint32_t out_count;
+};
+
+static void smbd_smb2_write_rdma_read_done(struct tevent_req *subreq);
+static void smbd_smb2_write_rdma_write_done(struct tevent_req *subreq);
+
+static bool smbd_smb2_write_rdma_cancel(struct tevent_req *req)
+{
+	struct smbd_smb2_write_rdma_state *state =
+		tevent_req_data(req,
+		struct smbd_smb2_write_rdma_state);
+
+	if (state->write_subreq == NULL) {
+		return false;
+	}
+
+	return tevent_req_cancel(state->write_subreq);
+}
+
+static struct tevent_req *smbd_smb2_write_rdma_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct smbd_smb2_request *smb2req,
+	struct files_struct *in_fsp,
+	DATA_BLOB in_channel_info,
+	uint32_t in_length,
+	uint64_t in_offset,
+	uint32_t in_flags)
+{
+	struct tevent_req *req = NULL;
+	struct smbd_smb2_write_rdma_state *state = NULL;
+	struct smbd_smbdirect_connection *smbdirect =
+		smb2req->xconn->transport.smbdirect;
+	struct tevent_req *subreq = NULL;
+	uint8_t *buf = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smb2_write_rdma_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->smb2req = smb2req;
+	state->fsp = in_fsp;
+	state->in_offset = in_offset;
+	state->in_flags = in_flags;
+
+	if (in_length > 0) {
+		buf = smbd_smbdirect_buffer_alloc(state, smbdirect, in_length);
+		if (buf == NULL) {
+			tevent_req_nterror(req,
+				map_nt_error_from_unix_common(errno));
+			return tevent_req_post(req, ev);
+		}
+	}
+	state->data = data_blob_const(buf, in_length);
+
+	subreq = smbd_smbdirect_rdma_read_send(state,
+					       ev,
+					       smbdirect,
+					       in_channel_info,
+					       state->data.data,
+					       state->data.length);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_write_rdma_read_done, req);
+
+	return req;
+}
+
+static void smbd_smb2_write_rdma_read_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(subreq,
+				 struct tevent_req);
+	struct smbd_smb2_write_rdma_state *state = tevent_req_data(req,
+					struct smbd_smb2_write_rdma_state);
+	NTSTATUS status;
+
+	status = smbd_smbdirect_rdma_read_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+
+	subreq = smbd_smb2_write_send(state, state->ev,
+				      state->smb2req, state->fsp,
+				      state->data,
+				      state->in_offset,
+				      state->in_flags);
+	if (tevent_req_nomem(subreq, req)) {
+		return;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_write_rdma_write_done, req);
+	state->write_subreq = subreq;
+
+	tevent_req_set_cancel_fn(req, smbd_smb2_write_rdma_cancel);
+}
+
+static void smbd_smb2_write_rdma_write_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(subreq,
+				 struct tevent_req);
+	struct smbd_smb2_write_rdma_state *state = tevent_req_data(req,
+					struct smbd_smb2_write_rdma_state);
+	NTSTATUS status;
+
+	state->write_subreq = NULL;
+	tevent_req_set_cancel_fn(req, NULL);
+
+	status = smbd_smb2_write_recv(subreq, &state->out_count);
+	TALLOC_FREE(subreq);
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static NTSTATUS smbd_smb2_write_rdma_recv(struct tevent_req *req,
+					  uint32_t *out_count)
+{
+	struct smbd_smb2_write_rdma_state *state = tevent_req_data(req,
+					struct smbd_smb2_write_rdma_state);
+	NTSTATUS status;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+
+	*out_count = state->out_count;
+
+	tevent_req_received(req);
+	return NT_STATUS_OK;
+}
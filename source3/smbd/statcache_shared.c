@@ -0,0 +1,602 @@
+/*
+   Unix SMB/CIFS implementation.
+   Case insensitive name cache shared by all smbd processes
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The GETREALFILENAME_CACHE in filename.c lives in the memcache of
+ * a single smbd, every new client connection starts cold. With
+ * "shared stat cache size" the parent smbd maps a table with the
+ * same key/value pairs that all children inherit.
+ *
+ * The table is set associative with a few slots per bucket. A slot
+ * has a sequence number that is odd while the slot is being
+ * written. Readers copy a slot and ignore it if the sequence number
+ * changed meanwhile, writers skip slots someone else is writing.
+ * Nobody ever waits, the worst case is a cache miss.
+ *
+ * Entries are kept per user: a slot also holds a hash of the Unix
+ * and NT token of the user that found the name, and lookups only
+ * return entries of the same token. A user that may not list a
+ * directory must not learn how the names in there are spelled on
+ * disk from someone else's lookups. Users with the same token, such
+ * as those of a share with "force user", share their entries.
+ *
+ * Entries are hints: filename.c opens the cached name and drops the
+ * entry if that fails. This keeps the cache correct for changes by
+ * other cluster nodes and changes outside of smbd. Removes and
+ * renames by smbd drop the affected entries right away from
+ * notify_fname().
+ *
+ * Keys are the parent directory's file_id followed by the upper
+ * cased name, see get_real_filename_cache_key_fid(). The bucket only
+ * depends on the name. notify_fname() only has a path, so this lets
+ * it check for cached entries without a stat of the parent to get
+ * its file_id. The price is that a name common in many directories
+ * can only be cached for as many of them as a bucket has slots.
+ *
+ * The file survives smbd restarts if the size did not change, the
+ * cache is warm from the start.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "lib/util_path.h"
+#include "util_tdb.h"
+#include "librpc/gen_ndr/ndr_security.h"
+#include "lib/crypto/gnutls_helpers.h"
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+#if defined(HAVE___ATOMIC_ADD_FETCH) && defined(HAVE___ATOMIC_ADD_LOAD)
+#include <sys/mman.h>
+#define SHARED_STAT_CACHE 1
+#endif
+
+#ifdef SHARED_STAT_CACHE
+
+#define SHARED_STAT_CACHE_MAGIC 0x7374636163686533ULL /* "stcache3" */
+#define SHARED_STAT_CACHE_WAYS 4
+#define SHARED_STAT_CACHE_OWNER 16
+#define SHARED_STAT_CACHE_DATA 480
+#define SHARED_STAT_CACHE_HDR 64
+
+struct shared_stat_cache_hdr {
+	uint64_t magic;
+	uint64_t num_buckets;
+};
+
+struct shared_stat_cache_slot {
+	uint64_t seq;
+	uint32_t hash;
+	uint16_t keylen;
+	uint16_t valuelen;
+	uint8_t owner[SHARED_STAT_CACHE_OWNER];
+	uint8_t data[SHARED_STAT_CACHE_DATA];
+};
+
+static struct {
+	uint8_t *map;
+	size_t maplen;
+	struct shared_stat_cache_slot *slots;
+	size_t num_buckets;
+} shared_stat_cache;
+
+static bool shared_stat_cache_map(int fd, size_t num_buckets)
+{
+	size_t maplen = SHARED_STAT_CACHE_HDR +
+		num_buckets * SHARED_STAT_CACHE_WAYS *
+		sizeof(struct shared_stat_cache_slot);
+	struct shared_stat_cache_hdr *hdr = NULL;
+	struct stat st;
+	uint8_t *map = NULL;
+	int ret;
+
+	ret = fstat(fd, &st);
+	if (ret == -1) {
+		DBG_WARNING("fstat failed: %s\n", strerror(errno));
+		return false;
+	}
+	if ((size_t)st.st_size != maplen) {
+		if (st.st_size != 0) {
+			/*
+			 * Someone else's table, don't touch
+			 */
+			return false;
+		}
+		ret = ftruncate(fd, maplen);
+		if (ret == -1) {
+			DBG_WARNING("ftruncate failed: %s\n", strerror(errno));
+			return false;
+		}
+	}
+
+	map = mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		DBG_WARNING("mmap failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	hdr = (struct shared_stat_cache_hdr *)map;
+
+	if (hdr->magic == 0) {
+		hdr->num_buckets = num_buckets;
+		__atomic_store_n(
+			&hdr->magic, SHARED_STAT_CACHE_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	if ((hdr->magic != SHARED_STAT_CACHE_MAGIC) ||
+	    (hdr->num_buckets != num_buckets)) {
+		munmap(map, maplen);
+		return false;
+	}
+
+	shared_stat_cache.map = map;
+	shared_stat_cache.maplen = maplen;
+	shared_stat_cache.slots =
+		(struct shared_stat_cache_slot *)(map + SHARED_STAT_CACHE_HDR);
+	shared_stat_cache.num_buckets = num_buckets;
+	return true;
+}
+
+/*
+ * Called in the parent smbd, the children inherit the mapping
+ */
+void smbd_shared_stat_cache_init(void)
+{
+	size_t size = (size_t)lp_shared_stat_cache_size() * 1024;
+	size_t num_buckets = size / (SHARED_STAT_CACHE_WAYS *
+				     sizeof(struct shared_stat_cache_slot));
+	char *path = NULL;
+	bool ok;
+	int fd;
+
+	if (shared_stat_cache.map != NULL) {
+		munmap(shared_stat_cache.map, shared_stat_cache.maplen);
+		ZERO_STRUCT(shared_stat_cache);
+	}
+
+	if (!lp_stat_cache() || (num_buckets == 0)) {
+		return;
+	}
+
+	path = lock_path(talloc_tos(), "stat_cache.shm");
+	if (path == NULL) {
+		return;
+	}
+
+	fd = open(path, O_RDWR|O_CREAT, 0600);
+	if (fd == -1) {
+		DBG_WARNING("open(%s) failed: %s\n", path, strerror(errno));
+		TALLOC_FREE(path);
+		return;
+	}
+
+	ok = shared_stat_cache_map(fd, num_buckets);
+	close(fd);
+
+	if (!ok) {
+		/*
+		 * Different size or layout. Running smbds from before
+		 * a restart might still use the old file, so don't
+		 * truncate it.
+		 */
+		unlink(path);
+
+		fd = open(path, O_RDWR|O_CREAT|O_EXCL, 0600);
+		if (fd == -1) {
+			DBG_WARNING("open(%s) failed: %s\n",
+				    path,
+				    strerror(errno));
+			TALLOC_FREE(path);
+			return;
+		}
+		ok = shared_stat_cache_map(fd, num_buckets);
+		close(fd);
+	}
+
+	if (!ok) {
+		DBG_WARNING("Could not map %s\n", path);
+	} else {
+		DBG_INFO("Mapped %s with %zu buckets\n", path, num_buckets);
+	}
+	TALLOC_FREE(path);
+}
+
+static struct shared_stat_cache_slot *shared_stat_cache_name_bucket(
+	DATA_BLOB name)
+{
+	TDB_DATA tname = { .dptr = name.data, .dsize = name.length };
+	size_t bucket = tdb_jenkins_hash(&tname) %
+		shared_stat_cache.num_buckets;
+
+	return &shared_stat_cache.slots[bucket * SHARED_STAT_CACHE_WAYS];
+}
+
+static struct shared_stat_cache_slot *shared_stat_cache_bucket(
+	DATA_BLOB key, uint32_t *_hash)
+{
+	TDB_DATA tkey = { .dptr = key.data, .dsize = key.length };
+	DATA_BLOB name = {
+		.data = key.data + sizeof(struct file_id),
+		.length = key.length - sizeof(struct file_id),
+	};
+
+	*_hash = tdb_jenkins_hash(&tkey);
+	return shared_stat_cache_name_bucket(name);
+}
+
+/*
+ * Hash of the current user's Unix and NT token
+ */
+static bool shared_stat_cache_owner(struct connection_struct *conn,
+				    uint8_t owner[SHARED_STAT_CACHE_OWNER])
+{
+	const struct security_unix_token *utok = get_current_utok(conn);
+	const struct security_token *ntok = get_current_nttok(conn);
+	TALLOC_CTX *frame = NULL;
+	DATA_BLOB ublob, nblob;
+	uint8_t digest[32];
+	enum ndr_err_code ndr_err;
+	int rc;
+
+	if ((utok == NULL) || (ntok == NULL)) {
+		return false;
+	}
+
+	frame = talloc_stackframe();
+
+	ndr_err = ndr_push_struct_blob(
+		&ublob,
+		frame,
+		utok,
+		(ndr_push_flags_fn_t)ndr_push_security_unix_token);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+	ndr_err = ndr_push_struct_blob(
+		&nblob,
+		frame,
+		ntok,
+		(ndr_push_flags_fn_t)ndr_push_security_token);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+	if (!data_blob_append(frame, &ublob, nblob.data, nblob.length)) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	rc = gnutls_hash_fast(
+		GNUTLS_DIG_SHA256, ublob.data, ublob.length, digest);
+	TALLOC_FREE(frame);
+	if (rc < 0) {
+		return false;
+	}
+
+	memcpy(owner, digest, SHARED_STAT_CACHE_OWNER);
+	ZERO_ARRAY(digest);
+	return true;
+}
+
+bool smbd_shared_stat_cache_lookup(TALLOC_CTX *mem_ctx,
+				   struct connection_struct *conn,
+				   DATA_BLOB key,
+				   DATA_BLOB *value)
+{
+	struct shared_stat_cache_slot *slots = NULL;
+	uint8_t owner[SHARED_STAT_CACHE_OWNER];
+	uint8_t slot_owner[SHARED_STAT_CACHE_OWNER];
+	uint8_t buf[SHARED_STAT_CACHE_DATA];
+	uint32_t hash;
+	size_t i;
+
+	if (shared_stat_cache.slots == NULL) {
+		return false;
+	}
+	if ((key.length < sizeof(struct file_id)) ||
+	    (key.length >= SHARED_STAT_CACHE_DATA)) {
+		return false;
+	}
+	if (!shared_stat_cache_owner(conn, owner)) {
+		return false;
+	}
+
+	slots = shared_stat_cache_bucket(key, &hash);
+
+	for (i=0; i<SHARED_STAT_CACHE_WAYS; i++) {
+		struct shared_stat_cache_slot *s = &slots[i];
+		uint64_t seq1, seq2;
+		size_t keylen, valuelen;
+
+		seq1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if ((seq1 % 2) != 0) {
+			continue;
+		}
+		if (__atomic_load_n(&s->hash, __ATOMIC_RELAXED) != hash) {
+			continue;
+		}
+		keylen = __atomic_load_n(&s->keylen, __ATOMIC_RELAXED);
+		valuelen = __atomic_load_n(&s->valuelen, __ATOMIC_RELAXED);
+
+		if ((keylen != key.length) ||
+		    (valuelen == 0) ||
+		    (keylen + valuelen > SHARED_STAT_CACHE_DATA)) {
+			continue;
+		}
+
+		memcpy(slot_owner, s->owner, sizeof(slot_owner));
+		memcpy(buf, s->data, keylen + valuelen);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+		if (seq1 != seq2) {
+			continue;
+		}
+
+		if ((memcmp(buf, key.data, keylen) != 0) ||
+		    (memcmp(slot_owner, owner, sizeof(owner)) != 0)) {
+			continue;
+		}
+
+		*value = data_blob_talloc(mem_ctx, buf + keylen, valuelen);
+		return (value->data != NULL);
+	}
+
+	return false;
+}
+
+static bool shared_stat_cache_slot_lock(struct shared_stat_cache_slot *s,
+					uint64_t *seq)
+{
+	uint64_t expected = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+
+	if ((expected % 2) != 0) {
+		return false;
+	}
+	if (!__atomic_compare_exchange_n(&s->seq,
+					 &expected,
+					 expected + 1,
+					 false,
+					 __ATOMIC_ACQUIRE,
+					 __ATOMIC_RELAXED)) {
+		return false;
+	}
+	*seq = expected;
+	return true;
+}
+
+static void shared_stat_cache_slot_unlock(struct shared_stat_cache_slot *s,
+					  uint64_t seq,
+					  bool modified)
+{
+	__atomic_store_n(&s->seq, modified ? seq + 2 : seq, __ATOMIC_RELEASE);
+}
+
+static bool shared_stat_cache_slot_matches(struct shared_stat_cache_slot *s,
+					   uint32_t hash,
+					   DATA_BLOB key)
+{
+	return ((s->hash == hash) &&
+		(s->keylen == key.length) &&
+		(memcmp(s->data, key.data, key.length) == 0));
+}
+
+void smbd_shared_stat_cache_add(struct connection_struct *conn,
+				DATA_BLOB key,
+				DATA_BLOB value)
+{
+	struct shared_stat_cache_slot *slots = NULL;
+	struct shared_stat_cache_slot *s = NULL;
+	uint8_t owner[SHARED_STAT_CACHE_OWNER];
+	uint32_t hash;
+	uint64_t seq;
+	size_t i, victim;
+
+	if (shared_stat_cache.slots == NULL) {
+		return;
+	}
+	if ((key.length < sizeof(struct file_id)) ||
+	    (value.length == 0) ||
+	    (key.length + value.length > SHARED_STAT_CACHE_DATA)) {
+		return;
+	}
+	if (!shared_stat_cache_owner(conn, owner)) {
+		return;
+	}
+
+	slots = shared_stat_cache_bucket(key, &hash);
+
+	/*
+	 * Prefer our own key, then an empty slot. Otherwise evict a
+	 * pseudo-random one, so that two hot keys in a bucket don't
+	 * keep evicting each other in one slot.
+	 */
+	victim = (hash >> 16) % SHARED_STAT_CACHE_WAYS;
+	for (i=0; i<SHARED_STAT_CACHE_WAYS; i++) {
+		uint16_t keylen = __atomic_load_n(
+			&slots[i].keylen, __ATOMIC_RELAXED);
+		uint32_t h = __atomic_load_n(&slots[i].hash, __ATOMIC_RELAXED);
+
+		if ((h == hash) && (keylen == key.length)) {
+			victim = i;
+			break;
+		}
+		if (keylen == 0) {
+			victim = i;
+		}
+	}
+	s = &slots[victim];
+
+	if (!shared_stat_cache_slot_lock(s, &seq)) {
+		return;
+	}
+
+	s->hash = hash;
+	s->keylen = key.length;
+	s->valuelen = value.length;
+	memcpy(s->owner, owner, sizeof(owner));
+	memcpy(s->data, key.data, key.length);
+	memcpy(s->data + key.length, value.data, value.length);
+
+	shared_stat_cache_slot_unlock(s, seq, true);
+}
+
+void smbd_shared_stat_cache_delete(DATA_BLOB key)
+{
+	struct shared_stat_cache_slot *slots = NULL;
+	uint32_t hash;
+	size_t i;
+
+	if (shared_stat_cache.slots == NULL) {
+		return;
+	}
+	if ((key.length < sizeof(struct file_id)) ||
+	    (key.length >= SHARED_STAT_CACHE_DATA)) {
+		return;
+	}
+
+	slots = shared_stat_cache_bucket(key, &hash);
+
+	for (i=0; i<SHARED_STAT_CACHE_WAYS; i++) {
+		struct shared_stat_cache_slot *s = &slots[i];
+		uint64_t seq;
+		bool match;
+
+		if (__atomic_load_n(&s->hash, __ATOMIC_RELAXED) != hash) {
+			continue;
+		}
+		if (!shared_stat_cache_slot_lock(s, &seq)) {
+			/*
+			 * Being rewritten, possibly with our key. The
+			 * reader verifies the entry anyway.
+			 */
+			continue;
+		}
+
+		match = shared_stat_cache_slot_matches(s, hash, key);
+		if (match) {
+			s->hash = 0;
+			s->keylen = 0;
+			s->valuelen = 0;
+		}
+
+		shared_stat_cache_slot_unlock(s, seq, match);
+	}
+}
+
+/*
+ * Is there an entry for "name" in any directory? "name" is the upper
+ * cased name as it ends the key, including the terminating 0.
+ */
+bool smbd_shared_stat_cache_have_name(DATA_BLOB name)
+{
+	struct shared_stat_cache_slot *slots = NULL;
+	size_t keylen = sizeof(struct file_id) + name.length;
+	uint8_t buf[SHARED_STAT_CACHE_DATA];
+	size_t i;
+
+	if (shared_stat_cache.slots == NULL) {
+		return false;
+	}
+	if (keylen >= SHARED_STAT_CACHE_DATA) {
+		return false;
+	}
+
+	slots = shared_stat_cache_name_bucket(name);
+
+	for (i=0; i<SHARED_STAT_CACHE_WAYS; i++) {
+		struct shared_stat_cache_slot *s = &slots[i];
+		uint64_t seq1, seq2;
+
+		seq1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if ((seq1 % 2) != 0) {
+			/*
+			 * Being written, maybe with our name
+			 */
+			return true;
+		}
+		if (__atomic_load_n(&s->keylen, __ATOMIC_RELAXED) != keylen) {
+			continue;
+		}
+
+		memcpy(buf, s->data, keylen);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+		if (seq1 != seq2) {
+			return true;
+		}
+
+		if (memcmp(buf + sizeof(struct file_id),
+			   name.data,
+			   name.length) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool smbd_shared_stat_cache_enabled(void)
+{
+	return (shared_stat_cache.slots != NULL);
+}
+
+#else /* SHARED_STAT_CACHE */
+
+void smbd_shared_stat_cache_init(void)
+{
+	if (lp_shared_stat_cache_size() != 0) {
+		DBG_WARNING("shared stat cache not available\n");
+	}
+}
+
+bool smbd_shared_stat_cache_lookup(TALLOC_CTX *mem_ctx,
+				   struct connection_struct *conn,
+				   DATA_BLOB key,
+				   DATA_BLOB *value)
+{
+	return false;
+}
+
+void smbd_shared_stat_cache_add(struct connection_struct *conn,
+				DATA_BLOB key,
+				DATA_BLOB value)
+{
+	return;
+}
+
+void smbd_shared_stat_cache_delete(DATA_BLOB key)
+{
+	return;
+}
+
+bool smbd_shared_stat_cache_have_name(DATA_BLOB name)
+{
+	return false;
+}
+
+bool smbd_shared_stat_cache_enabled(void)
+{
+	return false;
+}
+
+#endif /* SHARED_STAT_CACHE */
@@ -0,0 +1,616 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *
+ *  Unit tests for the [MS-SMBD] message parsing in smb2_smbdirect.c.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "smb2_smbdirect.c"
+#include <cmocka.h>
+
+/*
+ * No RDMA hardware is needed: ibv_post_send() and ibv_post_recv() are
+ * inline wrappers around the ops of the queue pair's context, so a
+ * fake context catches what the parser sends back to the client.
+ */
+
+#define TEST_NUM_SEND_IOS 4
+
+struct test_state {
+	struct ibv_context ctx;
+	struct ibv_qp qp;
+	struct rdma_cm_id cm_id;
+	struct ibv_mr mr;
+	struct smbd_smbdirect_connection *conn;
+	int fds[2];
+	uint8_t sent[SMBD_SMBDIRECT_MAX_SEND_SIZE];
+	size_t sent_len;
+	unsigned num_sent;
+	unsigned num_recv_posted;
+};
+
+static struct test_state *test_state;
+
+static int fake_post_send(struct ibv_qp *qp,
+			  struct ibv_send_wr *wr,
+			  struct ibv_send_wr **bad_wr)
+{
+	size_t len = wr->sg_list[0].length;
+
+	assert_true(len <= sizeof(test_state->sent));
+	memcpy(test_state->sent,
+	       (const void *)(uintptr_t)wr->sg_list[0].addr,
+	       len);
+	test_state->sent_len = len;
+	test_state->num_sent += 1;
+	return 0;
+}
+
+static int fake_post_recv(struct ibv_qp *qp,
+			  struct ibv_recv_wr *wr,
+			  struct ibv_recv_wr **bad_wr)
+{
+	test_state->num_recv_posted += 1;
+	return 0;
+}
+
+static int setup(void **state)
+{
+	struct test_state *s = NULL;
+	struct smbd_smbdirect_connection *conn = NULL;
+	size_t i;
+	int ret;
+
+	s = talloc_zero(NULL, struct test_state);
+	assert_non_null(s);
+
+	s->ctx.ops.post_send = fake_post_send;
+	s->ctx.ops.post_recv = fake_post_recv;
+	s->qp.context = &s->ctx;
+	s->cm_id.qp = &s->qp;
+
+	conn = talloc_zero(s, struct smbd_smbdirect_connection);
+	assert_non_null(conn);
+	conn->state = SMBD_SMBDIRECT_CONNECTED;
+	conn->cm_id = &s->cm_id;
+	conn->recv.mr = &s->mr;
+	conn->send.mr = &s->mr;
+	conn->max_send_size = SMBD_SMBDIRECT_MAX_SEND_SIZE;
+	conn->peer_max_fragmented_size = SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE;
+
+	conn->send.bufs = talloc_zero_array(
+		conn,
+		uint8_t,
+		TEST_NUM_SEND_IOS * SMBD_SMBDIRECT_MAX_SEND_SIZE);
+	assert_non_null(conn->send.bufs);
+	for (i = 0; i < TEST_NUM_SEND_IOS; i++) {
+		struct smbd_smbdirect_send_io *io = &conn->send.ios[i];
+
+		io->type = SMBD_SMBDIRECT_WR_SEND;
+		io->buf = conn->send.bufs + i * SMBD_SMBDIRECT_MAX_SEND_SIZE;
+		DLIST_ADD_END(conn->send.free, io);
+	}
+
+	/*
+	 * Reassembled PDUs show up on s->fds[1],
+	 * just like smbd would read them.
+	 */
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, s->fds);
+	assert_int_equal(ret, 0);
+	conn->sock = s->fds[0];
+	conn->smbd_sock = s->fds[1];
+
+	s->conn = conn;
+	test_state = s;
+	*state = s;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct test_state *s = talloc_get_type_abort(*state,
+						     struct test_state);
+
+	close(s->fds[0]);
+	close(s->fds[1]);
+	test_state = NULL;
+	TALLOC_FREE(s);
+	return 0;
+}
+
+static void build_negotiate(uint8_t buf[SMB_DIRECT_NEGOTIATE_REQUEST_SIZE],
+			    uint16_t min_version,
+			    uint16_t max_version,
+			    uint16_t credits_requested,
+			    uint32_t max_receive_size,
+			    uint32_t max_fragmented_size)
+{
+	memset(buf, 0, SMB_DIRECT_NEGOTIATE_REQUEST_SIZE);
+	SSVAL(buf, 0x00, min_version);
+	SSVAL(buf, 0x02, max_version);
+	SSVAL(buf, 0x06, credits_requested);
+	SIVAL(buf, 0x08, SMBD_SMBDIRECT_MAX_SEND_SIZE);
+	SIVAL(buf, 0x0C, max_receive_size);
+	SIVAL(buf, 0x10, max_fragmented_size);
+}
+
+/*
+ * A data transfer message with the payload at data_offset. The caller
+ * passes the buffer length separately, so it can lie about either.
+ */
+static void build_data(uint8_t *buf,
+		       size_t buflen,
+		       uint16_t credits_requested,
+		       uint16_t credits_granted,
+		       uint16_t flags,
+		       uint32_t remaining,
+		       uint32_t data_offset,
+		       uint32_t data_length,
+		       uint8_t fill)
+{
+	memset(buf, fill, buflen);
+	SSVAL(buf, 0x00, credits_requested);
+	SSVAL(buf, 0x02, credits_granted);
+	SSVAL(buf, 0x04, flags);
+	SSVAL(buf, 0x06, 0);
+	SIVAL(buf, 0x08, remaining);
+	SIVAL(buf, 0x0C, data_offset);
+	SIVAL(buf, 0x10, data_length);
+	SIVAL(buf, 0x14, 0);
+}
+
+static void test_negotiate_truncated(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_NEGOTIATE_REQUEST_SIZE];
+	NTSTATUS status;
+
+	build_negotiate(buf, 0x0100, 0x0100, 10, 8192, 1024*1024);
+
+	status = smbd_smbdirect_negotiate(s->conn, buf, sizeof(buf) - 1);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+	assert_int_equal(s->num_sent, 0);
+	assert_false(s->conn->negotiated);
+
+	status = smbd_smbdirect_negotiate(s->conn, buf, 0);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+	assert_int_equal(s->num_sent, 0);
+}
+
+static void test_negotiate_ok(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_NEGOTIATE_REQUEST_SIZE];
+	NTSTATUS status;
+
+	/*
+	 * A too large max receive size is clamped to what we send.
+	 */
+	build_negotiate(buf, 0x0100, 0x0100, 10, 8192, 1024*1024);
+	s->conn->recv.posted = 5;
+
+	status = smbd_smbdirect_negotiate(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_true(s->conn->negotiated);
+	assert_false(s->conn->negotiate_failed);
+	assert_int_equal(s->conn->recv.target, 10);
+	assert_int_equal(s->conn->recv.granted, 5);
+	assert_int_equal(s->conn->max_send_size,
+			 SMBD_SMBDIRECT_MAX_SEND_SIZE);
+	assert_int_equal(s->conn->peer_max_fragmented_size, 1024*1024);
+
+	assert_int_equal(s->num_sent, 1);
+	assert_int_equal(s->sent_len, SMB_DIRECT_NEGOTIATE_RESPONSE_SIZE);
+	assert_int_equal(SVAL(s->sent, 0x04), SMB_DIRECT_VERSION_1);
+	assert_int_equal(SVAL(s->sent, 0x0A), 5);
+	assert_int_equal(IVAL(s->sent, 0x0C), 0);
+	assert_int_equal(IVAL(s->sent, 0x14), SMBD_SMBDIRECT_MAX_SEND_SIZE);
+	assert_int_equal(IVAL(s->sent, 0x18), SMBD_SMBDIRECT_MAX_RECEIVE_SIZE);
+
+	/*
+	 * The response used a send buffer
+	 */
+	assert_int_equal(s->conn->send.inflight, 1);
+}
+
+static void test_negotiate_small_receive_size(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_NEGOTIATE_REQUEST_SIZE];
+	NTSTATUS status;
+
+	build_negotiate(buf, 0x0100, 0x0100, 1000, 128, 131072);
+
+	status = smbd_smbdirect_negotiate(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_true(s->conn->negotiated);
+	assert_int_equal(s->conn->max_send_size, 128);
+	assert_int_equal(s->conn->recv.target,
+			 SMBD_SMBDIRECT_RECV_CREDIT_MAX);
+	assert_int_equal(IVAL(s->sent, 0x14), 128);
+}
+
+static void test_negotiate_bad_version(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_NEGOTIATE_REQUEST_SIZE];
+	NTSTATUS status;
+
+	build_negotiate(buf, 0x0200, 0x0200, 10, 8192, 1024*1024);
+
+	/*
+	 * The failure goes to the client in the response,
+	 * we disconnect once that is sent.
+	 */
+	status = smbd_smbdirect_negotiate(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_false(s->conn->negotiated);
+	assert_true(s->conn->negotiate_failed);
+
+	assert_int_equal(s->num_sent, 1);
+	assert_int_equal(SVAL(s->sent, 0x04), 0);
+	assert_int_equal(IVAL(s->sent, 0x0C),
+			 NT_STATUS_V(NT_STATUS_NOT_SUPPORTED));
+}
+
+static void test_negotiate_invalid_parameters(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_NEGOTIATE_REQUEST_SIZE];
+	struct {
+		uint16_t credits_requested;
+		uint32_t max_receive_size;
+		uint32_t max_fragmented_size;
+	} cases[] = {
+		{ 0, 8192, 1024*1024 },
+		{ 10, 127, 1024*1024 },
+		{ 10, 8192, 131071 },
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		NTSTATUS status;
+
+		s->conn->negotiate_failed = false;
+
+		build_negotiate(buf,
+				0x0100,
+				0x0100,
+				cases[i].credits_requested,
+				cases[i].max_receive_size,
+				cases[i].max_fragmented_size);
+
+		status = smbd_smbdirect_negotiate(s->conn, buf, sizeof(buf));
+		assert_true(NT_STATUS_IS_OK(status));
+		assert_false(s->conn->negotiated);
+		assert_true(s->conn->negotiate_failed);
+
+		assert_int_equal(s->num_sent, i + 1);
+		assert_int_equal(IVAL(s->sent, 0x0C),
+				 NT_STATUS_V(NT_STATUS_INVALID_PARAMETER));
+	}
+}
+
+static void test_data_truncated(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_DATA_MIN_SIZE];
+	NTSTATUS status;
+
+	s->conn->recv.granted = 1;
+	build_data(buf, sizeof(buf), 1, 0, 0, 0, 0, 0, 0);
+
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf) - 1);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+	assert_int_equal(s->conn->recv.granted, 1);
+
+	/*
+	 * Exactly the minimum size is a valid keepalive
+	 */
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(s->conn->recv.granted, 0);
+}
+
+static void test_data_without_credit(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_DATA_MIN_SIZE];
+	NTSTATUS status;
+
+	build_data(buf, sizeof(buf), 1, 0, 0, 0, 0, 0, 0);
+
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+	assert_int_equal(s->conn->recv.granted, 0);
+}
+
+static void test_data_credits(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_DATA_MIN_SIZE];
+	NTSTATUS status;
+
+	s->conn->recv.granted = 10;
+
+	build_data(buf, sizeof(buf), 0, 3, 0, 0, 0, 0, 0);
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(s->conn->send.credits, 3);
+	assert_int_equal(s->conn->recv.granted, 9);
+	/* the peer always wants at least one credit */
+	assert_int_equal(s->conn->recv.target, 1);
+	assert_false(s->conn->send.response_requested);
+
+	build_data(buf, sizeof(buf), 1000, 0,
+		   SMB_DIRECT_RESPONSE_REQUESTED, 0, 0, 0, 0);
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(s->conn->send.credits, 3);
+	assert_int_equal(s->conn->recv.target,
+			 SMBD_SMBDIRECT_RECV_CREDIT_MAX);
+	assert_true(s->conn->send.response_requested);
+}
+
+static void test_data_credits_overflow(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[SMB_DIRECT_DATA_MIN_SIZE];
+	NTSTATUS status;
+
+	s->conn->recv.granted = 10;
+	s->conn->send.credits = UINT16_MAX - 1;
+
+	build_data(buf, sizeof(buf), 1, 2, 0, 0, 0, 0, 0);
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+	assert_int_equal(s->conn->send.credits, UINT16_MAX - 1);
+
+	build_data(buf, sizeof(buf), 1, 1, 0, 0, 0, 0, 0);
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(s->conn->send.credits, UINT16_MAX);
+}
+
+static void test_data_bad_offset(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[0x20];
+	uint32_t offsets[] = {
+		0x1C,		/* not 8 byte aligned */
+		0x10,		/* inside the header */
+		0x00,		/* no offset with data */
+		0x28,		/* behind the message */
+		0xFFFFFFF8,	/* way behind the message */
+	};
+	size_t i;
+
+	s->conn->recv.granted = ARRAY_SIZE(offsets);
+
+	for (i = 0; i < ARRAY_SIZE(offsets); i++) {
+		NTSTATUS status;
+
+		build_data(buf, sizeof(buf), 1, 0, 0, 0, offsets[i], 1, 0);
+		status = smbd_smbdirect_data_received(s->conn,
+						      buf,
+						      sizeof(buf));
+		assert_true(NT_STATUS_EQUAL(status,
+					    NT_STATUS_INVALID_PARAMETER));
+		assert_null(s->conn->recv.msg);
+	}
+}
+
+static void test_data_length_overflow(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[0x20];
+	uint32_t lengths[] = {
+		9,
+		0xFFFFFFFF,
+		0xFFFFFFF0,
+	};
+	size_t i;
+
+	s->conn->recv.granted = ARRAY_SIZE(lengths);
+
+	for (i = 0; i < ARRAY_SIZE(lengths); i++) {
+		NTSTATUS status;
+
+		build_data(buf, sizeof(buf), 1, 0, 0, 0,
+			   SMB_DIRECT_DATA_OFFSET, lengths[i], 0);
+		status = smbd_smbdirect_data_received(s->conn,
+						      buf,
+						      sizeof(buf));
+		assert_true(NT_STATUS_EQUAL(status,
+					    NT_STATUS_INVALID_PARAMETER));
+		assert_null(s->conn->recv.msg);
+	}
+}
+
+static void test_data_remaining_overflow(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[0x20];
+	uint32_t remainings[] = {
+		0xFFFFFFFF,
+		0xFFFFFFF8,
+		SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE - 7,
+	};
+	size_t i;
+
+	s->conn->recv.granted = ARRAY_SIZE(remainings) + 1;
+
+	for (i = 0; i < ARRAY_SIZE(remainings); i++) {
+		NTSTATUS status;
+
+		build_data(buf, sizeof(buf), 1, 0, 0, remainings[i],
+			   SMB_DIRECT_DATA_OFFSET, 8, 0);
+		status = smbd_smbdirect_data_received(s->conn,
+						      buf,
+						      sizeof(buf));
+		assert_true(NT_STATUS_EQUAL(status,
+					    NT_STATUS_INVALID_PARAMETER));
+		assert_null(s->conn->recv.msg);
+	}
+
+	/*
+	 * Exactly our max fragmented size is fine
+	 */
+	{
+		NTSTATUS status;
+
+		build_data(buf, sizeof(buf), 1, 0, 0,
+			   SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE - 8,
+			   SMB_DIRECT_DATA_OFFSET, 8, 0);
+		status = smbd_smbdirect_data_received(s->conn,
+						      buf,
+						      sizeof(buf));
+		assert_true(NT_STATUS_IS_OK(status));
+		assert_non_null(s->conn->recv.msg);
+		assert_int_equal(s->conn->recv.msg->len,
+				 NBT_HDR_SIZE +
+				 SMBD_SMBDIRECT_MAX_FRAGMENTED_SIZE);
+	}
+}
+
+static void test_data_inconsistent_fragment(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[0x20];
+	NTSTATUS status;
+
+	s->conn->recv.granted = 4;
+
+	/*
+	 * 8 bytes now, 16 to follow
+	 */
+	build_data(buf, sizeof(buf), 1, 0, 0, 16,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'a');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_non_null(s->conn->recv.msg);
+
+	/*
+	 * The remaining length didn't go down
+	 */
+	build_data(buf, sizeof(buf), 1, 0, 0, 16,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'b');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/*
+	 * The message ends early
+	 */
+	build_data(buf, sizeof(buf), 1, 0, 0, 0,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'b');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/*
+	 * The remaining length wraps around
+	 */
+	build_data(buf, sizeof(buf), 1, 0, 0, 0xFFFFFFFF,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'b');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/*
+	 * Nothing was passed on to smbd
+	 */
+	assert_null(s->conn->deliver.queue);
+	assert_int_equal(s->conn->recv.msg->ofs, NBT_HDR_SIZE + 8);
+}
+
+static void test_data_reassembly(void **state)
+{
+	struct test_state *s = *state;
+	uint8_t buf[0x20];
+	uint8_t pdu[NBT_HDR_SIZE + 24];
+	uint8_t expected[24];
+	NTSTATUS status;
+	ssize_t n;
+
+	s->conn->recv.granted = 3;
+
+	build_data(buf, sizeof(buf), 1, 0, 0, 16,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'a');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+
+	build_data(buf, sizeof(buf), 1, 0, 0, 8,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'b');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_non_null(s->conn->recv.msg);
+
+	build_data(buf, sizeof(buf), 1, 0, 0, 0,
+		   SMB_DIRECT_DATA_OFFSET, 8, 'c');
+	status = smbd_smbdirect_data_received(s->conn, buf, sizeof(buf));
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_null(s->conn->recv.msg);
+	assert_null(s->conn->deliver.queue);
+	assert_int_equal(s->conn->deliver.queued, 0);
+
+	n = read(s->fds[1], pdu, sizeof(pdu));
+	assert_int_equal(n, sizeof(pdu));
+	assert_int_equal(smb_len_tcp(pdu), 24);
+	assert_int_equal(CVAL(pdu, 0), 0);
+
+	memset(expected, 'a', 8);
+	memset(expected + 8, 'b', 8);
+	memset(expected + 16, 'c', 8);
+	assert_memory_equal(pdu + NBT_HDR_SIZE, expected, sizeof(expected));
+}
+
+int main(int argc, char **argv)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_negotiate_truncated,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_negotiate_ok,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(
+			test_negotiate_small_receive_size,
+			setup, teardown),
+		cmocka_unit_test_setup_teardown(test_negotiate_bad_version,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(
+			test_negotiate_invalid_parameters,
+			setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_truncated,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_without_credit,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_credits,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_credits_overflow,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_bad_offset,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_length_overflow,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_remaining_overflow,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(
+			test_data_inconsistent_fragment,
+			setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_reassembly,
+						setup, teardown),
+	};
+
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -102,6 +102,9 @@ bool run_posix_symlink_parent_test(int dummy);
 bool run_posix_symlink_chmod_test(int dummy);
 bool run_posix_dir_default_acl_test(int dummy);
 bool run_case_insensitive_create(int dummy);
+bool run_case_insensitive_cache(int dummy);
+bool run_case_insensitive_bench(int dummy);
+bool run_case_insensitive_index(int dummy);
 bool run_posix_symlink_rename_test(int dummy);
 bool run_posix_symlink_getpathinfo_test(int dummy);
 bool run_posix_symlink_setpathinfo_test(int dummy);
@@ -166,6 +169,12 @@ bool run_messaging_fdpass2(int dummy);
 bool run_messaging_fdpass2a(int dummy);
 bool run_messaging_fdpass2b(int dummy);
 bool run_messaging_send_all(int dummy);
+bool run_messaging_send_multi(int dummy);
+bool run_messaging_ring_order(int dummy);
+bool run_messaging_ring_full(int dummy);
+bool run_messaging_ring_rx_gone(int dummy);
+bool run_messaging_ring_tx_gone(int dummy);
+bool run_messaging_ring_tx_closed(int dummy);
 bool run_oplock_cancel(int dummy);
 bool run_pthreadpool_tevent(int dummy);
 bool run_g_lock1(int dummy);
@@ -21,6 +21,9 @@
 #include "torture/proto.h"
 #include "system/filesys.h"
 #include "libsmb/libsmb.h"
+#include "lib/util/tevent_ntstatus.h"
+
+extern int torture_numops;
 
 /*
  * Regression test file creates on case insensitive file systems (e.g. OS/X)
@@ -78,3 +81,416 @@ done:
 	torture_close_connection(cli);
 	return NT_STATUS_IS_OK(status);
 }
+
+/*
+ * Case insensitive lookups from two connections, the stat cache
+ * (possibly shared between the smbds) must follow renames and
+ * re-creates with a different case.
+ *
+ * The tests below use NTCreateX or SMB2 CREATE, so they run over
+ * whatever protocol the connection negotiated.
+ */
+
+static NTSTATUS case_insensitive_ntcreate(struct cli_state *cli,
+					  const char *fname,
+					  uint32_t disposition,
+					  uint16_t *fnum)
+{
+	return cli_ntcreate(cli,
+			    fname,
+			    0,
+			    FILE_READ_DATA|FILE_WRITE_DATA,
+			    FILE_ATTRIBUTE_NORMAL,
+			    FILE_SHARE_READ|FILE_SHARE_WRITE,
+			    disposition,
+			    0,
+			    0,
+			    fnum,
+			    NULL);
+}
+
+static bool case_insensitive_open(struct cli_state *cli,
+				  const char *fname,
+				  NTSTATUS expected)
+{
+	uint16_t fnum;
+	NTSTATUS status;
+
+	status = case_insensitive_ntcreate(cli, fname, FILE_OPEN, &fnum);
+	if (!NT_STATUS_EQUAL(status, expected)) {
+		printf("open of %s returned %s, expected %s\n",
+		       fname,
+		       nt_errstr(status),
+		       nt_errstr(expected));
+		return false;
+	}
+	if (NT_STATUS_IS_OK(status)) {
+		cli_close(cli, fnum);
+	}
+	return true;
+}
+
+bool run_case_insensitive_cache(int dummy)
+{
+	struct cli_state *cli1 = NULL;
+	struct cli_state *cli2 = NULL;
+	const char *fname = "StatCacheTest.dat";
+	const char *renamed = "StatCacheTest.renamed";
+	uint16_t fnum;
+	NTSTATUS status;
+	bool ret = false;
+
+	printf("Starting case_insensitive_cache\n");
+
+	if (!torture_open_connection(&cli1, 0) ||
+	    !torture_open_connection(&cli2, 1)) {
+		return false;
+	}
+
+	cli_unlink(cli1, fname, FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_HIDDEN);
+	cli_unlink(cli1, renamed, FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_HIDDEN);
+
+	status = case_insensitive_ntcreate(cli1, fname, FILE_CREATE, &fnum);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("create of %s failed: %s\n", fname, nt_errstr(status));
+		goto done;
+	}
+	cli_close(cli1, fnum);
+
+	/*
+	 * Fill the cache from both connections
+	 */
+	if (!case_insensitive_open(cli1, "statcachetest.DAT", NT_STATUS_OK)) {
+		goto unlink;
+	}
+	if (!case_insensitive_open(cli2, "STATCACHETEST.dat", NT_STATUS_OK)) {
+		goto unlink;
+	}
+
+	status = cli_rename(cli2, "STATCACHETEST.DAT", renamed, false);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rename failed: %s\n", nt_errstr(status));
+		goto unlink;
+	}
+
+	if (!case_insensitive_open(cli1,
+				   "statcachetest.DAT",
+				   NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+		goto unlink;
+	}
+
+	/*
+	 * Re-create with a different case, the old cache entry
+	 * must not hide it
+	 */
+	status = case_insensitive_ntcreate(
+		cli2, "STATCACHETEST.DAT", FILE_CREATE, &fnum);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("re-create failed: %s\n", nt_errstr(status));
+		goto unlink;
+	}
+	cli_close(cli2, fnum);
+
+	if (!case_insensitive_open(cli1, "statcachetest.DAT", NT_STATUS_OK)) {
+		goto unlink;
+	}
+	if (!case_insensitive_open(cli1, "STATCACHETEST.RENAMED",
+				   NT_STATUS_OK)) {
+		goto unlink;
+	}
+
+	ret = true;
+unlink:
+	cli_unlink(cli1, fname, FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_HIDDEN);
+	cli_unlink(cli1, renamed, FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_HIDDEN);
+done:
+	torture_close_connection(cli1);
+	torture_close_connection(cli2);
+	return ret;
+}
+
+/*
+ * Create torture_numops files in one directory and report the create
+ * rate as the directory grows. Without help each create of a new name
+ * scans the whole directory for case variants. Also check that case
+ * variants of existing names are still found.
+ */
+
+bool run_case_insensitive_bench(int dummy)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct cli_state *cli = NULL;
+	const char *dname = "cibench";
+	struct timeval start, step;
+	uint32_t i, prev, report;
+	uint16_t fnum;
+	NTSTATUS status;
+	bool ret = false;
+
+	printf("Starting case_insensitive_bench with %d files\n",
+	       torture_numops);
+
+	if (!torture_open_connection(&cli, 0)) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	torture_deltree(cli, dname);
+
+	status = cli_mkdir(cli, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_mkdir failed: %s\n", nt_errstr(status));
+		goto done;
+	}
+
+	start = step = timeval_current();
+	prev = 0;
+	report = 10;
+
+	for (i = 0; i < (uint32_t)torture_numops; i++) {
+		char *fname = talloc_asprintf(
+			frame, "%s\\File%08"PRIu32".dat", dname, i);
+		char *variant = NULL;
+
+		if (fname == NULL) {
+			printf("talloc_asprintf failed\n");
+			goto deltree;
+		}
+
+		status = case_insensitive_ntcreate(
+			cli, fname, FILE_CREATE, &fnum);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("create of %s failed: %s\n",
+			       fname, nt_errstr(status));
+			goto deltree;
+		}
+		cli_close(cli, fnum);
+		TALLOC_FREE(fname);
+
+		if ((i + 1 != report) && (i + 1 != (uint32_t)torture_numops)) {
+			continue;
+		}
+
+		printf("%"PRIu32" files: %.0f creates/sec since %"PRIu32"\n",
+		       i + 1,
+		       (i + 1 - prev) / timeval_elapsed(&step),
+		       prev);
+
+		/*
+		 * The first and the last file must be found in any
+		 * case, and must not be created a second time.
+		 */
+		variant = talloc_asprintf(
+			frame, "%s\\FILE%08"PRIu32".DAT", dname, prev);
+		if (variant == NULL) {
+			printf("talloc_asprintf failed\n");
+			goto deltree;
+		}
+		if (!case_insensitive_open(cli, variant, NT_STATUS_OK)) {
+			goto deltree;
+		}
+		TALLOC_FREE(variant);
+
+		variant = talloc_asprintf(
+			frame, "%s\\file%08"PRIu32".dat", dname, i);
+		if (variant == NULL) {
+			printf("talloc_asprintf failed\n");
+			goto deltree;
+		}
+		status = case_insensitive_ntcreate(
+			cli, variant, FILE_CREATE, &fnum);
+		if (!NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+			printf("create of %s returned %s\n",
+			       variant, nt_errstr(status));
+			if (NT_STATUS_IS_OK(status)) {
+				cli_close(cli, fnum);
+			}
+			goto deltree;
+		}
+		TALLOC_FREE(variant);
+
+		prev = i + 1;
+		report *= 10;
+		step = timeval_current();
+	}
+
+	printf("%d creates took %.2f seconds\n",
+	       torture_numops, timeval_elapsed(&start));
+
+	ret = true;
+deltree:
+	torture_deltree(cli, dname);
+done:
+	torture_close_connection(cli);
+	TALLOC_FREE(frame);
+	return ret;
+}
+
+/*
+ * Create a name from each connection at the same time. An smbd that
+ * adds its own creates to its directory index must not miss the
+ * names the other smbd creates meanwhile.
+ */
+
+static bool case_insensitive_create_pair(struct tevent_context *ev,
+					 struct cli_state *cli1,
+					 const char *fname1,
+					 struct cli_state *cli2,
+					 const char *fname2)
+{
+	struct tevent_req *req1 = NULL;
+	struct tevent_req *req2 = NULL;
+	uint16_t fnum1, fnum2;
+	NTSTATUS status1, status2;
+	bool ok;
+
+	req1 = cli_ntcreate_send(talloc_tos(),
+				 ev,
+				 cli1,
+				 fname1,
+				 0,
+				 FILE_READ_DATA|FILE_WRITE_DATA,
+				 FILE_ATTRIBUTE_NORMAL,
+				 FILE_SHARE_READ|FILE_SHARE_WRITE,
+				 FILE_CREATE,
+				 0,
+				 SMB2_IMPERSONATION_IMPERSONATION,
+				 0);
+	req2 = cli_ntcreate_send(talloc_tos(),
+				 ev,
+				 cli2,
+				 fname2,
+				 0,
+				 FILE_READ_DATA|FILE_WRITE_DATA,
+				 FILE_ATTRIBUTE_NORMAL,
+				 FILE_SHARE_READ|FILE_SHARE_WRITE,
+				 FILE_CREATE,
+				 0,
+				 SMB2_IMPERSONATION_IMPERSONATION,
+				 0);
+	if ((req1 == NULL) || (req2 == NULL)) {
+		printf("cli_ntcreate_send failed\n");
+		TALLOC_FREE(req1);
+		TALLOC_FREE(req2);
+		return false;
+	}
+
+	ok = tevent_req_poll_ntstatus(req1, ev, &status1);
+	if (ok) {
+		status1 = cli_ntcreate_recv(req1, &fnum1, NULL);
+	}
+	TALLOC_FREE(req1);
+
+	ok = tevent_req_poll_ntstatus(req2, ev, &status2);
+	if (ok) {
+		status2 = cli_ntcreate_recv(req2, &fnum2, NULL);
+	}
+	TALLOC_FREE(req2);
+
+	if (NT_STATUS_IS_OK(status1)) {
+		cli_close(cli1, fnum1);
+	}
+	if (NT_STATUS_IS_OK(status2)) {
+		cli_close(cli2, fnum2);
+	}
+
+	if (!NT_STATUS_IS_OK(status1) || !NT_STATUS_IS_OK(status2)) {
+		printf("create of %s returned %s, %s returned %s\n",
+		       fname1, nt_errstr(status1),
+		       fname2, nt_errstr(status2));
+		return false;
+	}
+	return true;
+}
+
+bool run_case_insensitive_index(int dummy)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct tevent_context *ev = NULL;
+	struct cli_state *cli1 = NULL;
+	struct cli_state *cli2 = NULL;
+	const char *dname = "ciindex";
+	int i;
+	bool ret = false;
+
+	printf("Starting case_insensitive_index\n");
+
+	ev = samba_tevent_context_init(frame);
+	if (ev == NULL) {
+		printf("samba_tevent_context_init failed\n");
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	if (!torture_open_connection(&cli1, 0) ||
+	    !torture_open_connection(&cli2, 1)) {
+		TALLOC_FREE(frame);
+		return false;
+	}
+
+	torture_deltree(cli1, dname);
+
+	if (!NT_STATUS_IS_OK(cli_mkdir(cli1, dname))) {
+		printf("cli_mkdir failed\n");
+		goto done;
+	}
+
+	for (i = 0; i < torture_numops; i++) {
+		char *fname1 = NULL;
+		char *fname2 = NULL;
+		char *variant = NULL;
+		bool ok;
+
+		fname1 = talloc_asprintf(
+			frame, "%s\\One%08d.dat", dname, i);
+		fname2 = talloc_asprintf(
+			frame, "%s\\Two%08d.dat", dname, i);
+		if ((fname1 == NULL) || (fname2 == NULL)) {
+			printf("talloc_asprintf failed\n");
+			goto deltree;
+		}
+
+		ok = case_insensitive_create_pair(ev, cli1, fname1,
+						  cli2, fname2);
+		if (!ok) {
+			goto deltree;
+		}
+
+		/*
+		 * Each side has to see the other side's name
+		 */
+		variant = talloc_asprintf(
+			frame, "%s\\TWO%08d.DAT", dname, i);
+		if (variant == NULL) {
+			printf("talloc_asprintf failed\n");
+			goto deltree;
+		}
+		if (!case_insensitive_open(cli1, variant, NT_STATUS_OK)) {
+			goto deltree;
+		}
+		TALLOC_FREE(variant);
+
+		variant = talloc_asprintf(
+			frame, "%s\\one%08d.dat", dname, i);
+		if (variant == NULL) {
+			printf("talloc_asprintf failed\n");
+			goto deltree;
+		}
+		if (!case_insensitive_open(cli2, variant, NT_STATUS_OK)) {
+			goto deltree;
+		}
+		TALLOC_FREE(variant);
+
+		TALLOC_FREE(fname1);
+		TALLOC_FREE(fname2);
+	}
+
+	ret = true;
+deltree:
+	torture_deltree(cli1, dname);
+done:
+	torture_close_connection(cli1);
+	torture_close_connection(cli2);
+	TALLOC_FREE(frame);
+	return ret;
+}
@@ -0,0 +1,876 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Tests for the messaging_dgm shared memory rings
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "lib/util/tevent_unix.h"
+#include "messages.h"
+#include "lib/messaging/messages_dgm.h"
+#include "lib/async_req/async_sock.h"
+#include "lib/util/sys_rw.h"
+#include <sys/syscall.h>
+
+#define MSG_TORTURE_RING 0xF010
+
+/*
+ * A sender asks for a ring after 16 messages, the first messages
+ * always go through the socket.
+ */
+#define RING_SETUP_MSGS 32
+
+/*
+ * Every message carries its sequence number in the first 4 bytes,
+ * the rest is filled with the sequence number's low byte. In the
+ * "mixed" pattern some messages are too large for the ring and some
+ * carry a pipe with the low byte to read from, both have to go
+ * through the socket.
+ */
+struct ring_pattern {
+	bool mixed;
+	size_t msglen;
+};
+
+static size_t ring_msg_len(const struct ring_pattern *p, uint32_t seq)
+{
+	if (p->mixed && ((seq % 77) == 76)) {
+		return 20000;
+	}
+	return p->msglen;
+}
+
+static bool ring_msg_has_fd(const struct ring_pattern *p, uint32_t seq)
+{
+	return (p->mixed && ((seq % 50) == 49));
+}
+
+static bool ring_send_seq(struct messaging_context *msg_ctx,
+			  struct server_id dst,
+			  const struct ring_pattern *p,
+			  uint32_t seq)
+{
+	size_t len = ring_msg_len(p, seq);
+	uint8_t *buf = NULL;
+	struct iovec iov;
+	int pipe_fds[2] = { -1, -1 };
+	size_t num_fds = 0;
+	uint8_t c = seq;
+	NTSTATUS status;
+	int ret;
+
+	buf = talloc_array(talloc_tos(), uint8_t, len);
+	if (buf == NULL) {
+		fprintf(stderr, "talloc_array failed\n");
+		return false;
+	}
+	memset(buf, c, len);
+	memcpy(buf, &seq, sizeof(seq));
+	iov = (struct iovec) { .iov_base = buf, .iov_len = len };
+
+	if (ring_msg_has_fd(p, seq)) {
+		ret = pipe(pipe_fds);
+		if (ret == -1) {
+			perror("pipe failed");
+			TALLOC_FREE(buf);
+			return false;
+		}
+		if (sys_write(pipe_fds[1], &c, 1) != 1) {
+			perror("write to pipe failed");
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+			TALLOC_FREE(buf);
+			return false;
+		}
+		close(pipe_fds[1]);
+		num_fds = 1;
+	}
+
+	status = messaging_send_iov(msg_ctx, dst, MSG_TORTURE_RING, &iov, 1,
+				    pipe_fds, num_fds);
+	if (num_fds != 0) {
+		close(pipe_fds[0]);
+	}
+	TALLOC_FREE(buf);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "messaging_send_iov(%"PRIu32") failed: %s\n",
+			seq, nt_errstr(status));
+		return false;
+	}
+	return true;
+}
+
+static bool ring_send_range(struct messaging_context *msg_ctx,
+			    struct server_id dst,
+			    const struct ring_pattern *p,
+			    uint32_t first,
+			    uint32_t last)
+{
+	uint32_t seq;
+
+	for (seq = first; seq < last; seq++) {
+		bool ok = ring_send_seq(msg_ctx, dst, p, seq);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct ring_recv_state {
+	struct ring_pattern pattern;
+	uint32_t next_seq;
+	uint32_t wait_for;
+	unsigned errors;
+};
+
+/*
+ * The filter sees every message in the order messaging_dgm delivers
+ * it, before messages.c closes the fds. It only lets the read finish
+ * with the message we wait for.
+ */
+static bool ring_recv_filter(struct messaging_rec *rec, void *private_data)
+{
+	struct ring_recv_state *state = private_data;
+	uint32_t seq;
+	uint8_t c;
+	size_t i;
+
+	if (rec->msg_type != MSG_TORTURE_RING) {
+		return false;
+	}
+
+	if (rec->buf.length < sizeof(seq)) {
+		fprintf(stderr, "message too short: %zu\n", rec->buf.length);
+		state->errors += 1;
+		return false;
+	}
+	memcpy(&seq, rec->buf.data, sizeof(seq));
+
+	if (seq != state->next_seq) {
+		fprintf(stderr, "expected message %"PRIu32", got %"PRIu32"\n",
+			state->next_seq, seq);
+		state->errors += 1;
+	}
+	state->next_seq = seq + 1;
+
+	if (rec->buf.length != ring_msg_len(&state->pattern, seq)) {
+		fprintf(stderr, "message %"PRIu32" has length %zu\n",
+			seq, rec->buf.length);
+		state->errors += 1;
+	}
+	for (i = sizeof(seq); i < rec->buf.length; i++) {
+		if (rec->buf.data[i] != (uint8_t)seq) {
+			fprintf(stderr, "message %"PRIu32" corrupt\n", seq);
+			state->errors += 1;
+			break;
+		}
+	}
+
+	if (ring_msg_has_fd(&state->pattern, seq)) {
+		if (rec->num_fds != 1) {
+			fprintf(stderr, "message %"PRIu32" has %"PRIu8" fds\n",
+				seq, rec->num_fds);
+			state->errors += 1;
+		} else if ((sys_read(rec->fds[0], &c, 1) != 1) ||
+			   (c != (uint8_t)seq)) {
+			fprintf(stderr, "message %"PRIu32" has a bad fd\n",
+				seq);
+			state->errors += 1;
+		}
+	} else if (rec->num_fds != 0) {
+		fprintf(stderr, "message %"PRIu32" has unexpected fds\n", seq);
+		state->errors += 1;
+	}
+
+	return (state->next_seq == state->wait_for);
+}
+
+static bool ring_recv(struct tevent_context *ev,
+		      struct messaging_context *msg_ctx,
+		      struct ring_recv_state *state,
+		      uint32_t wait_for)
+{
+	struct tevent_req *req = NULL;
+	struct messaging_rec *rec = NULL;
+	bool ok;
+	int ret;
+
+	state->wait_for = wait_for;
+
+	req = messaging_filtered_read_send(talloc_tos(), ev, msg_ctx,
+					   ring_recv_filter, state);
+	if (req == NULL) {
+		fprintf(stderr, "messaging_filtered_read_send failed\n");
+		return false;
+	}
+	ok = tevent_req_set_endtime(req, ev, timeval_current_ofs(30, 0));
+	if (!ok) {
+		fprintf(stderr, "tevent_req_set_endtime failed\n");
+		TALLOC_FREE(req);
+		return false;
+	}
+	ok = tevent_req_poll(req, ev);
+	if (!ok) {
+		fprintf(stderr, "tevent_req_poll failed\n");
+		TALLOC_FREE(req);
+		return false;
+	}
+	ret = messaging_filtered_read_recv(req, talloc_tos(), &rec);
+	TALLOC_FREE(req);
+	if (ret != 0) {
+		fprintf(stderr, "messaging_filtered_read_recv failed: %s, "
+			"waiting for message %"PRIu32"\n",
+			strerror(ret), state->next_seq);
+		return false;
+	}
+	TALLOC_FREE(rec);
+
+	if (state->errors != 0) {
+		fprintf(stderr, "%u errors\n", state->errors);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * The rings are memfds, see messaging_dgm_ring_request()
+ */
+static int ring_count_mappings(void)
+{
+	char line[1024];
+	int count = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/maps", "r");
+	if (f == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strstr(line, "memfd:messaging_dgm_ring") != NULL) {
+			count += 1;
+		}
+	}
+	fclose(f);
+
+	return count;
+}
+
+static void ring_tick(struct tevent_context *ev,
+		      struct tevent_timer *te,
+		      struct timeval current_time,
+		      void *private_data)
+{
+	bool *fired = private_data;
+	*fired = true;
+}
+
+/*
+ * Run one event loop iteration, waiting no longer than until "end"
+ */
+static bool ring_loop_once(struct tevent_context *ev, struct timeval end)
+{
+	struct tevent_timer *te = NULL;
+	bool fired = false;
+	int ret;
+
+	te = tevent_add_timer(ev, ev, end, ring_tick, &fired);
+	if (te == NULL) {
+		fprintf(stderr, "tevent_add_timer failed\n");
+		return false;
+	}
+	ret = tevent_loop_once(ev);
+	if (!fired) {
+		TALLOC_FREE(te);
+	}
+	if (ret != 0) {
+		fprintf(stderr, "tevent_loop_once failed\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Run the event loop until we have "num" rings mapped
+ */
+static bool ring_wait_mappings(struct tevent_context *ev, int num)
+{
+	struct timeval end = timeval_current_ofs(10, 0);
+	int count;
+
+	while ((count = ring_count_mappings()) != num) {
+		bool ok;
+
+		if (timeval_expired(&end)) {
+			fprintf(stderr, "Expected %d rings, have %d\n",
+				num, count);
+			return false;
+		}
+
+		ok = ring_loop_once(ev, timeval_current_ofs_msec(100));
+		if (!ok) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool ring_reap_child(pid_t child)
+{
+	int status;
+	pid_t pid;
+
+	pid = waitpid(child, &status, 0);
+	if (pid != child) {
+		perror("waitpid failed");
+		return false;
+	}
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "child failed: status 0x%x\n", status);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Run the event loop until the child closed its end of exit_fd,
+ * then check it succeeded
+ */
+static bool ring_wait_child(struct tevent_context *ev,
+			    pid_t child,
+			    int exit_fd)
+{
+	struct tevent_req *req = NULL;
+	int err;
+	bool ok;
+
+	req = wait_for_read_send(ev, ev, exit_fd, false);
+	if (req == NULL) {
+		fprintf(stderr, "wait_for_read_send failed\n");
+		return false;
+	}
+	ok = tevent_req_set_endtime(req, ev, timeval_current_ofs(30, 0));
+	if (!ok) {
+		fprintf(stderr, "tevent_req_set_endtime failed\n");
+		TALLOC_FREE(req);
+		return false;
+	}
+	ok = tevent_req_poll_unix(req, ev, &err);
+	if (!ok) {
+		fprintf(stderr, "tevent_req_poll_unix failed: %s\n",
+			strerror(err));
+		TALLOC_FREE(req);
+		return false;
+	}
+	ok = wait_for_read_recv(req, &err);
+	TALLOC_FREE(req);
+	if (!ok) {
+		fprintf(stderr, "Waiting for the child failed: %s\n",
+			strerror(err));
+		kill(child, SIGKILL);
+	}
+
+	return ring_reap_child(child) && ok;
+}
+
+static bool ring_pipe_wait(int fd)
+{
+	char c;
+	return (sys_read(fd, &c, 1) == 1);
+}
+
+/*
+ * Like ring_pipe_wait(), but keep the event loop running: Fragments
+ * the socket did not take right away are sent from there.
+ */
+static bool ring_pipe_wait_loop(struct tevent_context *ev, int fd)
+{
+	struct tevent_req *req = NULL;
+	int err;
+	bool ok;
+
+	req = wait_for_read_send(ev, ev, fd, false);
+	if (req == NULL) {
+		fprintf(stderr, "wait_for_read_send failed\n");
+		return false;
+	}
+	ok = tevent_req_set_endtime(req, ev, timeval_current_ofs(30, 0));
+	if (!ok) {
+		fprintf(stderr, "tevent_req_set_endtime failed\n");
+		TALLOC_FREE(req);
+		return false;
+	}
+	ok = tevent_req_poll_unix(req, ev, &err);
+	if (ok) {
+		ok = wait_for_read_recv(req, &err);
+	}
+	TALLOC_FREE(req);
+	if (!ok) {
+		fprintf(stderr, "Waiting for the pipe failed: %s\n",
+			strerror(err));
+		return false;
+	}
+	return ring_pipe_wait(fd);
+}
+
+/*
+ * Run the event loop for a while. The peer has read everything we
+ * sent through the socket, but we might not have seen the queue's
+ * completions yet. Until we do, new messages wait for the queue
+ * instead of going into the ring.
+ */
+static bool ring_settle(struct tevent_context *ev)
+{
+	struct timeval end = timeval_current_ofs_msec(100);
+
+	while (!timeval_expired(&end)) {
+		bool ok = ring_loop_once(ev, end);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool ring_pipe_signal(int fd)
+{
+	char c = 0;
+	return (sys_write(fd, &c, 1) == 1);
+}
+
+/*
+ * Set up the messaging context with rings enabled. Returns false
+ * with *skip set if this system can't do rings.
+ */
+static struct messaging_context *ring_messaging_init(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev, bool *skip)
+{
+	struct messaging_context *msg_ctx = NULL;
+	int ret;
+
+	*skip = false;
+
+	msg_ctx = messaging_init(mem_ctx, ev);
+	if (msg_ctx == NULL) {
+		fprintf(stderr, "messaging_init failed\n");
+		return NULL;
+	}
+
+	ret = messaging_dgm_enable_rings();
+	if (ret == ENOSYS) {
+		*skip = true;
+		TALLOC_FREE(msg_ctx);
+		return NULL;
+	}
+	if (ret != 0) {
+		fprintf(stderr, "messaging_dgm_enable_rings failed: %s\n",
+			strerror(ret));
+		TALLOC_FREE(msg_ctx);
+		return NULL;
+	}
+
+#ifdef SYS_pidfd_open
+	ret = syscall(SYS_pidfd_open, getpid(), 0);
+	if (ret == -1) {
+		/*
+		 * Built with rings, but the kernel can't watch peers
+		 */
+		*skip = true;
+		TALLOC_FREE(msg_ctx);
+		return NULL;
+	}
+	close(ret);
+#endif
+
+	return msg_ctx;
+}
+
+static bool ring_child_reinit(struct messaging_context *msg_ctx)
+{
+	NTSTATUS status;
+	int ret;
+
+	status = messaging_reinit(msg_ctx);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "messaging_reinit failed: %s\n",
+			nt_errstr(status));
+		return false;
+	}
+	ret = messaging_dgm_enable_rings();
+	if (ret != 0) {
+		fprintf(stderr, "messaging_dgm_enable_rings failed: %s\n",
+			strerror(ret));
+		return false;
+	}
+	return true;
+}
+
+struct ring_test {
+	TALLOC_CTX *frame;
+	struct tevent_context *ev;
+	struct messaging_context *msg_ctx;
+	struct server_id child_id;
+	pid_t child;
+	int to_child;
+	int from_child;
+	int exit_fd;
+};
+
+/*
+ * Fork a child with its own messaging context. The parent and the
+ * child talk through the pipes, the parent sees the child exit
+ * through exit_fd.
+ */
+static bool ring_test_start(struct ring_test *t, bool *skip)
+{
+	int down[2], up[2], exit_pipe[2];
+	int ret;
+
+	*t = (struct ring_test) {
+		.frame = talloc_stackframe(),
+		.to_child = -1, .from_child = -1, .exit_fd = -1,
+	};
+
+	t->ev = samba_tevent_context_init(t->frame);
+	if (t->ev == NULL) {
+		fprintf(stderr, "tevent_context_init failed\n");
+		return false;
+	}
+
+	t->msg_ctx = ring_messaging_init(t->frame, t->ev, skip);
+	if (t->msg_ctx == NULL) {
+		return false;
+	}
+
+	ret = pipe(down);
+	if (ret == -1) {
+		perror("pipe failed");
+		return false;
+	}
+	ret = pipe(up);
+	if (ret == -1) {
+		perror("pipe failed");
+		return false;
+	}
+	ret = pipe(exit_pipe);
+	if (ret == -1) {
+		perror("pipe failed");
+		return false;
+	}
+
+	t->child = fork();
+	if (t->child == -1) {
+		perror("fork failed");
+		return false;
+	}
+
+	if (t->child == 0) {
+		close(down[1]);
+		close(up[0]);
+		close(exit_pipe[0]);
+		t->to_child = up[1];	/* the child's way up */
+		t->from_child = down[0];
+		if (!ring_child_reinit(t->msg_ctx)) {
+			exit(1);
+		}
+		return true;
+	}
+
+	close(down[0]);
+	close(up[1]);
+	close(exit_pipe[1]);
+	t->to_child = down[1];
+	t->from_child = up[0];
+	t->exit_fd = exit_pipe[0];
+
+	t->child_id = messaging_server_id(t->msg_ctx);
+	t->child_id.pid = t->child;
+
+	return true;
+}
+
+static void ring_test_done(struct ring_test *t)
+{
+	if (t->to_child != -1) {
+		close(t->to_child);
+	}
+	if (t->from_child != -1) {
+		close(t->from_child);
+	}
+	if (t->exit_fd != -1) {
+		close(t->exit_fd);
+	}
+	TALLOC_FREE(t->frame);
+}
+
+/*
+ * Messages through the ring, large messages and messages with fds
+ * through the socket must arrive in the order they were sent
+ */
+
+#define RING_ORDER_MSGS 3000
+
+bool run_messaging_ring_order(int dummy)
+{
+	struct ring_pattern pattern = { .mixed = true, .msglen = 64 };
+	struct ring_test t;
+	bool skip = false;
+	bool ok;
+
+	ok = ring_test_start(&t, &skip);
+	if (!ok) {
+		ring_test_done(&t);
+		if (skip) {
+			printf("No shared memory rings, skipping\n");
+			return true;
+		}
+		return false;
+	}
+
+	if (t.child == 0) {
+		struct ring_recv_state state = { .pattern = pattern };
+
+		ok = ring_pipe_signal(t.to_child);
+		ok = ok && ring_recv(t.ev, t.msg_ctx, &state, RING_ORDER_MSGS);
+		exit(ok ? 0 : 1);
+	}
+
+	ok = ring_pipe_wait(t.from_child);
+	ok = ok && ring_send_range(t.msg_ctx, t.child_id, &pattern,
+				   0, RING_SETUP_MSGS);
+	ok = ok && ring_wait_mappings(t.ev, 1);
+	ok = ok && ring_send_range(t.msg_ctx, t.child_id, &pattern,
+				   RING_SETUP_MSGS, RING_ORDER_MSGS);
+
+	/*
+	 * Whatever didn't fit into the ring is sent
+	 * while we wait for the child
+	 */
+	ok &= ring_wait_child(t.ev, t.child, t.exit_fd);
+
+	ring_test_done(&t);
+	return ok;
+}
+
+/*
+ * Fill the ring while the receiver is busy. The sender has to
+ * hold back messages until the receiver kicks it through tx_wakeup.
+ */
+
+#define RING_FULL_MSGS 2000
+
+bool run_messaging_ring_full(int dummy)
+{
+	struct ring_pattern pattern = { .msglen = 1024 };
+	struct ring_test t;
+	bool skip = false;
+	bool ok;
+
+	ok = ring_test_start(&t, &skip);
+	if (!ok) {
+		ring_test_done(&t);
+		if (skip) {
+			printf("No shared memory rings, skipping\n");
+			return true;
+		}
+		return false;
+	}
+
+	if (t.child == 0) {
+		struct ring_recv_state state = { .pattern = pattern };
+
+		ok = ring_pipe_signal(t.to_child);
+		ok = ok && ring_recv(t.ev, t.msg_ctx, &state,
+				     RING_SETUP_MSGS);
+		ok = ok && ring_pipe_signal(t.to_child);
+
+		/*
+		 * Sleep while the parent fills the ring
+		 */
+		ok = ok && ring_pipe_wait(t.from_child);
+
+		ok = ok && ring_recv(t.ev, t.msg_ctx, &state,
+				     RING_FULL_MSGS);
+		exit(ok ? 0 : 1);
+	}
+
+	ok = ring_pipe_wait(t.from_child);
+	ok = ok && ring_send_range(t.msg_ctx, t.child_id, &pattern,
+				   0, RING_SETUP_MSGS);
+	ok = ok && ring_wait_mappings(t.ev, 1);
+	ok = ok && ring_pipe_wait_loop(t.ev, t.from_child);
+
+	/*
+	 * 2 MB don't fit into the 64k ring
+	 */
+	ok = ok && ring_send_range(t.msg_ctx, t.child_id, &pattern,
+				   RING_SETUP_MSGS, RING_FULL_MSGS);
+	ok = ok && ring_pipe_signal(t.to_child);
+
+	/*
+	 * The held back messages have to go out well before the
+	 * 60 second timeout that drops them
+	 */
+	ok &= ring_wait_child(t.ev, t.child, t.exit_fd);
+
+	ring_test_done(&t);
+	return ok;
+}
+
+/*
+ * The receiver dies without cleaning up, the sender has to unmap the
+ * ring when the receiver's pidfd fires
+ */
+
+bool run_messaging_ring_rx_gone(int dummy)
+{
+	struct ring_pattern pattern = { .msglen = 64 };
+	struct ring_test t;
+	bool skip = false;
+	bool ok;
+
+	ok = ring_test_start(&t, &skip);
+	if (!ok) {
+		ring_test_done(&t);
+		if (skip) {
+			printf("No shared memory rings, skipping\n");
+			return true;
+		}
+		return false;
+	}
+
+	if (t.child == 0) {
+		struct ring_recv_state state = { .pattern = pattern };
+
+		ok = ring_pipe_signal(t.to_child);
+		ok = ok && ring_recv(t.ev, t.msg_ctx, &state,
+				     RING_SETUP_MSGS);
+		ok = ok && ring_pipe_wait(t.from_child);
+		_exit(ok ? 0 : 1);
+	}
+
+	ok = ring_pipe_wait(t.from_child);
+	ok = ok && ring_send_range(t.msg_ctx, t.child_id, &pattern,
+				   0, RING_SETUP_MSGS);
+	ok = ok && ring_wait_mappings(t.ev, 1);
+	ok = ok && ring_pipe_signal(t.to_child);
+	ok &= ring_wait_child(t.ev, t.child, t.exit_fd);
+	ok = ok && ring_wait_mappings(t.ev, 0);
+
+	ring_test_done(&t);
+	return ok;
+}
+
+/*
+ * The sender leaves messages in the ring and goes away. The receiver
+ * has to deliver them and then unmap the ring. With "closed" the
+ * sender shuts down messaging and stays around, so the receiver has
+ * to notice tx_closed, otherwise it notices the sender's pidfd.
+ */
+
+#define RING_TX_GONE_MSGS 132
+
+static bool run_messaging_ring_tx_gone_int(bool closed)
+{
+	struct ring_pattern pattern = { .msglen = 64 };
+	struct ring_recv_state state = { .pattern = pattern };
+	struct ring_test t;
+	bool skip = false;
+	bool ok;
+
+	ok = ring_test_start(&t, &skip);
+	if (!ok) {
+		ring_test_done(&t);
+		if (skip) {
+			printf("No shared memory rings, skipping\n");
+			return true;
+		}
+		return false;
+	}
+
+	if (t.child == 0) {
+		struct server_id parent_id = messaging_server_id(t.msg_ctx);
+
+		parent_id.pid = getppid();
+
+		ok = ring_pipe_wait(t.from_child);
+		ok = ok && ring_send_range(t.msg_ctx, parent_id, &pattern,
+					   0, RING_SETUP_MSGS);
+		ok = ok && ring_wait_mappings(t.ev, 1);
+		ok = ok && ring_pipe_wait_loop(t.ev, t.from_child);
+		ok = ok && ring_settle(t.ev);
+
+		/*
+		 * The parent does not read now, these stay in the ring
+		 */
+		ok = ok && ring_send_range(t.msg_ctx, parent_id, &pattern,
+					   RING_SETUP_MSGS,
+					   RING_TX_GONE_MSGS);
+		if (!ok) {
+			_exit(1);
+		}
+
+		if (!closed) {
+			ring_pipe_signal(t.to_child);
+			_exit(0);
+		}
+
+		TALLOC_FREE(t.msg_ctx);
+		ok = (ring_count_mappings() == 0);
+		ok = ok && ring_pipe_signal(t.to_child);
+		ok = ok && ring_pipe_wait(t.from_child);
+		exit(ok ? 0 : 1);
+	}
+
+	ok = ring_pipe_signal(t.to_child);
+	ok = ok && ring_recv(t.ev, t.msg_ctx, &state, RING_SETUP_MSGS);
+	ok = ok && (ring_count_mappings() == 1);
+	ok = ok && ring_pipe_signal(t.to_child);
+	ok = ok && ring_pipe_wait(t.from_child);
+
+	if (!closed) {
+		/*
+		 * Don't run the event loop yet, without a reader
+		 * waiting the messages from the ring would be dropped
+		 */
+		ok &= ring_reap_child(t.child);
+	}
+
+	ok = ok && ring_recv(t.ev, t.msg_ctx, &state, RING_TX_GONE_MSGS);
+	ok = ok && ring_wait_mappings(t.ev, 0);
+
+	if (closed) {
+		/*
+		 * The child is still alive, so it was tx_closed
+		 */
+		ok &= ring_pipe_signal(t.to_child);
+		ok &= ring_wait_child(t.ev, t.child, t.exit_fd);
+	}
+
+	ring_test_done(&t);
+	return ok;
+}
+
+bool run_messaging_ring_tx_gone(int dummy)
+{
+	return run_messaging_ring_tx_gone_int(false);
+}
+
+bool run_messaging_ring_tx_closed(int dummy)
+{
+	return run_messaging_ring_tx_gone_int(true);
+}
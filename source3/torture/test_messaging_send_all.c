@@ -1,6 +1,6 @@
 /*
  * Unix SMB/CIFS implementation.
- * Test for a messaging_send_all bug
+ * Test for a messaging_send_all bug and messaging_send_iov_multi
  * Copyright (C) Volker Lendecke 2017
  *
  * This program is free software; you can redistribute it and/or modify
@@ -277,3 +277,125 @@ bool run_messaging_send_all(int dummy)
 
 	return true;
 }
+
+bool run_messaging_send_multi(int dummy)
+{
+	struct tevent_context *ev = NULL;
+	struct messaging_context *msg_ctx = NULL;
+	int exit_pipe[2];
+	pid_t children[MAX(5, torture_nprocs)];
+	struct server_id dsts[ARRAY_SIZE(children) + 1];
+	int errors[ARRAY_SIZE(dsts)];
+	struct tevent_req *req;
+	pid_t dead;
+	size_t i;
+	bool ok;
+	int ret, err;
+
+	ev = samba_tevent_context_init(talloc_tos());
+	if (ev == NULL) {
+		fprintf(stderr, "tevent_context_init failed\n");
+		return false;
+	}
+	msg_ctx = messaging_init(ev, ev);
+	if (msg_ctx == NULL) {
+		fprintf(stderr, "messaging_init failed\n");
+		return false;
+	}
+	ret = pipe(exit_pipe);
+	if (ret != 0) {
+		perror("parent: pipe failed for exit_pipe");
+		return false;
+	}
+
+	for (i=0; i<ARRAY_SIZE(children); i++) {
+		children[i] = fork_responder(msg_ctx, exit_pipe);
+		if (children[i] == -1) {
+			fprintf(stderr, "fork_responder(%zu) failed\n", i);
+			return false;
+		}
+		dsts[i] = pid_to_procid(children[i]);
+	}
+
+	/*
+	 * A process without a messaging socket must fail on its own
+	 */
+	dead = fork();
+	if (dead == -1) {
+		perror("fork failed");
+		return false;
+	}
+	if (dead == 0) {
+		_exit(0);
+	}
+	waitpid(dead, NULL, 0);
+	dsts[ARRAY_SIZE(children)] = pid_to_procid(dead);
+
+	req = collect_pong_send(ev, ev, msg_ctx, children,
+				ARRAY_SIZE(children));
+	if (req == NULL) {
+		perror("collect_pong failed");
+		return false;
+	}
+
+	ok = tevent_req_set_endtime(req, ev,
+				    tevent_timeval_current_ofs(10, 0));
+	if (!ok) {
+		perror("tevent_req_set_endtime failed");
+		return false;
+	}
+
+	ret = messaging_send_iov_multi(msg_ctx, dsts, NULL, ARRAY_SIZE(dsts),
+				       MSG_PING, NULL, 0, errors);
+	if (ret != 0) {
+		fprintf(stderr, "messaging_send_iov_multi failed: %s\n",
+			strerror(ret));
+		return false;
+	}
+
+	for (i=0; i<ARRAY_SIZE(children); i++) {
+		if (errors[i] != 0) {
+			fprintf(stderr, "send to %d failed: %s\n",
+				(int)children[i], strerror(errors[i]));
+			return false;
+		}
+	}
+	if (errors[ARRAY_SIZE(children)] != ENOENT) {
+		fprintf(stderr, "send to dead process returned %s\n",
+			strerror(errors[ARRAY_SIZE(children)]));
+		return false;
+	}
+
+	ok = tevent_req_poll_unix(req, ev, &err);
+	if (!ok) {
+		perror("tevent_req_poll_unix failed");
+		return false;
+	}
+
+	ret = collect_pong_recv(req);
+	TALLOC_FREE(req);
+
+	if (ret != 0) {
+		fprintf(stderr, "collect_pong_send returned %s\n",
+			strerror(ret));
+		return false;
+	}
+
+	close(exit_pipe[1]);
+
+	for (i=0; i<ARRAY_SIZE(children); i++) {
+		pid_t child;
+		int status;
+
+		do {
+			child = waitpid(children[i], &status, 0);
+		} while ((child == -1) && (errno == EINTR));
+
+		if (child != children[i]) {
+			printf("waitpid(%d) failed\n", children[i]);
+			return false;
+		}
+	}
+
+	return true;
+}
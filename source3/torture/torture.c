@@ -3714,6 +3714,362 @@ done:
 	return ret;
 }
 
+/*
+ * Check a byte that cli1 holds a write lock on and the free byte next to it
+ * from a second connection: Locking the first must fail, locking and
+ * writing the second must succeed.
+ */
+static bool lock_bench_probe(struct cli_state *cli2,
+			     uint16_t fnum2,
+			     uint32_t locked)
+{
+	uint8_t data = 0;
+	NTSTATUS status;
+
+	status = cli_lock32(cli2, fnum2, locked, 1, 0, WRITE_LOCK);
+	if (NT_STATUS_IS_OK(status)) {
+		printf("lock on %"PRIu32" succeeded! This is a locking bug\n",
+		       locked);
+		return false;
+	}
+
+	status = cli_lock32(cli2, fnum2, locked + 1, 1, 0, WRITE_LOCK);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("lock on %"PRIu32" failed (%s)\n",
+		       locked + 1, nt_errstr(status));
+		return false;
+	}
+
+	status = cli_writeall(cli2, fnum2, 0, &data, locked + 1, 1, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("write to %"PRIu32" failed (%s)\n",
+		       locked + 1, nt_errstr(status));
+		return false;
+	}
+
+	status = cli_unlock(cli2, fnum2, locked + 1, 1);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("unlock of %"PRIu32" failed (%s)\n",
+		       locked + 1, nt_errstr(status));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Take torture_numops single byte locks on one file, the way database
+ * applications lock records downwards from a high offset, and report
+ * the lock rate as the number of locks grows. Run with -o 100000 to
+ * see how the server scales with many locks on a single file.
+ */
+static bool run_lock_bench(int dummy)
+{
+	struct cli_state *cli1 = NULL, *cli2 = NULL;
+	const char *fname = "\\lockbench.lck";
+	const uint32_t top = 0x7ffffffe;
+	uint16_t fnum1, fnum2;
+	struct timeval start, step;
+	uint32_t i, prev, report;
+	NTSTATUS status;
+
+	if (!torture_open_connection(&cli1, 0) ||
+	    !torture_open_connection(&cli2, 1)) {
+		return false;
+	}
+	smbXcli_conn_set_sockopt(cli1->conn, sockops);
+	smbXcli_conn_set_sockopt(cli2->conn, sockops);
+
+	printf("starting lock bench with %d locks\n", torture_numops);
+
+	cli_unlink(cli1, fname, FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+
+	status = cli_openx(cli1, fname, O_RDWR|O_CREAT|O_EXCL, DENY_NONE,
+			   &fnum1);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("open of %s failed (%s)\n", fname, nt_errstr(status));
+		return false;
+	}
+
+	status = cli_openx(cli2, fname, O_RDWR, DENY_NONE, &fnum2);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("open2 of %s failed (%s)\n", fname, nt_errstr(status));
+		return false;
+	}
+
+	start = step = timeval_current();
+	prev = 0;
+	report = 10;
+
+	for (i = 0; i < (uint32_t)torture_numops; i++) {
+		uint32_t ofs = top - i * 2;
+
+		status = cli_lock32(cli1, fnum1, ofs, 1, 0, WRITE_LOCK);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("lock %"PRIu32" at %"PRIu32" failed (%s)\n",
+			       i, ofs, nt_errstr(status));
+			return false;
+		}
+
+		if ((i + 1 != report) && (i + 1 != (uint32_t)torture_numops)) {
+			continue;
+		}
+
+		printf("%"PRIu32" locks: %.0f locks/sec since %"PRIu32"\n",
+		       i + 1,
+		       (i + 1 - prev) / timeval_elapsed(&step),
+		       prev);
+
+		/*
+		 * Conflicts must be found at both ends of the range
+		 */
+		if (!lock_bench_probe(cli2, fnum2, top) ||
+		    !lock_bench_probe(cli2, fnum2, ofs)) {
+			return false;
+		}
+
+		prev = i + 1;
+		report *= 10;
+		step = timeval_current();
+	}
+
+	printf("%d locks took %.2f seconds\n",
+	       torture_numops, timeval_elapsed(&start));
+
+	start = timeval_current();
+
+	for (i = 0; i < (uint32_t)torture_numops; i++) {
+		uint32_t ofs = top - i * 2;
+
+		status = cli_unlock(cli1, fnum1, ofs, 1);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("unlock %"PRIu32" at %"PRIu32" failed (%s)\n",
+			       i, ofs, nt_errstr(status));
+			return false;
+		}
+	}
+
+	printf("%d unlocks took %.2f seconds\n",
+	       torture_numops, timeval_elapsed(&start));
+
+	status = cli_lock32(cli2, fnum2, top, 1, 0, WRITE_LOCK);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("lock after unlock failed (%s)\n", nt_errstr(status));
+		return false;
+	}
+
+	status = cli_close(cli2, fnum2);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("close2 failed (%s)\n", nt_errstr(status));
+		return false;
+	}
+
+	status = cli_close(cli1, fnum1);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("close1 failed (%s)\n", nt_errstr(status));
+		return false;
+	}
+
+	status = cli_unlink(cli1, fname,
+			    FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("unlink failed (%s)\n", nt_errstr(status));
+		return false;
+	}
+
+	if (!torture_close_connection(cli1)) {
+		return false;
+	}
+
+	if (!torture_close_connection(cli2)) {
+		return false;
+	}
+
+	printf("finished lock bench\n");
+
+	return true;
+}
+
+struct open_bench_op {
+	size_t *pending;
+	NTSTATUS status;
+	uint16_t fnum;
+};
+
+static void open_bench_open_done(struct tevent_req *subreq)
+{
+	struct open_bench_op *op = tevent_req_callback_data(
+		subreq, struct open_bench_op);
+
+	op->status = cli_ntcreate_recv(subreq, &op->fnum, NULL);
+	TALLOC_FREE(subreq);
+	*op->pending -= 1;
+}
+
+static void open_bench_close_done(struct tevent_req *subreq)
+{
+	struct open_bench_op *op = tevent_req_callback_data(
+		subreq, struct open_bench_op);
+
+	op->status = cli_close_recv(subreq);
+	TALLOC_FREE(subreq);
+	*op->pending -= 1;
+}
+
+/*
+ * Open one file from torture_nprocs connections at the same time
+ * with compatible share modes, the way login scripts and shared
+ * executables are opened, then close all handles again. Report the
+ * open and close rates over torture_numops rounds. Run with -N 1000
+ * to see how the server copes with many concurrent openers of a
+ * single file.
+ */
+static bool run_open_bench(int dummy)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct tevent_context *ev = NULL;
+	struct cli_state **clis = NULL;
+	struct open_bench_op *ops = NULL;
+	const char *fname = "\\openbench.dat";
+	struct timeval start;
+	double open_secs = 0.0, close_secs = 0.0;
+	size_t pending;
+	uint16_t fnum;
+	int i, round;
+	NTSTATUS status;
+	bool ret = false;
+
+	printf("starting open bench with %d openers and %d rounds\n",
+	       torture_nprocs, torture_numops);
+
+	ev = samba_tevent_context_init(frame);
+	clis = talloc_zero_array(frame, struct cli_state *, torture_nprocs);
+	ops = talloc_zero_array(frame, struct open_bench_op, torture_nprocs);
+	if ((ev == NULL) || (clis == NULL) || (ops == NULL)) {
+		printf("talloc failed\n");
+		goto done;
+	}
+
+	for (i = 0; i < torture_nprocs; i++) {
+		if (!torture_open_connection(&clis[i], i)) {
+			goto done;
+		}
+		smbXcli_conn_set_sockopt(clis[i]->conn, sockops);
+		ops[i].pending = &pending;
+	}
+
+	cli_unlink(clis[0], fname, FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+
+	status = cli_openx(clis[0], fname, O_RDWR|O_CREAT|O_EXCL, DENY_NONE,
+			   &fnum);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("create of %s failed (%s)\n", fname, nt_errstr(status));
+		goto done;
+	}
+	status = cli_close(clis[0], fnum);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("close of %s failed (%s)\n", fname, nt_errstr(status));
+		goto done;
+	}
+
+	for (round = 0; round < torture_numops; round++) {
+		start = timeval_current();
+		pending = torture_nprocs;
+
+		for (i = 0; i < torture_nprocs; i++) {
+			struct tevent_req *subreq = NULL;
+
+			subreq = cli_ntcreate_send(
+				frame, ev, clis[i], fname, 0,
+				FILE_READ_DATA|FILE_READ_ATTRIBUTES,
+				FILE_ATTRIBUTE_NORMAL,
+				FILE_SHARE_READ|FILE_SHARE_WRITE|
+				FILE_SHARE_DELETE,
+				FILE_OPEN, 0,
+				SMB2_IMPERSONATION_IMPERSONATION, 0);
+			if (subreq == NULL) {
+				printf("cli_ntcreate_send failed\n");
+				goto done;
+			}
+			tevent_req_set_callback(
+				subreq, open_bench_open_done, &ops[i]);
+		}
+		while (pending != 0) {
+			if (tevent_loop_once(ev) != 0) {
+				printf("tevent_loop_once failed\n");
+				goto done;
+			}
+		}
+		open_secs += timeval_elapsed(&start);
+
+		for (i = 0; i < torture_nprocs; i++) {
+			if (!NT_STATUS_IS_OK(ops[i].status)) {
+				printf("open %d in round %d failed (%s)\n",
+				       i, round, nt_errstr(ops[i].status));
+				goto done;
+			}
+		}
+
+		start = timeval_current();
+		pending = torture_nprocs;
+
+		for (i = 0; i < torture_nprocs; i++) {
+			struct tevent_req *subreq = NULL;
+
+			subreq = cli_close_send(frame, ev, clis[i], ops[i].fnum);
+			if (subreq == NULL) {
+				printf("cli_close_send failed\n");
+				goto done;
+			}
+			tevent_req_set_callback(
+				subreq, open_bench_close_done, &ops[i]);
+		}
+		while (pending != 0) {
+			if (tevent_loop_once(ev) != 0) {
+				printf("tevent_loop_once failed\n");
+				goto done;
+			}
+		}
+		close_secs += timeval_elapsed(&start);
+
+		for (i = 0; i < torture_nprocs; i++) {
+			if (!NT_STATUS_IS_OK(ops[i].status)) {
+				printf("close %d in round %d failed (%s)\n",
+				       i, round, nt_errstr(ops[i].status));
+				goto done;
+			}
+		}
+	}
+
+	printf("%d opens took %.2f seconds, %.0f opens/sec\n",
+	       torture_nprocs * torture_numops, open_secs,
+	       torture_nprocs * torture_numops / open_secs);
+	printf("%d closes took %.2f seconds, %.0f closes/sec\n",
+	       torture_nprocs * torture_numops, close_secs,
+	       torture_nprocs * torture_numops / close_secs);
+
+	status = cli_unlink(clis[0], fname,
+			    FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("unlink failed (%s)\n", nt_errstr(status));
+		goto done;
+	}
+
+	printf("finished open bench\n");
+	ret = true;
+done:
+	if (clis != NULL) {
+		for (i = 0; i < torture_nprocs; i++) {
+			if ((clis[i] != NULL) &&
+			    !torture_close_connection(clis[i])) {
+				ret = false;
+			}
+		}
+	}
+	TALLOC_FREE(frame);
+	return ret;
+}
+
 /*
 test whether fnums and tids open on one VC are available on another (a major
 security hole)
@@ -15352,6 +15708,14 @@ static struct {
 		.name = "LOCK13",
 		.fn   =  run_locktest13,
 	},
+	{
+		.name = "LOCK-BENCH",
+		.fn   =  run_lock_bench,
+	},
+	{
+		.name = "OPEN-BENCH",
+		.fn   =  run_open_bench,
+	},
 	{
 		.name = "UNLINK",
 		.fn   = run_unlinktest,
@@ -15557,6 +15921,18 @@ static struct {
 		.name  = "CASE-INSENSITIVE-CREATE",
 		.fn    = run_case_insensitive_create,
 	},
+	{
+		.name  = "CASE-INSENSITIVE-CACHE",
+		.fn    = run_case_insensitive_cache,
+	},
+	{
+		.name  = "CASE-INSENSITIVE-BENCH",
+		.fn    = run_case_insensitive_bench,
+	},
+	{
+		.name  = "CASE-INSENSITIVE-INDEX",
+		.fn    = run_case_insensitive_index,
+	},
 	{
 		.name  = "ASYNC-ECHO",
 		.fn    = run_async_echo,
@@ -15955,6 +16331,30 @@ static struct {
 		.name  = "LOCAL-MESSAGING-SEND-ALL",
 		.fn    = run_messaging_send_all,
 	},
+	{
+		.name  = "LOCAL-MESSAGING-SEND-MULTI",
+		.fn    = run_messaging_send_multi,
+	},
+	{
+		.name  = "LOCAL-MESSAGING-RING-ORDER",
+		.fn    = run_messaging_ring_order,
+	},
+	{
+		.name  = "LOCAL-MESSAGING-RING-FULL",
+		.fn    = run_messaging_ring_full,
+	},
+	{
+		.name  = "LOCAL-MESSAGING-RING-RX-GONE",
+		.fn    = run_messaging_ring_rx_gone,
+	},
+	{
+		.name  = "LOCAL-MESSAGING-RING-TX-GONE",
+		.fn    = run_messaging_ring_tx_gone,
+	},
+	{
+		.name  = "LOCAL-MESSAGING-RING-TX-CLOSED",
+		.fn    = run_messaging_ring_tx_closed,
+	},
 	{
 		.name  = "LOCAL-BASE64",
 		.fn    = run_local_base64,
@@ -905,6 +905,23 @@ static bool do_poolusage(struct tevent_context *ev_ctx,
 	return true;
 }
 
+/* Switch the sampled talloc allocation profile on or off */
+
+static bool do_talloc_profile(struct tevent_context *ev_ctx,
+			      struct messaging_context *msg_ctx,
+			      const struct server_id dst,
+			      const int argc, const char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: smbcontrol <dest> talloc-profile "
+			"<interval>|off\n");
+		return False;
+	}
+
+	return send_message(msg_ctx, dst, MSG_REQ_TALLOC_PROFILE, argv[1],
+			    strlen(argv[1]) + 1);
+}
+
 static bool do_rpc_dump_status(
 	struct tevent_context *ev_ctx,
 	struct messaging_context *msg_ctx,
@@ -1526,6 +1543,11 @@ static const struct {
 		.fn   = do_poolusage,
 		.help = "Display talloc memory usage",
 	},
+	{
+		.name = "talloc-profile",
+		.fn   = do_talloc_profile,
+		.help = "Sample talloc allocations per name for pool-usage",
+	},
 	{
 		.name = "rpc-dump-status",
 		.fn   = do_rpc_dump_status,
@@ -911,6 +911,12 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 		ldb_req_mark_untrusted(lreq);
 	}
 
+	/*
+	 * ldap_server_search_callback() encodes each entry as soon as
+	 * it arrives, so the backend does not need to copy it for us
+	 */
+	ldb_req_mark_read_only_view(lreq);
+
 	LDB_REQ_SET_LOCATION(lreq);
 
 	ldb_ret = ldb_request(samdb, lreq);
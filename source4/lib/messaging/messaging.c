@@ -124,9 +124,49 @@ static void pool_message(struct imessaging_context *msg,
 	}
 
 	talloc_full_report_printf(NULL, f);
+	talloc_report_profile(f);
 	fclose(f);
 }
 
+static void talloc_profile_message(struct imessaging_context *msg,
+				   void *private_data,
+				   uint32_t msg_type,
+				   struct server_id src,
+				   size_t num_fds,
+				   int *fds,
+				   DATA_BLOB *data)
+{
+	const char *arg = (const char *)data->data;
+	unsigned long long interval;
+	int error = 0;
+
+	if (num_fds != 0) {
+		DBG_WARNING("Received %zu fds, ignoring message\n", num_fds);
+		return;
+	}
+
+	if ((data->length == 0) || (arg[data->length - 1] != '\0')) {
+		DBG_WARNING("Invalid talloc profile message\n");
+		return;
+	}
+
+	if (strequal(arg, "off")) {
+		talloc_disable_profile();
+		return;
+	}
+
+	interval = smb_strtoull(arg, NULL, 10, &error, SMB_STR_FULL_STR_CONV);
+	if ((error != 0) || (interval == 0) || (interval > UINT_MAX)) {
+		DBG_WARNING("Invalid talloc profile interval: %s\n", arg);
+		return;
+	}
+
+	if (talloc_enable_profile(interval) != 0) {
+		DBG_WARNING("talloc_enable_profile failed: %s\n",
+			    strerror(errno));
+	}
+}
+
 static void ringbuf_log_msg(struct imessaging_context *msg,
 			    void *private_data,
 			    uint32_t msg_type,
@@ -590,6 +630,11 @@ static struct imessaging_context *imessaging_init_internal(
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;
 	}
+	status = imessaging_register(msg, NULL, MSG_REQ_TALLOC_PROFILE,
+				     talloc_profile_message);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto fail;
+	}
 	status = imessaging_register(msg, NULL, MSG_IRPC, irpc_handler);
 	if (!NT_STATUS_IS_OK(status)) {
 		goto fail;